@@ -0,0 +1,257 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_ASYNC_BOUNDED_QUEUE_H_
+#define CC_ASYNC_BOUNDED_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/logging.h"
+
+namespace minigo {
+
+// A fixed-capacity multi-producer multi-consumer FIFO queue.
+// `TryPush` and `TryPop` are lock-free: the queue is a ring buffer whose cells
+// each hold a sequence number that says whether the cell is ready to be
+// pushed to or popped from on the current lap of the ring (see Dmitry
+// Vyukov's bounded MPMC queue).
+// `Push` blocks while the queue is full and `Pop` blocks while it's empty,
+// which lets a slow consumer apply backpressure to its producers. A blocked
+// thread parks on a condition variable; the mutex is only touched by threads
+// that would otherwise block, and by the threads that wake them.
+//
+// Unlike `ThreadSafeQueue`, the queue's capacity must be chosen up front, and
+// `T` must be default constructible as well as movable. The capacity is
+// rounded up to a power of two, and to at least two: on a ring of one cell,
+// the sequence numbers can't tell a full cell from an empty one.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 2))),
+        mask_(capacity_ - 1),
+        cells_(new Cell[capacity_]) {
+    MG_CHECK(capacity > 0);
+    for (size_t i = 0; i < capacity_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~BoundedQueue() {
+    auto end = end_.load();
+    for (auto pos = begin_.load(); pos != end; ++pos) {
+      cells_[pos & mask_].value()->~T();
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  size_t capacity() const { return capacity_; }
+
+  // Pushes `x` if the queue isn't full, returning true on success. `x` is
+  // only moved from on success.
+  bool TryPush(T&& x) {
+    if (!TryPushImpl(&x)) {
+      return false;
+    }
+    WakeOne(&num_waiting_poppers_, &not_empty_);
+    return true;
+  }
+
+  // Pushes `x`, blocking while the queue is full.
+  void Push(T x) {
+    if (TryPush(std::move(x))) {
+      return;
+    }
+    absl::MutexLock lock(&mutex_);
+    num_waiting_pushers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!TryPushImpl(&x)) {
+      not_full_.Wait(&mutex_);
+    }
+    num_waiting_pushers_.fetch_sub(1);
+    WakeOneLocked(&num_waiting_poppers_, &not_empty_);
+  }
+
+  // Pops the element at the front of the queue into `x` if the queue isn't
+  // empty, returning true on success.
+  bool TryPop(T* x) {
+    if (!TryPopImpl(x)) {
+      return false;
+    }
+    WakeOne(&num_waiting_pushers_, &not_full_);
+    return true;
+  }
+
+  // Pops the element at the front of the queue, blocking while it's empty.
+  T Pop() {
+    T x;
+    PopWithDeadline(&x, absl::InfiniteFuture());
+    return x;
+  }
+
+  // Pops the element at the front of the queue into `x`, waiting up to
+  // `timeout` for one to be pushed if the queue is empty. Returns true on
+  // success.
+  bool PopWithTimeout(T* x, absl::Duration timeout) {
+    return PopWithDeadline(x, absl::Now() + timeout);
+  }
+
+  // The result is only a snapshot if other threads are using the queue.
+  size_t size() const {
+    auto end = end_.load(std::memory_order_acquire);
+    auto begin = begin_.load(std::memory_order_acquire);
+    return end > begin ? end - begin : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+ private:
+  // A cell is ready to be pushed to on lap `l` of the ring when its sequence
+  // number is `l * capacity_ + index`, and ready to be popped from when it's
+  // one more than that.
+  struct Cell {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+    T* value() { return reinterpret_cast<T*>(&storage); }
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t x) {
+    size_t result = 1;
+    while (result < x) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  bool TryPushImpl(T* x) {
+    auto pos = end_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& cell = cells_[pos & mask_];
+      auto seq = cell.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+      if (diff == 0) {
+        if (end_.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          new (cell.value()) T(std::move(*x));
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The cell still holds the element pushed on the previous lap.
+        return false;
+      } else {
+        pos = end_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool TryPopImpl(T* x) {
+    auto pos = begin_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& cell = cells_[pos & mask_];
+      auto seq = cell.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+      if (diff == 0) {
+        if (begin_.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+          *x = std::move(*cell.value());
+          cell.value()->~T();
+          cell.sequence.store(pos + capacity_, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The cell hasn't been pushed to on this lap yet.
+        return false;
+      } else {
+        pos = begin_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool PopWithDeadline(T* x, absl::Time deadline) {
+    if (TryPop(x)) {
+      return true;
+    }
+    bool success;
+    {
+      absl::MutexLock lock(&mutex_);
+      num_waiting_poppers_.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!(success = TryPopImpl(x))) {
+        if (not_empty_.WaitWithDeadline(&mutex_, deadline)) {
+          success = TryPopImpl(x);
+          break;
+        }
+      }
+      num_waiting_poppers_.fetch_sub(1);
+    }
+    if (success) {
+      WakeOne(&num_waiting_pushers_, &not_full_);
+    }
+    return success;
+  }
+
+  // Wakes one of the threads waiting on `cond_var`, if any. The fence orders
+  // the preceding push or pop before the check of `num_waiting`, pairing
+  // with the fence a waiter executes between registering itself and
+  // retrying: either the waiter sees the change or we see the waiter.
+  void WakeOne(std::atomic<int>* num_waiting, absl::CondVar* cond_var) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_waiting->load(std::memory_order_relaxed) != 0) {
+      absl::MutexLock lock(&mutex_);
+      cond_var->Signal();
+    }
+  }
+
+  void WakeOneLocked(std::atomic<int>* num_waiting, absl::CondVar* cond_var)
+      EXCLUSIVE_LOCKS_REQUIRED(&mutex_) {
+    if (num_waiting->load(std::memory_order_relaxed) != 0) {
+      cond_var->Signal();
+    }
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  // Keep the producers' and consumers' positions on separate cache lines.
+  char padding0_[64];
+  std::atomic<size_t> end_{0};
+  char padding1_[64];
+  std::atomic<size_t> begin_{0};
+  char padding2_[64];
+
+  absl::Mutex mutex_;
+  absl::CondVar not_empty_;
+  absl::CondVar not_full_;
+  std::atomic<int> num_waiting_poppers_{0};
+  std::atomic<int> num_waiting_pushers_{0};
+};
+
+}  // namespace minigo
+
+#endif  // CC_ASYNC_BOUNDED_QUEUE_H_
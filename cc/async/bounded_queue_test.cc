@@ -0,0 +1,175 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/async/bounded_queue.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Verify that the queue is a FIFO, including when it wraps around the ring.
+TEST(BoundedQueueTest, Ordering) {
+  BoundedQueue<int> q(3);
+  EXPECT_EQ(4u, q.capacity());
+
+  int x;
+  for (int i = 0; i < 10; ++i) {
+    q.Push(3 * i);
+    q.Push(3 * i + 1);
+    EXPECT_TRUE(q.TryPush(3 * i + 2));
+    EXPECT_EQ(3u, q.size());
+    EXPECT_EQ(3 * i, q.Pop());
+    EXPECT_TRUE(q.TryPop(&x));
+    EXPECT_EQ(3 * i + 1, x);
+    EXPECT_EQ(3 * i + 2, q.Pop());
+  }
+  EXPECT_TRUE(q.empty());
+  EXPECT_FALSE(q.TryPop(&x));
+}
+
+// Verify that TryPush fails when the queue is full, without consuming the
+// element it was passed.
+TEST(BoundedQueueTest, Full) {
+  BoundedQueue<std::unique_ptr<int>> q(2);
+  EXPECT_TRUE(q.TryPush(absl::make_unique<int>(1)));
+  EXPECT_TRUE(q.TryPush(absl::make_unique<int>(2)));
+
+  auto x = absl::make_unique<int>(3);
+  EXPECT_FALSE(q.TryPush(std::move(x)));
+  ASSERT_NE(nullptr, x);
+  EXPECT_EQ(3, *x);
+
+  EXPECT_EQ(1, *q.Pop());
+  EXPECT_TRUE(q.TryPush(std::move(x)));
+  EXPECT_EQ(2, *q.Pop());
+  EXPECT_EQ(3, *q.Pop());
+}
+
+// Verify that PopWithTimeout works whether the queue is empty or not.
+TEST(BoundedQueueTest, PopWithTimeout) {
+  BoundedQueue<int> q(2);
+  int x;
+  // Pop with a 2ms delay on an empty queue should take at least 1ms.
+  auto start = absl::Now();
+  EXPECT_FALSE(q.PopWithTimeout(&x, absl::Milliseconds(2)));
+  EXPECT_LT(absl::Milliseconds(1), absl::Now() - start);
+
+  q.Push(-123);
+  EXPECT_TRUE(q.PopWithTimeout(&x, absl::Milliseconds(2)));
+  EXPECT_EQ(-123, x);
+}
+
+// Verify that Push blocks while the queue is full.
+TEST(BoundedQueueTest, Backpressure) {
+  BoundedQueue<int> q(2);
+  q.Push(0);
+  q.Push(1);
+
+  absl::Notification pushed;
+  std::thread producer([&]() {
+    q.Push(2);
+    pushed.Notify();
+  });
+
+  EXPECT_FALSE(pushed.WaitForNotificationWithTimeout(absl::Milliseconds(10)));
+  EXPECT_EQ(0, q.Pop());
+  pushed.WaitForNotification();
+  EXPECT_EQ(1, q.Pop());
+  EXPECT_EQ(2, q.Pop());
+  producer.join();
+}
+
+// Verify that elements left in the queue are destroyed with it.
+TEST(BoundedQueueTest, Destructor) {
+  auto x = std::make_shared<int>(1);
+  {
+    BoundedQueue<std::shared_ptr<int>> q(4);
+    q.Push(x);
+    q.Push(x);
+    q.Push(x);
+    q.Pop();
+    EXPECT_EQ(3, x.use_count());
+  }
+  EXPECT_EQ(1, x.use_count());
+}
+
+// Verify multithreading with a queue much smaller than the number of
+// elements, so that producers and consumers both block.
+TEST(BoundedQueueTest, Multithreading) {
+  constexpr int kNumProducers = 4;
+  constexpr int kNumConsumers = 4;
+  constexpr int kNumPerProducer = 5000;
+
+  BoundedQueue<int> q(8);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumProducers; ++i) {
+    threads.emplace_back([&q, i]() {
+      for (int j = 0; j < kNumPerProducer; ++j) {
+        q.Push(i * kNumPerProducer + j);
+      }
+    });
+  }
+
+  absl::Mutex m;
+  std::map<int, int> popped;
+  std::atomic<int> num_remaining{kNumProducers * kNumPerProducer};
+  for (int i = 0; i < kNumConsumers; ++i) {
+    threads.emplace_back([&]() {
+      // Elements pushed by the same producer must be popped in order.
+      std::vector<int> prev(kNumProducers, -1);
+      std::vector<int> my_popped;
+      int x;
+      while (num_remaining.fetch_sub(1) > 0) {
+        x = q.Pop();
+        int producer = x / kNumPerProducer;
+        EXPECT_LT(prev[producer], x);
+        prev[producer] = x;
+        my_popped.push_back(x);
+      }
+
+      absl::MutexLock lock(&m);
+      for (int x : my_popped) {
+        popped[x] += 1;
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::map<int, int> pushed;
+  for (int i = 0; i < kNumProducers * kNumPerProducer; ++i) {
+    pushed[i] = 1;
+  }
+  EXPECT_THAT(popped, ::testing::ContainerEq(pushed));
+  EXPECT_TRUE(q.empty());
+}
+
+}  // namespace
+}  // namespace minigo
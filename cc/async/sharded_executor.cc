@@ -14,15 +14,51 @@
 
 #include "cc/async/sharded_executor.h"
 
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "cc/logging.h"
+#include "cc/platform/utils.h"
 #include "wtf/macros.h"
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
 namespace minigo {
 
-ShardedExecutor::ShardedExecutor(int num_shards) {
+namespace {
+
+// Number of times to poll while spinning before parking. Each poll is
+// followed by a pause instruction, so this is tens of microseconds: long
+// enough to cover the gap between batches of tree search, short enough not to
+// burn a core when a thread is idle for longer.
+constexpr int kNumSpins = 2000;
+
+void CpuRelax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Spinning on a single CPU only delays the thread we're waiting for.
+int GetNumSpins() {
+  static const int num_spins = GetNumLogicalCpus() > 1 ? kNumSpins : 0;
+  return num_spins;
+}
+
+}  // namespace
+
+ShardedExecutor::ShardedExecutor(int num_shards, ThreadRole role,
+                                 int numa_node) {
+  MG_CHECK(num_shards >= 1);
   threads_.reserve(num_shards - 1);
   for (int i = 1; i < num_shards; ++i) {
-    threads_.push_back(absl::make_unique<WorkerThread>(i, num_shards));
+    threads_.push_back(absl::make_unique<WorkerThread>(this, i, num_shards,
+                                                       role, numa_node));
   }
   for (auto& t : threads_) {
     t->Start();
@@ -30,6 +66,14 @@ ShardedExecutor::ShardedExecutor(int num_shards) {
 }
 
 ShardedExecutor::~ShardedExecutor() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stop_ = true;
+    epoch_ += 1;
+    for (auto& t : threads_) {
+      t->Notify(epoch_);
+    }
+  }
   for (auto& t : threads_) {
     t->Join();
   }
@@ -37,58 +81,104 @@ ShardedExecutor::~ShardedExecutor() {
 
 void ShardedExecutor::Execute(const std::function<void(int, int)>& fn) {
   WTF_SCOPE0("ShardedExecutor::Execute");
-  if (!threads_.empty()) {
-    auto num_shards = threads_.size() + 1;
+  if (threads_.empty()) {
+    fn(0, 1);
+    return;
+  }
 
-    // Create a blocking counter initialized to the number of threads that will
-    // do work. Each thread pops a shard of work off its queue, executes the
-    // function, then decrements this counter.
-    absl::BlockingCounter counter(threads_.size());
+  absl::MutexLock lock(&mutex_);
+  fn_ = &fn;
+  num_pending_.store(static_cast<int>(threads_.size()));
+  epoch_ += 1;
+  for (auto& t : threads_) {
+    t->Notify(epoch_);
+  }
 
-    // Push some work on to each thread's queue.
-    for (auto& t : threads_) {
-      t->Execute(&fn, &counter);
+  // Execute shard 0 on the caller's thread.
+  fn(0, threads_.size() + 1);
+
+  // Wait for the worker threads.
+  int num_pending = num_pending_.load();
+  while (num_pending != 0) {
+    num_pending = SpinThenPark(&num_pending_, num_pending, &caller_sleeping_,
+                               &done_mutex_, &done_cond_var_);
+  }
+  fn_ = nullptr;
+}
+
+template <typename T>
+T ShardedExecutor::SpinThenPark(const std::atomic<T>* x, T old_value,
+                                std::atomic<bool>* sleeping,
+                                absl::Mutex* mutex, absl::CondVar* cond_var) {
+  for (int i = 0; i < GetNumSpins(); ++i) {
+    T value = x->load(std::memory_order_acquire);
+    if (value != old_value) {
+      return value;
     }
+    CpuRelax();
+  }
 
-    // Execute shard 0 on the caller's thread.
-    fn(0, num_shards);
+  // Setting `sleeping` before checking `x` and the waker storing `x` before
+  // checking `sleeping` (both sequentially consistent) guarantees that either
+  // we see the new value or the waker sees that we're sleeping.
+  absl::MutexLock lock(mutex);
+  sleeping->store(true);
+  T value;
+  while ((value = x->load()) == old_value) {
+    cond_var->Wait(mutex);
+  }
+  sleeping->store(false);
+  return value;
+}
 
-    // Wait for the worker threads.
-    counter.Wait();
-  } else {
-    fn(0, 1);
+void ShardedExecutor::Wake(std::atomic<bool>* sleeping, absl::Mutex* mutex,
+                           absl::CondVar* cond_var) {
+  if (sleeping->load()) {
+    absl::MutexLock lock(mutex);
+    cond_var->Signal();
   }
 }
 
-ShardedExecutor::WorkerThread::WorkerThread(int shard, int num_shards)
+void ShardedExecutor::NotifyDone() {
+  Wake(&caller_sleeping_, &done_mutex_, &done_cond_var_);
+}
+
+ShardedExecutor::WorkerThread::WorkerThread(ShardedExecutor* executor,
+                                            int shard, int num_shards,
+                                            ThreadRole role, int numa_node)
     : Thread(absl::StrCat("ShardExec:", shard)),
+      executor_(executor),
       shard_(shard),
-      num_shards_(num_shards) {}
-
-void ShardedExecutor::WorkerThread::Execute(
-    const std::function<void(int, int)>* fn, absl::BlockingCounter* counter) {
-  work_queue_.Push({fn, counter});
-}
+      num_shards_(num_shards),
+      role_(role),
+      numa_node_(numa_node) {}
 
-void ShardedExecutor::WorkerThread::Join() {
-  // Pushing null work onto the queue tells the Run loop to stop.
-  work_queue_.Push({nullptr, nullptr});
-  Thread::Join();
+void ShardedExecutor::WorkerThread::Notify(uint64_t epoch) {
+  epoch_.store(epoch);
+  Wake(&sleeping_, &mutex_, &cond_var_);
 }
 
 void ShardedExecutor::WorkerThread::Run() {
   WTF_THREAD_ENABLE("ShardedExecutor");
+  if (numa_node_ >= 0) {
+    BindThreadToNumaNode(role_, numa_node_);
+  } else {
+    PinThreadToBudget(role_);
+  }
 
+  uint64_t epoch = 0;
   for (;;) {
-    auto work = work_queue_.Pop();
-    if (work.fn == nullptr) {
+    epoch = SpinThenPark(&epoch_, epoch, &sleeping_, &mutex_, &cond_var_);
+    if (executor_->stop_) {
       break;
     }
     {
       WTF_SCOPE0("ShardedExecutor::Run");
-      (*work.fn)(shard_, num_shards_);
+      (*executor_->fn_)(shard_, num_shards_);
+    }
+    if (executor_->num_pending_.fetch_sub(1) == 1) {
+      executor_->NotifyDone();
     }
-    work.counter->DecrementCount();
   }
 }
 
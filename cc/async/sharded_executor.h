@@ -15,14 +15,15 @@
 #ifndef CC_ASYNC_SHARDED_EXECUTOR_H_
 #define CC_ASYNC_SHARDED_EXECUTOR_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <vector>
 
-#include "absl/memory/memory.h"
-#include "absl/synchronization/blocking_counter.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
 #include "cc/async/thread.h"
-#include "cc/async/thread_safe_queue.h"
+#include "cc/async/thread_budget.h"
 
 namespace minigo {
 
@@ -41,7 +42,16 @@ namespace minigo {
 //   }
 // });
 //
-// `ShardedExecutor` is thread-safe.
+// `Execute` is called once or more per batch of inferences, so its fork-join
+// overhead matters: workers spin briefly waiting for work before parking, the
+// caller spins briefly waiting for the workers before parking, and `Execute`
+// doesn't allocate.
+//
+// `ShardedExecutor` is thread-safe. With more than one shard, concurrent calls
+// to `Execute` are executed sequentially. A single-shard executor has no
+// worker threads and runs `fn` inline on the caller's thread, so it doesn't
+// serialize concurrent calls: `fn` must be safe to run concurrently with
+// itself.
 class ShardedExecutor {
  public:
   struct Range {
@@ -56,7 +66,13 @@ class ShardedExecutor {
     return {begin, end};
   }
 
-  explicit ShardedExecutor(int num_shards);
+  // The executor's threads are pinned to the CPUs budgeted for `role`, if
+  // the thread budget pins threads (see SetThreadBudget).
+  // If `numa_node` is non-negative, the threads are instead bound to that
+  // NUMA node (see BindThreadToNumaNode).
+  explicit ShardedExecutor(int num_shards,
+                           ThreadRole role = ThreadRole::kSearch,
+                           int numa_node = -1);
 
   ~ShardedExecutor();
 
@@ -67,30 +83,67 @@ class ShardedExecutor {
   // the remaining invocations happen in parallel on threads owned by the
   // `ShardedExecutor`.
   // Blocks until all shards of work are complete.
-  void Execute(const std::function<void(int, int)>& fn);
+  void Execute(const std::function<void(int, int)>& fn) LOCKS_EXCLUDED(&mutex_);
 
  private:
-  struct WorkerThread : public Thread {
-    WorkerThread(int shard, int num_shards);
+  // Waits for a value other than `old_value` to be stored in `*x`, spinning
+  // for a while before parking on `cond_var`. Whoever stores a new value in
+  // `*x` must call `Wake` if `*sleeping` is set.
+  template <typename T>
+  static T SpinThenPark(const std::atomic<T>* x, T old_value,
+                        std::atomic<bool>* sleeping, absl::Mutex* mutex,
+                        absl::CondVar* cond_var);
 
-    void Execute(const std::function<void(int, int)>* fn,
-                 absl::BlockingCounter* counter);
-    void Join() override;
+  static void Wake(std::atomic<bool>* sleeping, absl::Mutex* mutex,
+                   absl::CondVar* cond_var);
 
-   private:
-    struct Work {
-      const std::function<void(int, int)>* fn;
-      absl::BlockingCounter* counter;
-    };
+  class WorkerThread : public Thread {
+   public:
+    WorkerThread(ShardedExecutor* executor, int shard, int num_shards,
+                 ThreadRole role, int numa_node);
 
+    // Starts the worker running the executor's current function.
+    void Notify(uint64_t epoch);
+
+   private:
     void Run() override;
 
+    // Keep the fields written by other threads off the cache lines of the
+    // neighbouring workers.
+    char padding_before_[64];
+    std::atomic<uint64_t> epoch_{0};
+    std::atomic<bool> sleeping_{false};
+    absl::Mutex mutex_;
+    absl::CondVar cond_var_;
+    char padding_after_[64];
+
+    ShardedExecutor* const executor_;
     const int shard_;
     const int num_shards_;
-    ThreadSafeQueue<Work> work_queue_;
+    const ThreadRole role_;
+    const int numa_node_;
   };
 
+  // Called by the last worker to finish a shard.
+  void NotifyDone();
+
   std::vector<std::unique_ptr<WorkerThread>> threads_;
+
+  // Serializes calls to Execute.
+  absl::Mutex mutex_;
+  uint64_t epoch_ GUARDED_BY(&mutex_) = 0;
+
+  // The state of the current call to Execute: written before the workers are
+  // notified and read by the workers after.
+  const std::function<void(int, int)>* fn_ = nullptr;
+  bool stop_ = false;
+
+  // Number of workers still running the current function.
+  char padding_[64];
+  std::atomic<int> num_pending_{0};
+  std::atomic<bool> caller_sleeping_{false};
+  absl::Mutex done_mutex_;
+  absl::CondVar done_cond_var_;
 };
 
 }  // namespace minigo
@@ -0,0 +1,94 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the fork-join latency of ShardedExecutor::Execute: the time from
+// calling Execute to it returning, for an empty function and for a function
+// that does a few microseconds of work per shard.
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/async/sharded_executor.h"
+#include "cc/init.h"
+#include "cc/logging.h"
+#include "gflags/gflags.h"
+
+DEFINE_int32(num_iterations, 20000, "Number of calls to Execute to time.");
+DEFINE_int32(work_size, 1000,
+             "Number of elements each shard sums in the non-empty benchmark.");
+
+namespace minigo {
+namespace {
+
+template <typename Fn>
+void BenchmarkExecute(int num_shards, const char* name, const Fn& fn) {
+  ShardedExecutor executor(num_shards);
+  std::function<void(int, int)> f = fn;
+
+  // Warm up: start the threads and page in everything.
+  for (int i = 0; i < 100; ++i) {
+    executor.Execute(f);
+  }
+
+  std::vector<double> latencies_us;
+  latencies_us.reserve(FLAGS_num_iterations);
+  for (int i = 0; i < FLAGS_num_iterations; ++i) {
+    auto start = absl::Now();
+    executor.Execute(f);
+    latencies_us.push_back(absl::ToDoubleMicroseconds(absl::Now() - start));
+  }
+
+  double total = 0;
+  for (auto x : latencies_us) {
+    total += x;
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+  auto percentile = [&](double p) {
+    return latencies_us[static_cast<size_t>(p * (latencies_us.size() - 1))];
+  };
+  MG_LOG(INFO) << name << " shards:" << num_shards
+               << " mean:" << total / latencies_us.size()
+               << "us p50:" << percentile(0.5)
+               << "us p99:" << percentile(0.99)
+               << "us max:" << latencies_us.back() << "us";
+}
+
+void RunBenchmark() {
+  std::vector<float> data(FLAGS_work_size * 64, 1.0f);
+  std::vector<float> sums(64);
+
+  for (int num_shards : {1, 2, 4, 8, 16}) {
+    BenchmarkExecute(num_shards, "empty", [](int, int) {});
+    BenchmarkExecute(num_shards, "sum", [&](int shard, int) {
+      const auto* x = data.data() + shard * FLAGS_work_size;
+      float sum = 0;
+      for (int i = 0; i < FLAGS_work_size; ++i) {
+        sum += x[i];
+      }
+      sums[shard] = sum;
+    });
+  }
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char* argv[]) {
+  minigo::Init(&argc, &argv);
+  minigo::RunBenchmark();
+  return 0;
+}
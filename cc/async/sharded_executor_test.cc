@@ -0,0 +1,69 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/async/sharded_executor.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "cc/async/thread.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(ShardedExecutorTest, RunsEachShardOnce) {
+  for (int num_shards : {1, 2, 5}) {
+    ShardedExecutor executor(num_shards);
+    std::vector<int> counts(num_shards, 0);
+    for (int i = 0; i < 1000; ++i) {
+      executor.Execute([&](int shard, int n) {
+        ASSERT_EQ(num_shards, n);
+        counts[shard] += 1;
+      });
+    }
+    for (int shard = 0; shard < num_shards; ++shard) {
+      EXPECT_EQ(1000, counts[shard]) << "shard " << shard;
+    }
+  }
+}
+
+TEST(ShardedExecutorTest, ConcurrentCallers) {
+  constexpr int kNumShards = 3;
+  constexpr int kNumCallers = 4;
+  constexpr int kNumCalls = 500;
+
+  ShardedExecutor executor(kNumShards);
+  std::atomic<int> total{0};
+  std::vector<std::unique_ptr<LambdaThread>> callers;
+  for (int i = 0; i < kNumCallers; ++i) {
+    callers.push_back(absl::make_unique<LambdaThread>([&]() {
+      for (int j = 0; j < kNumCalls; ++j) {
+        executor.Execute([&](int, int) { total += 1; });
+      }
+    }));
+  }
+  for (auto& t : callers) {
+    t->Start();
+  }
+  for (auto& t : callers) {
+    t->Join();
+  }
+  EXPECT_EQ(kNumShards * kNumCallers * kNumCalls, total);
+}
+
+}  // namespace
+}  // namespace minigo
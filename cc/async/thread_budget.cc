@@ -0,0 +1,214 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/async/thread_budget.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <utility>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+#include "cc/logging.h"
+#include "cc/platform/utils.h"
+
+namespace minigo {
+
+namespace {
+
+constexpr int kNumRoles = 3;
+constexpr std::array<const char*, kNumRoles> kRoleNames = {
+    "search", "inference", "output"};
+
+struct Budgets {
+  absl::Mutex mutex;
+  bool configured GUARDED_BY(&mutex) = false;
+  bool pin_threads GUARDED_BY(&mutex) = false;
+  std::array<ThreadBudget, kNumRoles> roles GUARDED_BY(&mutex);
+};
+
+// Returns the CPUs that the calling thread may run on.
+std::vector<int> GetAvailableCpus() {
+  std::vector<int> cpus;
+  if (!GetThreadAffinity(&cpus) || cpus.empty()) {
+    cpus.clear();
+    for (int i = 0; i < GetNumLogicalCpus(); ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+Budgets* GetBudgets() {
+  static Budgets* budgets = []() {
+    auto* result = new Budgets();
+    auto cpus = GetAvailableCpus();
+    absl::MutexLock lock(&result->mutex);
+    for (auto& role : result->roles) {
+      role.cpus = cpus;
+    }
+    return result;
+  }();
+  return budgets;
+}
+
+}  // namespace
+
+int ThreadBudget::threads_per_instance() const {
+  return std::max<int>(1, cpus.size() / std::max(1, num_instances));
+}
+
+void SetThreadBudget(absl::string_view spec, bool pin_threads) {
+  auto available = GetAvailableCpus();
+
+  std::array<int, kNumRoles> num_cpus;
+  num_cpus.fill(-1);
+  int total = 0;
+  std::vector<int> order;
+  for (absl::string_view item : absl::StrSplit(spec, ',', absl::SkipEmpty())) {
+    std::pair<absl::string_view, absl::string_view> kv =
+        absl::StrSplit(item, ':');
+    auto it = std::find(kRoleNames.begin(), kRoleNames.end(), kv.first);
+    MG_CHECK(it != kRoleNames.end())
+        << "Unrecognized thread role \"" << kv.first << "\"";
+    int role = it - kRoleNames.begin();
+    MG_CHECK(num_cpus[role] == -1) << "Role \"" << kv.first << "\" repeated";
+    MG_CHECK(absl::SimpleAtoi(kv.second, &num_cpus[role]) &&
+             num_cpus[role] > 0)
+        << "Couldn't parse thread budget \"" << item << "\"";
+    total += num_cpus[role];
+    order.push_back(role);
+  }
+  MG_CHECK(total <= static_cast<int>(available.size()))
+      << "Thread budget \"" << spec << "\" needs " << total
+      << " CPUs but only " << available.size() << " are available";
+
+  auto* budgets = GetBudgets();
+  absl::MutexLock lock(&budgets->mutex);
+  budgets->configured = true;
+  budgets->pin_threads = pin_threads;
+
+  // Assign contiguous ranges of CPUs to the listed roles, which keeps each
+  // role's CPUs on as few cores & sockets as possible.
+  auto begin = available.begin();
+  for (int role : order) {
+    budgets->roles[role].cpus.assign(begin, begin + num_cpus[role]);
+    begin += num_cpus[role];
+  }
+  std::vector<int> remaining(begin, available.end());
+  if (remaining.empty()) {
+    remaining = available;
+  }
+  for (int role = 0; role < kNumRoles; ++role) {
+    if (num_cpus[role] == -1) {
+      budgets->roles[role].cpus = remaining;
+    }
+  }
+}
+
+bool HasThreadBudget() {
+  auto* budgets = GetBudgets();
+  absl::MutexLock lock(&budgets->mutex);
+  return budgets->configured;
+}
+
+void SetThreadBudgetInstances(ThreadRole role, int num_instances) {
+  MG_CHECK(num_instances > 0);
+  auto* budgets = GetBudgets();
+  absl::MutexLock lock(&budgets->mutex);
+  budgets->roles[static_cast<int>(role)].num_instances = num_instances;
+}
+
+ThreadBudget GetThreadBudget(ThreadRole role) {
+  auto* budgets = GetBudgets();
+  absl::MutexLock lock(&budgets->mutex);
+  return budgets->roles[static_cast<int>(role)];
+}
+
+void PinThreadToBudget(ThreadRole role) {
+  std::vector<int> cpus;
+  {
+    auto* budgets = GetBudgets();
+    absl::MutexLock lock(&budgets->mutex);
+    if (!budgets->pin_threads) {
+      return;
+    }
+    cpus = budgets->roles[static_cast<int>(role)].cpus;
+  }
+  if (!SetThreadAffinity(cpus)) {
+    MG_LOG(WARNING) << "Couldn't pin " << kRoleNames[static_cast<int>(role)]
+                    << " thread to CPUs " << absl::StrJoin(cpus, ",");
+  }
+}
+
+std::vector<int> GetNumaNodeBudget(ThreadRole role, int node) {
+  auto node_cpus = GetNumaNodeCpus(node);
+  auto role_cpus = GetThreadBudget(role).cpus;
+  if (node_cpus.empty()) {
+    return role_cpus;
+  }
+  std::vector<int> cpus;
+  for (int cpu : role_cpus) {
+    if (std::find(node_cpus.begin(), node_cpus.end(), cpu) !=
+        node_cpus.end()) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus.empty() ? node_cpus : cpus;
+}
+
+void BindThreadToNumaNode(ThreadRole role, int node) {
+  // Each failure is only logged once per process: on platforms that don't
+  // support thread affinity or memory policies (e.g. macOS), binding fails
+  // for every thread.
+  static std::atomic<bool> logged_affinity_failure{false};
+  static std::atomic<bool> logged_memory_failure{false};
+
+  auto cpus = GetNumaNodeBudget(role, node);
+  if (!SetThreadAffinity(cpus) && !logged_affinity_failure.exchange(true)) {
+    MG_LOG(WARNING) << "Couldn't bind " << kRoleNames[static_cast<int>(role)]
+                    << " thread to CPUs " << absl::StrJoin(cpus, ",")
+                    << " on NUMA node " << node
+                    << "; further failures won't be logged";
+  }
+  // Memory is allocated from the node the thread runs on by default anyway,
+  // but setting the policy explicitly keeps allocations local even if the
+  // scheduler briefly runs the thread elsewhere.
+  if (!SetThreadMemoryNode(node) && !logged_memory_failure.exchange(true)) {
+    MG_LOG(WARNING) << "Couldn't bind " << kRoleNames[static_cast<int>(role)]
+                    << " thread's memory allocations to NUMA node " << node
+                    << "; further failures won't be logged";
+  }
+}
+
+std::string ThreadBudgetDebugString() {
+  auto* budgets = GetBudgets();
+  absl::MutexLock lock(&budgets->mutex);
+  std::vector<std::string> items;
+  for (int role = 0; role < kNumRoles; ++role) {
+    const auto& budget = budgets->roles[role];
+    items.push_back(absl::StrCat(
+        kRoleNames[role], ": ", budget.cpus.size(), " CPUs (",
+        budget.num_instances, " instances x ", budget.threads_per_instance(),
+        " threads)"));
+  }
+  return absl::StrCat(absl::StrJoin(items, ", "),
+                      budgets->pin_threads ? ", pinned" : "");
+}
+
+}  // namespace minigo
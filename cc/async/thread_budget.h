@@ -0,0 +1,91 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_ASYNC_THREAD_BUDGET_H_
+#define CC_ASYNC_THREAD_BUDGET_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace minigo {
+
+// The roles of the threads that share a process's CPUs.
+enum class ThreadRole {
+  // Tree search: SelfplayThreads and ShardedExecutor workers.
+  kSearch,
+
+  // Inference engines' threads (e.g. TensorFlow's and TFLite's thread pools)
+  // and the threads that create & run models.
+  kInference,
+
+  // Threads writing games & training examples.
+  kOutput,
+};
+
+// The CPUs budgeted for a ThreadRole.
+struct ThreadBudget {
+  // The logical CPUs that the role's threads should run on.
+  std::vector<int> cpus;
+
+  // Number of instances (e.g. inference engine instances) that share the
+  // role's CPUs.
+  int num_instances = 1;
+
+  // Number of threads each instance should use: the role's CPUs divided
+  // evenly between its instances.
+  int threads_per_instance() const;
+};
+
+// Partitions the CPUs that the process may run on between thread roles, from
+// a comma-separated list of "<role>:<num_cpus>" pairs, where <role> is one of
+// "search", "inference" or "output", e.g. "search:12,inference:16,output:4".
+// CPUs are assigned to the listed roles in order. Roles that aren't listed
+// share the remaining CPUs, or all CPUs if there are none left.
+// If `pin_threads` is true, threads that call PinThreadToBudget are
+// restricted to running on their role's CPUs.
+// Without a call to SetThreadBudget, every role may use all CPUs and threads
+// aren't pinned.
+void SetThreadBudget(absl::string_view spec, bool pin_threads);
+
+// Returns true if SetThreadBudget has been called.
+bool HasThreadBudget();
+
+// Sets the number of instances that share `role`'s CPUs.
+void SetThreadBudgetInstances(ThreadRole role, int num_instances);
+
+ThreadBudget GetThreadBudget(ThreadRole role);
+
+// Restricts the calling thread to `role`'s CPUs if the budget pins threads.
+// Threads inherit their creator's CPUs, so threads created by a pinned thread
+// (e.g. an inference engine's thread pool) share its CPUs.
+void PinThreadToBudget(ThreadRole role);
+
+// Returns the CPUs budgeted for `role` that are on NUMA node `node`. If none
+// of the role's CPUs are on the node, returns all of the node's CPUs instead.
+std::vector<int> GetNumaNodeBudget(ThreadRole role, int node);
+
+// Binds the calling thread to NUMA node `node`: restricts it to the CPUs
+// returned by GetNumaNodeBudget and makes it prefer allocating memory from the
+// node. Unlike PinThreadToBudget, the thread is bound whether or not the
+// budget pins threads.
+void BindThreadToNumaNode(ThreadRole role, int node);
+
+// Returns a description of the budget for logging.
+std::string ThreadBudgetDebugString();
+
+}  // namespace minigo
+
+#endif  // CC_ASYNC_THREAD_BUDGET_H_
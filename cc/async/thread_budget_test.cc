@@ -0,0 +1,117 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/async/thread_budget.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "cc/platform/utils.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+std::vector<int> AvailableCpus() {
+  std::vector<int> cpus;
+  if (!GetThreadAffinity(&cpus)) {
+    cpus.clear();
+    for (int i = 0; i < GetNumLogicalCpus(); ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+TEST(ThreadBudgetTest, Partition) {
+  auto available = AvailableCpus();
+  SetThreadBudget("inference:1", false);
+  EXPECT_TRUE(HasThreadBudget());
+
+  // Listed roles are assigned CPUs in order.
+  EXPECT_EQ(std::vector<int>({available[0]}),
+            GetThreadBudget(ThreadRole::kInference).cpus);
+
+  // Unlisted roles share the remaining CPUs, or all of them if there are none
+  // left.
+  std::vector<int> remaining(available.begin() + 1, available.end());
+  if (remaining.empty()) {
+    remaining = available;
+  }
+  EXPECT_EQ(remaining, GetThreadBudget(ThreadRole::kSearch).cpus);
+  EXPECT_EQ(remaining, GetThreadBudget(ThreadRole::kOutput).cpus);
+}
+
+TEST(ThreadBudgetTest, ThreadsPerInstance) {
+  ThreadBudget budget;
+  budget.cpus = {0, 1, 2, 3, 4, 5, 6};
+  EXPECT_EQ(7, budget.threads_per_instance());
+  budget.num_instances = 2;
+  EXPECT_EQ(3, budget.threads_per_instance());
+  budget.num_instances = 10;
+  EXPECT_EQ(1, budget.threads_per_instance());
+}
+
+TEST(ThreadBudgetTest, Pin) {
+  auto available = AvailableCpus();
+  std::vector<int> before;
+  if (!GetThreadAffinity(&before)) {
+    // Thread affinity isn't supported on this platform.
+    return;
+  }
+
+  SetThreadBudget("output:1", true);
+  PinThreadToBudget(ThreadRole::kOutput);
+  std::vector<int> after;
+  ASSERT_TRUE(GetThreadAffinity(&after));
+  EXPECT_EQ(std::vector<int>({available[0]}), after);
+
+  // Restore the thread's affinity for any following tests.
+  ASSERT_TRUE(SetThreadAffinity(before));
+}
+
+TEST(ThreadBudgetTest, NumaNodeBudget) {
+  ASSERT_GE(GetNumNumaNodes(), 1);
+  auto node_cpus = GetNumaNodeCpus(0);
+  ASSERT_FALSE(node_cpus.empty());
+
+  // The node's budget is the role's CPUs on the node, or all of the node's
+  // CPUs if the role has none on it.
+  SetThreadBudget("", false);
+  auto cpus = GetNumaNodeBudget(ThreadRole::kSearch, 0);
+  ASSERT_FALSE(cpus.empty());
+  for (int cpu : cpus) {
+    EXPECT_NE(node_cpus.end(),
+              std::find(node_cpus.begin(), node_cpus.end(), cpu));
+  }
+}
+
+TEST(ThreadBudgetTest, BindToNumaNode) {
+  std::vector<int> before;
+  if (!GetThreadAffinity(&before)) {
+    // Thread affinity isn't supported on this platform.
+    return;
+  }
+
+  SetThreadBudget("", false);
+  BindThreadToNumaNode(ThreadRole::kSearch, 0);
+  std::vector<int> after;
+  ASSERT_TRUE(GetThreadAffinity(&after));
+  EXPECT_EQ(GetNumaNodeBudget(ThreadRole::kSearch, 0), after);
+
+  ASSERT_TRUE(SetThreadAffinity(before));
+}
+
+}  // namespace
+}  // namespace minigo
@@ -0,0 +1,214 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/async/work_stealing_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "cc/logging.h"
+#include "wtf/macros.h"
+
+namespace minigo {
+
+// A worker's deque of tasks: the half-open range of task indices
+// [begin, end), packed into a single word so that the owner and thieves can
+// both update it with a compare-and-swap. Since tasks are only ever removed
+// from a deque, no further synchronization is required.
+// Padded so that workers' deques don't share cache lines.
+struct WorkStealingPool::Deque {
+  static uint64_t Pack(uint32_t begin, uint32_t end) {
+    return (static_cast<uint64_t>(end) << 32) | begin;
+  }
+  static uint32_t Begin(uint64_t range) {
+    return static_cast<uint32_t>(range);
+  }
+  static uint32_t End(uint64_t range) {
+    return static_cast<uint32_t>(range >> 32);
+  }
+
+  // Pops a task off the front of the deque, returning false if it's empty.
+  bool PopFront(int* task) {
+    auto r = range.load(std::memory_order_relaxed);
+    for (;;) {
+      auto begin = Begin(r);
+      auto end = End(r);
+      if (begin >= end) {
+        return false;
+      }
+      if (range.compare_exchange_weak(r, Pack(begin + 1, end),
+                                      std::memory_order_relaxed)) {
+        *task = static_cast<int>(begin);
+        return true;
+      }
+    }
+  }
+
+  // Pops a task off the back of the deque, returning false if it's empty.
+  bool PopBack(int* task) {
+    auto r = range.load(std::memory_order_relaxed);
+    for (;;) {
+      auto begin = Begin(r);
+      auto end = End(r);
+      if (begin >= end) {
+        return false;
+      }
+      if (range.compare_exchange_weak(r, Pack(begin, end - 1),
+                                      std::memory_order_relaxed)) {
+        *task = static_cast<int>(end - 1);
+        return true;
+      }
+    }
+  }
+
+  int size() const {
+    auto r = range.load(std::memory_order_relaxed);
+    return Begin(r) < End(r) ? static_cast<int>(End(r) - Begin(r)) : 0;
+  }
+
+  std::atomic<uint64_t> range{0};
+  char padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+struct WorkStealingPool::WorkerStats {
+  size_t num_steals = 0;
+  absl::Duration busy_time;
+  absl::Time end_time;
+};
+
+WorkStealingPool::WorkStealingPool(int num_workers, ThreadRole role,
+                                   int numa_node)
+    : num_workers_(num_workers),
+      deques_(new Deque[num_workers]),
+      worker_stats_(new WorkerStats[num_workers]),
+      run_worker_([this](int worker, int) { RunWorker(worker); }),
+      executor_(num_workers, role, numa_node) {
+  MG_CHECK(num_workers >= 1);
+  absl::MutexLock lock(&mutex_);
+  stats_.num_workers = num_workers;
+}
+
+WorkStealingPool::~WorkStealingPool() = default;
+
+void WorkStealingPool::Run(int num_tasks,
+                           const std::function<void(int, int)>& fn) {
+  WTF_SCOPE("WorkStealingPool::Run: tasks", int)(num_tasks);
+  MG_CHECK(num_tasks >= 0);
+
+  if (num_workers_ == 1) {
+    // There are no worker threads to share, so run the tasks on the calling
+    // thread without touching the shared per-worker state. Many selfplay
+    // threads share a single worker pool when --parallel_search=1, and must
+    // not be serialized.
+    auto start_time = absl::Now();
+    for (int task = 0; task < num_tasks; ++task) {
+      fn(0, task);
+    }
+    auto busy_time = absl::Now() - start_time;
+
+    absl::MutexLock lock(&mutex_);
+    stats_.num_runs += 1;
+    stats_.num_tasks += num_tasks;
+    stats_.busy_time += busy_time;
+    stats_.idle_us_histogram.Add(0);
+    return;
+  }
+
+  absl::MutexLock run_lock(&run_mutex_);
+  fn_ = &fn;
+  for (int i = 0; i < num_workers_; ++i) {
+    auto r = ShardedExecutor::GetShardRange(i, num_workers_, num_tasks);
+    deques_[i].range = Deque::Pack(r.begin, r.end);
+    worker_stats_[i] = WorkerStats();
+  }
+  executor_.Execute(run_worker_);
+  fn_ = nullptr;
+
+  auto end_time = absl::InfinitePast();
+  for (int i = 0; i < num_workers_; ++i) {
+    end_time = std::max(end_time, worker_stats_[i].end_time);
+  }
+
+  absl::MutexLock lock(&mutex_);
+  stats_.num_runs += 1;
+  stats_.num_tasks += num_tasks;
+  for (int i = 0; i < num_workers_; ++i) {
+    const auto& stats = worker_stats_[i];
+    auto idle_time = end_time - stats.end_time;
+    stats_.num_steals += stats.num_steals;
+    stats_.busy_time += stats.busy_time;
+    stats_.idle_time += idle_time;
+
+    stats_.idle_us_histogram.Add(absl::ToInt64Microseconds(idle_time));
+  }
+}
+
+void WorkStealingPool::RunWorker(int worker) {
+  auto& stats = worker_stats_[worker];
+  auto start_time = absl::Now();
+  int task;
+  for (;;) {
+    if (deques_[worker].PopFront(&task)) {
+      (*fn_)(worker, task);
+      continue;
+    }
+
+    // Steal from the worker with the most tasks left. The back of its
+    // deque holds the tasks it would otherwise run last.
+    int victim = -1;
+    int victim_size = 0;
+    for (int i = 1; i < num_workers_; ++i) {
+      int j = (worker + i) % num_workers_;
+      int size = deques_[j].size();
+      if (size > victim_size) {
+        victim = j;
+        victim_size = size;
+      }
+    }
+    if (victim == -1) {
+      break;
+    }
+    if (deques_[victim].PopBack(&task)) {
+      stats.num_steals += 1;
+      (*fn_)(worker, task);
+    }
+  }
+  stats.end_time = absl::Now();
+  stats.busy_time = stats.end_time - start_time;
+}
+
+WorkStealingPool::Stats WorkStealingPool::GetStats() const {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+std::ostream& operator<<(std::ostream& os,
+                         const WorkStealingPool::Stats& stats) {
+  auto total_time = stats.busy_time + stats.idle_time;
+  double idle_pct = 0;
+  if (total_time > absl::ZeroDuration()) {
+    idle_pct = 100 * absl::FDivDuration(stats.idle_time, total_time);
+  }
+  return os << "workers:" << stats.num_workers << " runs:" << stats.num_runs
+            << " tasks:" << stats.num_tasks << " steals:" << stats.num_steals
+            << " busy:" << stats.busy_time << " idle:" << stats.idle_time
+            << absl::StreamFormat(" (%.1f%%)", idle_pct)
+            << "\nidle_us:" << stats.idle_us_histogram;
+}
+
+}  // namespace minigo
@@ -0,0 +1,118 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_ASYNC_WORK_STEALING_POOL_H_
+#define CC_ASYNC_WORK_STEALING_POOL_H_
+
+#include <functional>
+#include <memory>
+#include <ostream>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "cc/async/sharded_executor.h"
+#include "cc/async/thread_budget.h"
+#include "cc/log2_histogram.h"
+
+namespace minigo {
+
+// Runs batches of independent tasks in parallel, balancing the load between
+// workers by work stealing.
+// Each call to `Run` deals the batch's tasks out to per-worker deques in
+// contiguous blocks. Workers pop tasks from the front of their own deque and,
+// once it's empty, steal from the back of the deque with the most tasks
+// remaining. This suits batches whose tasks vary a lot in cost, for example
+// selecting leaves for games that are at different stages.
+//
+// Worker 0 is the thread that calls `Run`; the other workers are the threads
+// of a `ShardedExecutor`, so like `ShardedExecutor`, `WorkStealingPool` is
+// thread-safe.
+class WorkStealingPool {
+ public:
+  // Cumulative stats over all calls to `Run`.
+  struct Stats {
+    int num_workers = 0;
+    size_t num_runs = 0;
+    size_t num_tasks = 0;
+
+    // Number of tasks that were run by a worker other than the one they
+    // were dealt to.
+    size_t num_steals = 0;
+
+    // Total time workers spent running tasks, and total time workers spent
+    // waiting for the other workers to finish a batch after running out of
+    // tasks.
+    absl::Duration busy_time;
+    absl::Duration idle_time;
+
+    // Distribution of each worker's idle time per batch in microseconds.
+    Log2Histogram idle_us_histogram;
+  };
+
+  // The pool's threads are pinned or bound to a NUMA node as described by
+  // the `ShardedExecutor` constructor.
+  explicit WorkStealingPool(int num_workers,
+                            ThreadRole role = ThreadRole::kSearch,
+                            int numa_node = -1);
+
+  ~WorkStealingPool();
+
+  int num_workers() const { return num_workers_; }
+
+  // Calls `fn(worker, task)` for each task in [0, `num_tasks`), where `worker`
+  // is the ID in the range [0, `num_workers`) of the worker running the task.
+  // Tasks run by the same worker are run sequentially, so `fn` can use
+  // `worker` to index per-worker state without locking.
+  // Blocks until all tasks are complete.
+  // Concurrent calls to `Run` are executed sequentially, except on a pool with
+  // a single worker: its tasks are always run on the calling thread, so
+  // concurrent calls run in parallel.
+  void Run(int num_tasks, const std::function<void(int, int)>& fn)
+      LOCKS_EXCLUDED(&run_mutex_, &mutex_);
+
+  Stats GetStats() const LOCKS_EXCLUDED(&mutex_);
+
+ private:
+  struct Deque;
+  struct WorkerStats;
+
+  void RunWorker(int worker);
+
+  const int num_workers_;
+
+  // Serializes calls to `Run` on pools with more than one worker, which share
+  // the per-worker state below so that `Run` doesn't allocate.
+  absl::Mutex run_mutex_;
+
+  // The state of the current call to `Run`, read by the workers.
+  const std::function<void(int, int)>* fn_ = nullptr;
+  std::unique_ptr<Deque[]> deques_;
+  std::unique_ptr<WorkerStats[]> worker_stats_;
+
+  // Calls `RunWorker`. Built once because a `std::function` that captures
+  // more than a pointer allocates.
+  std::function<void(int, int)> run_worker_;
+
+  ShardedExecutor executor_;
+
+  mutable absl::Mutex mutex_;
+  Stats stats_ GUARDED_BY(&mutex_);
+};
+
+std::ostream& operator<<(std::ostream& os,
+                         const WorkStealingPool::Stats& stats);
+
+}  // namespace minigo
+
+#endif  // CC_ASYNC_WORK_STEALING_POOL_H_
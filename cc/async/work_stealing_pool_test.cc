@@ -0,0 +1,121 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/async/work_stealing_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(WorkStealingPoolTest, RunsEachTaskOnce) {
+  WorkStealingPool pool(4);
+  EXPECT_EQ(4, pool.num_workers());
+
+  for (int num_tasks : {0, 1, 3, 4, 17, 100}) {
+    std::vector<std::atomic<int>> counts(num_tasks);
+    for (auto& count : counts) {
+      count = 0;
+    }
+    // Tasks run by the same worker run sequentially, so per-worker state
+    // doesn't need to be atomic.
+    std::vector<int> worker_counts(pool.num_workers(), 0);
+    pool.Run(num_tasks, [&](int worker, int task) {
+      ASSERT_GE(worker, 0);
+      ASSERT_LT(worker, pool.num_workers());
+      counts[task] += 1;
+      worker_counts[worker] += 1;
+    });
+
+    int total = 0;
+    for (int count : worker_counts) {
+      total += count;
+    }
+    EXPECT_EQ(num_tasks, total);
+    for (int i = 0; i < num_tasks; ++i) {
+      EXPECT_EQ(1, counts[i]) << "task " << i;
+    }
+  }
+
+  auto stats = pool.GetStats();
+  EXPECT_EQ(6u, stats.num_runs);
+  EXPECT_EQ(125u, stats.num_tasks);
+}
+
+TEST(WorkStealingPoolTest, StealsFromSlowWorkers) {
+  // Worker 0 is dealt tasks 0 and 1, worker 1 is dealt tasks 2 and 3. Task 1
+  // doesn't start until task 0 has started, so worker 1 can't take task 0.
+  // Task 0 doesn't complete until all the other tasks have run, so worker 1
+  // must run them all, stealing task 1 from worker 0.
+  WorkStealingPool pool(2);
+  absl::Notification task_0_started;
+  absl::Notification others_done;
+  std::atomic<int> num_done(0);
+  std::vector<int> task_worker(4, -1);
+  pool.Run(4, [&](int worker, int task) {
+    task_worker[task] = worker;
+    if (task == 0) {
+      task_0_started.Notify();
+      EXPECT_TRUE(
+          others_done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+      return;
+    }
+    if (task == 1) {
+      EXPECT_TRUE(
+          task_0_started.WaitForNotificationWithTimeout(absl::Seconds(10)));
+    }
+    if (++num_done == 3) {
+      others_done.Notify();
+    }
+  });
+
+  EXPECT_EQ(std::vector<int>({0, 1, 1, 1}), task_worker);
+  EXPECT_EQ(1u, pool.GetStats().num_steals);
+}
+
+// A single worker pool runs tasks on the calling thread, so concurrent calls
+// to Run aren't serialized: each call below only completes once the other
+// has started.
+TEST(WorkStealingPoolTest, SingleWorkerRunsConcurrently) {
+  WorkStealingPool pool(1);
+  absl::Notification started[2];
+  bool timed_out[2] = {false, false};
+  auto run = [&](int caller) {
+    pool.Run(1, [&](int worker, int task) {
+      EXPECT_EQ(0, worker);
+      started[caller].Notify();
+      timed_out[caller] = !started[1 - caller].WaitForNotificationWithTimeout(
+          absl::Seconds(10));
+    });
+  };
+  std::thread thread([&]() { run(1); });
+  run(0);
+  thread.join();
+
+  EXPECT_FALSE(timed_out[0]);
+  EXPECT_FALSE(timed_out[1]);
+  auto stats = pool.GetStats();
+  EXPECT_EQ(2u, stats.num_runs);
+  EXPECT_EQ(2u, stats.num_tasks);
+}
+
+}  // namespace
+}  // namespace minigo
@@ -0,0 +1,121 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/chunk_writer.h"
+
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "cc/file/path.h"
+#include "cc/file/utils.h"
+#include "cc/logging.h"
+
+namespace minigo {
+
+namespace {
+
+class PlainFile : public ChunkWriter::File {
+ public:
+  explicit PlainFile(const std::string& path) : path_(path) {
+    MG_CHECK(file::OpenWritableFile(path_, &file_));
+  }
+
+  void Append(absl::string_view record) override {
+    MG_CHECK(file_->Append(record)) << path_;
+  }
+
+  void Close() override { MG_CHECK(file_->Close()) << path_; }
+
+ private:
+  const std::string path_;
+  std::unique_ptr<file::WritableFile> file_;
+};
+
+}  // namespace
+
+std::unique_ptr<ChunkWriter::File> ChunkWriter::NewPlainFile(
+    const std::string& path) {
+  return absl::make_unique<PlainFile>(path);
+}
+
+ChunkWriter::ChunkWriter(std::string name_prefix, std::string extension,
+                         FileFactory file_factory, size_t max_bytes,
+                         absl::Duration max_age)
+    : name_prefix_(std::move(name_prefix)),
+      extension_(std::move(extension)),
+      file_factory_(std::move(file_factory)),
+      max_bytes_(max_bytes),
+      max_age_(max_age) {}
+
+ChunkWriter::~ChunkWriter() { Close(); }
+
+void ChunkWriter::Append(const std::string& dir, absl::string_view game_name,
+                         absl::Span<const std::string> records) {
+  auto now = absl::Now();
+  if (file_ != nullptr && dir != dir_) {
+    Close();
+  }
+  if (file_ == nullptr) {
+    Open(dir, now);
+  }
+
+  absl::StrAppend(&index_, game_name, "\t", num_records_, "\t",
+                  records.size(), "\n");
+  for (const auto& record : records) {
+    file_->Append(record);
+    num_bytes_ += record.size();
+  }
+  num_records_ += records.size();
+
+  if (num_bytes_ >= max_bytes_) {
+    Close();
+  } else {
+    CloseIfExpired(now);
+  }
+}
+
+void ChunkWriter::CloseIfExpired(absl::Time now) {
+  if (file_ != nullptr && now - open_time_ >= max_age_) {
+    Close();
+  }
+}
+
+void ChunkWriter::Close() {
+  if (file_ == nullptr) {
+    return;
+  }
+  file_->Close();
+  file_.reset();
+
+  // Write the index before renaming the chunk, so that it's in place before
+  // the chunk becomes visible.
+  MG_CHECK(file::WriteFile(absl::StrCat(path_, ".index"), index_));
+  MG_CHECK(file::RenameFile(absl::StrCat(path_, ".tmp"), path_));
+}
+
+void ChunkWriter::Open(const std::string& dir, absl::Time now) {
+  MG_CHECK(file::RecursivelyCreateDir(dir));
+  dir_ = dir;
+  path_ = file::JoinPath(
+      dir, absl::StrCat(name_prefix_, "-", num_chunks_++, extension_));
+  file_ = file_factory_(absl::StrCat(path_, ".tmp"));
+  open_time_ = now;
+  num_bytes_ = 0;
+  num_records_ = 0;
+  index_.clear();
+}
+
+}  // namespace minigo
@@ -0,0 +1,102 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_CHUNK_WRITER_H_
+#define CC_CHUNK_WRITER_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace minigo {
+
+// Appends the records of many games (e.g. their training examples or SGFs) to
+// large chunk files, rather than writing a separate file per game.
+//
+// A chunk is written to "<path>.tmp" and renamed to "<path>" when it's
+// complete, so globs that match the final name only ever see complete chunks.
+// Before the rename, an index is written to "<path>.index" with one line per
+// game: the game's name, the index of its first record in the chunk and its
+// number of records, separated by tabs.
+//
+// A chunk is completed once its records total `max_bytes`, once it has been
+// open for `max_age`, or when a game is written to a different directory
+// (e.g. because the output directory is bucketed by the hour). Chunks are
+// named "<name_prefix>-<n><extension>", where n counts the chunks written.
+//
+// ChunkWriter isn't thread-safe: each output thread should have its own.
+class ChunkWriter {
+ public:
+  // A chunk file being written.
+  class File {
+   public:
+    virtual ~File() = default;
+    virtual void Append(absl::string_view record) = 0;
+    virtual void Close() = 0;
+  };
+
+  // Creates the file at `path` to write a chunk to.
+  using FileFactory =
+      std::function<std::unique_ptr<File>(const std::string& path)>;
+
+  // Returns a file that records are written to verbatim, one after another.
+  static std::unique_ptr<File> NewPlainFile(const std::string& path);
+
+  ChunkWriter(std::string name_prefix, std::string extension,
+              FileFactory file_factory, size_t max_bytes,
+              absl::Duration max_age);
+
+  // Completes the current chunk, if any.
+  ~ChunkWriter();
+
+  // Appends the records of the game `game_name` to the current chunk in `dir`,
+  // starting a new chunk if necessary.
+  void Append(const std::string& dir, absl::string_view game_name,
+              absl::Span<const std::string> records);
+
+  // Completes the current chunk if it has been open for `max_age`. Should be
+  // called periodically so that a chunk doesn't stay open indefinitely while
+  // there are no new games.
+  void CloseIfExpired(absl::Time now);
+
+  // Completes the current chunk, if any.
+  void Close();
+
+ private:
+  void Open(const std::string& dir, absl::Time now);
+
+  const std::string name_prefix_;
+  const std::string extension_;
+  const FileFactory file_factory_;
+  const size_t max_bytes_;
+  const absl::Duration max_age_;
+  int num_chunks_ = 0;
+
+  // The current chunk.
+  std::unique_ptr<File> file_;
+  std::string dir_;
+  std::string path_;
+  absl::Time open_time_;
+  size_t num_bytes_ = 0;
+  int num_records_ = 0;
+  std::string index_;
+};
+
+}  // namespace minigo
+
+#endif  // CC_CHUNK_WRITER_H_
@@ -0,0 +1,92 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/chunk_writer.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/file/path.h"
+#include "cc/file/utils.h"
+#include "cc/logging.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+std::string FullPath(const char* basename) {
+  const char* tmpdir = std::getenv("TEST_TMPDIR");
+  MG_CHECK(tmpdir != nullptr) << "TEST_TMPDIR environment variable not found";
+  return file::JoinPath(tmpdir, basename);
+}
+
+std::string ReadFile(const std::string& dir, const std::string& name) {
+  std::string contents;
+  MG_CHECK(file::ReadFile(file::JoinPath(dir, name), &contents));
+  return contents;
+}
+
+TEST(ChunkWriterTest, RotatesBySize) {
+  auto dir = FullPath("rotates_by_size");
+  {
+    ChunkWriter writer("out", ".txt", &ChunkWriter::NewPlainFile, 8,
+                       absl::InfiniteDuration());
+    writer.Append(dir, "a", {"a1", "a2"});
+    writer.Append(dir, "b", {"b1"});
+
+    // Only complete chunks are visible under their final name.
+    std::vector<std::string> files;
+    ASSERT_TRUE(file::ListDir(dir, &files));
+    EXPECT_THAT(files, UnorderedElementsAre("out-0.txt.tmp"));
+
+    // Completes the first chunk.
+    writer.Append(dir, "c", {"c1", "c2", "c3"});
+    writer.Append(dir, "d", {"d1"});
+  }
+
+  std::vector<std::string> files;
+  ASSERT_TRUE(file::ListDir(dir, &files));
+  EXPECT_THAT(files, UnorderedElementsAre("out-0.txt", "out-0.txt.index",
+                                          "out-1.txt", "out-1.txt.index"));
+  EXPECT_EQ("a1a2b1c1c2c3", ReadFile(dir, "out-0.txt"));
+  EXPECT_EQ("a\t0\t2\nb\t2\t1\nc\t3\t3\n", ReadFile(dir, "out-0.txt.index"));
+  EXPECT_EQ("d1", ReadFile(dir, "out-1.txt"));
+  EXPECT_EQ("d\t0\t1\n", ReadFile(dir, "out-1.txt.index"));
+}
+
+TEST(ChunkWriterTest, RotatesByDirAndAge) {
+  auto dir_a = FullPath("rotates_by_dir/a");
+  auto dir_b = FullPath("rotates_by_dir/b");
+
+  ChunkWriter writer("out", ".txt", &ChunkWriter::NewPlainFile, 1000,
+                     absl::Minutes(1));
+  writer.Append(dir_a, "a", {"a1"});
+  writer.Append(dir_b, "b", {"b1"});
+  EXPECT_EQ("a1", ReadFile(dir_a, "out-0.txt"));
+
+  writer.CloseIfExpired(absl::Now());
+  writer.Append(dir_b, "c", {"c1"});
+  writer.CloseIfExpired(absl::Now() + absl::Minutes(2));
+  EXPECT_EQ("b1c1", ReadFile(dir_b, "out-1.txt"));
+  EXPECT_EQ("b\t0\t1\nc\t1\t1\n", ReadFile(dir_b, "out-1.txt.index"));
+}
+
+}  // namespace
+}  // namespace minigo
@@ -15,20 +15,26 @@
 #include <cmath>
 #include <functional>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_replace.h"
 #include "absl/strings/str_split.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "cc/async/bounded_queue.h"
 #include "cc/async/poll_thread.h"
-#include "cc/async/sharded_executor.h"
 #include "cc/async/thread.h"
+#include "cc/async/thread_budget.h"
 #include "cc/async/thread_safe_queue.h"
+#include "cc/async/work_stealing_pool.h"
+#include "cc/chunk_writer.h"
 #include "cc/file/directory_watcher.h"
 #include "cc/file/path.h"
 #include "cc/file/utils.h"
@@ -37,10 +43,13 @@
 #include "cc/init.h"
 #include "cc/logging.h"
 #include "cc/mcts_tree.h"
+#include "cc/model/bucketed_model.h"
 #include "cc/model/inference_cache.h"
+#include "cc/model/inference_dedup.h"
 #include "cc/model/loader.h"
 #include "cc/platform/utils.h"
 #include "cc/random.h"
+#include "cc/record_codec.h"
 #include "cc/tf_utils.h"
 #include "cc/wtf_saver.h"
 #include "cc/zobrist.h"
@@ -75,6 +84,12 @@ DEFINE_int32(cache_shards, 8,
              "is locked on a per-shard basis, so more shards means less "
              "contention but each shard is smaller. The number of shards "
              "is clamped such that it's always <= parallel_games.");
+DEFINE_string(cache_admission_policy, "",
+              "Policy that decides whether new inferences are inserted into a "
+              "full inference cache. One of: \"all\" (default), \"tinylfu\" "
+              "or \"move_number:N\", which only admits positions at most N "
+              "moves into the game. The rejection count and hit rate of the "
+              "chosen policy are reported in the cache stats.");
 
 // Tree search flags.
 DEFINE_int32(num_readouts, 104,
@@ -122,6 +137,57 @@ DEFINE_int32(concurrent_games_per_thread, 1,
              "evaluated together. Increasing concurrent_games_per_thread can "
              "help improve GPU or TPU utilization, especially for small "
              "models.");
+DEFINE_int32(pipeline_depth, 1,
+             "Number of inference batches each selfplay thread keeps in "
+             "flight. A thread's concurrent games are partitioned into "
+             "pipeline_depth slots, and leaves are selected for one slot "
+             "while the inferences for the others are running. Increasing "
+             "pipeline_depth can help saturate fast accelerators without "
+             "increasing the number of selfplay_threads.");
+DEFINE_bool(encode_features_in_search, false,
+            "If true and the inference engine supports it, the tree search "
+            "threads encode the input features for their leaves directly into "
+            "the model's input tensor, instead of the engine encoding all the "
+            "features serially before running inference. Inferences aren't "
+            "deduplicated in this mode.");
+DEFINE_string(batch_buckets, "",
+              "If non-empty, inference batches are padded up to one of a fixed "
+              "set of sizes so that the inference engine doesn't reallocate "
+              "its tensors whenever the batch size changes. Either a comma "
+              "separated list of sizes, or \"pow2:N\" for the powers of two "
+              "up to N.");
+DEFINE_bool(split_oversized_batches, false,
+            "Only used if batch_buckets is set. If true, batches larger than "
+            "the largest bucket are split into multiple batches. Otherwise, "
+            "they are run unpadded.");
+DEFINE_bool(warm_up_models, true,
+            "If true, newly loaded models run inference once for each batch "
+            "bucket size (or once if batch_buckets isn't set) before they "
+            "are used to play games. This keeps the inference engine's "
+            "one-off setup work from stalling selfplay when a new model is "
+            "loaded.");
+DEFINE_string(thread_budget, "",
+              "If non-empty, partitions the CPUs between the threads that run "
+              "tree search, inference and output, e.g. "
+              "\"search:12,inference:16,output:4\". Each listed role gets a "
+              "contiguous range of the given number of CPUs; roles that "
+              "aren't listed share the remaining CPUs. Inference engines "
+              "that run on the CPU size their thread pools to fit their "
+              "share of the inference CPUs.");
+DEFINE_bool(pin_threads, false,
+            "Only used if thread_budget is set. If true, threads are pinned "
+            "to the CPUs budgeted for their role.");
+DEFINE_bool(numa, false,
+            "If true, selfplay threads are assigned to NUMA nodes round "
+            "robin. Each selfplay thread is bound to its node's CPUs (within "
+            "the search thread budget, if set) and allocates its games' "
+            "trees from the node's memory. Each node gets its own "
+            "parallel_search tree search threads, and the inference cache is "
+            "split evenly between the nodes.");
+DEFINE_bool(numa_remote_cache_lookups, false,
+            "Only used if numa is true. If true, inferences that aren't in "
+            "the local node's inference cache are looked up in the other "
+            "nodes' caches.");
 
 // Game flags.
 DEFINE_uint64(seed, 0,
@@ -136,6 +202,10 @@ DEFINE_double(max_resign_threshold, -0.8,
               "[min_resign_threshold, max_resign_threshold)");
 DEFINE_double(disable_resign_pct, 0.1,
               "Fraction of games to disable resignation for.");
+DEFINE_bool(compact_game_history, true,
+            "If true, games in flight only store their moves and search "
+            "policies. The positions needed to build training examples are "
+            "regenerated by replaying each game on the output thread.");
 DEFINE_int32(num_games, 0,
              "Total number of games to play. Only one of run_forever and "
              "num_games must be set.");
@@ -170,6 +240,41 @@ DEFINE_string(wtf_trace, "/tmp/minigo.wtf-trace",
 DEFINE_bool(verbose, true, "Whether to log progress.");
 DEFINE_int32(output_threads, 1,
              "Number of threads write training examples on.");
+DEFINE_int32(output_queue_size, 64,
+             "Maximum number of finished games waiting to be written by the "
+             "output threads. Selfplay threads block when the queue is full, "
+             "so that output threads that can't keep up throttle selfplay "
+             "instead of finished games piling up in memory.");
+DEFINE_int32(output_chunk_mb, 0,
+             "If non-zero, each output thread appends games to large chunk "
+             "files instead of writing a TFRecord and SGFs per game, "
+             "starting a new chunk once the current one holds this many MB "
+             "of uncompressed records. An index of the games in each chunk "
+             "is written alongside it (see cc/chunk_writer.h). Note that "
+             "tools that expect a file per game, e.g. the game counting in "
+             "ml_perf/train_loop.py, don't understand chunks.");
+DEFINE_int32(output_chunk_secs, 600,
+             "If output_chunk_mb is non-zero, the maximum number of seconds "
+             "a chunk is written to before starting a new one.");
+DEFINE_bool(sparse_pi, false,
+            "If true, training examples store only the nonzero elements of "
+            "the search pi (see cc/tf_utils.h). preprocessing.py reads both "
+            "sparse and dense examples, but other tools may not.");
+DEFINE_bool(pack_features, false,
+            "If true, training examples store the input features packed "
+            "eight to a byte (see cc/tf_utils.h). preprocessing.py and "
+            "calibrate_native_int8 read both packed and unpacked examples, "
+            "but other tools may not.");
+DEFINE_string(output_compression, "zlib:2",
+              "How TFRecord files of training examples are compressed: "
+              "\"none\", \"zlib:<level>\" or \"zstd:<level>\" (see "
+              "cc/record_codec.h). zstd requires building with "
+              "--define=zstd=1, and its output can only be read by "
+              "sample_records and calibrate_native_int8, not by TensorFlow.");
+DEFINE_int32(output_compression_threads, 1,
+             "If output_chunk_mb is non-zero, the number of threads each "
+             "output thread compresses blocks of its chunks on in parallel. "
+             "The output is the same for any number of threads.");
 
 namespace minigo {
 namespace {
@@ -184,6 +289,29 @@ std::string GetOutputDir(absl::Time now, const std::string& model_name,
   return file::JoinPath(processed_root_dir, sub_dirs);
 }
 
+// Creates an inference cache of the given capacity, split evenly between the
+// NUMA nodes. Each node's cache is created on a thread bound to the node, so
+// that the memory it allocates up front is local to the node.
+std::shared_ptr<NumaInferenceCache> NewNumaInferenceCache(size_t capacity) {
+  int num_nodes = GetNumNumaNodes();
+  std::vector<std::unique_ptr<InferenceCache>> node_caches(num_nodes);
+  std::vector<std::thread> threads;
+  for (int node = 0; node < num_nodes; ++node) {
+    threads.emplace_back([&, node]() {
+      BindThreadToNumaNode(ThreadRole::kSearch, node);
+      auto a = node * capacity / num_nodes;
+      auto b = (node + 1) * capacity / num_nodes;
+      node_caches[node] = absl::make_unique<ThreadSafeInferenceCache>(
+          b - a, FLAGS_cache_shards, FLAGS_cache_admission_policy);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return std::make_shared<NumaInferenceCache>(std::move(node_caches),
+                                              FLAGS_numa_remote_cache_lookups);
+}
+
 // Information required to run a single inference.
 struct Inference {
   InferenceCache::Key cache_key;
@@ -353,18 +481,30 @@ class Selfplayer {
   void EndGame(std::unique_ptr<SelfplayGame> selfplay_game)
       LOCKS_EXCLUDED(&mutex_);
 
-  // Exectutes `fn` on `parallel_search` threads in parallel on a shared
-  // `ShardedExecutor`.
-  // Concurrent calls to `ExecuteSharded` are executed sequentially, unless
-  // `parallel_search == 1`. This blocking property can be used to pipeline
-  // CPU tree search and GPU inference.
-  void ExecuteSharded(std::function<void(int, int)> fn);
+  // Calls `fn(worker, task)` for each task in [0, `num_tasks`) on the
+  // `parallel_search` workers of a `WorkStealingPool` shared by all selfplay
+  // threads on `numa_node` (or all selfplay threads if NUMA mode is disabled,
+  // in which case `numa_node` is -1).
+  // If `parallel_search > 1`, concurrent calls to `RunSearchTasks` share the
+  // pool's threads, so a call may have to wait for other threads' tasks to
+  // complete. This blocking property can be used to pipeline CPU tree search
+  // and GPU inference. If `parallel_search == 1`, each call runs its tasks on
+  // the calling thread and calls from different threads run in parallel.
+  void RunSearchTasks(int numa_node, int num_tasks,
+                      const std::function<void(int, int)>& fn);
+
+  // Logs the stats of the tree search worker pools.
+  void LogSearchStats();
 
   // Grabs a model from a pool. If `selfplay_threads > parallel_inference`,
   // `AcquireModel` may block if a model isn't immediately available.
+  // Models in the pool that have been superseded by a newer model are
+  // destroyed rather than returned.
   std::unique_ptr<Model> AcquireModel();
 
   // Gives a previously acquired model back to the pool.
+  // `ReleaseModel` never destroys the model, so it's safe to call from a
+  // model's RunManyAsync completion callback.
   void ReleaseModel(std::unique_ptr<Model> model);
 
  private:
@@ -378,8 +518,16 @@ class Selfplayer {
   int num_games_remaining_ GUARDED_BY(&mutex_) = 0;
   Random rnd_ GUARDED_BY(&mutex_);
   WinStats win_stats_ GUARDED_BY(&mutex_);
-  ThreadSafeQueue<std::unique_ptr<SelfplayGame>> output_queue_;
-  ShardedExecutor executor_;
+  BoundedQueue<std::unique_ptr<SelfplayGame>> output_queue_;
+
+  // Number of times a selfplay thread blocked because the output queue was
+  // full, and the total time spent blocked.
+  int num_output_stalls_ GUARDED_BY(&mutex_) = 0;
+  absl::Duration output_stall_time_ GUARDED_BY(&mutex_);
+
+  // One tree search pool per NUMA node in NUMA mode, otherwise a single
+  // pool.
+  std::vector<std::unique_ptr<WorkStealingPool>> search_pools_;
 
   ThreadSafeQueue<std::unique_ptr<Model>> models_;
 
@@ -397,38 +545,51 @@ class Selfplayer {
 // Plays multiple games concurrently using `SelfplayGame` instances.
 class SelfplayThread : public Thread {
  public:
-  SelfplayThread(int thread_id, Selfplayer* selfplayer,
+  // If `numa_node` is non-negative, the thread is bound to that NUMA node.
+  SelfplayThread(int thread_id, int numa_node, Selfplayer* selfplayer,
                  std::shared_ptr<InferenceCache> cache);
 
  private:
+  struct PipelineSlot;
+
   void Run() override;
 
   // Starts new games playing.
-  void StartNewGames();
+  void StartNewGames(PipelineSlot* slot);
 
   // Selects leaves to perform inference on for all currently playing games.
   // The selected leaves are stored in `inferences_` and `inference_spans_`
   // maps contents of `inferences_` back to the `SelfplayGames` that they
   // came from.
-  void SelectLeaves();
+  void SelectLeaves(PipelineSlot* slot);
+
+  // Starts running inference on the leaves selected by `SelectLeaves`.
+  // The results are ready once `slot->inference_done` is notified.
+  void RunInferences(PipelineSlot* slot);
 
-  // Runs inference on the leaves selected by `SelectLeaves`.
-  // Returns the name of the model that ran the inferences.
-  std::string RunInferences();
+  // Waits for the inferences started by `RunInferences` to complete.
+  void WaitForInferences(PipelineSlot* slot);
 
   // Calls `SelfplayGame::ProcessInferences` for all inferences performed.
-  void ProcessInferences(const std::string& model);
+  void ProcessInferences(PipelineSlot* slot);
 
   // Plays moves on all games that have performed sufficient reads.
-  void PlayMoves();
+  void PlayMoves(PipelineSlot* slot);
 
+  // Logs the fraction of time spent in each stage of the pipeline.
+  void LogUtilization(absl::Duration total_time);
+
+  // The leaves selected by one tree search worker.
   struct TreeSearch {
     // Holds the span of inferences requested for a single `SelfplayGame`:
     // `pos` and `len` index into the `inferences` array.
+    // Only used when encoding features during SelectLeaves: the inferences
+    // occupy slots [batch_pos, batch_pos + len) of the model's input buffer.
     struct InferenceSpan {
       SelfplayGame* selfplay_game;
       size_t pos;
       size_t len;
+      int batch_pos;
     };
 
     void Clear() {
@@ -438,39 +599,104 @@ class SelfplayThread : public Thread {
 
     std::vector<Inference> inferences;
     std::vector<InferenceSpan> inference_spans;
+
+    // Scratch space for encoding features during SelectLeaves.
+    std::vector<const ModelInput*> input_ptrs;
+  };
+
+  // The games played by a selfplay thread are partitioned into
+  // `pipeline_depth` slots, each of which can have one batch of inferences
+  // in flight.
+  struct PipelineSlot {
+    std::vector<std::unique_ptr<SelfplayGame>> selfplay_games;
+    std::vector<TreeSearch> searches;
+    std::vector<const ModelInput*> input_ptrs;
+    std::vector<ModelOutput*> output_ptrs;
+    InferenceDeduplicator dedup;
+    bool deduplicated = false;
+    std::string model_name;
+
+    // Only set when encoding features during SelectLeaves, in which case the
+    // model is acquired before selecting leaves rather than after.
+    std::unique_ptr<Model> model;
+    ModelInputBuffer* input_buffer = nullptr;
+
+    // Non-null between the calls to `RunInferences` and `WaitForInferences`.
+    std::unique_ptr<absl::Notification> inference_done;
+    absl::Time inference_start_time;
+    absl::Time inference_end_time;
   };
 
   Selfplayer* selfplayer_;
-  std::vector<std::unique_ptr<SelfplayGame>> selfplay_games_;
-  std::unique_ptr<Model> model_;
+  std::vector<PipelineSlot> slots_;
   std::shared_ptr<InferenceCache> cache_;
-  std::vector<TreeSearch> searches_;
+  std::vector<InferenceCache::Request> cache_requests_;
   int num_games_finished_ = 0;
   const int thread_id_;
+  const int numa_node_;
+
+  // Time spent in each stage of the pipeline.
+  absl::Duration select_leaves_time_;
+  absl::Duration wait_for_inference_time_;
+  absl::Duration process_inference_time_;
+  absl::Duration play_moves_time_;
+
+  // Sum of the time that each batch of inferences took to run. Divided by
+  // the total time, this gives the average number of batches in flight.
+  absl::Duration inference_time_;
+
+  // Number of inferences requested, and the number that were actually run
+  // after removing duplicates.
+  size_t num_inferences_ = 0;
+  size_t num_unique_inferences_ = 0;
 };
 
 // Writes SGFs and training examples for completed games to disk.
 class OutputThread : public Thread {
  public:
   OutputThread(int thread_id, FeatureDescriptor feature_descriptor,
-               ThreadSafeQueue<std::unique_ptr<SelfplayGame>>* output_queue);
+               BoundedQueue<std::unique_ptr<SelfplayGame>>* output_queue);
 
  private:
   void Run() override;
   void WriteOutputs(std::unique_ptr<SelfplayGame> selfplay_game);
 
-  ThreadSafeQueue<std::unique_ptr<SelfplayGame>>* output_queue_;
+  BoundedQueue<std::unique_ptr<SelfplayGame>>* output_queue_;
   const std::string output_dir_;
   const std::string holdout_dir_;
   const std::string sgf_dir_;
   const FeatureDescriptor feature_descriptor_;
+  tf_utils::ExampleOptions example_options_;
+
+  // Compresses blocks of the example chunks in parallel if
+  // output_compression_threads > 1, otherwise null.
+  std::unique_ptr<WorkStealingPool> compression_pool_;
+
+  // Writers that append the training examples, holdout examples, clean SGFs
+  // and full SGFs to chunks if output_chunk_mb is set, otherwise empty.
+  std::unique_ptr<ChunkWriter> example_writer_;
+  std::unique_ptr<ChunkWriter> holdout_writer_;
+  std::unique_ptr<ChunkWriter> clean_sgf_writer_;
+  std::unique_ptr<ChunkWriter> full_sgf_writer_;
 };
 
 Selfplayer::Selfplayer()
     : rnd_(FLAGS_seed, Random::kUniqueStream),
-      executor_(FLAGS_parallel_search) {
-  absl::MutexLock lock(&mutex_);
-  ParseFlags();
+      output_queue_(FLAGS_output_queue_size) {
+  {
+    absl::MutexLock lock(&mutex_);
+    ParseFlags();
+  }
+
+  if (FLAGS_numa) {
+    for (int node = 0; node < GetNumNumaNodes(); ++node) {
+      search_pools_.push_back(absl::make_unique<WorkStealingPool>(
+          FLAGS_parallel_search, ThreadRole::kSearch, node));
+    }
+  } else {
+    search_pools_.push_back(
+        absl::make_unique<WorkStealingPool>(FLAGS_parallel_search));
+  }
 }
 
 SelfplayGame::SelfplayGame(int game_id, const Options& options,
@@ -680,8 +906,8 @@ bool SelfplayGame::MaybeQueueInference(MctsNode* leaf, InferenceCache* cache,
   auto inference_sym = GetInferenceSymmetry(leaf);
   auto cache_key =
       InferenceCache::Key(leaf->move, leaf->canonical_symmetry, leaf->position);
-  if (cache->TryGet(cache_key, leaf->canonical_symmetry, inference_sym,
-                    &cached_output)) {
+  if (cache->TryGet(cache_key, leaf->position.n(), leaf->canonical_symmetry,
+                    inference_sym, &cached_output)) {
     tree_->IncorporateResults(leaf, cached_output.policy, cached_output.value);
     return false;
   }
@@ -690,6 +916,13 @@ bool SelfplayGame::MaybeQueueInference(MctsNode* leaf, InferenceCache* cache,
   auto& inference = inferences->back();
   inference.cache_key = cache_key;
   inference.input.sym = inference_sym;
+  // Like the inference cache, deduplication treats positions with the same
+  // cache key as equal, even if their histories differ. Only deduplicate if
+  // the cache is enabled, so that inference is exact when it's disabled.
+  if (FLAGS_cache_size_mb > 0) {
+    inference.input.dedup_key =
+        cache_key.Fingerprint(leaf->canonical_symmetry);
+  }
   inference.leaf = leaf;
 
   // TODO(tommadams): add a method to FeatureDescriptor that returns the
@@ -710,13 +943,18 @@ bool SelfplayGame::MaybeQueueInference(MctsNode* leaf, InferenceCache* cache,
 void Selfplayer::Run() {
   // Create the inference cache.
   std::shared_ptr<InferenceCache> inference_cache;
+  std::shared_ptr<NumaInferenceCache> numa_cache;
   if (FLAGS_cache_size_mb > 0) {
     auto capacity = BasicInferenceCache::CalculateCapacity(FLAGS_cache_size_mb);
     MG_LOG(INFO) << "Will cache up to " << capacity
                  << " inferences, using roughly " << FLAGS_cache_size_mb
                  << "MB.\n";
-    inference_cache = std::make_shared<ThreadSafeInferenceCache>(
-        capacity, FLAGS_cache_shards);
+    if (FLAGS_numa) {
+      numa_cache = NewNumaInferenceCache(capacity);
+    } else {
+      inference_cache = std::make_shared<ThreadSafeInferenceCache>(
+          capacity, FLAGS_cache_shards, FLAGS_cache_admission_policy);
+    }
   } else {
     inference_cache = std::make_shared<NullInferenceCache>();
   }
@@ -741,8 +979,18 @@ void Selfplayer::Run() {
     absl::MutexLock lock(&mutex_);
     selfplay_threads.reserve(FLAGS_selfplay_threads);
     for (int i = 0; i < FLAGS_selfplay_threads; ++i) {
-      selfplay_threads.push_back(
-          absl::make_unique<SelfplayThread>(i, this, inference_cache));
+      int numa_node = -1;
+      auto cache = inference_cache;
+      if (FLAGS_numa) {
+        numa_node = i % static_cast<int>(search_pools_.size());
+        if (numa_cache != nullptr) {
+          // The node's view of the cache shares ownership of the whole cache.
+          cache = std::shared_ptr<InferenceCache>(
+              numa_cache, numa_cache->node_cache(numa_node));
+        }
+      }
+      selfplay_threads.push_back(absl::make_unique<SelfplayThread>(
+          i, numa_node, this, std::move(cache)));
     }
   }
 
@@ -780,7 +1028,25 @@ void Selfplayer::Run() {
   }
   MG_CHECK(output_queue_.empty());
 
-  if (FLAGS_cache_size_mb > 0) {
+  LogSearchStats();
+
+  {
+    absl::MutexLock lock(&mutex_);
+    MG_LOG(INFO) << "Selfplay threads blocked on a full output queue "
+                 << num_output_stalls_ << " times for "
+                 << output_stall_time_;
+  }
+
+  if (numa_cache != nullptr) {
+    MG_LOG(INFO) << "Inference cache stats: " << numa_cache->GetStats();
+    for (int node = 0; node < numa_cache->num_nodes(); ++node) {
+      auto stats = numa_cache->GetCrossNodeStats(node);
+      MG_LOG(INFO) << "NUMA node " << node << " inference cache: "
+                   << numa_cache->node_cache(node)->GetStats()
+                   << " remote_lookups:" << stats.num_remote_lookups
+                   << " remote_hits:" << stats.num_remote_hits;
+    }
+  } else if (FLAGS_cache_size_mb > 0) {
     MG_LOG(INFO) << "Inference cache stats: " << inference_cache->GetStats();
   }
 
@@ -815,6 +1081,7 @@ std::unique_ptr<SelfplayGame> Selfplayer::StartNewGame(bool verbose) {
         -rnd_.Uniform(std::fabs(FLAGS_min_resign_threshold),
                       std::fabs(FLAGS_max_resign_threshold));
     game_options.resign_enabled = rnd_() >= FLAGS_disable_resign_pct;
+    game_options.compact_history = FLAGS_compact_game_history;
 
     tree_options = tree_options_;
 
@@ -845,26 +1112,46 @@ void Selfplayer::EndGame(std::unique_ptr<SelfplayGame> selfplay_game) {
     absl::MutexLock lock(&mutex_);
     win_stats_.Update(*selfplay_game->game());
   }
-  output_queue_.Push(std::move(selfplay_game));
+
+  // Block until the output threads catch up if the queue is full.
+  if (!output_queue_.TryPush(std::move(selfplay_game))) {
+    auto start = absl::Now();
+    output_queue_.Push(std::move(selfplay_game));
+    absl::MutexLock lock(&mutex_);
+    num_output_stalls_ += 1;
+    output_stall_time_ += absl::Now() - start;
+  }
 }
 
-void Selfplayer::ExecuteSharded(std::function<void(int, int)> fn) {
-  executor_.Execute(std::move(fn));
+void Selfplayer::RunSearchTasks(int numa_node, int num_tasks,
+                                const std::function<void(int, int)>& fn) {
+  search_pools_[std::max(numa_node, 0)]->Run(num_tasks, fn);
 }
 
-std::unique_ptr<Model> Selfplayer::AcquireModel() { return models_.Pop(); }
+void Selfplayer::LogSearchStats() {
+  for (size_t i = 0; i < search_pools_.size(); ++i) {
+    MG_LOG(INFO) << "Tree search pool " << i << " "
+                 << search_pools_[i]->GetStats();
+  }
+}
 
-void Selfplayer::ReleaseModel(std::unique_ptr<Model> model) {
-  bool keep_model;
-  {
+std::unique_ptr<Model> Selfplayer::AcquireModel() {
+  for (;;) {
+    auto model = models_.Pop();
     absl::MutexLock lock(&mutex_);
-    keep_model = model->name() == latest_model_name_;
-  }
-  if (keep_model) {
-    models_.Push(std::move(model));
+    if (model->name() == latest_model_name_) {
+      return model;
+    }
   }
 }
 
+void Selfplayer::ReleaseModel(std::unique_ptr<Model> model) {
+  // Models that are out of date are destroyed the next time they're
+  // acquired, rather than here: ReleaseModel may be called from the model's
+  // own inference thread.
+  models_.Push(std::move(model));
+}
+
 void Selfplayer::ParseFlags() {
   // Check that exactly one of (run_forever and num_games) is set.
   if (FLAGS_run_forever) {
@@ -885,6 +1172,11 @@ void Selfplayer::ParseFlags() {
         max_concurrent_games_per_thread, FLAGS_concurrent_games_per_thread);
   }
 
+  // Every pipeline slot needs at least one game.
+  MG_CHECK(FLAGS_pipeline_depth >= 1);
+  FLAGS_pipeline_depth =
+      std::min(FLAGS_pipeline_depth, FLAGS_concurrent_games_per_thread);
+
   tree_options_.value_init_penalty = FLAGS_value_init_penalty;
   tree_options_.policy_softmax_temp = FLAGS_policy_softmax_temp;
   tree_options_.soft_pick_enabled = true;
@@ -916,17 +1208,39 @@ FeatureDescriptor Selfplayer::InitializeModels() {
 void Selfplayer::CreateModels(const std::string& path) {
   MG_LOG(INFO) << "Loading model " << path;
 
-  auto def = LoadModelDefinition(path);
-  auto* factory = GetModelFactory(def, FLAGS_device);
+  std::vector<int> bucket_sizes;
+  if (!FLAGS_batch_buckets.empty()) {
+    bucket_sizes = BucketedModel::ParseBuckets(FLAGS_batch_buckets);
+  }
 
-  auto model = factory->NewModel(def);
-  {
-    absl::MutexLock lock(&mutex_);
-    latest_model_name_ = model->name();
+  // Warm up every batch size that the models will run if batches are
+  // bucketed. Otherwise, a single inference still gets the engine's one-off
+  // setup out of the way.
+  std::vector<int> warm_up_batch_sizes;
+  if (FLAGS_warm_up_models) {
+    warm_up_batch_sizes = bucket_sizes;
+    if (warm_up_batch_sizes.empty()) {
+      warm_up_batch_sizes.push_back(1);
+    }
   }
-  models_.Push(std::move(model));
-  for (int i = 1; i < FLAGS_parallel_inference; ++i) {
-    models_.Push(factory->NewModel(def));
+
+  auto models = NewModels(path, FLAGS_device, FLAGS_parallel_inference,
+                          warm_up_batch_sizes);
+  if (!bucket_sizes.empty()) {
+    for (auto& model : models) {
+      model = absl::make_unique<BucketedModel>(std::move(model), bucket_sizes,
+                                               FLAGS_split_oversized_batches);
+    }
+  }
+
+  // Publish all the new models at once: AcquireModel discards the previous
+  // models as soon as the latest model name changes, so publishing the
+  // models one at a time would leave the selfplay threads waiting on fewer
+  // models than usual.
+  absl::MutexLock lock(&mutex_);
+  latest_model_name_ = models[0]->name();
+  for (auto& model : models) {
+    models_.Push(std::move(model));
   }
 }
 
@@ -936,38 +1250,77 @@ void Selfplayer::CheckAbortFile() {
   }
 }
 
-SelfplayThread::SelfplayThread(int thread_id, Selfplayer* selfplayer,
+SelfplayThread::SelfplayThread(int thread_id, int numa_node,
+                               Selfplayer* selfplayer,
                                std::shared_ptr<InferenceCache> cache)
     : Thread(absl::StrCat("Selfplay:", thread_id)),
       selfplayer_(selfplayer),
       cache_(std::move(cache)),
-      thread_id_(thread_id) {
-  selfplay_games_.resize(FLAGS_concurrent_games_per_thread);
+      thread_id_(thread_id),
+      numa_node_(numa_node) {
+  // Partition the games as evenly as possible between the pipeline slots.
+  slots_.resize(FLAGS_pipeline_depth);
+  for (int i = 0; i < FLAGS_pipeline_depth; ++i) {
+    int num_games = FLAGS_concurrent_games_per_thread / FLAGS_pipeline_depth;
+    if (i < FLAGS_concurrent_games_per_thread % FLAGS_pipeline_depth) {
+      num_games += 1;
+    }
+    slots_[i].selfplay_games.resize(num_games);
+    slots_[i].searches.resize(FLAGS_parallel_search);
+  }
 }
 
 void SelfplayThread::Run() {
   WTF_THREAD_ENABLE("SelfplayThread");
+  // The games' trees are created and expanded by this thread and the node's
+  // tree search threads, so binding them to a NUMA node keeps the trees in
+  // the node's memory.
+  if (numa_node_ >= 0) {
+    BindThreadToNumaNode(ThreadRole::kSearch, numa_node_);
+  } else {
+    PinThreadToBudget(ThreadRole::kSearch);
+  }
 
-  searches_.resize(FLAGS_parallel_search);
-  while (!selfplay_games_.empty()) {
-    StartNewGames();
-    SelectLeaves();
-    auto model_name = RunInferences();
-    ProcessInferences(model_name);
-    PlayMoves();
+  auto start_time = absl::Now();
+
+  // Visit the slots round robin: by the time a slot comes around again, its
+  // inferences have (hopefully) completed while leaves were being selected
+  // for the other slots.
+  for (;;) {
+    bool any_playing = false;
+    for (auto& slot : slots_) {
+      if (slot.inference_done != nullptr) {
+        WaitForInferences(&slot);
+        ProcessInferences(&slot);
+        PlayMoves(&slot);
+      }
+      StartNewGames(&slot);
+      if (slot.selfplay_games.empty()) {
+        continue;
+      }
+      any_playing = true;
+      SelectLeaves(&slot);
+      RunInferences(&slot);
+    }
+    if (!any_playing) {
+      break;
+    }
   }
 
   MG_LOG(INFO) << "SelfplayThread " << thread_id_ << " played "
                << num_games_finished_ << " games";
+  LogUtilization(absl::Now() - start_time);
 }
 
-void SelfplayThread::StartNewGames() {
+void SelfplayThread::StartNewGames(PipelineSlot* slot) {
   WTF_SCOPE0("StartNewGames");
-  for (size_t i = 0; i < selfplay_games_.size();) {
-    if (selfplay_games_[i] == nullptr) {
+  auto& selfplay_games = slot->selfplay_games;
+  for (size_t i = 0; i < selfplay_games.size();) {
+    if (selfplay_games[i] == nullptr) {
       // The i'th element is null, either start a new game, or remove the
-      // element from the `selfplay_games_` array.
-      bool verbose = FLAGS_verbose && thread_id_ == 0 && i == 0;
+      // element from the `selfplay_games` array.
+      bool verbose = FLAGS_verbose && thread_id_ == 0 && slot == &slots_[0] &&
+                     i == 0;
       auto selfplay_game = selfplayer_->StartNewGame(verbose);
       if (selfplay_game == nullptr) {
         // There are no more games to play remove the empty i'th slot from the
@@ -975,11 +1328,11 @@ void SelfplayThread::StartNewGames() {
         // we move the last element into position i and pop off the back. After
         // doing this, go around the loop again without incrementing i
         // (otherwise we'd skip over the newly moved element).
-        selfplay_games_[i] = std::move(selfplay_games_.back());
-        selfplay_games_.pop_back();
+        selfplay_games[i] = std::move(selfplay_games.back());
+        selfplay_games.pop_back();
         continue;
       } else {
-        selfplay_games_[i] = std::move(selfplay_game);
+        selfplay_games[i] = std::move(selfplay_game);
       }
     }
     // We didn't remove an element from the array, iterate as normal.
@@ -987,95 +1340,191 @@ void SelfplayThread::StartNewGames() {
   }
 }
 
-void SelfplayThread::SelectLeaves() {
-  WTF_SCOPE("SelectLeaves: games", size_t)(selfplay_games_.size());
-
-  std::atomic<size_t> game_idx(0);
-  selfplayer_->ExecuteSharded([this, &game_idx](int shard_idx, int num_shards) {
-    WTF_SCOPE0("SelectLeaf");
-    MG_CHECK(static_cast<size_t>(num_shards) == searches_.size());
-
-    SelfplayGame::SelectLeavesStats total_stats;
+void SelfplayThread::SelectLeaves(PipelineSlot* slot) {
+  WTF_SCOPE("SelectLeaves: games", size_t)(slot->selfplay_games.size());
+  auto start_time = absl::Now();
+
+  // Borrow the model's input buffer if possible, so that each shard can
+  // encode the features for its leaves as soon as it has selected them.
+  // Each game queues at most `virtual_losses` leaves.
+  if (FLAGS_encode_features_in_search) {
+    slot->model = selfplayer_->AcquireModel();
+    slot->input_buffer = slot->model->LendInputBuffer(
+        slot->selfplay_games.size() * FLAGS_virtual_losses);
+    if (slot->input_buffer == nullptr) {
+      selfplayer_->ReleaseModel(std::move(slot->model));
+    }
+  }
 
-    auto& search = searches_[shard_idx];
+  // Games vary a lot in how expensive it is to select their leaves (compare
+  // the opening with a late game that needs superko checks), so each game is
+  // a separate task that idle workers can steal.
+  for (auto& search : slot->searches) {
     search.Clear();
+  }
+  std::atomic<int> batch_size(0);
+  auto select_leaves = [this, slot, &batch_size](int worker, int game_idx) {
+    WTF_SCOPE0("SelectLeaf");
+    auto& search = slot->searches[worker];
+
+    TreeSearch::InferenceSpan span;
+    span.selfplay_game = slot->selfplay_games[game_idx].get();
+    span.pos = search.inferences.size();
+    auto stats =
+        span.selfplay_game->SelectLeaves(cache_.get(), &search.inferences);
+    span.len = stats.num_leaves_queued;
+    if (span.len == 0) {
+      return;
+    }
 
-    for (;;) {
-      auto i = game_idx.fetch_add(1);
-      if (i >= selfplay_games_.size()) {
-        break;
-      }
-
-      TreeSearch::InferenceSpan span;
-      span.selfplay_game = selfplay_games_[i].get();
-      span.pos = search.inferences.size();
-      auto stats = span.selfplay_game->SelectLeaves(cache_.get(),
-                                                    &search.inferences);
-      span.len = stats.num_leaves_queued;
-      if (span.len > 0) {
-        search.inference_spans.push_back(span);
+    if (slot->input_buffer != nullptr) {
+      WTF_SCOPE("SetFeatures: inputs", size_t)(span.len);
+      search.input_ptrs.clear();
+      for (size_t i = span.pos; i < span.pos + span.len; ++i) {
+        search.input_ptrs.push_back(&search.inferences[i].input);
       }
-      total_stats += stats;
+      span.batch_pos = batch_size.fetch_add(span.len);
+      slot->input_buffer->SetFeatures(span.batch_pos, search.input_ptrs);
     }
+    search.inference_spans.push_back(span);
 
     WTF_APPEND_SCOPE("leaves, nodes, cache_hits, game_over", int, int, int, int)
-    (total_stats.num_leaves_queued, total_stats.num_nodes_selected,
-     total_stats.num_cache_hits, total_stats.num_game_over_leaves);
-  });
+    (stats.num_leaves_queued, stats.num_nodes_selected, stats.num_cache_hits,
+     stats.num_game_over_leaves);
+  };
+  selfplayer_->RunSearchTasks(numa_node_, slot->selfplay_games.size(),
+                              select_leaves);
+
+  select_leaves_time_ += absl::Now() - start_time;
 }
 
-std::string SelfplayThread::RunInferences() {
+void SelfplayThread::RunInferences(PipelineSlot* slot) {
   WTF_SCOPE0("RunInferences");
 
-  // TODO(tommadams): stop allocating theses temporary vectors.
-  std::vector<const ModelInput*> input_ptrs;
-  std::vector<ModelOutput*> output_ptrs;
-  for (auto& s : searches_) {
-    for (auto& x : s.inferences) {
-      input_ptrs.push_back(&x.input);
-      output_ptrs.push_back(&x.output);
+  slot->input_ptrs.clear();
+  slot->output_ptrs.clear();
+  if (slot->input_buffer != nullptr) {
+    // The features have already been encoded: order the inferences to match
+    // their slots in the model's input buffer.
+    size_t num_inferences = 0;
+    for (const auto& s : slot->searches) {
+      num_inferences += s.inferences.size();
+    }
+    slot->input_ptrs.resize(num_inferences);
+    slot->output_ptrs.resize(num_inferences);
+    for (auto& s : slot->searches) {
+      for (const auto& span : s.inference_spans) {
+        for (size_t i = 0; i < span.len; ++i) {
+          auto& inference = s.inferences[span.pos + i];
+          slot->input_ptrs[span.batch_pos + i] = &inference.input;
+          slot->output_ptrs[span.batch_pos + i] = &inference.output;
+        }
+      }
+    }
+    slot->input_buffer = nullptr;
+  } else {
+    for (auto& s : slot->searches) {
+      for (auto& x : s.inferences) {
+        slot->input_ptrs.push_back(&x.input);
+        slot->output_ptrs.push_back(&x.output);
+      }
+    }
+  }
+
+  slot->inference_done = absl::make_unique<absl::Notification>();
+  slot->inference_start_time = absl::Now();
+  if (slot->input_ptrs.empty()) {
+    if (slot->model != nullptr) {
+      slot->model->ReturnInputBuffer();
+      selfplayer_->ReleaseModel(std::move(slot->model));
     }
+    slot->deduplicated = false;
+    slot->model_name.clear();
+    slot->inference_end_time = slot->inference_start_time;
+    slot->inference_done->Notify();
+    return;
   }
 
-  if (input_ptrs.empty()) {
-    return {};
+  // Games that reach the same position in the same batch (most likely in the
+  // opening) only need inference running once. This is only done when the
+  // inference cache is enabled (see MaybeQueueInference). Deduplication would
+  // reorder the inputs, so it isn't possible if their features have already
+  // been written to the model's input buffer.
+  const std::vector<const ModelInput*>* run_inputs = &slot->input_ptrs;
+  std::vector<ModelOutput*>* run_outputs = &slot->output_ptrs;
+  slot->deduplicated = slot->model == nullptr && FLAGS_cache_size_mb > 0;
+  if (slot->deduplicated) {
+    slot->dedup.Deduplicate(slot->input_ptrs, slot->output_ptrs);
+    run_inputs = &slot->dedup.unique_inputs();
+    run_outputs = slot->dedup.unique_outputs();
   }
+  num_inferences_ += slot->input_ptrs.size();
+  num_unique_inferences_ += run_inputs->size();
+
+  // std::function requires a copyable closure, so temporarily release
+  // ownership of the model while it's running. The model is returned to the
+  // pool as soon as it's done, rather than when this thread gets around to
+  // processing the results: otherwise a thread could block in AcquireModel
+  // while holding the models for its other pipeline slots.
+  auto* model = slot->model != nullptr ? slot->model.release()
+                                      : selfplayer_->AcquireModel().release();
+  slot->model_name = model->name();
+  model->RunManyAsync(
+      *run_inputs, run_outputs, nullptr, [this, slot, model]() {
+        slot->inference_end_time = absl::Now();
+        selfplayer_->ReleaseModel(std::unique_ptr<Model>(model));
+        slot->inference_done->Notify();
+      });
+}
 
-  std::string model_name;
-  auto model = selfplayer_->AcquireModel();
-  model->RunMany(input_ptrs, &output_ptrs, nullptr);
-  model_name = model->name();
-  selfplayer_->ReleaseModel(std::move(model));
-  return model_name;
+void SelfplayThread::WaitForInferences(PipelineSlot* slot) {
+  WTF_SCOPE0("WaitForInferences");
+  auto start_time = absl::Now();
+  slot->inference_done->WaitForNotification();
+  slot->inference_done = nullptr;
+  if (slot->deduplicated) {
+    slot->dedup.CopyDuplicateOutputs();
+  }
+  wait_for_inference_time_ += absl::Now() - start_time;
+  inference_time_ += slot->inference_end_time - slot->inference_start_time;
 }
 
-void SelfplayThread::ProcessInferences(const std::string& model_name) {
+void SelfplayThread::ProcessInferences(PipelineSlot* slot) {
+  auto start_time = absl::Now();
+
   {
     WTF_SCOPE0("UpdateCache");
-    for (auto& s : searches_) {
+    cache_requests_.clear();
+    for (auto& s : slot->searches) {
       for (auto& inference : s.inferences) {
-        cache_->Merge(inference.cache_key, inference.leaf->canonical_symmetry,
-                      inference.input.sym, &inference.output);
+        cache_requests_.push_back({inference.cache_key,
+                                   inference.leaf->position.n(),
+                                   inference.leaf->canonical_symmetry,
+                                   inference.input.sym, &inference.output});
       }
     }
+    cache_->MergeMany(cache_requests_);
   }
 
   {
     WTF_SCOPE0("ProcessInferences");
-    for (auto& s : searches_) {
+    for (auto& s : slot->searches) {
       for (const auto& span : s.inference_spans) {
         span.selfplay_game->ProcessInferences(
-            model_name,
+            slot->model_name,
             absl::MakeSpan(s.inferences).subspan(span.pos, span.len));
       }
     }
   }
+
+  process_inference_time_ += absl::Now() - start_time;
 }
 
-void SelfplayThread::PlayMoves() {
+void SelfplayThread::PlayMoves(PipelineSlot* slot) {
   WTF_SCOPE0("PlayMoves");
+  auto start_time = absl::Now();
 
-  for (auto& selfplay_game : selfplay_games_) {
+  for (auto& selfplay_game : slot->selfplay_games) {
     if (!selfplay_game->MaybePlayMove()) {
       continue;
     }
@@ -1088,26 +1537,100 @@ void SelfplayThread::PlayMoves() {
       selfplay_game = nullptr;
     }
   }
+
+  play_moves_time_ += absl::Now() - start_time;
+}
+
+void SelfplayThread::LogUtilization(absl::Duration total_time) {
+  auto pct = [total_time](absl::Duration d) {
+    return 100 * absl::FDivDuration(d, total_time);
+  };
+  MG_LOG(INFO) << absl::StreamFormat(
+      "SelfplayThread %d pipeline_depth:%d select_leaves:%.1f%% "
+      "wait_for_inference:%.1f%% process_inferences:%.1f%% "
+      "play_moves:%.1f%% avg_batches_in_flight:%.2f "
+      "inferences:%d unique_inferences:%d",
+      thread_id_, slots_.size(), pct(select_leaves_time_),
+      pct(wait_for_inference_time_), pct(process_inference_time_),
+      pct(play_moves_time_), absl::FDivDuration(inference_time_, total_time),
+      num_inferences_, num_unique_inferences_);
 }
 
 OutputThread::OutputThread(
     int thread_id, FeatureDescriptor feature_descriptor,
-    ThreadSafeQueue<std::unique_ptr<SelfplayGame>>* output_queue)
+    BoundedQueue<std::unique_ptr<SelfplayGame>>* output_queue)
     : Thread(absl::StrCat("Output:", thread_id)),
       output_queue_(output_queue),
       output_dir_(FLAGS_output_dir),
       holdout_dir_(FLAGS_holdout_dir),
       sgf_dir_(FLAGS_sgf_dir),
-      feature_descriptor_(std::move(feature_descriptor)) {}
+      feature_descriptor_(std::move(feature_descriptor)) {
+  example_options_.sparse_pi = FLAGS_sparse_pi;
+  example_options_.pack_features = FLAGS_pack_features;
+  example_options_.compression =
+      ParseRecordCompression(FLAGS_output_compression);
+  if (FLAGS_output_chunk_mb > 0) {
+    // Include the start time in the chunk names: a restarted process can get
+    // the same pid (e.g. in a container) and would otherwise overwrite the
+    // chunks written by its predecessor.
+    auto start_time =
+        absl::FormatTime("%Y%m%dT%H%M%S", absl::Now(), absl::UTCTimeZone());
+    auto name_prefix = absl::StrCat(GetHostname(), "-", GetProcessId(), "-",
+                                    start_time, "-", thread_id);
+    size_t max_bytes = static_cast<size_t>(FLAGS_output_chunk_mb) << 20;
+    auto max_age = absl::Seconds(FLAGS_output_chunk_secs);
+    if (FLAGS_output_compression_threads > 1) {
+      compression_pool_ = absl::make_unique<WorkStealingPool>(
+          FLAGS_output_compression_threads, ThreadRole::kOutput);
+    }
+    auto compression = example_options_.compression;
+    auto* pool = compression_pool_.get();
+    auto new_example_file = [compression, pool](const std::string& path) {
+      return tf_utils::NewTfRecordChunkFile(path, compression, pool);
+    };
+    const char* extension = GetTfRecordExtension(compression.codec);
+    example_writer_ = absl::make_unique<ChunkWriter>(
+        name_prefix, extension, new_example_file, max_bytes, max_age);
+    // The holdout chunks get their own prefix so that their names don't
+    // collide with the training chunks if holdout_dir == output_dir.
+    holdout_writer_ = absl::make_unique<ChunkWriter>(
+        absl::StrCat(name_prefix, "-holdout"), extension, new_example_file,
+        max_bytes, max_age);
+    clean_sgf_writer_ = absl::make_unique<ChunkWriter>(
+        name_prefix, ".sgf", &ChunkWriter::NewPlainFile, max_bytes, max_age);
+    full_sgf_writer_ = absl::make_unique<ChunkWriter>(
+        name_prefix, ".sgf", &ChunkWriter::NewPlainFile, max_bytes, max_age);
+  }
+}
 
 void OutputThread::Run() {
+  PinThreadToBudget(ThreadRole::kOutput);
+  std::vector<ChunkWriter*> chunk_writers;
+  if (example_writer_ != nullptr) {
+    chunk_writers = {example_writer_.get(), holdout_writer_.get(),
+                     clean_sgf_writer_.get(), full_sgf_writer_.get()};
+  }
+
   for (;;) {
-    auto selfplay_game = output_queue_->Pop();
+    // Wake up periodically so that chunks don't stay open indefinitely while
+    // no games are finishing.
+    std::unique_ptr<SelfplayGame> selfplay_game;
+    if (!output_queue_->PopWithTimeout(&selfplay_game, absl::Seconds(1))) {
+      auto now = absl::Now();
+      for (auto* writer : chunk_writers) {
+        writer->CloseIfExpired(now);
+      }
+      continue;
+    }
     if (selfplay_game == nullptr) {
       break;
     }
     WriteOutputs(std::move(selfplay_game));
   }
+
+  for (auto* writer : chunk_writers) {
+    writer->Close();
+  }
 }
 
 void OutputThread::WriteOutputs(std::unique_ptr<SelfplayGame> selfplay_game) {
@@ -1128,17 +1651,35 @@ void OutputThread::WriteOutputs(std::unique_ptr<SelfplayGame> selfplay_game) {
       !models_used.empty() ? models_used.back() : game->black_name();
 
   if (!sgf_dir_.empty()) {
-    WriteSgf(GetOutputDir(now, player_name, file::JoinPath(sgf_dir_, "clean")),
-             output_name, *game, false);
-    WriteSgf(GetOutputDir(now, player_name, file::JoinPath(sgf_dir_, "full")),
-             output_name, *game, true);
+    auto clean_dir =
+        GetOutputDir(now, player_name, file::JoinPath(sgf_dir_, "clean"));
+    auto full_dir =
+        GetOutputDir(now, player_name, file::JoinPath(sgf_dir_, "full"));
+    if (clean_sgf_writer_ != nullptr) {
+      // Concatenated SGF game trees form a valid SGF collection.
+      clean_sgf_writer_->Append(clean_dir, output_name,
+                                {MakeSgfString(*game, false)});
+      full_sgf_writer_->Append(full_dir, output_name,
+                               {MakeSgfString(*game, true)});
+    } else {
+      WriteSgf(clean_dir, output_name, *game, false);
+      WriteSgf(full_dir, output_name, *game, true);
+    }
   }
 
-  const auto& example_dir =
-      selfplay_game->options().is_holdout ? holdout_dir_ : output_dir_;
+  bool is_holdout = selfplay_game->options().is_holdout;
+  const auto& example_dir = is_holdout ? holdout_dir_ : output_dir_;
   if (!example_dir.empty()) {
-    tf_utils::WriteGameExamples(GetOutputDir(now, player_name, example_dir),
-                                output_name, feature_descriptor_, *game);
+    auto dir = GetOutputDir(now, player_name, example_dir);
+    auto* writer = is_holdout ? holdout_writer_.get() : example_writer_.get();
+    if (writer != nullptr) {
+      writer->Append(dir, output_name,
+                     tf_utils::SerializeGameExamples(
+                         feature_descriptor_, example_options_, *game));
+    } else {
+      tf_utils::WriteGameExamples(dir, output_name, feature_descriptor_,
+                                  example_options_, *game);
+    }
   }
 }
 
@@ -1149,6 +1690,13 @@ int main(int argc, char* argv[]) {
   minigo::Init(&argc, &argv);
   minigo::zobrist::Init(FLAGS_seed);
 
+  if (!FLAGS_thread_budget.empty()) {
+    minigo::SetThreadBudget(FLAGS_thread_budget, FLAGS_pin_threads);
+    minigo::SetThreadBudgetInstances(minigo::ThreadRole::kInference,
+                                     FLAGS_parallel_inference);
+    MG_LOG(INFO) << minigo::ThreadBudgetDebugString();
+  }
+
   {
     minigo::Selfplayer selfplayer;
     selfplayer.Run();
@@ -0,0 +1,222 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Calibrates a model for int8 inference on the native engine, using the
+// input features of training examples (e.g. the output of sample_records),
+// and reports the accuracy of the int8 model relative to the float model:
+//   calibrate_native_int8 \
+//       --model=saved_models/000990-cormorant.minigo \
+//       --examples=sampled.tfrecord.zz \
+//       --output=saved_models/000990-cormorant-int8.minigo
+// The calibrated model runs in int8 when loaded with a "native:" prefix.
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/constants.h"
+#include "cc/dual_net/native_dual_net.h"
+#include "cc/init.h"
+#include "cc/logging.h"
+#include "cc/model/features.h"
+#include "cc/model/loader.h"
+#include "cc/model/model.h"
+#include "cc/tf_records.h"
+#include "gflags/gflags.h"
+#include "tensorflow/core/example/example.pb.h"
+
+DEFINE_string(model, "", "Path of the \"tf\" model to calibrate.");
+DEFINE_string(examples, "",
+              "Comma-separated list of TFRecord files of training examples "
+              "to read input features from. Files with a .zz or .zst "
+              "extension are read as zlib or zstd compressed.");
+DEFINE_int32(num_calibration_examples, 4096,
+             "Number of examples to calibrate the activation scales on.");
+DEFINE_int32(num_eval_examples, 4096,
+             "Number of further examples on which to compare the int8 model's "
+             "outputs against the float model's.");
+DEFINE_string(output, "",
+              "If set, path to write the calibrated model to. The model "
+              "otherwise matches the source model.");
+
+namespace minigo {
+namespace {
+
+// Reads the input features of up to `num_examples` examples.
+std::vector<uint8_t> ReadFeatures(const std::vector<std::string>& paths,
+                                  int example_size, int num_examples) {
+  std::vector<uint8_t> result;
+  for (const auto& path : paths) {
+    if (static_cast<int>(result.size()) >= num_examples * example_size) {
+      break;
+    }
+    bool ok = ReadTfRecords(path, [&](std::string* record) {
+      tensorflow::Example example;
+      MG_CHECK(example.ParseFromString(*record)) << path;
+      const auto& feature = example.features().feature();
+      auto it = feature.find("x_bits");
+      if (it != feature.end()) {
+        // The features are packed eight to a byte.
+        const auto& x_bits = it->second.bytes_list();
+        MG_CHECK(x_bits.value_size() == 1 &&
+                 static_cast<int>(x_bits.value(0).size()) ==
+                     GetPackedFeaturesSize(example_size))
+            << "Features in " << path << " don't match the model";
+        const auto& packed = x_bits.value(0);
+        result.resize(result.size() + example_size);
+        UnpackFeatures(
+            {reinterpret_cast<const uint8_t*>(packed.data()), packed.size()},
+            {result.data() + result.size() - example_size,
+             static_cast<size_t>(example_size)});
+      } else {
+        const auto& x = feature.at("x").bytes_list();
+        MG_CHECK(x.value_size() == 1 &&
+                 static_cast<int>(x.value(0).size()) == example_size)
+            << "Features in " << path << " don't match the model";
+        result.insert(result.end(), x.value(0).begin(), x.value(0).end());
+      }
+      return static_cast<int>(result.size()) < num_examples * example_size;
+    });
+    MG_CHECK(ok) << "Error reading records from \"" << path << "\"";
+  }
+  return result;
+}
+
+// Runs `model` on the encoded `features`, writing the outputs to `outputs`.
+// Returns the time spent running inference.
+absl::Duration RunModel(Model* model, const Tensor<uint8_t>& features,
+                        std::vector<ModelOutput>* outputs) {
+  constexpr int kBatchSize = 64;
+
+  int num_examples = features.shape[0];
+  int example_size = features.shape.num_elements() / num_examples;
+  outputs->resize(num_examples);
+
+  ModelInput input;
+  input.sym = symmetry::kIdentity;
+  absl::Duration duration;
+  for (int begin = 0; begin < num_examples; begin += kBatchSize) {
+    int batch_size = std::min(kBatchSize, num_examples - begin);
+    std::vector<const ModelInput*> input_ptrs(batch_size, &input);
+    std::vector<ModelOutput*> output_ptrs;
+    for (int i = 0; i < batch_size; ++i) {
+      output_ptrs.push_back(&(*outputs)[begin + i]);
+    }
+
+    auto start = absl::Now();
+    auto* buffer = model->LendInputBuffer(batch_size);
+    MG_CHECK(buffer != nullptr);
+    Tensor<uint8_t> batch({batch_size, kN, kN, example_size / kNumPoints},
+                          features.data + begin * example_size);
+    buffer->CopyFeatures(0, batch);
+    model->RunMany(input_ptrs, &output_ptrs, nullptr);
+    duration += absl::Now() - start;
+  }
+  return duration;
+}
+
+void Calibrate() {
+  MG_CHECK(!FLAGS_model.empty());
+  MG_CHECK(!FLAGS_examples.empty());
+
+  auto def = LoadModelDefinition("native:" + FLAGS_model);
+  auto* factory = GetModelFactory(def, "");
+  auto float_model = factory->NewModel(def);
+  const auto& desc = float_model->feature_descriptor();
+  int example_size = kNumPoints * desc.num_planes;
+
+  std::vector<std::string> paths = absl::StrSplit(FLAGS_examples, ',');
+  int num_examples = FLAGS_num_calibration_examples + FLAGS_num_eval_examples;
+  auto features = ReadFeatures(paths, example_size, num_examples);
+  num_examples = features.size() / example_size;
+  int num_calibration = std::min(FLAGS_num_calibration_examples, num_examples);
+  int num_eval = num_examples - num_calibration;
+  MG_CHECK(num_calibration > 0) << "Couldn't read any examples";
+  MG_LOG(INFO) << "Calibrating on " << num_calibration << " examples";
+
+  auto int8_def = CalibrateNativeInt8(
+      def, Tensor<uint8_t>(desc.GetInputShape(num_calibration),
+                           features.data()));
+  auto int8_model = factory->NewModel(int8_def);
+
+  if (num_eval > 0) {
+    Tensor<uint8_t> eval_features(
+        desc.GetInputShape(num_eval),
+        features.data() + num_calibration * example_size);
+    std::vector<ModelOutput> expected;
+    std::vector<ModelOutput> actual;
+    auto float_time = RunModel(float_model.get(), eval_features, &expected);
+    auto int8_time = RunModel(int8_model.get(), eval_features, &actual);
+
+    // Policy KL divergence of the int8 model from the float model, and the
+    // mean squared error of the value.
+    double total_kl = 0;
+    double max_kl = 0;
+    double value_mse = 0;
+    int num_same_move = 0;
+    for (int i = 0; i < num_eval; ++i) {
+      const auto& p = expected[i].policy;
+      const auto& q = actual[i].policy;
+      double kl = 0;
+      for (int j = 0; j < kNumMoves; ++j) {
+        if (p[j] > 0) {
+          kl += p[j] * std::log(p[j] / std::max(q[j], 1e-20f));
+        }
+      }
+      total_kl += kl;
+      max_kl = std::max(max_kl, kl);
+      double error = expected[i].value - actual[i].value;
+      value_mse += error * error;
+      if (std::max_element(p.begin(), p.end()) - p.begin() ==
+          std::max_element(q.begin(), q.end()) - q.begin()) {
+        num_same_move += 1;
+      }
+    }
+
+    MG_LOG(INFO) << "Evaluated on " << num_eval << " examples";
+    MG_LOG(INFO) << "  policy KL divergence: mean " << total_kl / num_eval
+                 << " max " << max_kl;
+    MG_LOG(INFO) << "  value MSE: " << value_mse / num_eval;
+    MG_LOG(INFO) << "  same top move: "
+                 << 100.0 * num_same_move / num_eval << "%";
+    MG_LOG(INFO) << "  float: " << num_eval / absl::ToDoubleSeconds(float_time)
+                 << " inferences/sec";
+    MG_LOG(INFO) << "  int8: " << num_eval / absl::ToDoubleSeconds(int8_time)
+                 << " inferences/sec";
+  }
+
+  if (!FLAGS_output.empty()) {
+    // Write the model back out as a regular "tf" model.
+    int8_def.metadata.Set("engine", "tf");
+    WriteModelDefinition(FLAGS_output, int8_def);
+    MG_LOG(INFO) << "Wrote " << FLAGS_output;
+  }
+
+  float_model.reset();
+  int8_model.reset();
+  ShutdownModelFactories();
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char* argv[]) {
+  minigo::Init(&argc, &argv);
+  minigo::Calibrate();
+  return 0;
+}
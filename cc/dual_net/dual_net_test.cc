@@ -19,7 +19,6 @@
 #include <vector>
 
 #include "absl/memory/memory.h"
-#include "absl/strings/str_cat.h"
 #include "cc/model/features.h"
 #include "cc/model/loader.h"
 #include "cc/model/model.h"
@@ -226,13 +225,14 @@ TYPED_TEST(DualNetTest, TestBackendsEqual) {
     return;
   }
 
-  std::vector<std::string> model_basenames;
+  std::vector<std::string> model_paths;
 #if MG_ENABLE_TF_DUAL_NET
-  model_basenames.push_back("test_tf.minigo");
+  model_paths.push_back("cc/dual_net/test_tf.minigo");
 #endif
 #if MG_ENABLE_LITE_DUAL_NET
-  model_basenames.push_back("test_lite.minigo");
+  model_paths.push_back("cc/dual_net/test_lite.minigo");
 #endif
+  model_paths.push_back("native:cc/dual_net/test_tf.minigo");
 
   Random rnd(Random::kUniqueSeed, Random::kUniqueStream);
   ModelInput input;
@@ -254,9 +254,9 @@ TYPED_TEST(DualNetTest, TestBackendsEqual) {
     return oss.str();
   };
 
-  for (const auto& name : model_basenames) {
+  for (const auto& name : model_paths) {
     MG_LOG(INFO) << "Loading " << name;
-    auto model = NewModel(absl::StrCat("cc/dual_net/", name), "");
+    auto model = NewModel(name, "");
 
     ModelOutput output;
     std::vector<const ModelInput*> inputs = {&input};
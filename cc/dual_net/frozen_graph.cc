@@ -0,0 +1,423 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/dual_net/frozen_graph.h"
+
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/match.h"
+
+namespace minigo {
+namespace {
+
+// Protocol buffer wire types.
+constexpr int kVarint = 0;
+constexpr int kFixed64 = 1;
+constexpr int kLengthDelimited = 2;
+constexpr int kFixed32 = 5;
+
+// Reads fields from a binary serialized protocol buffer message.
+class WireReader {
+ public:
+  explicit WireReader(absl::string_view bytes) : bytes_(bytes) {}
+
+  bool done() const { return pos_ == bytes_.size(); }
+  bool ok() const { return ok_; }
+
+  // Reads the next field's tag. Returns false at the end of the message or
+  // on error.
+  bool Next() {
+    if (!ok_ || done()) {
+      return false;
+    }
+    uint64_t key;
+    if (!ReadVarint(&key)) {
+      return false;
+    }
+    field_ = static_cast<int>(key >> 3);
+    wire_type_ = static_cast<int>(key & 7);
+    return true;
+  }
+
+  int field() const { return field_; }
+  int wire_type() const { return wire_type_; }
+
+  uint64_t varint() {
+    uint64_t x = 0;
+    if (Expect(kVarint)) {
+      ReadVarint(&x);
+    }
+    return x;
+  }
+
+  float fixed32_float() {
+    float x = 0;
+    if (Expect(kFixed32) && Check(sizeof(x))) {
+      memcpy(&x, bytes_.data() + pos_, sizeof(x));
+      pos_ += sizeof(x);
+    }
+    return x;
+  }
+
+  absl::string_view bytes() {
+    uint64_t size = 0;
+    if (!Expect(kLengthDelimited) || !ReadVarint(&size) || !Check(size)) {
+      return {};
+    }
+    auto result = bytes_.substr(pos_, size);
+    pos_ += size;
+    return result;
+  }
+
+  // Reads a repeated varint field, which may or may not be packed.
+  void AppendVarints(std::vector<int64_t>* result) {
+    if (wire_type_ == kVarint) {
+      result->push_back(static_cast<int64_t>(varint()));
+      return;
+    }
+    WireReader packed(bytes());
+    uint64_t x;
+    while (!packed.done() && packed.ReadVarint(&x)) {
+      result->push_back(static_cast<int64_t>(x));
+    }
+    ok_ &= packed.ok();
+  }
+
+  // Reads a repeated float field, which may or may not be packed.
+  void AppendFloats(std::vector<float>* result) {
+    if (wire_type_ == kFixed32) {
+      result->push_back(fixed32_float());
+      return;
+    }
+    auto packed = bytes();
+    if (packed.size() % sizeof(float) != 0) {
+      ok_ = false;
+      return;
+    }
+    auto size = result->size();
+    result->resize(size + packed.size() / sizeof(float));
+    memcpy(result->data() + size, packed.data(), packed.size());
+  }
+
+  void Skip() {
+    switch (wire_type_) {
+      case kVarint:
+        varint();
+        break;
+      case kFixed64:
+        if (Check(8)) {
+          pos_ += 8;
+        }
+        break;
+      case kLengthDelimited:
+        bytes();
+        break;
+      case kFixed32:
+        if (Check(4)) {
+          pos_ += 4;
+        }
+        break;
+      default:
+        ok_ = false;
+        break;
+    }
+  }
+
+ private:
+  bool ReadVarint(uint64_t* x) {
+    *x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (!Check(1)) {
+        return false;
+      }
+      uint8_t byte = static_cast<uint8_t>(bytes_[pos_++]);
+      *x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    ok_ = false;
+    return false;
+  }
+
+  bool Expect(int wire_type) {
+    ok_ &= wire_type_ == wire_type;
+    return ok_;
+  }
+
+  bool Check(uint64_t size) {
+    ok_ &= size <= bytes_.size() - pos_;
+    return ok_;
+  }
+
+  absl::string_view bytes_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+  int field_ = 0;
+  int wire_type_ = 0;
+};
+
+bool ParseTensorShape(absl::string_view bytes, std::vector<int64_t>* shape) {
+  WireReader reader(bytes);
+  while (reader.Next()) {
+    if (reader.field() == 2) {
+      // TensorShapeProto.Dim
+      WireReader dim(reader.bytes());
+      int64_t size = 0;
+      while (dim.Next()) {
+        if (dim.field() == 1) {
+          size = static_cast<int64_t>(dim.varint());
+        } else {
+          dim.Skip();
+        }
+      }
+      if (!dim.ok()) {
+        return false;
+      }
+      shape->push_back(size);
+    } else {
+      reader.Skip();
+    }
+  }
+  return reader.ok();
+}
+
+bool ParseTensor(absl::string_view bytes, FrozenGraph::Tensor* tensor) {
+  using Tensor = FrozenGraph::Tensor;
+
+  absl::string_view content;
+  WireReader reader(bytes);
+  while (reader.Next()) {
+    switch (reader.field()) {
+      case 1:
+        tensor->dtype = static_cast<int>(reader.varint());
+        break;
+      case 2:
+        if (!ParseTensorShape(reader.bytes(), &tensor->shape)) {
+          return false;
+        }
+        break;
+      case 4:
+        content = reader.bytes();
+        break;
+      case 5:
+        reader.AppendFloats(&tensor->floats);
+        break;
+      case 7:
+      case 10:
+        reader.AppendVarints(&tensor->ints);
+        break;
+      default:
+        reader.Skip();
+        break;
+    }
+  }
+  if (!reader.ok()) {
+    return false;
+  }
+
+  // Small constants are stored in the typed value fields; larger ones as raw
+  // little-endian bytes in `tensor_content`. If a typed field has fewer values
+  // than the tensor, the last value is repeated.
+  auto n = tensor->num_elements();
+  switch (tensor->dtype) {
+    case Tensor::kFloat:
+      if (!content.empty()) {
+        if (content.size() != n * sizeof(float)) {
+          return false;
+        }
+        tensor->floats.resize(n);
+        memcpy(tensor->floats.data(), content.data(), content.size());
+      } else if (!tensor->floats.empty()) {
+        tensor->floats.resize(n, tensor->floats.back());
+      }
+      break;
+
+    case Tensor::kInt32:
+    case Tensor::kInt64:
+      if (!content.empty()) {
+        size_t element_size = tensor->dtype == Tensor::kInt32 ? 4 : 8;
+        if (content.size() != n * element_size) {
+          return false;
+        }
+        tensor->ints.resize(n);
+        for (int64_t i = 0; i < n; ++i) {
+          const auto* src = content.data() + i * element_size;
+          if (element_size == 4) {
+            int32_t x;
+            memcpy(&x, src, sizeof(x));
+            tensor->ints[i] = x;
+          } else {
+            memcpy(&tensor->ints[i], src, sizeof(int64_t));
+          }
+        }
+      } else if (!tensor->ints.empty()) {
+        // Negative int32 values are sign extended to 64 bits on the wire, so
+        // the cast in AppendVarints already gives the right result.
+        tensor->ints.resize(n, tensor->ints.back());
+      }
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+bool ParseAttr(absl::string_view bytes, FrozenGraph::Attr* attr) {
+  WireReader reader(bytes);
+  while (reader.Next()) {
+    switch (reader.field()) {
+      case 1: {
+        // ListValue: only the list of ints is used.
+        WireReader list(reader.bytes());
+        while (list.Next()) {
+          if (list.field() == 3) {
+            list.AppendVarints(&attr->list_i);
+          } else {
+            list.Skip();
+          }
+        }
+        if (!list.ok()) {
+          return false;
+        }
+        break;
+      }
+      case 2:
+        attr->s = std::string(reader.bytes());
+        break;
+      case 3:
+        attr->i = static_cast<int64_t>(reader.varint());
+        break;
+      case 4:
+        attr->f = reader.fixed32_float();
+        break;
+      case 5:
+        attr->b = reader.varint() != 0;
+        break;
+      case 6:
+        attr->type = static_cast<int>(reader.varint());
+        break;
+      case 8:
+        if (!ParseTensor(reader.bytes(), &attr->tensor)) {
+          return false;
+        }
+        break;
+      default:
+        reader.Skip();
+        break;
+    }
+  }
+  return reader.ok();
+}
+
+bool ParseNode(absl::string_view bytes, FrozenGraph::Node* node) {
+  WireReader reader(bytes);
+  while (reader.Next()) {
+    switch (reader.field()) {
+      case 1:
+        node->name = std::string(reader.bytes());
+        break;
+      case 2:
+        node->op = std::string(reader.bytes());
+        break;
+      case 3: {
+        auto input = reader.bytes();
+        if (absl::StartsWith(input, "^")) {
+          // Control dependency.
+          break;
+        }
+        auto pos = input.find(':');
+        if (pos != absl::string_view::npos) {
+          if (input.substr(pos) != ":0") {
+            return false;
+          }
+          input = input.substr(0, pos);
+        }
+        node->inputs.emplace_back(input);
+        break;
+      }
+      case 5: {
+        // map<string, AttrValue> entry.
+        WireReader entry(reader.bytes());
+        std::string key;
+        FrozenGraph::Attr attr;
+        while (entry.Next()) {
+          if (entry.field() == 1) {
+            key = std::string(entry.bytes());
+          } else if (entry.field() == 2) {
+            if (!ParseAttr(entry.bytes(), &attr)) {
+              return false;
+            }
+          } else {
+            entry.Skip();
+          }
+        }
+        if (!entry.ok()) {
+          return false;
+        }
+        node->attrs[key] = std::move(attr);
+        break;
+      }
+      default:
+        reader.Skip();
+        break;
+    }
+  }
+  return reader.ok();
+}
+
+}  // namespace
+
+int64_t FrozenGraph::Tensor::num_elements() const {
+  int64_t n = 1;
+  for (auto x : shape) {
+    n *= x;
+  }
+  return n;
+}
+
+const FrozenGraph::Attr* FrozenGraph::Node::FindAttr(
+    absl::string_view name) const {
+  auto it = attrs.find(name);
+  return it != attrs.end() ? &it->second : nullptr;
+}
+
+const FrozenGraph::Node* FrozenGraph::FindNode(absl::string_view name) const {
+  for (const auto& node : nodes) {
+    if (node.name == name) {
+      return &node;
+    }
+  }
+  return nullptr;
+}
+
+bool ParseFrozenGraph(absl::string_view bytes, FrozenGraph* graph) {
+  graph->nodes.clear();
+  WireReader reader(bytes);
+  while (reader.Next()) {
+    if (reader.field() == 1) {
+      graph->nodes.emplace_back();
+      if (!ParseNode(reader.bytes(), &graph->nodes.back())) {
+        return false;
+      }
+    } else {
+      reader.Skip();
+    }
+  }
+  return reader.ok();
+}
+
+}  // namespace minigo
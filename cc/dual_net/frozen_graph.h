@@ -0,0 +1,93 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_DUAL_NET_FROZEN_GRAPH_H_
+#define CC_DUAL_NET_FROZEN_GRAPH_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+
+namespace minigo {
+
+// A minimal in-memory representation of a frozen TensorFlow GraphDef, as
+// written to Minigo model files by freeze_graph.py.
+// This is just enough of the GraphDef protocol buffer to let engines that
+// don't link against TensorFlow (see NativeDualNet) read the model's
+// structure and weights. Only the fields they need are parsed, the rest are
+// skipped.
+struct FrozenGraph {
+  // The contents of a TensorProto. Float and integer tensors are supported:
+  // half, double, string, etc. tensors are left empty.
+  struct Tensor {
+    // TensorFlow's DataType enum values for the supported types.
+    static constexpr int kFloat = 1;
+    static constexpr int kInt32 = 3;
+    static constexpr int kInt64 = 9;
+
+    int64_t num_elements() const;
+
+    int dtype = 0;
+    std::vector<int64_t> shape;
+
+    // Only one of these is populated, depending on the `dtype`.
+    std::vector<float> floats;
+    std::vector<int64_t> ints;
+  };
+
+  // An AttrValue. Only the fields used by the ops NativeDualNet supports are
+  // parsed.
+  struct Attr {
+    std::string s;
+    int64_t i = 0;
+    float f = 0;
+    bool b = false;
+    int type = 0;
+    std::vector<int64_t> list_i;
+    Tensor tensor;
+  };
+
+  struct Node {
+    // Returns the attr with the given name, or null if the node doesn't have
+    // one.
+    const Attr* FindAttr(absl::string_view name) const;
+
+    std::string name;
+    std::string op;
+
+    // Names of the nodes whose outputs are inputs to this one. Control
+    // dependencies are dropped and the ":0" suffix is removed from output
+    // references.
+    std::vector<std::string> inputs;
+
+    absl::flat_hash_map<std::string, Attr> attrs;
+  };
+
+  // Returns the node with the given name, or null if there's no such node.
+  const Node* FindNode(absl::string_view name) const;
+
+  std::vector<Node> nodes;
+};
+
+// Parses a binary serialized GraphDef.
+// Returns false if `bytes` isn't a valid protocol buffer, or a node refers to
+// an output other than the first of one of its inputs.
+bool ParseFrozenGraph(absl::string_view bytes, FrozenGraph* graph);
+
+}  // namespace minigo
+
+#endif  //  CC_DUAL_NET_FROZEN_GRAPH_H_
@@ -17,10 +17,12 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "cc/async/thread_budget.h"
 #include "cc/constants.h"
 #include "cc/file/path.h"
 #include "cc/file/utils.h"
 #include "cc/logging.h"
+#include "cc/model/model_thread.h"
 #include "cc/platform/utils.h"
 #include "tensorflow/lite/context.h"
 #include "tensorflow/lite/interpreter.h"
@@ -50,14 +52,25 @@ class LiteDualNet : public Model {
                std::vector<ModelOutput*>* outputs,
                std::string* model_name) override;
 
+  // Runs inference on a dedicated thread, which is started by the first call.
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override;
+
+  ModelInputBuffer* LendInputBuffer(int capacity) override;
+  void ReturnInputBuffer() override;
+
  private:
   void Reserve(int capacity);
 
-  // The raw model bytes. These bytes must outlive the parsed model, so
-  // `model_bytes_` must be ordered in the list of members before `model_`.
-  // TODO(tommadams): share model bytes between all instances of the same
-  // model.
-  std::string model_bytes_;
+  // Returns a ModelInputBuffer that writes to the input tensor.
+  ModelInputBuffer GetInputBuffer();
+
+  // The raw model bytes, which are shared between all instances of the same
+  // model. These bytes must outlive the parsed model, so `model_bytes_` must
+  // be ordered in the list of members before `model_`. FlatBufferModel reads
+  // the flat buffer in place, so the model's weights aren't copied.
+  ModelBytes model_bytes_;
 
   std::unique_ptr<tflite::FlatBufferModel> model_;
   std::unique_ptr<tflite::Interpreter> interpreter_;
@@ -75,6 +88,17 @@ class LiteDualNet : public Model {
 
   BackedTensor<float> unquantized_policy_;
   BackedTensor<float> unquantized_value_;
+
+  // The buffer returned by LendInputBuffer. `input_buffer_lent_` is true
+  // between the calls to LendInputBuffer and RunMany (or ReturnInputBuffer),
+  // during which time the input tensor already holds the features.
+  ModelInputBuffer input_buffer_;
+  bool input_buffer_lent_ = false;
+
+  // Created by the first call to RunManyAsync. Declared last so that it's
+  // destroyed (and any pending inferences are finished) before the
+  // interpreter.
+  std::unique_ptr<ModelThread> model_thread_;
 };
 
 LiteDualNet::LiteDualNet(const ModelDefinition& def,
@@ -90,8 +114,14 @@ LiteDualNet::LiteDualNet(const ModelDefinition& def,
   tflite::InterpreterBuilder(*model_, resolver)(&interpreter_);
   MG_CHECK(interpreter_ != nullptr);
 
-  // Let's just use all the processors we can.
-  interpreter_->SetNumThreads(GetNumLogicalCpus());
+  // Use this instance's share of the inference CPUs if a thread budget was
+  // set, otherwise just use all the processors we can.
+  if (HasThreadBudget()) {
+    interpreter_->SetNumThreads(
+        GetThreadBudget(ThreadRole::kInference).threads_per_instance());
+  } else {
+    interpreter_->SetNumThreads(GetNumLogicalCpus());
+  }
 
   const auto& inputs = interpreter_->inputs();
   MG_CHECK(inputs.size() == 1);
@@ -146,21 +176,35 @@ void LiteDualNet::Reserve(int capacity) {
   batch_capacity_ = capacity;
 }
 
+void LiteDualNet::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                               std::vector<ModelOutput*>* outputs,
+                               std::string* model_name,
+                               std::function<void()> done) {
+  if (model_thread_ == nullptr) {
+    model_thread_ = absl::make_unique<ModelThread>(this);
+  }
+  model_thread_->RunManyAsync(inputs, outputs, model_name, std::move(done));
+}
+
 void LiteDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
                           std::vector<ModelOutput*>* outputs,
                           std::string* model_name) {
   MG_CHECK(inputs.size() == outputs->size());
 
-  Reserve(inputs.size());
+  // If the input buffer was lent out, the caller has already written the
+  // features to the input tensor.
+  bool features_encoded = input_buffer_lent_;
+  input_buffer_lent_ = false;
+  if (features_encoded) {
+    MG_CHECK(static_cast<int>(inputs.size()) <= batch_capacity_);
+  } else {
+    Reserve(inputs.size());
+    GetInputBuffer().SetFeatures(0, inputs);
+  }
 
   Tensor<float> policy, value;
-  const auto& dims = input_->dims->data;
   switch (input_->type) {
     case kTfLiteFloat32: {
-      Tensor<float> features({dims[0], dims[1], dims[2], dims[3]},
-                             input_->data.f);
-      feature_descriptor().set_floats(inputs, &features);
-
       MG_CHECK(interpreter_->Invoke() == kTfLiteOk);
 
       policy = Tensor<float>({batch_capacity_, kNumMoves}, policy_->data.f);
@@ -168,9 +212,6 @@ void LiteDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
       break;
     }
     case kTfLiteUInt8: {
-      Tensor<uint8_t> features({dims[0], dims[1], dims[2], dims[3]},
-                               input_->data.uint8);
-      feature_descriptor().set_bytes(inputs, &features);
       MG_CHECK(interpreter_->Invoke() == kTfLiteOk);
 
       Tensor<uint8_t> quantized_policy({batch_capacity_, kNumMoves},
@@ -195,6 +236,35 @@ void LiteDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
   }
 }
 
+ModelInputBuffer* LiteDualNet::LendInputBuffer(int capacity) {
+  MG_CHECK(!input_buffer_lent_);
+  Reserve(capacity);
+  input_buffer_ = GetInputBuffer();
+  input_buffer_lent_ = true;
+  return &input_buffer_;
+}
+
+void LiteDualNet::ReturnInputBuffer() {
+  MG_CHECK(input_buffer_lent_);
+  input_buffer_lent_ = false;
+}
+
+ModelInputBuffer LiteDualNet::GetInputBuffer() {
+  const auto& dims = input_->dims->data;
+  TensorShape shape({dims[0], dims[1], dims[2], dims[3]});
+  switch (input_->type) {
+    case kTfLiteFloat32:
+      return ModelInputBuffer(feature_descriptor(),
+                              Tensor<float>(shape, input_->data.f));
+    case kTfLiteUInt8:
+      return ModelInputBuffer(feature_descriptor(),
+                              Tensor<uint8_t>(shape, input_->data.uint8));
+    default:
+      MG_LOG(FATAL) << "Unsupported input type" << input_->type;
+      return {};
+  }
+}
+
 }  // namespace
 
 std::unique_ptr<Model> LiteDualNetFactory::NewModel(
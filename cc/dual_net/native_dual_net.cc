@@ -0,0 +1,901 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/dual_net/native_dual_net.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "cc/constants.h"
+#include "cc/dual_net/frozen_graph.h"
+#include "cc/dual_net/native_kernels.h"
+#include "cc/file/path.h"
+#include "cc/logging.h"
+#include "cc/model/model_thread.h"
+#include "wtf/macros.h"
+
+namespace minigo {
+namespace {
+
+using native::Epilogue;
+using native::PackedMatrix;
+using native::QuantizedMatrix;
+
+// Metadata key holding the activation scales of a model calibrated for int8
+// inference, as a list of "<layer>=<scale>" pairs.
+constexpr char kInt8ScalesKey[] = "native_int8_scales";
+
+}  // namespace
+
+namespace native {
+
+// A model compiled from a frozen graph into a sequence of layers, along with
+// an assignment of the values that the layers compute to buffers. Compiled
+// models are immutable, so all instances of a model share a single compiled
+// model and its weights.
+class CompiledModel {
+ public:
+  enum class Op {
+    kConv2D,
+    kDense,
+    kAdd,
+    kRelu,
+    kSoftmax,
+    kTanh,
+  };
+
+  struct Layer {
+    Op op;
+
+    // Name of the graph node that the layer was created from.
+    std::string name;
+
+    // Indices into `values()`. For kConv2D & kDense layers, `input2` is the
+    // optional residual; for kAdd layers it's the second operand.
+    int input = -1;
+    int input2 = -1;
+    int output = -1;
+
+    // Only used by kConv2D and kDense layers.
+    int kernel_size = 0;
+    PackedMatrix weights;
+    std::vector<float> bias;
+
+    // Only used by kConv2D, kDense and kAdd layers.
+    bool relu = false;
+
+    // Set for kConv2D and kDense layers that run using int8 kernels.
+    QuantizedMatrix quantized_weights;
+    float input_scale = 0;
+  };
+
+  // A tensor computed by the model. Reshaping a value creates a new value
+  // that shares its buffer.
+  struct Value {
+    // Shape of the value for a single example, excluding the batch dimension.
+    std::vector<int> shape;
+
+    // Number of elements per example.
+    int size = 0;
+
+    // Index of the layer that computes the value, or -1 for the model's input
+    // and values created by reshaping.
+    int producer = -1;
+
+    // Number of graph nodes that consume the value.
+    int num_consumers = 0;
+
+    // Values that share a buffer have the same group.
+    int group = -1;
+  };
+
+  // Runs the layers listed in `int8_scales` using int8 kernels, quantizing
+  // their inputs with the given scale. All other layers run in float.
+  CompiledModel(const std::string& graph_path,
+                const FeatureDescriptor& feature_desc,
+                const FrozenGraph& graph,
+                const absl::flat_hash_map<std::string, float>& int8_scales);
+
+  const std::vector<Layer>& layers() const { return layers_; }
+  const std::vector<Value>& values() const { return values_; }
+  int input_value() const { return input_value_; }
+  int policy_value() const { return policy_value_; }
+  int value_value() const { return value_value_; }
+
+  // Index of the buffer that holds `value`.
+  int buffer(int value) const { return group_buffers_[values_[value].group]; }
+
+  // The number of elements per example that each buffer needs to hold.
+  const std::vector<int>& buffer_sizes() const { return buffer_sizes_; }
+
+ private:
+  // Compiles the graph into `layers_`.
+  void Compile(const FrozenGraph& graph, int num_input_planes);
+
+  // Assigns each value a buffer, reusing buffers that hold values which are
+  // no longer needed.
+  void AssignBuffers();
+
+  int AddValue(std::vector<int> shape, int producer, int num_consumers);
+
+  // Returns the layer that produces `value` if the consumer of `value` can be
+  // fused into it, or null.
+  Layer* GetFusableLayer(int value);
+
+  const std::string graph_path_;
+
+  std::vector<Layer> layers_;
+  std::vector<Value> values_;
+  int input_value_ = -1;
+  int policy_value_ = -1;
+  int value_value_ = -1;
+
+  // The buffer assigned to each value group.
+  std::vector<int> group_buffers_;
+  std::vector<int> buffer_sizes_;
+};
+
+CompiledModel::CompiledModel(
+    const std::string& graph_path, const FeatureDescriptor& feature_desc,
+    const FrozenGraph& graph,
+    const absl::flat_hash_map<std::string, float>& int8_scales)
+    : graph_path_(graph_path) {
+  MG_CHECK(feature_desc.layout == FeatureDescriptor::Layout::kNhwc)
+      << "NativeDualNet only supports NHWC models";
+  Compile(graph, feature_desc.num_planes);
+  AssignBuffers();
+
+  int num_quantized = 0;
+  for (auto& layer : layers_) {
+    auto it = int8_scales.find(layer.name);
+    if (it == int8_scales.end()) {
+      continue;
+    }
+    MG_CHECK(layer.op == Op::kConv2D || layer.op == Op::kDense) << layer.name;
+    MG_CHECK(it->second > 0) << layer.name << " " << it->second;
+    layer.quantized_weights = QuantizedMatrix(layer.weights);
+    layer.input_scale = it->second;
+    num_quantized += 1;
+  }
+  MG_CHECK(num_quantized == static_cast<int>(int8_scales.size()))
+      << "int8 scales don't match the model's layers";
+  if (num_quantized > 0) {
+    MG_LOG(INFO) << "Running " << num_quantized << " layers of " << graph_path_
+                 << " using int8";
+  }
+}
+
+void CompiledModel::Compile(const FrozenGraph& graph, int num_input_planes) {
+  using Node = FrozenGraph::Node;
+
+  absl::flat_hash_map<absl::string_view, const Node*> nodes;
+  for (const auto& node : graph.nodes) {
+    nodes[node.name] = &node;
+  }
+  auto get_node = [&nodes](absl::string_view name) {
+    auto it = nodes.find(name);
+    MG_CHECK(it != nodes.end()) << "Couldn't find node \"" << name << "\"";
+    return it->second;
+  };
+
+  // Topologically sort the nodes required to compute the outputs.
+  std::vector<const Node*> order;
+  absl::flat_hash_map<absl::string_view, bool> visited;
+  std::function<void(const Node*)> visit = [&](const Node* node) {
+    auto it = visited.find(node->name);
+    if (it != visited.end()) {
+      MG_CHECK(it->second) << "Graph has a cycle at \"" << node->name << "\"";
+      return;
+    }
+    visited[node->name] = false;
+    for (const auto& input : node->inputs) {
+      visit(get_node(input));
+    }
+    visited[node->name] = true;
+    order.push_back(node);
+  };
+  visit(get_node("policy_output"));
+  visit(get_node("value_output"));
+
+  absl::flat_hash_map<absl::string_view, int> num_consumers;
+  for (const auto* node : order) {
+    for (const auto& input : node->inputs) {
+      num_consumers[input] += 1;
+    }
+  }
+
+  // Map from node name to the constant or value that it outputs.
+  absl::flat_hash_map<absl::string_view, const FrozenGraph::Tensor*> consts;
+  absl::flat_hash_map<absl::string_view, int> node_values;
+
+  auto get_const = [&consts](absl::string_view name) {
+    auto it = consts.find(name);
+    MG_CHECK(it != consts.end()) << "\"" << name << "\" isn't a constant";
+    return it->second;
+  };
+  auto get_floats = [&](absl::string_view name, int64_t size) {
+    const auto* tensor = get_const(name);
+    MG_CHECK(tensor->dtype == FrozenGraph::Tensor::kFloat &&
+             static_cast<int64_t>(tensor->floats.size()) == size)
+        << "\"" << name << "\" isn't a float tensor of size " << size;
+    return tensor->floats.data();
+  };
+  auto get_value = [&node_values](absl::string_view name) {
+    auto it = node_values.find(name);
+    MG_CHECK(it != node_values.end()) << "\"" << name << "\" isn't a value";
+    return it->second;
+  };
+  auto check_attr = [](const Node* node, absl::string_view name,
+                       absl::string_view expected) {
+    const auto* attr = node->FindAttr(name);
+    MG_CHECK(attr == nullptr || attr->s == expected)
+        << node->name << " has unsupported " << name << " \"" << attr->s
+        << "\"";
+  };
+
+  for (const auto* node : order) {
+    const auto& op = node->op;
+    const auto& inputs = node->inputs;
+    auto consumers = num_consumers[node->name];
+
+    if (op == "Placeholder") {
+      MG_CHECK(node->name == "pos_tensor") << node->name;
+      input_value_ = AddValue({kN, kN, num_input_planes}, -1, consumers);
+      node_values[node->name] = input_value_;
+    } else if (op == "Const") {
+      const auto* attr = node->FindAttr("value");
+      MG_CHECK(attr != nullptr) << node->name;
+      consts[node->name] = &attr->tensor;
+    } else if (op == "Identity" || op == "Cast") {
+      // The input features are always float, so casts from bool features are
+      // no-ops too.
+      MG_CHECK(inputs.size() == 1);
+      if (consts.contains(inputs[0])) {
+        consts[node->name] = consts[inputs[0]];
+      } else {
+        auto value = get_value(inputs[0]);
+        values_[value].num_consumers += consumers - 1;
+        node_values[node->name] = value;
+      }
+    } else if (op == "Reshape") {
+      MG_CHECK(inputs.size() == 2);
+      auto input = get_value(inputs[0]);
+      const auto* new_shape = get_const(inputs[1]);
+      MG_CHECK(!new_shape->ints.empty());
+      std::vector<int> shape(new_shape->ints.begin() + 1,
+                             new_shape->ints.end());
+      auto value = AddValue(shape, -1, consumers);
+      MG_CHECK(values_[value].size == values_[input].size)
+          << node->name << " changes the size of the example";
+      values_[value].group = values_[input].group;
+      node_values[node->name] = value;
+    } else if (op == "Conv2D") {
+      MG_CHECK(inputs.size() == 2);
+      check_attr(node, "padding", "SAME");
+      check_attr(node, "data_format", "NHWC");
+      for (const auto* name : {"strides", "dilations"}) {
+        const auto* attr = node->FindAttr(name);
+        MG_CHECK(attr == nullptr ||
+                 std::all_of(attr->list_i.begin(), attr->list_i.end(),
+                             [](int64_t x) { return x == 1; }))
+            << node->name << " has unsupported " << name;
+      }
+      auto input = get_value(inputs[0]);
+      const auto& input_shape = values_[input].shape;
+      MG_CHECK(input_shape.size() == 3 && input_shape[0] == kN &&
+               input_shape[1] == kN);
+      const auto* kernel = get_const(inputs[1]);
+      const auto& kernel_shape = kernel->shape;
+      MG_CHECK(kernel_shape.size() == 4 && kernel_shape[0] == kernel_shape[1] &&
+               kernel_shape[0] % 2 == 1 && kernel_shape[2] == input_shape[2])
+          << node->name << " has unsupported kernel shape";
+
+      int out_channels = kernel_shape[3];
+      int rows = kernel->num_elements() / out_channels;
+      Layer layer;
+      layer.op = Op::kConv2D;
+      layer.name = node->name;
+      layer.input = input;
+      layer.kernel_size = kernel_shape[0];
+      layer.weights = PackedMatrix(rows, out_channels,
+                                   get_floats(inputs[1], rows * out_channels));
+      layer.bias.resize(out_channels, 0.0f);
+      layer.output =
+          AddValue({kN, kN, out_channels}, layers_.size(), consumers);
+      node_values[node->name] = layer.output;
+      layers_.push_back(std::move(layer));
+    } else if (op == "MatMul") {
+      MG_CHECK(inputs.size() == 2);
+      for (const auto* name : {"transpose_a", "transpose_b"}) {
+        const auto* attr = node->FindAttr(name);
+        MG_CHECK(attr == nullptr || !attr->b) << node->name << " " << name;
+      }
+      auto input = get_value(inputs[0]);
+      const auto* weights = get_const(inputs[1]);
+      MG_CHECK(weights->shape.size() == 2 &&
+               weights->shape[0] == values_[input].size)
+          << node->name << " has unsupported weights shape";
+      int rows = weights->shape[0];
+      int cols = weights->shape[1];
+      Layer layer;
+      layer.op = Op::kDense;
+      layer.name = node->name;
+      layer.input = input;
+      layer.weights =
+          PackedMatrix(rows, cols, get_floats(inputs[1], rows * cols));
+      layer.bias.resize(cols, 0.0f);
+      layer.output = AddValue({cols}, layers_.size(), consumers);
+      node_values[node->name] = layer.output;
+      layers_.push_back(std::move(layer));
+    } else if (op == "FusedBatchNorm" || op == "FusedBatchNormV3") {
+      // Fold the batch norm into the preceding layer's weights & bias.
+      MG_CHECK(inputs.size() == 5);
+      check_attr(node, "data_format", "NHWC");
+      const auto* is_training = node->FindAttr("is_training");
+      MG_CHECK(is_training == nullptr || !is_training->b) << node->name;
+      const auto* epsilon_attr = node->FindAttr("epsilon");
+      float epsilon = epsilon_attr != nullptr ? epsilon_attr->f : 0.001f;
+
+      auto value = get_value(inputs[0]);
+      auto* layer = GetFusableLayer(value);
+      MG_CHECK(layer != nullptr &&
+               (layer->op == Op::kConv2D || layer->op == Op::kDense) &&
+               layer->input2 == -1 && !layer->relu)
+          << node->name << " can't be folded into the preceding layer";
+
+      int n = layer->weights.cols();
+      const auto* scale = get_floats(inputs[1], n);
+      const auto* offset = get_floats(inputs[2], n);
+      const auto* mean = get_floats(inputs[3], n);
+      const auto* variance = get_floats(inputs[4], n);
+      std::vector<float> multiplier(n);
+      for (int i = 0; i < n; ++i) {
+        multiplier[i] = scale[i] / std::sqrt(variance[i] + epsilon);
+        layer->bias[i] =
+            (layer->bias[i] - mean[i]) * multiplier[i] + offset[i];
+      }
+      layer->weights.ScaleColumns(multiplier.data());
+      values_[value].num_consumers += consumers - 1;
+      node_values[node->name] = value;
+    } else if (op == "BiasAdd") {
+      MG_CHECK(inputs.size() == 2);
+      check_attr(node, "data_format", "NHWC");
+      auto value = get_value(inputs[0]);
+      auto* layer = GetFusableLayer(value);
+      MG_CHECK(layer != nullptr &&
+               (layer->op == Op::kConv2D || layer->op == Op::kDense) &&
+               layer->input2 == -1 && !layer->relu)
+          << node->name << " can't be fused into the preceding layer";
+      int n = layer->weights.cols();
+      const auto* bias = get_floats(inputs[1], n);
+      for (int i = 0; i < n; ++i) {
+        layer->bias[i] += bias[i];
+      }
+      values_[value].num_consumers += consumers - 1;
+      node_values[node->name] = value;
+    } else if (op == "Add" || op == "AddV2") {
+      MG_CHECK(inputs.size() == 2);
+      int a = get_value(inputs[0]);
+      int b = get_value(inputs[1]);
+      MG_CHECK(values_[a].shape == values_[b].shape)
+          << node->name << " broadcasting isn't supported";
+
+      // Try to fuse the addition into the layer that computes one of the
+      // operands, as long as the other operand has already been computed by
+      // the time that layer runs.
+      bool fused = false;
+      for (auto x : {std::make_pair(a, b), std::make_pair(b, a)}) {
+        auto* layer = GetFusableLayer(x.first);
+        if (layer != nullptr &&
+            (layer->op == Op::kConv2D || layer->op == Op::kDense) &&
+            layer->input2 == -1 && !layer->relu &&
+            values_[x.second].producer < values_[x.first].producer) {
+          layer->input2 = x.second;
+          values_[x.first].num_consumers += consumers - 1;
+          node_values[node->name] = x.first;
+          fused = true;
+          break;
+        }
+      }
+      if (!fused) {
+        Layer layer;
+        layer.op = Op::kAdd;
+        layer.input = a;
+        layer.input2 = b;
+        layer.output = AddValue(values_[a].shape, layers_.size(), consumers);
+        node_values[node->name] = layer.output;
+        layers_.push_back(std::move(layer));
+      }
+    } else if (op == "Relu") {
+      MG_CHECK(inputs.size() == 1);
+      auto value = get_value(inputs[0]);
+      auto* layer = GetFusableLayer(value);
+      if (layer != nullptr && layer->op != Op::kRelu && !layer->relu &&
+          (layer->op == Op::kConv2D || layer->op == Op::kDense ||
+           layer->op == Op::kAdd)) {
+        layer->relu = true;
+        values_[value].num_consumers += consumers - 1;
+        node_values[node->name] = value;
+      } else {
+        Layer layer;
+        layer.op = Op::kRelu;
+        layer.input = value;
+        layer.output =
+            AddValue(values_[value].shape, layers_.size(), consumers);
+        node_values[node->name] = layer.output;
+        layers_.push_back(std::move(layer));
+      }
+    } else if (op == "Softmax" || op == "Tanh") {
+      MG_CHECK(inputs.size() == 1);
+      auto value = get_value(inputs[0]);
+      Layer layer;
+      layer.op = op == "Softmax" ? Op::kSoftmax : Op::kTanh;
+      layer.input = value;
+      layer.output = AddValue(values_[value].shape, layers_.size(), consumers);
+      node_values[node->name] = layer.output;
+      layers_.push_back(std::move(layer));
+    } else {
+      MG_LOG(FATAL) << "Node \"" << node->name << "\" has unsupported op \""
+                    << op << "\"";
+    }
+  }
+
+  MG_CHECK(input_value_ != -1) << "Couldn't find pos_tensor";
+  policy_value_ = get_value("policy_output");
+  value_value_ = get_value("value_output");
+  MG_CHECK(values_[policy_value_].size == kNumMoves);
+  MG_CHECK(values_[value_value_].size == 1);
+}
+
+int CompiledModel::AddValue(std::vector<int> shape, int producer,
+                            int num_consumers) {
+  Value value;
+  value.size = 1;
+  for (auto x : shape) {
+    MG_CHECK(x > 0) << "unsupported dimension " << x;
+    value.size *= x;
+  }
+  value.shape = std::move(shape);
+  value.producer = producer;
+  value.num_consumers = num_consumers;
+  value.group = values_.size();
+  values_.push_back(std::move(value));
+  return values_.size() - 1;
+}
+
+CompiledModel::Layer* CompiledModel::GetFusableLayer(int value) {
+  const auto& v = values_[value];
+  if (v.producer == -1 || v.num_consumers != 1) {
+    return nullptr;
+  }
+  return &layers_[v.producer];
+}
+
+void CompiledModel::AssignBuffers() {
+  // For each value group, find the last layer that reads it. Groups are
+  // allocated a buffer when first written, in the layer scan below.
+  int num_groups = values_.size();
+  int num_layers = layers_.size();
+  std::vector<int> last_read(num_groups, -1);
+  std::vector<int> group_sizes(num_groups, 0);
+  for (const auto& value : values_) {
+    group_sizes[value.group] = std::max(group_sizes[value.group], value.size);
+  }
+  for (int i = 0; i < num_layers; ++i) {
+    const auto& layer = layers_[i];
+    for (int input : {layer.input, layer.input2}) {
+      if (input != -1) {
+        last_read[values_[input].group] = i;
+      }
+    }
+  }
+  // The outputs are read after the last layer.
+  last_read[values_[policy_value_].group] = num_layers;
+  last_read[values_[value_value_].group] = num_layers;
+
+  // Allocate the buffers by scanning over the layers. A layer's output never
+  // shares a buffer with its inputs.
+  group_buffers_.assign(num_groups, -1);
+  std::vector<int> free_buffers;
+  auto allocate = [&](int group) {
+    int buffer;
+    if (!free_buffers.empty()) {
+      buffer = free_buffers.back();
+      free_buffers.pop_back();
+    } else {
+      buffer = buffer_sizes_.size();
+      buffer_sizes_.push_back(0);
+    }
+    buffer_sizes_[buffer] = std::max(buffer_sizes_[buffer], group_sizes[group]);
+    group_buffers_[group] = buffer;
+  };
+
+  allocate(values_[input_value_].group);
+  for (int i = 0; i < num_layers; ++i) {
+    int output_group = values_[layers_[i].output].group;
+    if (group_buffers_[output_group] == -1) {
+      allocate(output_group);
+    }
+    for (int group = 0; group < num_groups; ++group) {
+      if (last_read[group] == i && group_buffers_[group] != -1) {
+        free_buffers.push_back(group_buffers_[group]);
+      }
+    }
+  }
+
+  MG_LOG(INFO) << "Model " << graph_path_ << " compiled to " << num_layers
+               << " layers using " << buffer_sizes_.size() << " buffers";
+}
+
+}  // namespace native
+
+namespace {
+
+using native::CompiledModel;
+
+class NativeDualNet : public Model {
+ public:
+  NativeDualNet(const std::string& graph_path,
+                const FeatureDescriptor& feature_desc,
+                std::shared_ptr<const CompiledModel> model);
+  ~NativeDualNet() override;
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override;
+
+  // Runs inference on a dedicated thread, which is started by the first call.
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override;
+
+  ModelInputBuffer* LendInputBuffer(int capacity) override;
+  void ReturnInputBuffer() override;
+
+  // Runs the model over a batch of encoded input features and returns the
+  // int8 scale for the input of each layer that can be quantized, keyed by
+  // layer name. The scale maps the largest input seen to 127. Layers whose
+  // inputs can be negative aren't quantized.
+  absl::flat_hash_map<std::string, float> Calibrate(
+      const Tensor<uint8_t>& features);
+
+ private:
+  using Op = CompiledModel::Op;
+  using Layer = CompiledModel::Layer;
+
+  void Reserve(int capacity);
+
+  // Returns a ModelInputBuffer that writes to the input buffer.
+  ModelInputBuffer GetInputBuffer();
+
+  void RunLayer(const Layer& layer, int batch_size);
+
+  float* data(int value) { return buffers_[model_->buffer(value)].data(); }
+
+  const std::string graph_path_;
+
+  // Shared by all instances of the model.
+  const std::shared_ptr<const CompiledModel> model_;
+
+  // Buffers holding the values computed by the model.
+  std::vector<std::vector<float>> buffers_;
+
+  // Scratch space used by the convolutions and quantized layers.
+  std::vector<float> scratch_;
+  std::vector<uint8_t> quantized_scratch_;
+
+  int batch_capacity_ = 0;
+
+  // The buffer returned by LendInputBuffer. `input_buffer_lent_` is true
+  // between the calls to LendInputBuffer and RunMany (or ReturnInputBuffer),
+  // during which time the input buffer already holds the features.
+  ModelInputBuffer input_buffer_;
+  bool input_buffer_lent_ = false;
+
+  // Created by the first call to RunManyAsync.
+  std::unique_ptr<ModelThread> model_thread_;
+};
+
+NativeDualNet::NativeDualNet(const std::string& graph_path,
+                             const FeatureDescriptor& feature_desc,
+                             std::shared_ptr<const CompiledModel> model)
+    : Model(std::string(file::Stem(file::Basename(graph_path))), feature_desc),
+      graph_path_(graph_path),
+      model_(std::move(model)),
+      buffers_(model_->buffer_sizes().size()) {}
+
+NativeDualNet::~NativeDualNet() {
+  // Finish any pending asynchronous inferences.
+  model_thread_.reset();
+}
+
+void NativeDualNet::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                                 std::vector<ModelOutput*>* outputs,
+                                 std::string* model_name,
+                                 std::function<void()> done) {
+  if (model_thread_ == nullptr) {
+    model_thread_ = absl::make_unique<ModelThread>(this);
+  }
+  model_thread_->RunManyAsync(inputs, outputs, model_name, std::move(done));
+}
+
+void NativeDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
+                            std::vector<ModelOutput*>* outputs,
+                            std::string* model_name) {
+  // If the input buffer was lent out, the caller has already written the
+  // features to it.
+  bool features_encoded = input_buffer_lent_;
+  input_buffer_lent_ = false;
+  int batch_size = inputs.size();
+  if (features_encoded) {
+    MG_CHECK(batch_size <= batch_capacity_);
+  } else {
+    Reserve(batch_size);
+  }
+
+  WTF_SCOPE("NativeDualNet::Run: inputs, capacity", size_t, int)
+  (inputs.size(), batch_capacity_);
+  MG_CHECK(inputs.size() == outputs->size());
+
+  if (!features_encoded) {
+    WTF_SCOPE("Features::SetFeatures: inputs", size_t)(inputs.size());
+    GetInputBuffer().SetFeatures(0, inputs);
+  }
+
+  for (const auto& layer : model_->layers()) {
+    RunLayer(layer, batch_size);
+  }
+
+  Tensor<float> policy({batch_size, kNumMoves}, data(model_->policy_value()));
+  Tensor<float> value({batch_size}, data(model_->value_value()));
+  {
+    WTF_SCOPE("Model::GetOutputs: outputs", size_t)(outputs->size());
+    Model::GetOutputs(inputs, policy, value, absl::MakeSpan(*outputs));
+  }
+
+  if (model_name != nullptr) {
+    *model_name = graph_path_;
+  }
+}
+
+ModelInputBuffer* NativeDualNet::LendInputBuffer(int capacity) {
+  MG_CHECK(!input_buffer_lent_);
+  Reserve(capacity);
+  input_buffer_ = GetInputBuffer();
+  input_buffer_lent_ = true;
+  return &input_buffer_;
+}
+
+void NativeDualNet::ReturnInputBuffer() {
+  MG_CHECK(input_buffer_lent_);
+  input_buffer_lent_ = false;
+}
+
+ModelInputBuffer NativeDualNet::GetInputBuffer() {
+  auto shape = feature_descriptor().GetInputShape(batch_capacity_);
+  return ModelInputBuffer(feature_descriptor(),
+                          Tensor<float>(shape, data(model_->input_value())));
+}
+
+void NativeDualNet::Reserve(int capacity) {
+  MG_CHECK(capacity > 0);
+  if (capacity <= batch_capacity_) {
+    return;
+  }
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    buffers_[i].resize(capacity * model_->buffer_sizes()[i]);
+  }
+  batch_capacity_ = capacity;
+}
+
+absl::flat_hash_map<std::string, float> NativeDualNet::Calibrate(
+    const Tensor<uint8_t>& features) {
+  constexpr int kBatchSize = 64;
+
+  int example_size = model_->values()[model_->input_value()].size;
+  int num_examples = features.shape[0];
+  MG_CHECK(features.shape.num_elements() == num_examples * example_size)
+      << features.shape;
+
+  std::vector<float> min_inputs(model_->layers().size(), 0);
+  std::vector<float> max_inputs(model_->layers().size(), 0);
+  for (int begin = 0; begin < num_examples; begin += kBatchSize) {
+    int batch_size = std::min(kBatchSize, num_examples - begin);
+    Reserve(batch_size);
+    const uint8_t* src = features.data + begin * example_size;
+    std::copy(src, src + batch_size * example_size,
+              data(model_->input_value()));
+
+    for (size_t i = 0; i < model_->layers().size(); ++i) {
+      const auto& layer = model_->layers()[i];
+      if (layer.op == Op::kConv2D || layer.op == Op::kDense) {
+        const float* input = data(layer.input);
+        int size = batch_size * model_->values()[layer.input].size;
+        auto range = std::minmax_element(input, input + size);
+        min_inputs[i] = std::min(min_inputs[i], *range.first);
+        max_inputs[i] = std::max(max_inputs[i], *range.second);
+      }
+      RunLayer(layer, batch_size);
+    }
+  }
+
+  absl::flat_hash_map<std::string, float> scales;
+  for (size_t i = 0; i < model_->layers().size(); ++i) {
+    const auto& layer = model_->layers()[i];
+    if ((layer.op == Op::kConv2D || layer.op == Op::kDense) &&
+        min_inputs[i] >= 0) {
+      scales[layer.name] = max_inputs[i] > 0 ? max_inputs[i] / 127 : 1;
+    }
+  }
+  return scales;
+}
+
+void NativeDualNet::RunLayer(const Layer& layer, int batch_size) {
+  const float* input = data(layer.input);
+  float* output = data(layer.output);
+  int size = batch_size * model_->values()[layer.output].size;
+
+  switch (layer.op) {
+    case Op::kConv2D:
+    case Op::kDense: {
+      Epilogue epilogue;
+      epilogue.bias = layer.bias.data();
+      epilogue.residual = layer.input2 != -1 ? data(layer.input2) : nullptr;
+      epilogue.relu = layer.relu;
+      if (layer.input_scale > 0) {
+        const auto& weights = layer.quantized_weights;
+        if (layer.op == Op::kConv2D) {
+          WTF_SCOPE("QuantizedConv2D: kernel_size, channels", int, int)
+          (layer.kernel_size, weights.cols());
+          native::QuantizedConv2D(batch_size, kN, layer.kernel_size, input,
+                                  layer.input_scale, weights, epilogue, output,
+                                  &quantized_scratch_);
+        } else {
+          WTF_SCOPE("QuantizedDense: channels", int)(weights.cols());
+          int stride = weights.padded_rows();
+          quantized_scratch_.resize(batch_size * stride);
+          native::QuantizeActivations(batch_size, weights.rows(), input,
+                                      layer.input_scale, stride,
+                                      quantized_scratch_.data());
+          native::QuantizedGemm(batch_size, quantized_scratch_.data(),
+                                layer.input_scale, weights, epilogue, output);
+        }
+      } else if (layer.op == Op::kConv2D) {
+        WTF_SCOPE("Conv2D: kernel_size, channels", int, int)
+        (layer.kernel_size, layer.weights.cols());
+        native::Conv2D(batch_size, kN, layer.kernel_size, input, layer.weights,
+                       epilogue, output, &scratch_);
+      } else {
+        WTF_SCOPE("Dense: channels", int)(layer.weights.cols());
+        native::Gemm(batch_size, input, layer.weights, epilogue, output);
+      }
+      break;
+    }
+
+    case Op::kAdd: {
+      const float* input2 = data(layer.input2);
+      for (int i = 0; i < size; ++i) {
+        output[i] = input[i] + input2[i];
+      }
+      if (layer.relu) {
+        native::Relu(size, output);
+      }
+      break;
+    }
+
+    case Op::kRelu:
+      memcpy(output, input, size * sizeof(float));
+      native::Relu(size, output);
+      break;
+
+    case Op::kSoftmax: {
+      int n = model_->values()[layer.output].shape.back();
+      memcpy(output, input, size * sizeof(float));
+      native::Softmax(size / n, n, output);
+      break;
+    }
+
+    case Op::kTanh:
+      memcpy(output, input, size * sizeof(float));
+      native::Tanh(size, output);
+      break;
+  }
+}
+
+absl::flat_hash_map<std::string, float> ParseInt8Scales(
+    absl::string_view scales_str) {
+  absl::flat_hash_map<std::string, float> int8_scales;
+  for (absl::string_view item :
+       absl::StrSplit(scales_str, ',', absl::SkipEmpty())) {
+    std::pair<absl::string_view, absl::string_view> kv =
+        absl::StrSplit(item, '=');
+    float scale;
+    MG_CHECK(absl::SimpleAtof(kv.second, &scale))
+        << "Couldn't parse " << kInt8ScalesKey << " \"" << item << "\"";
+    int8_scales[std::string(kv.first)] = scale;
+  }
+  return int8_scales;
+}
+
+std::shared_ptr<const CompiledModel> CompileModel(
+    const ModelDefinition& def, const FeatureDescriptor& feature_desc,
+    const absl::flat_hash_map<std::string, float>& int8_scales) {
+  FrozenGraph graph;
+  MG_CHECK(ParseFrozenGraph(def.model_bytes.view(), &graph))
+      << "Couldn't parse GraphDef from " << def.path;
+  return std::make_shared<const CompiledModel>(def.path, feature_desc, graph,
+                                               int8_scales);
+}
+
+FeatureDescriptor GetFeatureDescriptor(const ModelDefinition& def) {
+  return FeatureDescriptor::Create(
+      def.metadata.Get<std::string>("input_features"),
+      def.metadata.Get<std::string>("input_layout"));
+}
+
+}  // namespace
+
+std::unique_ptr<Model> NativeDualNetFactory::NewModel(
+    const ModelDefinition& def) {
+  MG_CHECK(def.metadata.Get<std::string>("engine") == "native");
+
+  auto feature_desc = GetFeatureDescriptor(def);
+  std::string scales_str;
+  def.metadata.TryGet(kInt8ScalesKey, &scales_str);
+
+  // Only compile the model (and quantize its weights) for the first instance:
+  // the rest share the compiled model.
+  auto model = compiled_models_.GetOrCreate(
+      def.model_bytes, scales_str, [&]() {
+        return CompileModel(def, feature_desc, ParseInt8Scales(scales_str));
+      });
+  return absl::make_unique<NativeDualNet>(def.path, feature_desc,
+                                          std::move(model));
+}
+
+ModelDefinition CalibrateNativeInt8(const ModelDefinition& def,
+                                    const Tensor<uint8_t>& features) {
+  auto feature_desc = GetFeatureDescriptor(def);
+  NativeDualNet model(def.path, feature_desc,
+                      CompileModel(def, feature_desc, {}));
+  auto scales = model.Calibrate(features);
+
+  // Sort the scales so that calibration is deterministic.
+  std::vector<std::pair<std::string, float>> sorted(scales.begin(),
+                                                    scales.end());
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<std::string> items;
+  for (const auto& kv : sorted) {
+    items.push_back(absl::StrCat(kv.first, "=", kv.second));
+  }
+
+  ModelDefinition result = def;
+  result.metadata.Set(kInt8ScalesKey, absl::StrJoin(items, ","));
+  return result;
+}
+
+}  // namespace minigo
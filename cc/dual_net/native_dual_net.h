@@ -0,0 +1,61 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_DUAL_NET_NATIVE_DUAL_NET_H_
+#define CC_DUAL_NET_NATIVE_DUAL_NET_H_
+
+#include <memory>
+
+#include "cc/model/factory.h"
+#include "cc/model/model.h"
+
+namespace minigo {
+
+namespace native {
+class CompiledModel;
+}  // namespace native
+
+// Runs frozen TensorFlow models on the CPU without depending on TensorFlow.
+// The model's GraphDef is compiled into a sequence of convolution and dense
+// layers with batch norm, bias, residual & ReLU fused in, which are run using
+// the kernels in native_kernels.h.
+// Supports the residual network built by dual_net.py for NHWC models; models
+// with squeeze-excitation blocks or swish activations aren't supported.
+//
+// The models are loaded from regular "tf" engine Minigo files, selected by
+// prefixing the model path with "native:" (see LoadModelDefinition).
+// Models calibrated with CalibrateNativeInt8 run their convolution and dense
+// layers using int8 kernels.
+// All instances of a model share the compiled model and its weights.
+class NativeDualNetFactory : public ModelFactory {
+ public:
+  std::unique_ptr<Model> NewModel(const ModelDefinition& def) override;
+
+ private:
+  SharedModelCache<const native::CompiledModel> compiled_models_;
+};
+
+// Calibrates a model for int8 inference on the native engine.
+// Runs the float model `def` over `features`, a batch of input features
+// encoded using the model's FeatureDescriptor (for example the "x" feature of
+// training examples), and returns a copy of `def` whose metadata holds the
+// quantization scale for the input of each layer that can run in int8.
+// Weights are quantized with a scale per output channel when the model is
+// loaded.
+ModelDefinition CalibrateNativeInt8(const ModelDefinition& def,
+                                    const Tensor<uint8_t>& features);
+
+}  // namespace minigo
+
+#endif  // CC_DUAL_NET_NATIVE_DUAL_NET_H_
@@ -0,0 +1,131 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the inference throughput of one or more models at different batch
+// sizes. Intended to compare the native engine against the TensorFlow engine:
+//   native_dual_net_benchmark \
+//       --models=native:path/to/model.minigo,path/to/model.minigo
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/constants.h"
+#include "cc/init.h"
+#include "cc/logging.h"
+#include "cc/model/loader.h"
+#include "cc/model/model.h"
+#include "cc/position.h"
+#include "cc/random.h"
+#include "cc/symmetries.h"
+#include "gflags/gflags.h"
+
+DEFINE_string(models, "native:cc/dual_net/test_tf.minigo",
+              "Comma-separated list of models to benchmark.");
+DEFINE_string(device, "", "Device to run the models on.");
+DEFINE_string(batch_sizes, "1,8,16,64,256",
+              "Comma-separated list of batch sizes to benchmark.");
+DEFINE_int32(num_inferences, 4096,
+             "Number of inferences to run for each batch size.");
+
+namespace minigo {
+namespace {
+
+void BenchmarkModel(const std::string& path,
+                    const std::vector<int>& batch_sizes) {
+  auto model = NewModel(path, FLAGS_device);
+
+  // Generate positions from random games, restarting the game every
+  // kGameLength moves.
+  constexpr int kGameLength = 60;
+  Random rnd(8475, 1);
+  std::vector<Position> positions;
+  Position position(Color::kBlack);
+  while (positions.size() < 256) {
+    if (positions.size() % kGameLength == 0) {
+      position = Position(Color::kBlack);
+    }
+    Coord c = Coord::kPass;
+    for (int i = 0; i < 10; ++i) {
+      Coord x = rnd.UniformInt(0, kN * kN - 1);
+      if (position.legal_move(x)) {
+        c = x;
+        break;
+      }
+    }
+    position.PlayMove(c);
+    positions.push_back(position);
+  }
+
+  int max_batch_size =
+      *std::max_element(batch_sizes.begin(), batch_sizes.end());
+  std::vector<ModelInput> inputs(max_batch_size);
+  std::vector<ModelOutput> outputs(max_batch_size);
+  for (int i = 0; i < max_batch_size; ++i) {
+    inputs[i].sym = symmetry::kIdentity;
+    inputs[i].position_history.push_back(&positions[i % positions.size()]);
+  }
+
+  for (int batch_size : batch_sizes) {
+    std::vector<const ModelInput*> input_ptrs;
+    std::vector<ModelOutput*> output_ptrs;
+    for (int i = 0; i < batch_size; ++i) {
+      input_ptrs.push_back(&inputs[i]);
+      output_ptrs.push_back(&outputs[i]);
+    }
+
+    // Warm up.
+    model->RunMany(input_ptrs, &output_ptrs, nullptr);
+
+    int num_batches = std::max(1, FLAGS_num_inferences / batch_size);
+    auto start = absl::Now();
+    for (int i = 0; i < num_batches; ++i) {
+      model->RunMany(input_ptrs, &output_ptrs, nullptr);
+    }
+    auto duration = absl::Now() - start;
+
+    auto num_inferences = num_batches * batch_size;
+    MG_LOG(INFO) << path << " batch_size:" << batch_size << " "
+                 << absl::FormatDuration(duration / num_inferences)
+                 << " per inference, "
+                 << num_inferences / absl::ToDoubleSeconds(duration)
+                 << " inferences/sec";
+  }
+}
+
+void RunBenchmark() {
+  std::vector<int> batch_sizes;
+  for (auto str : absl::StrSplit(FLAGS_batch_sizes, ',')) {
+    int x;
+    MG_CHECK(absl::SimpleAtoi(str, &x) && x > 0) << str;
+    batch_sizes.push_back(x);
+  }
+  for (const auto& path : absl::StrSplit(FLAGS_models, ',')) {
+    BenchmarkModel(std::string(path), batch_sizes);
+  }
+  ShutdownModelFactories();
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char* argv[]) {
+  minigo::Init(&argc, &argv);
+  minigo::RunBenchmark();
+  return 0;
+}
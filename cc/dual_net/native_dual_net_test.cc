@@ -0,0 +1,445 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cc/dual_net/native_dual_net.h"
+#include "cc/dual_net/native_kernels.h"
+#include "cc/model/loader.h"
+#include "cc/model/model.h"
+#include "cc/position.h"
+#include "cc/random.h"
+#include "cc/symmetries.h"
+#include "cc/test_utils.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace native {
+namespace {
+
+std::vector<float> RandomVector(size_t size, Random* rnd) {
+  std::vector<float> result(size);
+  rnd->Uniform(-1.0f, 1.0f, &result);
+  return result;
+}
+
+void ApplyEpilogue(int m, int n, const Epilogue& epilogue, float* c) {
+  for (int i = 0; i < m; ++i) {
+    for (int j = 0; j < n; ++j) {
+      float& x = c[i * n + j];
+      if (epilogue.bias != nullptr) {
+        x += epilogue.bias[j];
+      }
+      if (epilogue.residual != nullptr) {
+        x += epilogue.residual[i * n + j];
+      }
+      if (epilogue.relu) {
+        x = std::max(x, 0.0f);
+      }
+    }
+  }
+}
+
+void ExpectNear(const std::vector<float>& expected,
+                const std::vector<float>& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_NEAR(expected[i], actual[i], 1e-4f) << "at " << i;
+  }
+}
+
+TEST(NativeKernelsTest, Gemm) {
+  Random rnd(614, 1);
+  // Sizes that exercise the remainder rows & partial column panels.
+  for (int m : {1, 5, 6, 13, 81}) {
+    for (int k : {1, 17, 64}) {
+      for (int n : {1, 16, 33}) {
+        auto a = RandomVector(m * k, &rnd);
+        auto b = RandomVector(k * n, &rnd);
+        auto bias = RandomVector(n, &rnd);
+        auto residual = RandomVector(m * n, &rnd);
+
+        for (int i = 0; i < 4; ++i) {
+          Epilogue epilogue;
+          epilogue.bias = (i & 1) ? bias.data() : nullptr;
+          epilogue.residual = (i & 2) ? residual.data() : nullptr;
+          epilogue.relu = i == 3;
+
+          std::vector<float> expected(m * n, 0.0f);
+          for (int row = 0; row < m; ++row) {
+            for (int col = 0; col < n; ++col) {
+              for (int j = 0; j < k; ++j) {
+                expected[row * n + col] += a[row * k + j] * b[j * n + col];
+              }
+            }
+          }
+          ApplyEpilogue(m, n, epilogue, expected.data());
+
+          std::vector<float> actual(m * n);
+          Gemm(m, a.data(), PackedMatrix(k, n, b.data()), epilogue,
+               actual.data());
+          ExpectNear(expected, actual);
+        }
+      }
+    }
+  }
+}
+
+TEST(NativeKernelsTest, ScaleColumns) {
+  Random rnd(614, 2);
+  int k = 7;
+  int n = 19;
+  auto a = RandomVector(k, &rnd);
+  auto b = RandomVector(k * n, &rnd);
+  auto scale = RandomVector(n, &rnd);
+
+  PackedMatrix packed(k, n, b.data());
+  packed.ScaleColumns(scale.data());
+  for (int i = 0; i < k; ++i) {
+    for (int j = 0; j < n; ++j) {
+      b[i * n + j] *= scale[j];
+    }
+  }
+
+  std::vector<float> expected(n);
+  std::vector<float> actual(n);
+  Gemm(1, a.data(), PackedMatrix(k, n, b.data()), {}, expected.data());
+  Gemm(1, a.data(), packed, {}, actual.data());
+  ExpectNear(expected, actual);
+}
+
+TEST(NativeKernelsTest, Conv2D) {
+  Random rnd(614, 3);
+  int size = 9;
+  int in_channels = 5;
+  int out_channels = 18;
+  // A batch of 8 is larger than a single im2col chunk on a 9x9 board.
+  for (int batch_size : {1, 8}) {
+    for (int kernel_size : {1, 3, 5}) {
+      int pad = kernel_size / 2;
+      auto input = RandomVector(batch_size * size * size * in_channels, &rnd);
+      auto weights = RandomVector(
+          kernel_size * kernel_size * in_channels * out_channels, &rnd);
+      auto bias = RandomVector(out_channels, &rnd);
+      auto residual =
+          RandomVector(batch_size * size * size * out_channels, &rnd);
+      Epilogue epilogue;
+      epilogue.bias = bias.data();
+      epilogue.residual = residual.data();
+      epilogue.relu = true;
+
+      std::vector<float> expected(batch_size * size * size * out_channels,
+                                  0.0f);
+      for (int b = 0; b < batch_size; ++b) {
+        for (int y = 0; y < size; ++y) {
+          for (int x = 0; x < size; ++x) {
+            float* dst =
+                &expected[((b * size + y) * size + x) * out_channels];
+            for (int dy = 0; dy < kernel_size; ++dy) {
+              for (int dx = 0; dx < kernel_size; ++dx) {
+                int sy = y + dy - pad;
+                int sx = x + dx - pad;
+                if (sy < 0 || sy >= size || sx < 0 || sx >= size) {
+                  continue;
+                }
+                const float* src =
+                    &input[((b * size + sy) * size + sx) * in_channels];
+                const float* w =
+                    &weights[(dy * kernel_size + dx) * in_channels *
+                             out_channels];
+                for (int i = 0; i < in_channels; ++i) {
+                  for (int o = 0; o < out_channels; ++o) {
+                    dst[o] += src[i] * w[i * out_channels + o];
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+      ApplyEpilogue(batch_size * size * size, out_channels, epilogue,
+                    expected.data());
+
+      std::vector<float> actual(expected.size());
+      std::vector<float> scratch;
+      PackedMatrix packed(kernel_size * kernel_size * in_channels,
+                          out_channels, weights.data());
+      Conv2D(batch_size, size, kernel_size, input.data(), packed, epilogue,
+             actual.data(), &scratch);
+      ExpectNear(expected, actual);
+    }
+  }
+}
+
+TEST(NativeKernelsTest, QuantizedGemm) {
+  Random rnd(614, 5);
+  for (int m : {1, 4, 7, 81}) {
+    for (int k : {3, 32, 153}) {
+      for (int n : {1, 16, 33}) {
+        auto a = RandomVector(m * k, &rnd);
+        auto b = RandomVector(k * n, &rnd);
+        auto bias = RandomVector(n, &rnd);
+        for (auto& x : a) {
+          x = std::abs(x);
+        }
+
+        QuantizedMatrix qb(PackedMatrix(k, n, b.data()));
+        ASSERT_EQ(k, qb.rows());
+        ASSERT_EQ(0, qb.padded_rows() % 4);
+        float a_scale = 1.0f / 127;
+        std::vector<uint8_t> qa(m * qb.padded_rows());
+        QuantizeActivations(m, k, a.data(), a_scale, qb.padded_rows(),
+                            qa.data());
+
+        // Compute the expected result from the quantized values.
+        Epilogue epilogue;
+        epilogue.bias = bias.data();
+        std::vector<float> expected(m * n);
+        for (int row = 0; row < m; ++row) {
+          for (int col = 0; col < n; ++col) {
+            int32_t sum = 0;
+            for (int i = 0; i < k; ++i) {
+              auto w = std::lrint(b[i * n + col] / qb.scale(col));
+              sum += qa[row * qb.padded_rows() + i] * w;
+            }
+            expected[row * n + col] = sum * a_scale * qb.scale(col);
+          }
+        }
+        ApplyEpilogue(m, n, epilogue, expected.data());
+
+        std::vector<float> actual(m * n);
+        QuantizedGemm(m, qa.data(), a_scale, qb, epilogue, actual.data());
+        ExpectNear(expected, actual);
+      }
+    }
+  }
+}
+
+TEST(NativeKernelsTest, QuantizedConv2D) {
+  Random rnd(614, 6);
+  int size = 9;
+  int in_channels = 6;
+  int out_channels = 20;
+  for (int batch_size : {1, 8}) {
+    for (int kernel_size : {1, 3}) {
+      auto input = RandomVector(batch_size * size * size * in_channels, &rnd);
+      for (auto& x : input) {
+        x = std::abs(x);
+      }
+      auto weights = RandomVector(
+          kernel_size * kernel_size * in_channels * out_channels, &rnd);
+      auto bias = RandomVector(out_channels, &rnd);
+      Epilogue epilogue;
+      epilogue.bias = bias.data();
+
+      PackedMatrix packed(kernel_size * kernel_size * in_channels,
+                          out_channels, weights.data());
+      std::vector<float> expected(batch_size * size * size * out_channels);
+      std::vector<float> float_scratch;
+      Conv2D(batch_size, size, kernel_size, input.data(), packed, epilogue,
+             expected.data(), &float_scratch);
+
+      std::vector<float> actual(expected.size());
+      std::vector<uint8_t> scratch;
+      QuantizedConv2D(batch_size, size, kernel_size, input.data(), 1.0f / 127,
+                      QuantizedMatrix(packed), epilogue, actual.data(),
+                      &scratch);
+
+      // The quantization error of each product is at most about 1/127 of the
+      // input and weight ranges.
+      float tolerance = kernel_size * kernel_size * in_channels * 2.0f / 127;
+      for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_NEAR(expected[i], actual[i], tolerance) << "at " << i;
+      }
+    }
+  }
+}
+
+TEST(NativeKernelsTest, Softmax) {
+  std::vector<float> data = {1, 2, 3, 1000, 1000, 1000};
+  Softmax(2, 3, data.data());
+  float sum = std::exp(1.0f) + std::exp(2.0f) + std::exp(3.0f);
+  EXPECT_NEAR(std::exp(1.0f) / sum, data[0], 1e-6f);
+  EXPECT_NEAR(std::exp(2.0f) / sum, data[1], 1e-6f);
+  EXPECT_NEAR(std::exp(3.0f) / sum, data[2], 1e-6f);
+  for (int i = 3; i < 6; ++i) {
+    EXPECT_NEAR(1.0f / 3, data[i], 1e-6f);
+  }
+}
+
+}  // namespace
+}  // namespace native
+
+namespace {
+
+class NativeDualNetTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    model_ = NewModel("native:cc/dual_net/test_tf.minigo", "");
+
+    Random rnd(614, 4);
+    for (int i = 0; i < kNumPositions; ++i) {
+      TestablePosition position("");
+      for (int j = 0; j < i * 5; ++j) {
+        position.PlayMove(GetRandomLegalMove(position, &rnd));
+      }
+      positions_.push_back(position);
+    }
+    inputs_.resize(kNumPositions);
+    for (int i = 0; i < kNumPositions; ++i) {
+      inputs_[i].sym = static_cast<symmetry::Symmetry>(
+          i % symmetry::kNumSymmetries);
+      inputs_[i].position_history.push_back(&positions_[i]);
+    }
+  }
+
+  void TearDown() override {
+    model_.reset();
+    ShutdownModelFactories();
+  }
+
+  std::vector<ModelOutput> Run(int begin, int end) {
+    std::vector<ModelOutput> outputs(end - begin);
+    std::vector<const ModelInput*> input_ptrs;
+    std::vector<ModelOutput*> output_ptrs;
+    for (int i = begin; i < end; ++i) {
+      input_ptrs.push_back(&inputs_[i]);
+      output_ptrs.push_back(&outputs[i - begin]);
+    }
+    model_->RunMany(input_ptrs, &output_ptrs, nullptr);
+    return outputs;
+  }
+
+  static constexpr int kNumPositions = 10;
+
+  std::unique_ptr<Model> model_;
+  std::vector<TestablePosition> positions_;
+  std::vector<ModelInput> inputs_;
+};
+
+constexpr int NativeDualNetTest::kNumPositions;
+
+void ExpectOutputsNear(const ModelOutput& expected,
+                       const ModelOutput& actual) {
+  for (int i = 0; i < kNumMoves; ++i) {
+    ASSERT_NEAR(expected.policy[i], actual.policy[i], 1e-5f);
+  }
+  ASSERT_NEAR(expected.value, actual.value, 1e-5f);
+}
+
+TEST_F(NativeDualNetTest, Outputs) {
+  for (const auto& output : Run(0, kNumPositions)) {
+    float sum = 0;
+    for (auto p : output.policy) {
+      EXPECT_LE(0, p);
+      sum += p;
+    }
+    EXPECT_NEAR(1, sum, 1e-4f);
+    EXPECT_LE(-1, output.value);
+    EXPECT_GE(1, output.value);
+  }
+}
+
+// The empty board's outputs, as computed by an unoptimized reference
+// implementation of the test model's graph.
+TEST_F(NativeDualNetTest, EmptyBoard) {
+  TestablePosition position("");
+  ModelInput input;
+  input.sym = symmetry::kIdentity;
+  input.position_history.push_back(&position);
+  ModelOutput output;
+  std::vector<const ModelInput*> input_ptrs = {&input};
+  std::vector<ModelOutput*> output_ptrs = {&output};
+  model_->RunMany(input_ptrs, &output_ptrs, nullptr);
+
+  EXPECT_NEAR(-0.0098678f, output.value, 1e-6f);
+  EXPECT_NEAR(0.0103561f, output.policy[0], 1e-6f);
+  EXPECT_NEAR(0.0445211f, output.policy[31], 1e-6f);
+  EXPECT_NEAR(0.0277032f, output.policy[Coord::kPass], 1e-6f);
+}
+
+// The results for each position don't depend on the batch size.
+TEST_F(NativeDualNetTest, BatchSize) {
+  auto expected = Run(0, kNumPositions);
+  for (int i = 0; i < kNumPositions; ++i) {
+    ExpectOutputsNear(expected[i], Run(i, i + 1)[0]);
+  }
+  auto actual = Run(3, 8);
+  for (int i = 3; i < 8; ++i) {
+    ExpectOutputsNear(expected[i], actual[i - 3]);
+  }
+}
+
+// Calibrates the test model for int8 inference and checks that its outputs are
+// close to the float model's.
+TEST_F(NativeDualNetTest, Int8) {
+  const auto& desc = model_->feature_descriptor();
+  std::vector<const ModelInput*> input_ptrs;
+  for (const auto& input : inputs_) {
+    input_ptrs.push_back(&input);
+  }
+  BackedTensor<uint8_t> features(desc.GetInputShape(kNumPositions));
+  desc.set_bytes(input_ptrs, &features.tensor());
+
+  auto def = LoadModelDefinition("native:cc/dual_net/test_tf.minigo");
+  auto int8_def = CalibrateNativeInt8(def, features.tensor());
+  ASSERT_TRUE(int8_def.metadata.Has("native_int8_scales"));
+  auto int8_model = GetModelFactory(int8_def, "")->NewModel(int8_def);
+
+  auto expected = Run(0, kNumPositions);
+  std::vector<ModelOutput> actual(kNumPositions);
+  std::vector<ModelOutput*> output_ptrs;
+  for (auto& output : actual) {
+    output_ptrs.push_back(&output);
+  }
+  int8_model->RunMany(input_ptrs, &output_ptrs, nullptr);
+
+  for (int i = 0; i < kNumPositions; ++i) {
+    double kl = 0;
+    for (int j = 0; j < kNumMoves; ++j) {
+      float p = expected[i].policy[j];
+      float q = actual[i].policy[j];
+      kl += p * std::log(p / q);
+    }
+    EXPECT_LT(kl, 1e-3) << i;
+    EXPECT_NEAR(expected[i].value, actual[i].value, 0.02f) << i;
+  }
+}
+
+TEST_F(NativeDualNetTest, LendInputBuffer) {
+  auto expected = Run(0, kNumPositions);
+
+  std::vector<const ModelInput*> input_ptrs;
+  for (const auto& input : inputs_) {
+    input_ptrs.push_back(&input);
+  }
+  auto* buffer = model_->LendInputBuffer(kNumPositions);
+  ASSERT_NE(nullptr, buffer);
+  buffer->SetFeatures(0, input_ptrs);
+
+  std::vector<ModelOutput> actual(kNumPositions);
+  std::vector<ModelOutput*> output_ptrs;
+  for (auto& output : actual) {
+    output_ptrs.push_back(&output);
+  }
+  model_->RunMany(input_ptrs, &output_ptrs, nullptr);
+  for (int i = 0; i < kNumPositions; ++i) {
+    ExpectOutputsNear(expected[i], actual[i]);
+  }
+}
+
+}  // namespace
+}  // namespace minigo
@@ -0,0 +1,531 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/dual_net/native_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "cc/logging.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define MG_NATIVE_AVX2 1
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define MG_NATIVE_VNNI 1
+#elif defined(__AVXVNNI__)
+#define MG_NATIVE_AVX_VNNI 1
+#endif
+#endif
+
+namespace minigo {
+namespace native {
+namespace {
+
+constexpr int kPanelWidth = PackedMatrix::kPanelWidth;
+
+// Maximum number of rows in the expanded patch matrix of a convolution.
+// Batching several positions into one GEMM amortizes the cost of streaming
+// the weights through the cache.
+constexpr int kMaxConvRows = 512;
+
+// Applies the epilogue to one row of a GEMM micro-kernel's results.
+// `acc` holds the kPanelWidth results for columns [col, col + width) of row
+// `row` of `c`.
+inline void StoreRow(const float* acc, int row, int col, int width, int n,
+                     const Epilogue& epilogue, float* c) {
+  float* dst = c + row * n + col;
+  for (int j = 0; j < width; ++j) {
+    float x = acc[j];
+    if (epilogue.bias != nullptr) {
+      x += epilogue.bias[col + j];
+    }
+    if (epilogue.residual != nullptr) {
+      x += epilogue.residual[row * n + col + j];
+    }
+    if (epilogue.relu) {
+      x = std::max(x, 0.0f);
+    }
+    dst[j] = x;
+  }
+}
+
+#ifdef MG_NATIVE_AVX2
+
+// Number of rows of `c` computed by each micro-kernel invocation. Six rows of
+// two 8-wide accumulators use 12 of the 16 AVX registers.
+constexpr int kRowBlock = 6;
+
+// Applies the epilogue to the 8 results in `x` for columns [col, col + 8) of
+// row `row` of `c`.
+inline void StoreRow8(__m256 x, int row, int col, int n,
+                      const Epilogue& epilogue, float* c) {
+  int offset = row * n + col;
+  if (epilogue.bias != nullptr) {
+    x = _mm256_add_ps(x, _mm256_loadu_ps(epilogue.bias + col));
+  }
+  if (epilogue.residual != nullptr) {
+    x = _mm256_add_ps(x, _mm256_loadu_ps(epilogue.residual + offset));
+  }
+  if (epilogue.relu) {
+    x = _mm256_max_ps(x, _mm256_setzero_ps());
+  }
+  _mm256_storeu_ps(c + offset, x);
+}
+
+// Computes rows [row, row + MR) of columns [col, col + width) of `c`.
+template <int MR>
+void MicroKernel(int k, const float* a, const float* panel, int row, int col,
+                 int width, int n, const Epilogue& epilogue, float* c) {
+  __m256 acc[MR][2];
+  for (int r = 0; r < MR; ++r) {
+    acc[r][0] = _mm256_setzero_ps();
+    acc[r][1] = _mm256_setzero_ps();
+  }
+
+  const float* a_row = a + row * k;
+  for (int i = 0; i < k; ++i) {
+    __m256 b0 = _mm256_loadu_ps(panel + i * kPanelWidth);
+    __m256 b1 = _mm256_loadu_ps(panel + i * kPanelWidth + 8);
+    for (int r = 0; r < MR; ++r) {
+      __m256 x = _mm256_broadcast_ss(a_row + r * k + i);
+      acc[r][0] = _mm256_fmadd_ps(x, b0, acc[r][0]);
+      acc[r][1] = _mm256_fmadd_ps(x, b1, acc[r][1]);
+    }
+  }
+
+  if (width < kPanelWidth) {
+    alignas(32) float tmp[kPanelWidth];
+    for (int r = 0; r < MR; ++r) {
+      _mm256_store_ps(tmp, acc[r][0]);
+      _mm256_store_ps(tmp + 8, acc[r][1]);
+      StoreRow(tmp, row + r, col, width, n, epilogue, c);
+    }
+    return;
+  }
+
+  for (int r = 0; r < MR; ++r) {
+    StoreRow8(acc[r][0], row + r, col, n, epilogue, c);
+    StoreRow8(acc[r][1], row + r, col + 8, n, epilogue, c);
+  }
+}
+
+// Number of rows computed by each quantized micro-kernel invocation. The
+// AVX2 version needs a couple of extra registers for the 16-bit products.
+constexpr int kQuantizedRowBlock = 4;
+
+// Adds the dot products of each group of 4 unsigned bytes in `a` with the
+// corresponding signed bytes in `b` to the int32 lanes of `acc`.
+inline __m256i DotProduct(__m256i acc, __m256i a, __m256i b) {
+#if defined(MG_NATIVE_VNNI)
+  return _mm256_dpbusd_epi32(acc, a, b);
+#elif defined(MG_NATIVE_AVX_VNNI)
+  return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+  // The pairwise sums of products can't saturate because the activations are
+  // at most 127.
+  __m256i sums = _mm256_maddubs_epi16(a, b);
+  sums = _mm256_madd_epi16(sums, _mm256_set1_epi16(1));
+  return _mm256_add_epi32(acc, sums);
+#endif
+}
+
+// Computes rows [row, row + MR) of columns [col, col + width) of `c`.
+// `k` is the padded number of rows of the quantized matrix and `scales` holds
+// the combined activation & weight scale of each column.
+template <int MR>
+void QuantizedMicroKernel(int k, const uint8_t* a, const int8_t* panel,
+                          const float* scales, int row, int col, int width,
+                          int n, const Epilogue& epilogue, float* c) {
+  __m256i acc[MR][2];
+  for (int r = 0; r < MR; ++r) {
+    acc[r][0] = _mm256_setzero_si256();
+    acc[r][1] = _mm256_setzero_si256();
+  }
+
+  const uint8_t* a_row = a + row * k;
+  for (int i = 0; i < k; i += 4) {
+    const auto* b = reinterpret_cast<const __m256i*>(panel + i * kPanelWidth);
+    __m256i b0 = _mm256_loadu_si256(b);
+    __m256i b1 = _mm256_loadu_si256(b + 1);
+    for (int r = 0; r < MR; ++r) {
+      int32_t group;
+      memcpy(&group, a_row + r * k + i, sizeof(group));
+      __m256i x = _mm256_set1_epi32(group);
+      acc[r][0] = DotProduct(acc[r][0], x, b0);
+      acc[r][1] = DotProduct(acc[r][1], x, b1);
+    }
+  }
+
+  __m256 s0 = _mm256_loadu_ps(scales + col);
+  __m256 s1 = _mm256_loadu_ps(scales + col + 8);
+  for (int r = 0; r < MR; ++r) {
+    __m256 x0 = _mm256_mul_ps(_mm256_cvtepi32_ps(acc[r][0]), s0);
+    __m256 x1 = _mm256_mul_ps(_mm256_cvtepi32_ps(acc[r][1]), s1);
+    if (width < kPanelWidth) {
+      alignas(32) float tmp[kPanelWidth];
+      _mm256_store_ps(tmp, x0);
+      _mm256_store_ps(tmp + 8, x1);
+      StoreRow(tmp, row + r, col, width, n, epilogue, c);
+    } else {
+      StoreRow8(x0, row + r, col, n, epilogue, c);
+      StoreRow8(x1, row + r, col + 8, n, epilogue, c);
+    }
+  }
+}
+
+#else  // MG_NATIVE_AVX2
+
+constexpr int kRowBlock = 4;
+
+// Portable version of the micro-kernel, written so that the compiler can
+// vectorize the inner loop.
+template <int MR>
+void MicroKernel(int k, const float* a, const float* panel, int row, int col,
+                 int width, int n, const Epilogue& epilogue, float* c) {
+  float acc[MR][kPanelWidth] = {};
+  const float* a_row = a + row * k;
+  for (int i = 0; i < k; ++i) {
+    const float* b = panel + i * kPanelWidth;
+    for (int r = 0; r < MR; ++r) {
+      float x = a_row[r * k + i];
+      for (int j = 0; j < kPanelWidth; ++j) {
+        acc[r][j] += x * b[j];
+      }
+    }
+  }
+  for (int r = 0; r < MR; ++r) {
+    StoreRow(acc[r], row + r, col, width, n, epilogue, c);
+  }
+}
+
+constexpr int kQuantizedRowBlock = 4;
+
+template <int MR>
+void QuantizedMicroKernel(int k, const uint8_t* a, const int8_t* panel,
+                          const float* scales, int row, int col, int width,
+                          int n, const Epilogue& epilogue, float* c) {
+  int32_t acc[MR][kPanelWidth] = {};
+  const uint8_t* a_row = a + row * k;
+  for (int i = 0; i < k; i += 4) {
+    const int8_t* b = panel + i * kPanelWidth;
+    for (int r = 0; r < MR; ++r) {
+      const uint8_t* x = a_row + r * k + i;
+      for (int j = 0; j < kPanelWidth; ++j) {
+        acc[r][j] += x[0] * b[j * 4] + x[1] * b[j * 4 + 1] +
+                     x[2] * b[j * 4 + 2] + x[3] * b[j * 4 + 3];
+      }
+    }
+  }
+  for (int r = 0; r < MR; ++r) {
+    float tmp[kPanelWidth];
+    for (int j = 0; j < kPanelWidth; ++j) {
+      tmp[j] = acc[r][j] * scales[col + j];
+    }
+    StoreRow(tmp, row + r, col, width, n, epilogue, c);
+  }
+}
+
+#endif  // MG_NATIVE_AVX2
+
+// Runs the micro-kernel for the `m % kRowBlock` rows left over at the end of
+// a panel.
+template <int MR>
+void RemainderKernel(int rows, int k, const float* a, const float* panel,
+                     int row, int col, int width, int n,
+                     const Epilogue& epilogue, float* c) {
+  if (rows == MR) {
+    MicroKernel<MR>(k, a, panel, row, col, width, n, epilogue, c);
+  } else {
+    RemainderKernel<MR - 1>(rows, k, a, panel, row, col, width, n, epilogue,
+                            c);
+  }
+}
+
+template <>
+void RemainderKernel<0>(int rows, int k, const float* a, const float* panel,
+                        int row, int col, int width, int n,
+                        const Epilogue& epilogue, float* c) {}
+
+template <int MR>
+void QuantizedRemainderKernel(int rows, int k, const uint8_t* a,
+                              const int8_t* panel, const float* scales,
+                              int row, int col, int width, int n,
+                              const Epilogue& epilogue, float* c) {
+  if (rows == MR) {
+    QuantizedMicroKernel<MR>(k, a, panel, scales, row, col, width, n, epilogue,
+                             c);
+  } else {
+    QuantizedRemainderKernel<MR - 1>(rows, k, a, panel, scales, row, col,
+                                     width, n, epilogue, c);
+  }
+}
+
+template <>
+void QuantizedRemainderKernel<0>(int rows, int k, const uint8_t* a,
+                                 const int8_t* panel, const float* scales,
+                                 int row, int col, int width, int n,
+                                 const Epilogue& epilogue, float* c) {}
+
+// Copies the input patch around each point on the board into a row of `dst`.
+// Rows are `row_stride` elements apart; any padding at the end of a row is
+// zeroed.
+template <typename T>
+void Im2Col(int batch_size, int board_size, int kernel_size, int channels,
+            int row_stride, const T* src, T* dst) {
+  int pad = kernel_size / 2;
+  int row_size = kernel_size * kernel_size * channels;
+  for (int b = 0; b < batch_size; ++b) {
+    for (int y = 0; y < board_size; ++y) {
+      for (int x = 0; x < board_size; ++x) {
+        T* row = dst + ((b * board_size + y) * board_size + x) * row_stride;
+        for (int dy = 0; dy < kernel_size; ++dy) {
+          int sy = y + dy - pad;
+          for (int dx = 0; dx < kernel_size; ++dx) {
+            int sx = x + dx - pad;
+            T* patch = row + (dy * kernel_size + dx) * channels;
+            if (sy < 0 || sy >= board_size || sx < 0 || sx >= board_size) {
+              memset(patch, 0, channels * sizeof(T));
+            } else {
+              const T* point =
+                  src + ((b * board_size + sy) * board_size + sx) * channels;
+              memcpy(patch, point, channels * sizeof(T));
+            }
+          }
+        }
+        memset(row + row_size, 0, (row_stride - row_size) * sizeof(T));
+      }
+    }
+  }
+}
+
+}  // namespace
+
+PackedMatrix::PackedMatrix(int rows, int cols, const float* data)
+    : rows_(rows), cols_(cols) {
+  data_.resize(num_panels() * rows * kPanelWidth, 0.0f);
+  for (int p = 0; p < num_panels(); ++p) {
+    float* panel = data_.data() + p * rows * kPanelWidth;
+    int col = p * kPanelWidth;
+    int width = std::min(kPanelWidth, cols - col);
+    for (int i = 0; i < rows; ++i) {
+      memcpy(panel + i * kPanelWidth, data + i * cols + col,
+             width * sizeof(float));
+    }
+  }
+}
+
+void PackedMatrix::ScaleColumns(const float* scale) {
+  for (int p = 0; p < num_panels(); ++p) {
+    float* panel = data_.data() + p * rows_ * kPanelWidth;
+    int col = p * kPanelWidth;
+    int width = std::min(kPanelWidth, cols_ - col);
+    for (int i = 0; i < rows_; ++i) {
+      for (int j = 0; j < width; ++j) {
+        panel[i * kPanelWidth + j] *= scale[col + j];
+      }
+    }
+  }
+}
+
+void Gemm(int m, const float* a, const PackedMatrix& b,
+          const Epilogue& epilogue, float* c) {
+  int k = b.rows();
+  int n = b.cols();
+  for (int p = 0; p < b.num_panels(); ++p) {
+    const float* panel = b.panel(p);
+    int col = p * kPanelWidth;
+    int width = std::min(kPanelWidth, n - col);
+    int row = 0;
+    for (; row + kRowBlock <= m; row += kRowBlock) {
+      MicroKernel<kRowBlock>(k, a, panel, row, col, width, n, epilogue, c);
+    }
+    RemainderKernel<kRowBlock - 1>(m - row, k, a, panel, row, col, width, n,
+                                   epilogue, c);
+  }
+}
+
+void Conv2D(int batch_size, int board_size, int kernel_size,
+            const float* input, const PackedMatrix& weights,
+            const Epilogue& epilogue, float* output,
+            std::vector<float>* scratch) {
+  int num_points = board_size * board_size;
+  if (kernel_size == 1) {
+    // A 1x1 convolution is just a matrix multiply.
+    Gemm(batch_size * num_points, input, weights, epilogue, output);
+    return;
+  }
+
+  int patch_size = weights.rows();
+  int in_channels = patch_size / (kernel_size * kernel_size);
+  int out_channels = weights.cols();
+  MG_CHECK(in_channels * kernel_size * kernel_size == patch_size);
+
+  int chunk_size = std::max(1, kMaxConvRows / num_points);
+  scratch->resize(std::min(chunk_size, batch_size) * num_points * patch_size);
+  for (int begin = 0; begin < batch_size; begin += chunk_size) {
+    int size = std::min(chunk_size, batch_size - begin);
+    int offset = begin * num_points * out_channels;
+    Im2Col(size, board_size, kernel_size, in_channels, patch_size,
+           input + begin * num_points * in_channels, scratch->data());
+    Epilogue chunk_epilogue = epilogue;
+    if (chunk_epilogue.residual != nullptr) {
+      chunk_epilogue.residual += offset;
+    }
+    Gemm(size * num_points, scratch->data(), weights, chunk_epilogue,
+         output + offset);
+  }
+}
+
+QuantizedMatrix::QuantizedMatrix(const PackedMatrix& m)
+    : rows_(m.rows()), cols_(m.cols()) {
+  scales_.resize(cols_);
+  data_.resize(num_panels() * padded_rows() * kPanelWidth, 0);
+  for (int p = 0; p < num_panels(); ++p) {
+    const float* src = m.panel(p);
+    int8_t* dst = data_.data() + p * padded_rows() * kPanelWidth;
+    int col = p * kPanelWidth;
+    int width = std::min(kPanelWidth, cols_ - col);
+    for (int j = 0; j < width; ++j) {
+      // Symmetric quantization: map the column's largest magnitude to 127.
+      float max = 0;
+      for (int i = 0; i < rows_; ++i) {
+        max = std::max(max, std::abs(src[i * kPanelWidth + j]));
+      }
+      float scale = max > 0 ? max / 127 : 1;
+      scales_[col + j] = scale;
+      for (int i = 0; i < rows_; ++i) {
+        auto x = std::lrint(src[i * kPanelWidth + j] / scale);
+        dst[((i / 4) * kPanelWidth + j) * 4 + i % 4] = static_cast<int8_t>(x);
+      }
+    }
+  }
+}
+
+void QuantizeActivations(int m, int k, const float* src, float scale,
+                         int stride, uint8_t* dst) {
+  float inv_scale = 1 / scale;
+  for (int i = 0; i < m; ++i) {
+    const float* s = src + i * k;
+    uint8_t* d = dst + i * stride;
+    for (int j = 0; j < k; ++j) {
+      float x = std::min(std::max(s[j] * inv_scale, 0.0f), 127.0f);
+      d[j] = static_cast<uint8_t>(x + 0.5f);
+    }
+    memset(d + k, 0, stride - k);
+  }
+}
+
+void QuantizedGemm(int m, const uint8_t* a, float a_scale,
+                   const QuantizedMatrix& b, const Epilogue& epilogue,
+                   float* c) {
+  int k = b.padded_rows();
+  int n = b.cols();
+
+  // Combined scale of each column, padded to a whole number of panels.
+  std::vector<float> scales(b.num_panels() * kPanelWidth, 0.0f);
+  for (int j = 0; j < n; ++j) {
+    scales[j] = a_scale * b.scale(j);
+  }
+
+  for (int p = 0; p < b.num_panels(); ++p) {
+    const int8_t* panel = b.panel(p);
+    int col = p * kPanelWidth;
+    int width = std::min(kPanelWidth, n - col);
+    int row = 0;
+    for (; row + kQuantizedRowBlock <= m; row += kQuantizedRowBlock) {
+      QuantizedMicroKernel<kQuantizedRowBlock>(k, a, panel, scales.data(), row,
+                                               col, width, n, epilogue, c);
+    }
+    QuantizedRemainderKernel<kQuantizedRowBlock - 1>(
+        m - row, k, a, panel, scales.data(), row, col, width, n, epilogue, c);
+  }
+}
+
+void QuantizedConv2D(int batch_size, int board_size, int kernel_size,
+                     const float* input, float input_scale,
+                     const QuantizedMatrix& weights, const Epilogue& epilogue,
+                     float* output, std::vector<uint8_t>* scratch) {
+  int num_points = board_size * board_size;
+  int num_rows = batch_size * num_points;
+  int patch_size = weights.padded_rows();
+  if (kernel_size == 1) {
+    int in_channels = weights.rows();
+    scratch->resize(num_rows * patch_size);
+    QuantizeActivations(num_rows, in_channels, input, input_scale, patch_size,
+                        scratch->data());
+    QuantizedGemm(num_rows, scratch->data(), input_scale, weights, epilogue,
+                  output);
+    return;
+  }
+
+  int in_channels = weights.rows() / (kernel_size * kernel_size);
+  int out_channels = weights.cols();
+  MG_CHECK(in_channels * kernel_size * kernel_size == weights.rows());
+
+  // The quantized input is followed by space for the expanded patches.
+  int chunk_size = std::max(1, kMaxConvRows / num_points);
+  size_t input_size = num_rows * in_channels;
+  scratch->resize(input_size +
+                  std::min(chunk_size, batch_size) * num_points * patch_size);
+  uint8_t* quantized = scratch->data();
+  uint8_t* patches = quantized + input_size;
+  QuantizeActivations(num_rows, in_channels, input, input_scale, in_channels,
+                      quantized);
+
+  for (int begin = 0; begin < batch_size; begin += chunk_size) {
+    int size = std::min(chunk_size, batch_size - begin);
+    int offset = begin * num_points * out_channels;
+    Im2Col(size, board_size, kernel_size, in_channels, patch_size,
+           quantized + begin * num_points * in_channels, patches);
+    Epilogue chunk_epilogue = epilogue;
+    if (chunk_epilogue.residual != nullptr) {
+      chunk_epilogue.residual += offset;
+    }
+    QuantizedGemm(size * num_points, patches, input_scale, weights,
+                  chunk_epilogue, output + offset);
+  }
+}
+
+void Softmax(int m, int n, float* data) {
+  for (int i = 0; i < m; ++i) {
+    float* row = data + i * n;
+    float max = *std::max_element(row, row + n);
+    float sum = 0;
+    for (int j = 0; j < n; ++j) {
+      row[j] = std::exp(row[j] - max);
+      sum += row[j];
+    }
+    float scale = 1 / sum;
+    for (int j = 0; j < n; ++j) {
+      row[j] *= scale;
+    }
+  }
+}
+
+void Relu(int n, float* data) {
+  for (int i = 0; i < n; ++i) {
+    data[i] = std::max(data[i], 0.0f);
+  }
+}
+
+void Tanh(int n, float* data) {
+  for (int i = 0; i < n; ++i) {
+    data[i] = std::tanh(data[i]);
+  }
+}
+
+}  // namespace native
+}  // namespace minigo
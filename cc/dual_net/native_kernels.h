@@ -0,0 +1,149 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_DUAL_NET_NATIVE_KERNELS_H_
+#define CC_DUAL_NET_NATIVE_KERNELS_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace minigo {
+namespace native {
+
+// A row-major `rows x cols` weight matrix, repacked into column panels of
+// `kPanelWidth` so that the GEMM micro-kernel can stream through it
+// contiguously. The last panel is padded with zeros.
+class PackedMatrix {
+ public:
+  static constexpr int kPanelWidth = 16;
+
+  PackedMatrix() = default;
+  PackedMatrix(int rows, int cols, const float* data);
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int num_panels() const { return (cols_ + kPanelWidth - 1) / kPanelWidth; }
+
+  // Returns the `rows x kPanelWidth` panel holding columns
+  // [i * kPanelWidth, (i + 1) * kPanelWidth).
+  const float* panel(int i) const {
+    return data_.data() + i * rows_ * kPanelWidth;
+  }
+
+  // Multiplies each column `j` of the matrix by `scale[j]`.
+  void ScaleColumns(const float* scale);
+
+ private:
+  int rows_ = 0;
+  int cols_ = 0;
+  std::vector<float> data_;
+};
+
+// A weight matrix quantized to int8 with a separate scale for each column,
+// packed for QuantizedGemm. The rows are padded with zeros to a multiple of
+// 4 so that the micro-kernel can compute 4-element dot products.
+class QuantizedMatrix {
+ public:
+  static constexpr int kPanelWidth = PackedMatrix::kPanelWidth;
+
+  QuantizedMatrix() = default;
+  explicit QuantizedMatrix(const PackedMatrix& m);
+
+  int rows() const { return rows_; }
+  int padded_rows() const { return (rows_ + 3) & ~3; }
+  int cols() const { return cols_; }
+  int num_panels() const { return (cols_ + kPanelWidth - 1) / kPanelWidth; }
+
+  // Column `j` of the matrix is `scale(j)` times the quantized values.
+  float scale(int j) const { return scales_[j]; }
+
+  // Returns the panel holding columns [i * kPanelWidth, (i + 1) *
+  // kPanelWidth). Each group of 4 rows is stored as kPanelWidth runs of 4
+  // bytes, one per column.
+  const int8_t* panel(int i) const {
+    return data_.data() + i * padded_rows() * kPanelWidth;
+  }
+
+ private:
+  int rows_ = 0;
+  int cols_ = 0;
+  std::vector<float> scales_;
+  std::vector<int8_t> data_;
+};
+
+// Epilogue applied to the result of a GEMM or convolution:
+//   c = relu?(a * b + bias + residual)
+// `bias` has `cols` elements and `residual` is a matrix the same size as the
+// output. Either may be null.
+struct Epilogue {
+  const float* bias = nullptr;
+  const float* residual = nullptr;
+  bool relu = false;
+};
+
+// Computes `c = a * b` followed by the epilogue, where `a` is a row-major
+// `m x b.rows()` matrix and `c` is a row-major `m x b.cols()` matrix.
+// Uses AVX2 & FMA if the compiler targets them, portable code otherwise.
+void Gemm(int m, const float* a, const PackedMatrix& b,
+          const Epilogue& epilogue, float* c);
+
+// A 2D convolution with "SAME" padding and a stride of 1 on NHWC tensors
+// whose height & width are both `board_size`.
+// `weights` holds the `kernel_size x kernel_size x in_channels x
+// out_channels` kernel (TensorFlow's HWIO layout), packed as a
+// `kernel_size * kernel_size * in_channels` x `out_channels` matrix.
+// The convolution is computed by expanding the input patches with im2col and
+// running a GEMM over several positions at a time. `scratch` is resized as
+// needed to hold the expanded patches.
+void Conv2D(int batch_size, int board_size, int kernel_size,
+            const float* input, const PackedMatrix& weights,
+            const Epilogue& epilogue, float* output,
+            std::vector<float>* scratch);
+
+// Quantizes the non-negative activations in the row-major `m x k` matrix
+// `src` to `round(x / scale)`, writing them to rows of `stride` bytes in `dst`
+// and zeroing the padding at the end of each row. Negative values are clamped
+// to 0 and the result is clamped to 127: keeping the activations to 7 bits
+// means that the AVX2 kernel's 16-bit intermediate sums can't saturate.
+void QuantizeActivations(int m, int k, const float* src, float scale,
+                         int stride, uint8_t* dst);
+
+// Computes `c = (a * b) * a_scale` followed by the epilogue, where `a` is a
+// row-major `m x b.padded_rows()` matrix of quantized activations and `c` is
+// a row-major float `m x b.cols()` matrix.
+// Uses VNNI or AVX2 int8 dot products if the compiler targets them, portable
+// code otherwise. The dot products are accumulated exactly in int32, so they
+// don't depend on which version runs.
+void QuantizedGemm(int m, const uint8_t* a, float a_scale,
+                   const QuantizedMatrix& b, const Epilogue& epilogue,
+                   float* c);
+
+// Quantized version of Conv2D: quantizes `input` using `input_scale`, then
+// runs the convolution with QuantizedGemm.
+void QuantizedConv2D(int batch_size, int board_size, int kernel_size,
+                     const float* input, float input_scale,
+                     const QuantizedMatrix& weights, const Epilogue& epilogue,
+                     float* output, std::vector<uint8_t>* scratch);
+
+// In-place softmax over each row of a row-major `m x n` matrix.
+void Softmax(int m, int n, float* data);
+
+// In-place element-wise activations.
+void Relu(int n, float* data);
+void Tanh(int n, float* data);
+
+}  // namespace native
+}  // namespace minigo
+
+#endif  //  CC_DUAL_NET_NATIVE_KERNELS_H_
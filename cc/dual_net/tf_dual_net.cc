@@ -15,6 +15,7 @@
 #include "cc/dual_net/tf_dual_net.h"
 
 #include <algorithm>
+#include <memory>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -23,9 +24,11 @@
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/notification.h"
+#include "cc/async/thread_budget.h"
 #include "cc/constants.h"
 #include "cc/file/path.h"
 #include "cc/logging.h"
+#include "cc/model/model_thread.h"
 #include "tensorflow/core/common_runtime/device.h"
 #include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/framework/tensor.h"
@@ -44,37 +47,48 @@ void PlaceOnDevice(tensorflow::GraphDef* graph_def, const std::string& device) {
   }
 }
 
-class TfDualNet : public Model {
+}  // namespace
+
+// A TensorFlow session running a model's graph, shared by all instances of
+// the model. The graph's constant tensors (i.e. the model's weights) are
+// owned by the session's kernels, so sharing the session means they're only
+// held in memory once. Sessions are thread safe, and the same callable can be
+// run concurrently from multiple threads.
+class TfSession {
  public:
-  TfDualNet(const std::string& graph_path,
-            const FeatureDescriptor& feature_desc,
+  TfSession(const std::string& graph_path,
             const tensorflow::GraphDef& graph_def);
-  ~TfDualNet() override;
+  ~TfSession();
 
-  void RunMany(const std::vector<const ModelInput*>& inputs,
-               std::vector<ModelOutput*>* outputs,
-               std::string* model_name) override;
+  void Run(const std::vector<tensorflow::Tensor>& inputs,
+           std::vector<tensorflow::Tensor>* outputs) {
+    TF_CHECK_OK(session_->RunCallable(handle_, inputs, outputs, nullptr));
+  }
 
- private:
-  void Reserve(int capacity);
+  tensorflow::DataType input_type() const { return input_type_; }
 
+ private:
   std::unique_ptr<tensorflow::Session> session_;
   tensorflow::Session::CallableHandle handle_;
-  std::vector<tensorflow::Tensor> inputs_;
-  std::vector<tensorflow::Tensor> outputs_;
-  const std::string graph_path_;
-  int batch_capacity_ = 0;
   tensorflow::DataType input_type_ = tensorflow::DT_INVALID;
 };
 
-TfDualNet::TfDualNet(const std::string& graph_path,
-                     const FeatureDescriptor& feature_desc,
-                     const tensorflow::GraphDef& graph_def)
-    : Model(std::string(file::Stem(file::Basename(graph_path))), feature_desc),
-      graph_path_(graph_path) {
+TfSession::TfSession(const std::string& graph_path,
+                     const tensorflow::GraphDef& graph_def) {
   tensorflow::SessionOptions session_options;
   session_options.config.mutable_gpu_options()->set_allow_growth(true);
 
+  // The session is shared by all instances of the model, so give each
+  // instance an inter-op thread and split the inference CPUs between their
+  // ops.
+  if (HasThreadBudget()) {
+    auto budget = GetThreadBudget(ThreadRole::kInference);
+    session_options.config.set_intra_op_parallelism_threads(
+        budget.threads_per_instance());
+    session_options.config.set_inter_op_parallelism_threads(
+        budget.num_instances);
+  }
+
   // session_options.config.set_inter_op_parallelism_threads(1);
   // auto* thread_pool_options =
   //     session_options.config.add_session_inter_op_thread_pool();
@@ -108,47 +122,114 @@ TfDualNet::TfDualNet(const std::string& graph_path,
       google::protobuf::GetEnumDescriptor<tensorflow::DataType>();
   const auto* value = desc->FindValueByNumber(input_type_);
   MG_CHECK(value != nullptr);
-  MG_LOG(INFO) << "Model " << graph_path_ << " has input type "
+  MG_LOG(INFO) << "Model " << graph_path << " has input type "
                << value->name();
   MG_CHECK(input_type_ == tensorflow::DT_FLOAT ||
            input_type_ == tensorflow::DT_BOOL)
       << input_type_;
 }
 
+TfSession::~TfSession() {
+  TF_CHECK_OK(session_->ReleaseCallable(handle_));
+  TF_CHECK_OK(session_->Close());
+}
+
+namespace {
+
+class TfDualNet : public Model {
+ public:
+  TfDualNet(const std::string& graph_path,
+            const FeatureDescriptor& feature_desc,
+            std::shared_ptr<TfSession> session);
+  ~TfDualNet() override;
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override;
+
+  // Runs inference on a dedicated thread, which is started by the first call.
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override;
+
+  ModelInputBuffer* LendInputBuffer(int capacity) override;
+  void ReturnInputBuffer() override;
+
+ private:
+  void Reserve(int capacity);
+
+  // Returns a ModelInputBuffer that writes to the input tensor.
+  ModelInputBuffer GetInputBuffer();
+
+  // Shared by all instances of the model.
+  const std::shared_ptr<TfSession> session_;
+  std::vector<tensorflow::Tensor> inputs_;
+  std::vector<tensorflow::Tensor> outputs_;
+  const std::string graph_path_;
+  int batch_capacity_ = 0;
+  const tensorflow::DataType input_type_;
+
+  // The buffer returned by LendInputBuffer. `input_buffer_lent_` is true
+  // between the calls to LendInputBuffer and RunMany (or ReturnInputBuffer),
+  // during which time the input tensor already holds the features.
+  ModelInputBuffer input_buffer_;
+  bool input_buffer_lent_ = false;
+
+  // Created by the first call to RunManyAsync.
+  std::unique_ptr<ModelThread> model_thread_;
+};
+
+TfDualNet::TfDualNet(const std::string& graph_path,
+                     const FeatureDescriptor& feature_desc,
+                     std::shared_ptr<TfSession> session)
+    : Model(std::string(file::Stem(file::Basename(graph_path))), feature_desc),
+      session_(std::move(session)),
+      graph_path_(graph_path),
+      input_type_(session_->input_type()) {}
+
 TfDualNet::~TfDualNet() {
-  if (session_ != nullptr) {
-    TF_CHECK_OK(session_->ReleaseCallable(handle_));
-    TF_CHECK_OK(session_->Close());
+  // Finish any pending asynchronous inferences before the session can be
+  // closed.
+  model_thread_.reset();
+}
+
+void TfDualNet::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                             std::vector<ModelOutput*>* outputs,
+                             std::string* model_name,
+                             std::function<void()> done) {
+  if (model_thread_ == nullptr) {
+    model_thread_ = absl::make_unique<ModelThread>(this);
   }
+  model_thread_->RunManyAsync(inputs, outputs, model_name, std::move(done));
 }
 
 void TfDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
                         std::vector<ModelOutput*>* outputs,
                         std::string* model_name) {
-  Reserve(inputs.size());
+  // If the input buffer was lent out, the caller has already written the
+  // features to the input tensor.
+  bool features_encoded = input_buffer_lent_;
+  input_buffer_lent_ = false;
+  if (features_encoded) {
+    MG_CHECK(static_cast<int>(inputs.size()) <= batch_capacity_);
+  } else {
+    Reserve(inputs.size());
+  }
 
   WTF_SCOPE("TfDualNet::Run: inputs, capacity", size_t, int)
   (inputs.size(), batch_capacity_);
   MG_CHECK(inputs.size() == outputs->size());
 
-  auto shape = feature_descriptor().GetInputShape(batch_capacity_);
-  if (input_type_ == tensorflow::DT_FLOAT) {
-    WTF_SCOPE("Features::SetFloat: inputs", int)(inputs.size());
-    Tensor<float> features(shape, inputs_[0].flat<float>().data());
-    feature_descriptor().set_floats(inputs, &features);
-  } else {
-    WTF_SCOPE("Features::SetBool: inputs", size_t)(inputs.size());
-    static_assert(sizeof(bool) == sizeof(uint8_t), "bool must be 1 byte");
-    Tensor<uint8_t> features(
-        shape, reinterpret_cast<uint8_t*>(inputs_[0].flat<bool>().data()));
-    feature_descriptor().set_bytes(inputs, &features);
+  if (!features_encoded) {
+    WTF_SCOPE("Features::SetFeatures: inputs", size_t)(inputs.size());
+    GetInputBuffer().SetFeatures(0, inputs);
   }
 
   // Run the model.
   {
     WTF_SCOPE("Session::Run: capacity", int)(batch_capacity_);
     outputs_.clear();
-    TF_CHECK_OK(session_->RunCallable(handle_, inputs_, &outputs_, nullptr));
+    session_->Run(inputs_, &outputs_);
   }
 
   Tensor<float> policy({batch_capacity_, kNumMoves},
@@ -164,6 +245,33 @@ void TfDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
   }
 }
 
+ModelInputBuffer* TfDualNet::LendInputBuffer(int capacity) {
+  MG_CHECK(!input_buffer_lent_);
+  Reserve(capacity);
+  input_buffer_ = GetInputBuffer();
+  input_buffer_lent_ = true;
+  return &input_buffer_;
+}
+
+void TfDualNet::ReturnInputBuffer() {
+  MG_CHECK(input_buffer_lent_);
+  input_buffer_lent_ = false;
+}
+
+ModelInputBuffer TfDualNet::GetInputBuffer() {
+  auto shape = feature_descriptor().GetInputShape(batch_capacity_);
+  if (input_type_ == tensorflow::DT_FLOAT) {
+    return ModelInputBuffer(
+        feature_descriptor(),
+        Tensor<float>(shape, inputs_[0].flat<float>().data()));
+  }
+  static_assert(sizeof(bool) == sizeof(uint8_t), "bool must be 1 byte");
+  return ModelInputBuffer(
+      feature_descriptor(),
+      Tensor<uint8_t>(
+          shape, reinterpret_cast<uint8_t*>(inputs_[0].flat<bool>().data())));
+}
+
 void TfDualNet::Reserve(int capacity) {
   MG_CHECK(capacity > 0);
   if (capacity <= batch_capacity_ && capacity > 3 * batch_capacity_ / 4) {
@@ -195,30 +303,36 @@ TfDualNetFactory::TfDualNetFactory(absl::string_view device) {
 std::unique_ptr<Model> TfDualNetFactory::NewModel(const ModelDefinition& def) {
   MG_CHECK(def.metadata.Get<std::string>("engine") == "tf");
 
-  tensorflow::protobuf::io::CodedInputStream coded_stream(
-      reinterpret_cast<const uint8_t*>(def.model_bytes.data()),
-      def.model_bytes.size());
-  coded_stream.SetTotalBytesLimit(1024 * 1024 * 1024);
-
-  tensorflow::GraphDef graph_def;
-  MG_CHECK(graph_def.ParseFromCodedStream(&coded_stream) &&
-           coded_stream.ConsumedEntireMessage());
-
-  // Check that we're not loading a TPU model.
-  for (const auto& node : graph_def.node()) {
-    MG_CHECK(!absl::StartsWithIgnoreCase(node.name(), "tpu"))
-        << "found node named \"" << node.name()
-        << "\", this model looks like it was compiled for TPU";
-  }
-
   auto feature_desc =
       FeatureDescriptor::Create(def.metadata.Get<std::string>("input_features"),
                                 def.metadata.Get<std::string>("input_layout"));
 
-  if (place_on_gpu_) {
-    PlaceOnDevice(&graph_def, "/gpu:0");
-  }
-  return absl::make_unique<TfDualNet>(def.path, feature_desc, graph_def);
+  // Only parse the graph & create a session for the first instance of the
+  // model: the rest share the session.
+  auto session = sessions_.GetOrCreate(def.model_bytes, "", [&]() {
+    tensorflow::protobuf::io::CodedInputStream coded_stream(
+        reinterpret_cast<const uint8_t*>(def.model_bytes.data()),
+        def.model_bytes.size());
+    coded_stream.SetTotalBytesLimit(1024 * 1024 * 1024);
+
+    tensorflow::GraphDef graph_def;
+    MG_CHECK(graph_def.ParseFromCodedStream(&coded_stream) &&
+             coded_stream.ConsumedEntireMessage());
+
+    // Check that we're not loading a TPU model.
+    for (const auto& node : graph_def.node()) {
+      MG_CHECK(!absl::StartsWithIgnoreCase(node.name(), "tpu"))
+          << "found node named \"" << node.name()
+          << "\", this model looks like it was compiled for TPU";
+    }
+
+    if (place_on_gpu_) {
+      PlaceOnDevice(&graph_def, "/gpu:0");
+    }
+    return std::make_shared<TfSession>(def.path, graph_def);
+  });
+  return absl::make_unique<TfDualNet>(def.path, feature_desc,
+                                      std::move(session));
 }
 
 }  // namespace minigo
@@ -23,6 +23,10 @@
 
 namespace minigo {
 
+class TfSession;
+
+// All instances of a model created by the factory share a single TensorFlow
+// session, and with it the model's weights.
 class TfDualNetFactory : public ModelFactory {
  public:
   explicit TfDualNetFactory(absl::string_view device);
@@ -31,6 +35,7 @@ class TfDualNetFactory : public ModelFactory {
 
  private:
   bool place_on_gpu_ = true;
+  SharedModelCache<TfSession> sessions_;
 };
 
 }  // namespace minigo
@@ -83,6 +83,28 @@ DEFINE_int32(num_target_readouts, 100,
              "model.)");
 
 DEFINE_int32(parallel_games, 32, "Number of games to play in parallel.");
+DEFINE_string(batching_policy, "client_count",
+              "Policy used to decide when to run a batch of inferences. One "
+              "of \"client_count\", which waits for enough games to submit "
+              "inference requests, or \"deadline\", which runs a batch once "
+              "it has max_batch_size inferences or its oldest request has "
+              "waited for max_queue_delay_ms.");
+DEFINE_int32(max_batch_size, 256,
+             "Maximum number of inferences in a batch for the deadline "
+             "batching policy.");
+DEFINE_double(max_queue_delay_ms, 2,
+              "Maximum time in milliseconds an inference request waits before "
+              "its batch is run for the deadline batching policy.");
+DEFINE_bool(adaptive_queue_delay, false,
+            "If true, the deadline batching policy tunes the queue delay "
+            "based on how long the model takes to run, never exceeding "
+            "max_queue_delay_ms.");
+DEFINE_int32(min_split_batch_size, 0,
+             "If non-zero, a batch with at least twice this many inferences "
+             "is split across the model buffers that are free when it's run, "
+             "each running at least this many inferences. This helps when a "
+             "single model instance can't use all of the available compute, "
+             "for example on CPUs or hosts with multiple GPUs.");
 
 // Output flags.
 DEFINE_string(output_bigtable, "",
@@ -153,15 +175,29 @@ class Evaluator {
 
  public:
   Evaluator() {
+    BatchingOptions batching_options;
+    if (FLAGS_batching_policy == "deadline") {
+      batching_options.policy = BatchingOptions::Policy::kDeadline;
+    } else {
+      MG_CHECK(FLAGS_batching_policy == "client_count")
+          << "Unrecognized batching_policy \"" << FLAGS_batching_policy
+          << "\"";
+    }
+    batching_options.max_batch_size = FLAGS_max_batch_size;
+    batching_options.max_queue_delay =
+        absl::Milliseconds(FLAGS_max_queue_delay_ms);
+    batching_options.adaptive_queue_delay = FLAGS_adaptive_queue_delay;
+    batching_options.min_split_batch_size = FLAGS_min_split_batch_size;
+
     // Create a batcher for the eval model.
-    batchers_.push_back(
-        absl::make_unique<BatchingModelFactory>(FLAGS_eval_device, 2));
+    batchers_.push_back(absl::make_unique<BatchingModelFactory>(
+        FLAGS_eval_device, 2, batching_options));
 
     // If the target model requires a different device, create one & a second
     // batcher too.
     if (FLAGS_target_device != FLAGS_eval_device) {
-      batchers_.push_back(
-          absl::make_unique<BatchingModelFactory>(FLAGS_target_device, 2));
+      batchers_.push_back(absl::make_unique<BatchingModelFactory>(
+          FLAGS_target_device, 2, batching_options));
     }
   }
 
@@ -201,6 +237,12 @@ class Evaluator {
     MG_LOG(INFO) << "Evaluated " << num_games << " games, total time "
                  << (absl::Now() - start_time);
 
+    for (auto& batcher : batchers_) {
+      for (const auto& kv : batcher->FlushStats()) {
+        MG_LOG(INFO) << "Batching stats for " << kv.first << ": " << kv.second;
+      }
+    }
+
     MG_LOG(INFO) << FormatWinStatsTable(
         {{eval_model.name(), eval_model.GetWinStats()},
          {target_model.name(), target_model.GetWinStats()}});
@@ -0,0 +1,126 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "cc/example_serializer.h"
+
+#include "cc/logging.h"
+
+namespace minigo {
+
+namespace {
+
+// Tags of the fields written by the serializer: field numbers shifted left by
+// three, with wire type 2 (length delimited).
+// Example.features, Features.feature, the map entry key, BytesList.value,
+// FloatList.value & Int64List.value are all field 1.
+constexpr uint8_t kField1Tag = (1 << 3) | 2;
+// The map entry value.
+constexpr uint8_t kField2Tag = (2 << 3) | 2;
+// Feature.bytes_list, Feature.float_list & Feature.int64_list.
+constexpr uint8_t kBytesListTag = (1 << 3) | 2;
+constexpr uint8_t kFloatListTag = (2 << 3) | 2;
+constexpr uint8_t kInt64ListTag = (3 << 3) | 2;
+
+size_t VarintSize(uint64_t x) {
+  size_t size = 1;
+  while (x >= 0x80) {
+    x >>= 7;
+    size += 1;
+  }
+  return size;
+}
+
+// Returns the size of a length delimited field holding `size` bytes.
+size_t FieldSize(size_t size) { return 1 + VarintSize(size) + size; }
+
+void AppendVarint(uint64_t x, std::string* dst) {
+  char buf[10];
+  int n = 0;
+  while (x >= 0x80) {
+    buf[n++] = static_cast<char>(x | 0x80);
+    x >>= 7;
+  }
+  buf[n++] = static_cast<char>(x);
+  dst->append(buf, n);
+}
+
+void AppendFieldHeader(uint8_t tag, size_t size, std::string* dst) {
+  dst->push_back(static_cast<char>(tag));
+  AppendVarint(size, dst);
+}
+
+}  // namespace
+
+void ExampleSerializer::AddBytes(absl::string_view key,
+                                 absl::string_view value) {
+  AddEntry(key, kBytesListTag, FieldSize(value.size()));
+  AppendFieldHeader(kField1Tag, value.size(), &features_);
+  features_.append(value.data(), value.size());
+}
+
+void ExampleSerializer::AddFloats(absl::string_view key,
+                                  absl::Span<const float> values) {
+  // Packed repeated fields are omitted entirely when empty.
+  size_t data_size = sizeof(float) * values.size();
+  AddEntry(key, kFloatListTag, values.empty() ? 0 : FieldSize(data_size));
+  if (!values.empty()) {
+    // Floats are written as little endian fixed32s, which is the in-memory
+    // representation on the platforms we support.
+    AppendFieldHeader(kField1Tag, data_size, &features_);
+    features_.append(reinterpret_cast<const char*>(values.data()), data_size);
+  }
+}
+
+void ExampleSerializer::AddInt64s(absl::string_view key,
+                                  absl::Span<const int64_t> values) {
+  size_t data_size = 0;
+  for (auto x : values) {
+    data_size += VarintSize(static_cast<uint64_t>(x));
+  }
+  AddEntry(key, kInt64ListTag, values.empty() ? 0 : FieldSize(data_size));
+  if (!values.empty()) {
+    AppendFieldHeader(kField1Tag, data_size, &features_);
+    for (auto x : values) {
+      AppendVarint(static_cast<uint64_t>(x), &features_);
+    }
+  }
+}
+
+void ExampleSerializer::Finish(std::string* output) {
+  output->clear();
+  output->reserve(FieldSize(features_.size()));
+  AppendFieldHeader(kField1Tag, features_.size(), output);
+  output->append(features_);
+  features_.clear();
+  last_key_.clear();
+}
+
+void ExampleSerializer::AddEntry(absl::string_view key, uint8_t kind_tag,
+                                 size_t list_size) {
+  MG_CHECK(features_.empty() || key > last_key_)
+      << "Features must be added in increasing key order: \"" << key
+      << "\" follows \"" << last_key_ << "\"";
+  last_key_.assign(key.data(), key.size());
+
+  // map<string, Feature> entries are messages holding the key as field 1 and
+  // the value as field 2. Feature is a oneof of the three list kinds.
+  size_t feature_size = FieldSize(list_size);
+  size_t entry_size = FieldSize(key.size()) + FieldSize(feature_size);
+  AppendFieldHeader(kField1Tag, entry_size, &features_);
+  AppendFieldHeader(kField1Tag, key.size(), &features_);
+  features_.append(key.data(), key.size());
+  AppendFieldHeader(kField2Tag, feature_size, &features_);
+  AppendFieldHeader(kind_tag, list_size, &features_);
+}
+
+}  // namespace minigo
@@ -0,0 +1,62 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef CC_EXAMPLE_SERIALIZER_H_
+#define CC_EXAMPLE_SERIALIZER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace minigo {
+
+// Serializes tensorflow.Example protos directly to the protobuf wire format,
+// without building the intermediate Example, Features & Feature messages.
+//
+// Features must be added in increasing order of their keys. The output is then
+// byte identical to deterministic serialization of the equivalent Example,
+// which writes its feature map ordered by key.
+//
+// The serializer reuses its buffer between examples, so it's cheapest to keep
+// one around for serializing many examples.
+class ExampleSerializer {
+ public:
+  // Adds a feature holding a BytesList with a single value.
+  void AddBytes(absl::string_view key, absl::string_view value);
+
+  // Adds a feature holding a FloatList.
+  void AddFloats(absl::string_view key, absl::Span<const float> values);
+
+  // Adds a feature holding an Int64List.
+  void AddInt64s(absl::string_view key, absl::Span<const int64_t> values);
+
+  // Replaces the contents of `output` with the serialized Example holding the
+  // features added since the last call to Finish.
+  void Finish(std::string* output);
+
+ private:
+  // Writes the key & tags of a feature map entry whose value holds a list
+  // of the given kind, serialized to `list_size` bytes.
+  void AddEntry(absl::string_view key, uint8_t kind_tag, size_t list_size);
+
+  // The serialized entries of the Features message's feature map.
+  std::string features_;
+
+  std::string last_key_;
+};
+
+}  // namespace minigo
+
+#endif  // CC_EXAMPLE_SERIALIZER_H_
@@ -0,0 +1,124 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// Compares the throughput of serializing selfplay training examples by
+// building tensorflow::Example protos, as tf_utils used to, against
+// ExampleSerializer.
+
+#include <string>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/constants.h"
+#include "cc/example_serializer.h"
+#include "cc/init.h"
+#include "cc/logging.h"
+#include "gflags/gflags.h"
+#include "tensorflow/core/example/example.pb.h"
+
+DEFINE_int32(num_examples, 20000, "Number of examples to serialize.");
+DEFINE_int32(num_planes, 17, "Number of input feature planes.");
+
+namespace minigo {
+namespace {
+
+struct Inputs {
+  std::string x;
+  std::vector<float> pi;
+  float outcome;
+  float q;
+  int64_t n;
+  int64_t c;
+};
+
+void SerializeProto(const Inputs& inputs, std::string* output) {
+  tensorflow::Example example;
+  auto& features = *example.mutable_features()->mutable_feature();
+  features["x"].mutable_bytes_list()->add_value(inputs.x);
+  features["pi"].mutable_bytes_list()->add_value(
+      reinterpret_cast<const void*>(inputs.pi.data()),
+      sizeof(float) * inputs.pi.size());
+  features["outcome"].mutable_float_list()->add_value(inputs.outcome);
+  features["q"].mutable_float_list()->add_value(inputs.q);
+  features["n"].mutable_int64_list()->add_value(inputs.n);
+  features["c"].mutable_int64_list()->add_value(inputs.c);
+  example.SerializeToString(output);
+}
+
+void SerializeDirect(const Inputs& inputs, ExampleSerializer* serializer,
+                     std::string* output) {
+  serializer->AddInt64s("c", {inputs.c});
+  serializer->AddInt64s("n", {inputs.n});
+  serializer->AddFloats("outcome", {inputs.outcome});
+  serializer->AddBytes(
+      "pi", {reinterpret_cast<const char*>(inputs.pi.data()),
+             sizeof(float) * inputs.pi.size()});
+  serializer->AddFloats("q", {inputs.q});
+  serializer->AddBytes("x", inputs.x);
+  serializer->Finish(output);
+}
+
+template <typename Fn>
+void Benchmark(const char* name, const Fn& fn) {
+  std::string output;
+  size_t total_bytes = 0;
+  auto start = absl::Now();
+  for (int i = 0; i < FLAGS_num_examples; ++i) {
+    fn(&output);
+    total_bytes += output.size();
+  }
+  auto elapsed = absl::ToDoubleSeconds(absl::Now() - start);
+  MG_LOG(INFO) << name << ": " << FLAGS_num_examples / elapsed
+               << " records/sec, " << total_bytes / elapsed / (1 << 20)
+               << " MB/sec";
+}
+
+void RunBenchmark() {
+  Inputs inputs;
+  inputs.x.resize(kNumPoints * FLAGS_num_planes);
+  for (size_t i = 0; i < inputs.x.size(); ++i) {
+    inputs.x[i] = i % 3 == 0;
+  }
+  inputs.pi.resize(kNumMoves);
+  inputs.pi[0] = 0.5;
+  inputs.pi[kNumMoves - 1] = 0.5;
+  inputs.outcome = 1;
+  inputs.q = 0.25;
+  inputs.n = 800;
+  inputs.c = 42;
+
+  std::string expected;
+  std::string actual;
+  ExampleSerializer serializer;
+  SerializeProto(inputs, &expected);
+  SerializeDirect(inputs, &serializer, &actual);
+  MG_CHECK(expected.size() == actual.size());
+
+  for (int i = 0; i < 2; ++i) {
+    Benchmark("tensorflow::Example",
+              [&](std::string* output) { SerializeProto(inputs, output); });
+    Benchmark("ExampleSerializer", [&](std::string* output) {
+      SerializeDirect(inputs, &serializer, output);
+    });
+  }
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char* argv[]) {
+  minigo::Init(&argc, &argv);
+  minigo::RunBenchmark();
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "cc/example_serializer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cc/logging.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "tensorflow/core/example/example.pb.h"
+
+namespace minigo {
+namespace {
+
+// Serializes `example` with its feature map ordered by key.
+std::string SerializeDeterministic(const tensorflow::Example& example) {
+  std::string result;
+  {
+    google::protobuf::io::StringOutputStream stream(&result);
+    google::protobuf::io::CodedOutputStream coded(&stream);
+    coded.SetSerializationDeterministic(true);
+    MG_CHECK(example.SerializeToCodedStream(&coded));
+  }
+  return result;
+}
+
+// Adds the same features to both an Example proto and an ExampleSerializer.
+class ExampleBuilder {
+ public:
+  void AddBytes(const std::string& key, const std::string& value) {
+    (*feature())[key].mutable_bytes_list()->add_value(value);
+    serializer_.AddBytes(key, value);
+  }
+
+  void AddFloats(const std::string& key, const std::vector<float>& values) {
+    auto* list = (*feature())[key].mutable_float_list();
+    for (auto x : values) {
+      list->add_value(x);
+    }
+    serializer_.AddFloats(key, values);
+  }
+
+  void AddInt64s(const std::string& key, const std::vector<int64_t>& values) {
+    auto* list = (*feature())[key].mutable_int64_list();
+    for (auto x : values) {
+      list->add_value(x);
+    }
+    serializer_.AddInt64s(key, values);
+  }
+
+  // Checks that the serializer's output matches the proto's, then starts a
+  // new example.
+  void ExpectEqual() {
+    std::string actual;
+    serializer_.Finish(&actual);
+    EXPECT_EQ(SerializeDeterministic(example_), actual);
+
+    tensorflow::Example parsed;
+    ASSERT_TRUE(parsed.ParseFromString(actual));
+    EXPECT_EQ(example_.DebugString(), parsed.DebugString());
+    example_.Clear();
+  }
+
+ private:
+  google::protobuf::Map<std::string, tensorflow::Feature>* feature() {
+    return example_.mutable_features()->mutable_feature();
+  }
+
+  tensorflow::Example example_;
+  ExampleSerializer serializer_;
+};
+
+std::string MakeBytes(size_t size) {
+  std::string result(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    result[i] = static_cast<char>(i * 7 + 3);
+  }
+  return result;
+}
+
+// The features written by selfplay, using both the dense & sparse pi and the
+// unpacked & packed input features.
+TEST(ExampleSerializerTest, SelfplayExamples) {
+  ExampleBuilder builder;
+  std::vector<float> pi(362);
+  for (size_t i = 0; i < pi.size(); ++i) {
+    pi[i] = i % 5 == 0 ? 0.001f * i : 0.0f;
+  }
+
+  builder.AddInt64s("c", {47});
+  builder.AddInt64s("n", {1600});
+  builder.AddFloats("outcome", {-1});
+  builder.AddBytes("pi", std::string(reinterpret_cast<const char*>(pi.data()),
+                                     sizeof(float) * pi.size()));
+  builder.AddFloats("q", {0.375f});
+  builder.AddBytes("x", MakeBytes(19 * 19 * 17));
+  builder.ExpectEqual();
+
+  builder.AddInt64s("c", {361});
+  builder.AddInt64s("n", {0});
+  builder.AddFloats("outcome", {1});
+  builder.AddInt64s("pi_idx", {3, 80, 200, 361});
+  builder.AddFloats("pi_val", {0.25f, 0.125f, 0.5f, 0.125f});
+  builder.AddFloats("q", {-0.5f});
+  builder.AddBytes("x_bits", MakeBytes((19 * 19 * 17 + 7) / 8));
+  builder.ExpectEqual();
+}
+
+TEST(ExampleSerializerTest, EdgeCases) {
+  ExampleBuilder builder;
+
+  // A single feature.
+  builder.AddBytes("a", "");
+  builder.ExpectEqual();
+
+  builder.AddBytes("a", MakeBytes(127));
+  builder.AddBytes("b", MakeBytes(128));
+  builder.AddBytes("c", MakeBytes(20000));
+  builder.AddFloats("d", {});
+  builder.AddInt64s("e", {});
+  builder.AddInt64s("f", {0, 1, 127, 128, 16383, 16384, -1, INT64_MIN,
+                          INT64_MAX});
+  builder.AddFloats("g", {0.0f, -0.0f, 1e30f, -1e-30f});
+  builder.AddBytes(std::string(200, 'k'), "long key");
+  builder.ExpectEqual();
+}
+
+}  // namespace
+}  // namespace minigo
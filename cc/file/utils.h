@@ -15,7 +15,9 @@
 #ifndef CC_FILE_UTILS_H_
 #define CC_FILE_UTILS_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -33,11 +35,68 @@ MG_WARN_UNUSED_RESULT bool RecursivelyCreateDir(std::string path);
 MG_WARN_UNUSED_RESULT bool WriteFile(std::string path,
                                      absl::string_view contents);
 
+// A file being written to by appending to it, opened by OpenWritableFile.
+class WritableFile {
+ public:
+  virtual ~WritableFile() = default;
+
+  MG_WARN_UNUSED_RESULT virtual bool Append(absl::string_view data) = 0;
+
+  // Flushes any buffered data and closes the file. The file must be closed
+  // before it's destroyed.
+  MG_WARN_UNUSED_RESULT virtual bool Close() = 0;
+};
+
+// Create a file for writing, truncating it if it already exists.
+// When compiled with --define=tf=1, uses TensorFlow's file APIs to enable
+// access to GCS. Only allows local file access otherwise.
+MG_WARN_UNUSED_RESULT bool OpenWritableFile(
+    std::string path, std::unique_ptr<WritableFile>* file);
+
+// Rename a file, replacing `dst` if it already exists. Readers of `dst` see
+// either the old or new contents for local files, but GCS doesn't support
+// atomic renames.
+// When compiled with --define=tf=1, uses TensorFlow's file APIs to enable
+// access to GCS. Only allows local file access otherwise.
+MG_WARN_UNUSED_RESULT bool RenameFile(std::string src, std::string dst);
+
 // Read a file in one shot.
 // When compiled with --define=tf=1, uses TensorFlow's file APIs to enable
 // access to GCS. Only allows local file access otherwise.
 MG_WARN_UNUSED_RESULT bool ReadFile(std::string path, std::string* contents);
 
+// The read-only contents of a file mapped into memory by MapFile.
+class MappedFile {
+ public:
+  // Expected access pattern for a range of the contents, passed to Advise.
+  enum class Advice {
+    kSequential,
+    kRandom,
+    kWillNeed,
+  };
+
+  virtual ~MappedFile() = default;
+
+  absl::string_view contents() const { return contents_; }
+
+  // Hints how the `size` bytes of the contents starting at `offset` will be
+  // accessed, e.g. so that the operating system can read them ahead. Has no
+  // effect on Windows, or if the file was read into memory instead of mapped.
+  virtual void Advise(size_t offset, size_t size, Advice advice) const {}
+
+ protected:
+  absl::string_view contents_;
+};
+
+// Map a file into memory read-only: its pages are only read from disk when
+// they're first accessed. The file must not be modified while mapped.
+// Files that can't be mapped (e.g. those on GCS) are read into memory in one
+// shot instead.
+// When compiled with --define=tf=1, uses TensorFlow's file APIs to enable
+// access to GCS. Only allows local file access otherwise.
+MG_WARN_UNUSED_RESULT bool MapFile(std::string path,
+                                   std::unique_ptr<MappedFile>* file);
+
 // Get the modification time for a file.
 // When compiled with --define=tf=1, uses TensorFlow's file APIs to enable
 // access to GCS. Only allows local file access otherwise.
@@ -13,12 +13,19 @@
 // limitations under the License.
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <string>
+#include <utility>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "cc/file/path.h"
@@ -65,6 +72,89 @@ bool RecursivelyCreateDirNormalized(const std::string& path) {
   // Creates the directory knowing the parent already exists.
   return MaybeCreateDir(path);
 }
+
+class PosixMappedFile : public MappedFile {
+ public:
+  PosixMappedFile(void* addr, size_t size) : addr_(addr), size_(size) {
+    contents_ = absl::string_view(static_cast<const char*>(addr), size);
+  }
+
+  ~PosixMappedFile() override {
+    if (size_ != 0) {
+      munmap(addr_, size_);
+    }
+  }
+
+  void Advise(size_t offset, size_t size, Advice advice) const override {
+    if (size_ == 0 || offset >= size_) {
+      return;
+    }
+
+    // madvise requires a page aligned address.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = offset / page_size * page_size;
+    size_t end = std::min(offset + size, size_);
+
+    int posix_advice = MADV_NORMAL;
+    switch (advice) {
+      case Advice::kSequential:
+        posix_advice = MADV_SEQUENTIAL;
+        break;
+      case Advice::kRandom:
+        posix_advice = MADV_RANDOM;
+        break;
+      case Advice::kWillNeed:
+        posix_advice = MADV_WILLNEED;
+        break;
+    }
+    if (madvise(static_cast<char*>(addr_) + begin, end - begin,
+                posix_advice) != 0) {
+      MG_LOG(WARNING) << "madvise failed: " << strerror(errno);
+    }
+  }
+
+ private:
+  void* addr_;
+  size_t size_;
+};
+
+// A file written through stdio.
+class StdioWritableFile : public WritableFile {
+ public:
+  StdioWritableFile(std::string path, FILE* f)
+      : path_(std::move(path)), f_(f) {}
+
+  ~StdioWritableFile() override {
+    if (f_ != nullptr) {
+      fclose(f_);
+    }
+  }
+
+  bool Append(absl::string_view data) override {
+    if (data.empty()) {
+      return true;
+    }
+    if (fwrite(data.data(), data.size(), 1, f_) != 1) {
+      MG_LOG(ERROR) << "error writing " << path_;
+      return false;
+    }
+    return true;
+  }
+
+  bool Close() override {
+    bool ok = fclose(f_) == 0;
+    f_ = nullptr;
+    if (!ok) {
+      MG_LOG(ERROR) << "error closing " << path_;
+    }
+    return ok;
+  }
+
+ private:
+  const std::string path_;
+  FILE* f_;
+};
+
 }  // namespace
 
 bool RecursivelyCreateDir(std::string path) {
@@ -91,6 +181,29 @@ bool WriteFile(std::string path, absl::string_view contents) {
   return ok;
 }
 
+bool OpenWritableFile(std::string path, std::unique_ptr<WritableFile>* file) {
+  path = NormalizeSlashes(path);
+
+  FILE* f = fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    MG_LOG(ERROR) << "error opening " << path << " for write";
+    return false;
+  }
+  *file = absl::make_unique<StdioWritableFile>(path, f);
+  return true;
+}
+
+bool RenameFile(std::string src, std::string dst) {
+  src = NormalizeSlashes(src);
+  dst = NormalizeSlashes(dst);
+  if (rename(src.c_str(), dst.c_str()) != 0) {
+    MG_LOG(ERROR) << "error renaming " << src << " to " << dst << ": "
+                  << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
 bool ReadFile(std::string path, std::string* contents) {
   path = NormalizeSlashes(path);
 
@@ -110,6 +223,40 @@ bool ReadFile(std::string path, std::string* contents) {
   return ok;
 }
 
+bool MapFile(std::string path, std::unique_ptr<MappedFile>* file) {
+  path = NormalizeSlashes(path);
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    MG_LOG(ERROR) << "error opening " << path << " for read";
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    MG_LOG(ERROR) << "error statting " << path;
+    close(fd);
+    return false;
+  }
+
+  // Empty files can't be mapped.
+  size_t size = st.st_size;
+  void* addr = nullptr;
+  if (size != 0) {
+    addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      MG_LOG(ERROR) << "error mapping " << path << ": " << strerror(errno);
+      close(fd);
+      return false;
+    }
+  }
+
+  // The mapping remains valid after the file is closed.
+  close(fd);
+  *file = absl::make_unique<PosixMappedFile>(addr, size);
+  return true;
+}
+
 bool GetModTime(std::string path, uint64_t* mtime_usec) {
   path = NormalizeSlashes(path);
 
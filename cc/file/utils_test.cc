@@ -15,6 +15,7 @@
 #include "cc/file/utils.h"
 
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -54,6 +55,64 @@ TEST(UtilsTest, ReadAndWriteFile) {
   ASSERT_EQ(expected_contents, actual_contents);
 }
 
+TEST(UtilsTest, AppendAndRenameFile) {
+  auto dir = FullPath("foo/bar\\append_rename");
+  ASSERT_TRUE(RecursivelyCreateDir(dir));
+
+  // Append to a file in a few pieces.
+  auto tmp_path = JoinPath(dir, "test.txt.tmp");
+  std::unique_ptr<WritableFile> file;
+  ASSERT_TRUE(OpenWritableFile(tmp_path, &file));
+  ASSERT_TRUE(file->Append("this "));
+  ASSERT_TRUE(file->Append(""));
+  ASSERT_TRUE(file->Append("is a test"));
+  ASSERT_TRUE(file->Close());
+
+  // Rename it over an existing file.
+  auto path = JoinPath(dir, "test.txt");
+  ASSERT_TRUE(WriteFile(path, "old contents"));
+  ASSERT_TRUE(RenameFile(tmp_path, path));
+  std::vector<std::string> files;
+  ASSERT_TRUE(ListDir(dir, &files));
+  EXPECT_THAT(files, ::testing::ElementsAre("test.txt"));
+
+  std::string contents;
+  ASSERT_TRUE(ReadFile(path, &contents));
+  EXPECT_EQ("this is a test", contents);
+}
+
+TEST(UtilsTest, MapFile) {
+  auto dir = FullPath("foo/bar\\map_file");
+  ASSERT_TRUE(RecursivelyCreateDir(dir));
+
+  // Write a file spanning a few pages.
+  auto path = JoinPath(dir, "test.bin");
+  std::string expected_contents;
+  for (int i = 0; i < 10000; ++i) {
+    expected_contents += std::to_string(i);
+  }
+  ASSERT_TRUE(WriteFile(path, expected_contents));
+
+  std::unique_ptr<MappedFile> file;
+  ASSERT_TRUE(MapFile(path, &file));
+  EXPECT_EQ(expected_contents, file->contents());
+
+  // Advice is only a hint and shouldn't change the contents, even for ranges
+  // that aren't page aligned or extend past the end of the file.
+  file->Advise(100, 20000, MappedFile::Advice::kWillNeed);
+  file->Advise(0, 1000000, MappedFile::Advice::kSequential);
+  file->Advise(1000000, 10, MappedFile::Advice::kRandom);
+  EXPECT_EQ(expected_contents, file->contents());
+
+  // Empty files can be mapped too.
+  auto empty_path = JoinPath(dir, "empty.bin");
+  ASSERT_TRUE(WriteFile(empty_path, ""));
+  ASSERT_TRUE(MapFile(empty_path, &file));
+  EXPECT_TRUE(file->contents().empty());
+
+  EXPECT_FALSE(MapFile(JoinPath(dir, "missing.bin"), &file));
+}
+
 TEST(UtilsTest, GetModTime) {
   // Recursively create a directory using both forward and back slashes.
   auto dir = FullPath("foo/bar\\mod_date");
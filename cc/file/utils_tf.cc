@@ -12,8 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <utility>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "cc/file/path.h"
@@ -25,6 +36,102 @@
 namespace minigo {
 namespace file {
 
+namespace {
+
+// The contents of a file read through TensorFlow's ReadOnlyMemoryRegion,
+// which memory maps local files.
+class TfMappedFile : public MappedFile {
+ public:
+  TfMappedFile(std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region,
+               bool is_local)
+      : region_(std::move(region)), is_local_(is_local) {
+    contents_ = absl::string_view(static_cast<const char*>(region_->data()),
+                                  region_->length());
+  }
+
+  void Advise(size_t offset, size_t size, Advice advice) const override {
+#ifndef _WIN32
+    // Only local files are known to be mapped.
+    if (!is_local_ || offset >= contents_.size()) {
+      return;
+    }
+
+    // madvise requires a page aligned address.
+    auto addr = reinterpret_cast<uintptr_t>(contents_.data()) + offset;
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = addr / page_size * page_size;
+    size = std::min(size, contents_.size() - offset);
+
+    int posix_advice = MADV_NORMAL;
+    switch (advice) {
+      case Advice::kSequential:
+        posix_advice = MADV_SEQUENTIAL;
+        break;
+      case Advice::kRandom:
+        posix_advice = MADV_RANDOM;
+        break;
+      case Advice::kWillNeed:
+        posix_advice = MADV_WILLNEED;
+        break;
+    }
+    if (madvise(reinterpret_cast<void*>(begin), addr + size - begin,
+                posix_advice) != 0) {
+      MG_LOG(WARNING) << "madvise failed: " << strerror(errno);
+    }
+#endif  // _WIN32
+  }
+
+ private:
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region_;
+  bool is_local_;
+};
+
+// The contents of a file that was read into memory rather than mapped.
+class BufferedFile : public MappedFile {
+ public:
+  explicit BufferedFile(std::string buffer) : buffer_(std::move(buffer)) {
+    contents_ = buffer_;
+  }
+
+ private:
+  const std::string buffer_;
+};
+
+// A file written through TensorFlow's file APIs.
+class TfWritableFile : public WritableFile {
+ public:
+  TfWritableFile(std::string path,
+                 std::unique_ptr<tensorflow::WritableFile> file)
+      : path_(std::move(path)), file_(std::move(file)) {}
+
+  bool Append(absl::string_view data) override {
+    if (data.empty()) {
+      return true;
+    }
+    auto status = file_->Append({data.data(), data.size()});
+    if (!status.ok()) {
+      MG_LOG(ERROR) << "error writing to \"" << path_ << "\": " << status;
+      return false;
+    }
+    return true;
+  }
+
+  bool Close() override {
+    auto status = file_->Close();
+    if (!status.ok()) {
+      MG_LOG(ERROR) << "error closing \"" << path_ << "\": " << status;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  const std::string path_;
+  std::unique_ptr<tensorflow::WritableFile> file_;
+};
+
+}  // namespace
+
 bool RecursivelyCreateDir(std::string path) {
   path = NormalizeSlashes(path);
 
@@ -79,6 +186,32 @@ bool WriteFile(std::string path, absl::string_view contents) {
   return true;
 }
 
+bool OpenWritableFile(std::string path, std::unique_ptr<WritableFile>* file) {
+  path = NormalizeSlashes(path);
+
+  std::unique_ptr<tensorflow::WritableFile> tf_file;
+  auto status = tensorflow::Env::Default()->NewWritableFile(path, &tf_file);
+  if (!status.ok()) {
+    MG_LOG(ERROR) << "error opening \"" << path << "\" for write: " << status;
+    return false;
+  }
+  *file = absl::make_unique<TfWritableFile>(path, std::move(tf_file));
+  return true;
+}
+
+bool RenameFile(std::string src, std::string dst) {
+  src = NormalizeSlashes(src);
+  dst = NormalizeSlashes(dst);
+
+  auto status = tensorflow::Env::Default()->RenameFile(src, dst);
+  if (!status.ok()) {
+    MG_LOG(ERROR) << "error renaming \"" << src << "\" to \"" << dst
+                  << "\": " << status;
+    return false;
+  }
+  return true;
+}
+
 bool ReadFile(std::string path, std::string* contents) {
   path = NormalizeSlashes(path);
 
@@ -111,6 +244,28 @@ bool ReadFile(std::string path, std::string* contents) {
   return true;
 }
 
+bool MapFile(std::string path, std::unique_ptr<MappedFile>* file) {
+  path = NormalizeSlashes(path);
+
+  auto* env = tensorflow::Env::Default();
+  std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> region;
+  auto status = env->NewReadOnlyMemoryRegionFromFile(path, &region);
+  if (status.ok()) {
+    bool is_local = path.find("://") == std::string::npos;
+    *file = absl::make_unique<TfMappedFile>(std::move(region), is_local);
+    return true;
+  }
+
+  // Not all file systems support memory regions (GCS doesn't, for example):
+  // fall back to reading the whole file.
+  std::string contents;
+  if (!ReadFile(std::move(path), &contents)) {
+    return false;
+  }
+  *file = absl::make_unique<BufferedFile>(std::move(contents));
+  return true;
+}
+
 bool GetModTime(std::string path, uint64_t* mtime_usec) {
   path = NormalizeSlashes(path);
 
@@ -14,7 +14,9 @@
 
 #include <cstdio>
 #include <string>
+#include <utility>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "cc/file/path.h"
@@ -58,6 +60,64 @@ bool RecursivelyCreateDirNormalized(const std::string& path) {
   return MaybeCreateDir(path);
 }
 
+// A file mapped into memory with MapViewOfFile.
+// Advise isn't implemented: Windows has no direct equivalent of madvise.
+class WindowsMappedFile : public MappedFile {
+ public:
+  WindowsMappedFile(HANDLE mapping, const void* addr, size_t size)
+      : mapping_(mapping), addr_(addr) {
+    contents_ = absl::string_view(static_cast<const char*>(addr), size);
+  }
+
+  ~WindowsMappedFile() override {
+    if (addr_ != nullptr) {
+      UnmapViewOfFile(addr_);
+      CloseHandle(mapping_);
+    }
+  }
+
+ private:
+  HANDLE mapping_;
+  const void* addr_;
+};
+
+// A file written through stdio.
+class StdioWritableFile : public WritableFile {
+ public:
+  StdioWritableFile(std::string path, FILE* f)
+      : path_(std::move(path)), f_(f) {}
+
+  ~StdioWritableFile() override {
+    if (f_ != nullptr) {
+      fclose(f_);
+    }
+  }
+
+  bool Append(absl::string_view data) override {
+    if (data.empty()) {
+      return true;
+    }
+    if (fwrite(data.data(), data.size(), 1, f_) != 1) {
+      MG_LOG(ERROR) << "error writing " << path_;
+      return false;
+    }
+    return true;
+  }
+
+  bool Close() override {
+    bool ok = fclose(f_) == 0;
+    f_ = nullptr;
+    if (!ok) {
+      MG_LOG(ERROR) << "error closing " << path_;
+    }
+    return ok;
+  }
+
+ private:
+  const std::string path_;
+  FILE* f_;
+};
+
 }  // namespace
 
 bool RecursivelyCreateDir(std::string path) {
@@ -83,6 +143,28 @@ bool WriteFile(std::string path, absl::string_view contents) {
   return ok;
 }
 
+bool OpenWritableFile(std::string path, std::unique_ptr<WritableFile>* file) {
+  path = NormalizeSlashes(path);
+
+  FILE* f = fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    MG_LOG(ERROR) << "error opening " << path << " for write";
+    return false;
+  }
+  *file = absl::make_unique<StdioWritableFile>(path, f);
+  return true;
+}
+
+bool RenameFile(std::string src, std::string dst) {
+  src = NormalizeSlashes(src);
+  dst = NormalizeSlashes(dst);
+  if (!MoveFileEx(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    MG_LOG(ERROR) << "error renaming " << src << " to " << dst;
+    return false;
+  }
+  return true;
+}
+
 bool ReadFile(std::string path, std::string* contents) {
   path = NormalizeSlashes(path);
 
@@ -102,6 +184,48 @@ bool ReadFile(std::string path, std::string* contents) {
   return ok;
 }
 
+bool MapFile(std::string path, std::unique_ptr<MappedFile>* file) {
+  path = NormalizeSlashes(path);
+
+  auto h = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (h == INVALID_HANDLE_VALUE) {
+    MG_LOG(ERROR) << "error opening " << path << " for read";
+    return false;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(h, &size)) {
+    MG_LOG(ERROR) << "error getting the size of " << path;
+    CloseHandle(h);
+    return false;
+  }
+
+  // Empty files can't be mapped.
+  HANDLE mapping = nullptr;
+  const void* addr = nullptr;
+  if (size.QuadPart != 0) {
+    mapping = CreateFileMapping(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (addr == nullptr) {
+        CloseHandle(mapping);
+      }
+    }
+    if (addr == nullptr) {
+      MG_LOG(ERROR) << "error mapping " << path << ": " << GetLastError();
+      CloseHandle(h);
+      return false;
+    }
+  }
+
+  // The mapping keeps the file open after its handle is closed.
+  CloseHandle(h);
+  *file = absl::make_unique<WindowsMappedFile>(
+      mapping, addr, static_cast<size_t>(size.QuadPart));
+  return true;
+}
+
 bool GetModTime(std::string path, uint64_t* mtime_usec) {
   path = NormalizeSlashes(path);
 
@@ -14,6 +14,7 @@
 
 #include "cc/game.h"
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
@@ -21,13 +22,41 @@
 
 namespace minigo {
 
+namespace {
+
+// Positional superko history of a game that's being replayed, so that the
+// legal moves of the replayed positions match those seen during search.
+class ReplayZobristHistory : public Position::ZobristHistory {
+ public:
+  void Add(zobrist::Hash stone_hash) { hashes_.insert(stone_hash); }
+
+  bool HasPositionBeenPlayedBefore(zobrist::Hash stone_hash) const override {
+    return hashes_.contains(stone_hash);
+  }
+
+ private:
+  absl::flat_hash_set<zobrist::Hash> hashes_;
+};
+
+}  // namespace
+
 std::ostream& operator<<(std::ostream& os, const Game::Options& options) {
   os << "resign_threshold:" << options.resign_threshold
      << " resign_enabled:" << options.resign_enabled << " komi:"
-     << options.komi;
+     << options.komi << " compact_history:" << options.compact_history;
   return os;
 }
 
+std::array<float, kNumMoves> Game::Move::GetSearchPi() const {
+  MG_CHECK(trainable);
+  std::array<float, kNumMoves> result;
+  result.fill(0);
+  for (const auto& p : search_pi) {
+    result[p.first] = p.second;
+  }
+  return result;
+}
+
 std::string Game::FormatScore(float score) {
   return absl::StrFormat("%c+%.1f", score > 0 ? 'B' : 'W', std::abs(score));
 }
@@ -43,6 +72,7 @@ Game::Game(std::string black_name, std::string white_name,
 void Game::NewGame() {
   game_over_ = false;
   moves_.clear();
+  positions_.clear();
   comment_.clear();
 }
 
@@ -58,7 +88,13 @@ void Game::AddTrainableMove(Color color, Coord c, const Position& position,
                             std::string comment, float Q, int N,
                             const std::array<float, kNumMoves>& search_pi) {
   AddNonTrainableMove(color, c, position, comment, Q, N);
-  moves_.back()->search_pi = search_pi;
+  auto* move = moves_.back().get();
+  move->trainable = true;
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (search_pi[i] != 0) {
+      move->search_pi.emplace_back(i, search_pi[i]);
+    }
+  }
 }
 
 void Game::AddNonTrainableMove(Color color, Coord c, const Position& position,
@@ -67,7 +103,12 @@ void Game::AddNonTrainableMove(Color color, Coord c, const Position& position,
            moves_.back()->c != c)
       << moves_.back()->color << " " << color << " " << c;
   MG_CHECK(!game_over_);
-  moves_.push_back(absl::make_unique<Move>(position));
+  moves_.push_back(absl::make_unique<Move>());
+  if (options_.compact_history) {
+    positions_.clear();
+  } else {
+    positions_.push_back(position);
+  }
   auto* move = moves_.back().get();
   move->color = color;
   move->c = c;
@@ -79,6 +120,11 @@ void Game::AddNonTrainableMove(Color color, Coord c, const Position& position,
 void Game::UndoMove() {
   MG_CHECK(!moves_.empty());
   moves_.pop_back();
+  if (options_.compact_history) {
+    positions_.clear();
+  } else {
+    positions_.pop_back();
+  }
   game_over_ = false;
 }
 
@@ -128,4 +174,21 @@ bool Game::FindBleakestMove(int* move, float* q) const {
   return true;
 }
 
+void Game::ReplayPositions() const {
+  MG_CHECK(options_.compact_history);
+  positions_.clear();
+
+  Position position(Color::kBlack);
+  ReplayZobristHistory zobrist_history;
+  zobrist_history.Add(position.stone_hash());
+  for (const auto& move : moves_) {
+    positions_.push_back(position);
+    if (move->c == Coord::kResign) {
+      continue;
+    }
+    position.PlayMove(move->c, move->color, &zobrist_history);
+    zobrist_history.Add(position.stone_hash());
+  }
+}
+
 }  // namespace minigo
@@ -16,12 +16,13 @@
 #define CC_GAME_H_
 
 #include <array>
+#include <deque>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 
-#include "absl/types/optional.h"
 #include "cc/color.h"
 #include "cc/constants.h"
 #include "cc/coord.h"
@@ -44,13 +45,20 @@ class Game {
 
     float komi = kDefaultKomi;
 
+    // If true, the game doesn't keep a copy of the position before each move.
+    // GetPositionHistory instead regenerates them by replaying the moves from
+    // an empty board, which is only valid for games that start from an empty
+    // board with black to play (e.g. selfplay).
+    bool compact_history = false;
+
     friend std::ostream& operator<<(std::ostream& os, const Options& options);
   };
 
   struct Move {
-    explicit Move(const Position& position) : position(position) {}
+    bool is_trainable() const { return trainable; }
 
-    bool is_trainable() const { return search_pi.has_value(); }
+    // Returns the dense search policy of a trainable move.
+    std::array<float, kNumMoves> GetSearchPi() const;
 
     Color color;
 
@@ -60,15 +68,15 @@ class Game {
 
     int N;
 
+    bool trainable = false;
+
     // Comments associated with the move.
     std::string comment;
 
-    // Only set if the move is trainable.
-    absl::optional<std::array<float, kNumMoves>> search_pi;
-
-    // This is used to build training features after a selfplay game has
-    // finished.
-    Position position;
+    // The nonzero elements of the search policy, ordered by coord. Only set if
+    // the move is trainable. The search policy is typically nonzero for only
+    // a small fraction of the legal moves.
+    std::vector<std::pair<Coord, float>> search_pi;
   };
 
   enum class GameOverReason {
@@ -99,6 +107,8 @@ class Game {
   // Returns up to the last `num_moves` of moves that lead up to the requested
   // `move`, including the move itself.
   // If `move < num_moves`, history will be truncated to the first `move` moves.
+  // For games with a compact history, the first call after the game was
+  // modified replays the whole game, so this isn't thread safe.
   template <typename T>
   void GetPositionHistory(int move, int num_moves, T* history) const;
 
@@ -140,6 +150,9 @@ class Game {
   const std::vector<std::unique_ptr<Move>>& moves() const { return moves_; }
 
  private:
+  // Regenerates positions_ for a game with a compact history.
+  void ReplayPositions() const;
+
   const Options options_;
   const std::string black_name_;
   const std::string white_name_;
@@ -149,6 +162,11 @@ class Game {
   std::string result_string_;
   std::string comment_;
   std::vector<std::unique_ptr<Move>> moves_;
+
+  // The position before each move, used to build training features after a
+  // selfplay game has finished. For games with a compact history, this is
+  // empty until GetPositionHistory is called.
+  mutable std::deque<Position> positions_;
 };
 
 template <typename T>
@@ -156,8 +174,11 @@ void Game::GetPositionHistory(int move, int num_moves, T* history) const {
   history->clear();
   MG_CHECK(move >= 0);
   MG_CHECK(move < static_cast<int>(moves_.size()));
+  if (positions_.size() != moves_.size()) {
+    ReplayPositions();
+  }
   for (int i = 0; i < num_moves && move - i >= 0; ++i) {
-    history->push_back(&moves_[move - i]->position);
+    history->push_back(&positions_[move - i]);
   }
 }
 
@@ -0,0 +1,127 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "cc/game.h"
+
+#include <array>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "cc/constants.h"
+#include "cc/mcts_tree.h"
+#include "cc/position.h"
+#include "cc/random.h"
+#include "cc/zobrist.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Plays a random game, adding its moves to each of `games`.
+void PlayRandomGame(Random* rnd, absl::Span<Game* const> games) {
+  MctsTree tree(Position(Color::kBlack), MctsTree::Options());
+  while (!tree.is_game_over() && tree.root()->position.n() < 2 * kNumPoints) {
+    const auto& position = tree.root()->position;
+    Coord c = Coord::kPass;
+    for (int i = 0; i < 10; ++i) {
+      Coord candidate = rnd->UniformInt(0, kNumPoints - 1);
+      if (position.legal_move(candidate)) {
+        c = candidate;
+        break;
+      }
+    }
+
+    std::array<float, kNumMoves> search_pi;
+    search_pi.fill(0);
+    search_pi[c] = 0.75;
+    search_pi[Coord::kPass] += 0.25;
+    for (auto* game : games) {
+      if (position.n() % 2 == 0) {
+        game->AddTrainableMove(tree.to_play(), c, position, "", 0, 0,
+                               search_pi);
+      } else {
+        game->AddNonTrainableMove(tree.to_play(), c, position, "", 0, 0);
+      }
+    }
+    tree.PlayMove(c);
+  }
+}
+
+TEST(GameTest, SparseSearchPi) {
+  Game game("b", "w", Game::Options());
+  std::array<float, kNumMoves> search_pi;
+  search_pi.fill(0);
+  search_pi[3] = 0.5;
+  search_pi[Coord::kPass] = 0.5;
+  Position position(Color::kBlack);
+  game.AddTrainableMove(Color::kBlack, 3, position, "", 0, 0, search_pi);
+
+  const auto* move = game.moves()[0].get();
+  EXPECT_TRUE(move->is_trainable());
+  EXPECT_EQ(2, move->search_pi.size());
+  EXPECT_EQ(search_pi, move->GetSearchPi());
+}
+
+// Verifies that the positions replayed for games with a compact history match
+// the ones recorded by games that store every position.
+TEST(GameTest, CompactHistory) {
+  Game::Options options;
+  Game full("b", "w", options);
+  options.compact_history = true;
+  Game compact("b", "w", options);
+
+  Random rnd(614, 1);
+  for (int i = 0; i < 4; ++i) {
+    full.NewGame();
+    compact.NewGame();
+    PlayRandomGame(&rnd, {&full, &compact});
+    if (i == 0) {
+      // Undoing a move must also discard any replayed positions.
+      std::vector<const Position*> history;
+      compact.GetPositionHistory(compact.num_moves() - 1, 1, &history);
+      full.UndoMove();
+      compact.UndoMove();
+    }
+    ASSERT_EQ(full.num_moves(), compact.num_moves());
+
+    std::vector<const Position*> expected;
+    std::vector<const Position*> actual;
+    for (int j = 0; j < full.num_moves(); ++j) {
+      full.GetPositionHistory(j, 8, &expected);
+      compact.GetPositionHistory(j, 8, &actual);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (size_t k = 0; k < expected.size(); ++k) {
+        const auto& a = *expected[k];
+        const auto& b = *actual[k];
+        ASSERT_EQ(a.ToSimpleString(), b.ToSimpleString());
+        ASSERT_EQ(a.to_play(), b.to_play());
+        ASSERT_EQ(a.n(), b.n());
+        ASSERT_EQ(a.ko(), b.ko());
+        ASSERT_EQ(a.stone_hash(), b.stone_hash());
+        ASSERT_EQ(a.num_captures(), b.num_captures());
+        for (int c = 0; c < kNumMoves; ++c) {
+          ASSERT_EQ(a.legal_move(c), b.legal_move(c)) << j << " " << c;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
@@ -66,10 +66,7 @@ std::string GetOutputName(size_t game_id) {
   return absl::StrCat(GetHostname(), "-", GetProcessId(), "-", game_id);
 }
 
-void WriteSgf(const std::string& output_dir, const std::string& output_name,
-              const Game& game, bool write_comments) {
-  MG_CHECK(file::RecursivelyCreateDir(output_dir));
-
+std::string MakeSgfString(const Game& game, bool write_comments) {
   bool log_names = game.black_name() != game.white_name();
 
   std::vector<sgf::MoveWithComment> moves;
@@ -103,9 +100,14 @@ void WriteSgf(const std::string& output_dir, const std::string& output_name,
   options.black_name = game.black_name();
   options.white_name = game.white_name();
   options.game_comment = game.comment();
-  auto sgf_str = sgf::CreateSgfString(moves, options);
+  return sgf::CreateSgfString(moves, options);
+}
+
+void WriteSgf(const std::string& output_dir, const std::string& output_name,
+              const Game& game, bool write_comments) {
+  MG_CHECK(file::RecursivelyCreateDir(output_dir));
   auto output_path = file::JoinPath(output_dir, output_name + ".sgf");
-  MG_CHECK(file::WriteFile(output_path, sgf_str));
+  MG_CHECK(file::WriteFile(output_path, MakeSgfString(game, write_comments)));
 }
 
 void LogEndGameInfo(const Game& game, absl::Duration game_time) {
@@ -60,6 +60,9 @@ std::string FormatWinStatsTable(
 // (e.g. SGF, TF example, etc) based on the hostname, process ID and game ID.
 std::string GetOutputName(size_t game_id);
 
+// Returns an SGF of the given game.
+std::string MakeSgfString(const Game& game, bool write_comments);
+
 // Writes an SGF of the given game.
 void WriteSgf(const std::string& output_dir, const std::string& output_name,
               const Game& game, bool write_comments);
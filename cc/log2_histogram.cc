@@ -0,0 +1,48 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/log2_histogram.h"
+
+#include "absl/strings/str_format.h"
+
+namespace minigo {
+
+void Log2Histogram::Add(uint64_t x) {
+  int bucket = 0;
+  while (x != 0 && bucket + 1 < kNumBuckets) {
+    x >>= 1;
+    bucket += 1;
+  }
+  counts[bucket] += 1;
+}
+
+std::ostream& operator<<(std::ostream& os, const Log2Histogram& histogram) {
+  // Only print the range of buckets that are non-empty.
+  int begin = 0;
+  while (begin < Log2Histogram::kNumBuckets && histogram.counts[begin] == 0) {
+    ++begin;
+  }
+  int end = Log2Histogram::kNumBuckets;
+  while (end > begin && histogram.counts[end - 1] == 0) {
+    --end;
+  }
+  for (int i = begin; i < end; ++i) {
+    uint64_t lo = i == 0 ? 0 : uint64_t(1) << (i - 1);
+    uint64_t hi = uint64_t(1) << i;
+    os << absl::StreamFormat("\n  [%d, %d): %d", lo, hi, histogram.counts[i]);
+  }
+  return os;
+}
+
+}  // namespace minigo
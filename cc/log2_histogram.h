@@ -0,0 +1,41 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_LOG2_HISTOGRAM_H_
+#define CC_LOG2_HISTOGRAM_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace minigo {
+
+// Histogram with exponentially sized buckets: bucket 0 counts values of 0, and
+// bucket i > 0 counts values in the range [2^(i-1), 2^i). Values too large for
+// the last bucket are counted in it.
+struct Log2Histogram {
+  static constexpr int kNumBuckets = 32;
+
+  void Add(uint64_t x);
+
+  std::array<size_t, kNumBuckets> counts{};
+};
+
+// Prints one line per bucket, for the range of buckets that are non-empty.
+std::ostream& operator<<(std::ostream& os, const Log2Histogram& histogram);
+
+}  // namespace minigo
+
+#endif  // CC_LOG2_HISTOGRAM_H_
@@ -0,0 +1,51 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/log2_histogram.h"
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(Log2HistogramTest, Buckets) {
+  Log2Histogram histogram;
+  for (uint64_t x : {0, 1, 2, 3, 4, 7, 8, 1000}) {
+    histogram.Add(x);
+  }
+  histogram.Add(~uint64_t(0));
+
+  EXPECT_EQ(1, histogram.counts[0]);
+  EXPECT_EQ(1, histogram.counts[1]);
+  EXPECT_EQ(2, histogram.counts[2]);
+  EXPECT_EQ(2, histogram.counts[3]);
+  EXPECT_EQ(1, histogram.counts[4]);
+  EXPECT_EQ(1, histogram.counts[10]);
+
+  // Values too large for the last bucket are clamped to it.
+  EXPECT_EQ(1, histogram.counts[Log2Histogram::kNumBuckets - 1]);
+
+  // Only the range of non-empty buckets is printed.
+  Log2Histogram small;
+  small.Add(2);
+  small.Add(5);
+  std::ostringstream oss;
+  oss << small;
+  EXPECT_EQ("\n  [2, 4): 1\n  [4, 8): 1", oss.str());
+}
+
+}  // namespace
+}  // namespace minigo
@@ -178,7 +178,8 @@ void MctsPlayer::SelectLeaves(int num_leaves, int max_num_reads) {
       cache_key =
           InferenceCache::Key(leaf->move, canonical_sym, leaf->position);
 
-      if (inference_cache_->TryGet(cache_key, canonical_sym, inference_sym,
+      if (inference_cache_->TryGet(cache_key, leaf->position.n(),
+                                   canonical_sym, inference_sym,
                                    &cached_output)) {
         tree_->IncorporateResults(leaf, cached_output.policy,
                                   cached_output.value);
@@ -193,6 +194,9 @@ void MctsPlayer::SelectLeaves(int num_leaves, int max_num_reads) {
 
     auto& input = tree_search_inferences_.back().input;
     input.sym = inference_sym;
+    if (inference_cache_ != nullptr) {
+      input.dedup_key = cache_key.Fingerprint(canonical_sym);
+    }
     // TODO(tommadams): add a method to Model that returns the required position
     // history size.
     auto* node = leaf;
@@ -240,17 +244,23 @@ void MctsPlayer::ProcessLeaves() {
     inferences_.back().total_count += tree_search_inferences_.size();
   }
 
+  // Merge the inference outputs with those in the inference cache, possibly
+  // updating the values in each inference's `output`.
+  if (inference_cache_ != nullptr) {
+    cache_requests_.clear();
+    for (auto& inference : tree_search_inferences_) {
+      cache_requests_.push_back({inference.cache_key,
+                                 inference.leaf->position.n(),
+                                 inference.canonical_sym,
+                                 inference.inference_sym, &inference.output});
+    }
+    inference_cache_->MergeMany(cache_requests_);
+  }
+
   // Incorporate the inference outputs back into tree search.
   for (auto& inference : tree_search_inferences_) {
     auto& output = inference.output;
 
-    // Merge the inference output with those in the inference cache, possibly
-    // updating the values in `output`.
-    if (inference_cache_ != nullptr) {
-      inference_cache_->Merge(inference.cache_key, inference.canonical_sym,
-                              inference.inference_sym, &output);
-    }
-
     // Propagate the results back up the tree to the root.
     tree_->IncorporateResults(inference.leaf, output.policy, output.value);
     tree_->RevertVirtualLoss(inference.leaf);
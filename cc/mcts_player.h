@@ -281,6 +281,7 @@ class MctsPlayer {
   std::vector<TreeSearchInference> tree_search_inferences_;
   std::vector<const ModelInput*> input_ptrs_;
   std::vector<ModelOutput*> output_ptrs_;
+  std::vector<InferenceCache::Request> cache_requests_;
 
   TreeSearchCallback tree_search_cb_ = nullptr;
 
@@ -14,6 +14,7 @@
 
 #include "cc/model/batching_model.h"
 
+#include <algorithm>
 #include <utility>
 
 #include "absl/memory/memory.h"
@@ -25,12 +26,53 @@
 
 namespace minigo {
 
+std::ostream& operator<<(std::ostream& os, const BatchingModelStats& stats) {
+  // Fraction of inferences that were removed by deduplication.
+  double dedup_ratio = 0;
+  if (stats.num_inferences > 0) {
+    dedup_ratio = 1 - static_cast<double>(stats.num_unique_inferences) /
+                          stats.num_inferences;
+  }
+  return os << "num_inferences:" << stats.num_inferences
+            << " dedup_ratio:" << dedup_ratio
+            << " run_batch_time:" << stats.run_batch_time
+            << " run_many_time:" << stats.run_many_time
+            << "\nbatch_size:" << stats.batch_size_histogram
+            << "\nqueue_wait_us:" << stats.queue_wait_us_histogram;
+}
+
 namespace internal {
 
-ModelBatcher::ModelBatcher(std::unique_ptr<Model> model_impl, int buffer_count)
-    : model_impl_(std::move(model_impl)), stats_(buffer_count) {}
+ModelBatcher::ModelBatcher(std::unique_ptr<Model> model_impl, int buffer_count,
+                           const BatchingOptions& options)
+    : model_impl_(std::move(model_impl)),
+      options_(options),
+      stats_(buffer_count) {}
 
 ModelBatcher::~ModelBatcher() {
+  std::unique_ptr<PollThread> deadline_thread;
+  {
+    absl::MutexLock lock(&mutex_);
+    deadline_thread = std::move(deadline_thread_);
+  }
+  if (deadline_thread != nullptr) {
+    deadline_thread->Join();
+  }
+
+  {
+    absl::MutexLock lock(&mutex_);
+    while (!queue_.empty()) {
+      RunBatch();
+    }
+
+    // Batches run by an asynchronous `model_impl_` call FinishBatch on another
+    // thread: wait for them, since FinishBatch uses this batcher.
+    auto all_finished = [this]() EXCLUSIVE_LOCKS_REQUIRED(&mutex_) {
+      return num_running_batches_ == 0;
+    };
+    mutex_.Await(absl::Condition(&all_finished));
+  }
+
   MG_LOG(INFO) << "Ran " << num_batches_ << " batches with an average size of "
                << static_cast<float>(num_inferences_) / num_batches_;
 }
@@ -53,10 +95,66 @@ void ModelBatcher::RunMany(ModelBatcher* other_batcher,
   WTF_SCOPE("ModelBatcher::RunMany", size_t)(inputs.size());
 
   absl::Notification notification;
+  Enqueue(other_batcher, inputs, outputs, model_name,
+          [&notification]() { notification.Notify(); }, false);
+
+  if (options_.policy != BatchingOptions::Policy::kDeadline) {
+    notification.WaitForNotification();
+    return;
+  }
+
+  // Synchronous clients don't need a dedicated thread that runs batches when
+  // their deadline expires. Instead, clients waiting on their notification
+  // wake up when the oldest queued request's deadline passes and run the
+  // batch themselves.
+  for (;;) {
+    absl::Time deadline;
+    {
+      absl::MutexLock lock(&mutex_);
+      deadline = GetQueueDeadline();
+    }
+    if (notification.WaitForNotificationWithDeadline(deadline)) {
+      break;
+    }
+    absl::MutexLock lock(&mutex_);
+    MaybeRunBatchesLocked();
+  }
+}
+
+void ModelBatcher::RunManyAsync(ModelBatcher* other_batcher,
+                                const std::vector<const ModelInput*>& inputs,
+                                std::vector<ModelOutput*>* outputs,
+                                std::string* model_name,
+                                std::function<void()> done) {
+  WTF_SCOPE("ModelBatcher::RunManyAsync", size_t)(inputs.size());
 
+  if (options_.policy == BatchingOptions::Policy::kDeadline) {
+    absl::MutexLock lock(&mutex_);
+    if (deadline_thread_ == nullptr) {
+      auto interval = std::max(absl::Microseconds(100),
+                               options_.max_queue_delay / 2);
+      deadline_thread_ = absl::make_unique<PollThread>(
+          "deadline", interval, [this]() {
+            absl::MutexLock lock(&mutex_);
+            MaybeRunBatchesLocked();
+          });
+      deadline_thread_->Start();
+    }
+  }
+
+  Enqueue(other_batcher, inputs, outputs, model_name, std::move(done), true);
+}
+
+void ModelBatcher::Enqueue(ModelBatcher* other_batcher,
+                           const std::vector<const ModelInput*>& inputs,
+                           std::vector<ModelOutput*>* outputs,
+                           std::string* model_name,
+                           std::function<void()> done, bool async) {
   {
     absl::MutexLock lock(&mutex_);
-    queue_.push({other_batcher, &inputs, outputs, model_name, &notification});
+    queue_.push({other_batcher, &inputs, outputs, model_name, std::move(done),
+                 absl::Now(), async});
+    num_queued_inferences_ += inputs.size();
     if (other_batcher != nullptr) {
       other_batcher->num_waiting_ += 1;
     }
@@ -67,8 +165,6 @@ void ModelBatcher::RunMany(ModelBatcher* other_batcher,
     absl::MutexLock lock(&other_batcher->mutex_);
     other_batcher->MaybeRunBatchesLocked();
   }
-
-  notification.WaitForNotification();
 }
 
 BatchingModelStats ModelBatcher::FlushStats() {
@@ -83,7 +179,42 @@ size_t ModelBatcher::GetBatchSize() const {
   return std::max<size_t>(1, num_active_clients_ / stats_.buffer_count);
 }
 
+absl::Duration ModelBatcher::GetQueueDelay() const {
+  if (!options_.adaptive_queue_delay || !has_run_many_time_) {
+    return options_.max_queue_delay;
+  }
+  return std::min(options_.max_queue_delay,
+                  avg_run_many_time_ / stats_.buffer_count);
+}
+
+absl::Time ModelBatcher::GetQueueDeadline() const {
+  if (queue_.empty()) {
+    return absl::InfiniteFuture();
+  }
+  return queue_.front().enqueue_time + GetQueueDelay();
+}
+
 void ModelBatcher::MaybeRunBatchesLocked() {
+  if (options_.policy == BatchingOptions::Policy::kDeadline) {
+    while (!queue_.empty()) {
+      bool is_full = num_queued_inferences_ >= options_.max_batch_size;
+      bool is_expired = absl::Now() >= GetQueueDeadline();
+
+      // If every active client has submitted a request, waiting any longer
+      // won't make the batch any bigger. Clients that never call StartGame
+      // aren't counted, in which case we rely solely on the deadline.
+      bool all_clients_queued =
+          num_active_clients_ > 0 &&
+          queue_.size() + num_waiting_ >= num_active_clients_;
+
+      if (!is_full && !is_expired && !all_clients_queued) {
+        break;
+      }
+      RunBatch();
+    }
+    return;
+  }
+
   while (!queue_.empty()) {
     auto queue_size = queue_.size();
     if (queue_size < GetBatchSize()) {
@@ -116,46 +247,97 @@ void ModelBatcher::MaybeRunBatchesLocked() {
 
 void ModelBatcher::RunBatch() {
   WTF_SCOPE0("ModelBatcher::RunBatch");
-  auto run_batch_start_time = absl::Now();
+  auto batch = absl::make_unique<Batch>();
+  batch->run_batch_start_time = absl::Now();
 
   auto batch_size = GetBatchSize();
 
   // TODO(tommadams): reserve GetBatchSize() * virtual_losses elements.
-  std::vector<const ModelInput*> inputs;
-  std::vector<ModelOutput*> outputs;
-  std::vector<InferenceRequest> inferences;
+  auto& inputs = batch->inputs;
+  auto& outputs = batch->outputs;
+  auto& inferences = batch->inferences;
 
-  while (!queue_.empty() && inferences.size() < batch_size) {
+  bool use_deadline = options_.policy == BatchingOptions::Policy::kDeadline;
+  while (!queue_.empty()) {
     auto& inference = queue_.front();
     size_t num_features = inference.inputs->size();
+    if (use_deadline) {
+      if (!inputs.empty() &&
+          inputs.size() + num_features > options_.max_batch_size) {
+        break;
+      }
+    } else if (inferences.size() >= batch_size) {
+      break;
+    }
+
+    stats_.queue_wait_us_histogram.Add(absl::ToInt64Microseconds(
+        batch->run_batch_start_time - inference.enqueue_time));
+    num_queued_inferences_ -= num_features;
 
     std::copy_n(inference.inputs->begin(), num_features,
                 std::back_inserter(inputs));
     std::copy_n(inference.outputs->begin(), num_features,
                 std::back_inserter(outputs));
-    inferences.push_back(inference);
+    batch->async |= inference.async;
+    inferences.push_back(std::move(inference));
 
     queue_.pop();
   }
 
   num_batches_ += 1;
   num_inferences_ += inputs.size();
-  auto num_inferences_in_batch = inputs.size();
+  num_running_batches_ += 1;
 
   // Unlock the mutex while running inference. This allows more inferences
   // to be enqueued while inference is running.
   mutex_.Unlock();
 
-  std::string model_name;
-  auto run_many_start_time = absl::Now();
-
   MG_CHECK(inputs.size() == outputs.size());
-  model_impl_->RunMany(inputs, &outputs, &model_name);
-  auto run_many_time = absl::Now() - run_many_start_time;
 
-  for (auto& inference : inferences) {
+  const auto* run_inputs = &inputs;
+  auto* run_outputs = &outputs;
+  if (options_.deduplicate) {
+    WTF_SCOPE0("Deduplicate");
+    batch->dedup.Deduplicate(inputs, outputs);
+    run_inputs = &batch->dedup.unique_inputs();
+    run_outputs = batch->dedup.unique_outputs();
+  }
+
+  batch->run_many_start_time = absl::Now();
+
+  if (!batch->async) {
+    // Every client in the batch is blocked waiting for it anyway, so run it
+    // on this thread rather than paying for a hop to the model's thread.
+    model_impl_->RunMany(*run_inputs, run_outputs, &batch->model_name);
+    FinishBatch(std::move(batch));
+  } else {
+    // If `model_impl_` is asynchronous, the batch may complete on another
+    // thread after RunManyAsync returns. std::function requires a copyable
+    // closure, so the batch is passed to it as a raw pointer.
+    auto* raw_batch = batch.release();
+    model_impl_->RunManyAsync(
+        *run_inputs, run_outputs, &raw_batch->model_name,
+        [this, raw_batch]() {
+          FinishBatch(std::unique_ptr<Batch>(raw_batch));
+        });
+  }
+
+  // Lock the mutex again.
+  mutex_.Lock();
+}
+
+void ModelBatcher::FinishBatch(std::unique_ptr<Batch> batch) {
+  auto run_many_time = absl::Now() - batch->run_many_start_time;
+  auto num_inferences_in_batch = batch->inputs.size();
+  auto num_unique_inferences = num_inferences_in_batch;
+  if (options_.deduplicate) {
+    batch->dedup.CopyDuplicateOutputs();
+    num_unique_inferences -= batch->dedup.num_duplicates();
+  }
+
+  for (auto& inference : batch->inferences) {
     if (inference.model_name != nullptr) {
-      *inference.model_name = model_name;
+      *inference.model_name = batch->model_name;
     }
     // For all two player games, tell the batcher of the opponent model that
     // it isn't blocked on this inference any more.
@@ -164,18 +346,32 @@ void ModelBatcher::RunBatch() {
     }
   }
 
-  // All the required work is done, unblock all the waiting clients.
-  for (auto& inference : inferences) {
-    inference.notification->Notify();
+  // Update the stats before unblocking the clients: once unblocked, they're
+  // free to destroy their BatchingModel and with it possibly this batcher.
+  // Once `num_running_batches_` is decremented, the destructor may also
+  // destroy this batcher, so it mustn't be used after the lock is released.
+  {
+    absl::MutexLock lock(&mutex_);
+    num_running_batches_ -= 1;
+    stats_.run_batch_time +=
+        (absl::Now() - batch->run_batch_start_time) / stats_.buffer_count;
+    stats_.run_many_time += (run_many_time) / stats_.buffer_count;
+    stats_.num_inferences += num_inferences_in_batch;
+    stats_.num_unique_inferences += num_unique_inferences;
+    stats_.batch_size_histogram.Add(num_inferences_in_batch);
+
+    if (has_run_many_time_) {
+      avg_run_many_time_ = 0.9 * avg_run_many_time_ + 0.1 * run_many_time;
+    } else {
+      avg_run_many_time_ = run_many_time;
+      has_run_many_time_ = true;
+    }
   }
 
-  // Lock the mutex again.
-  mutex_.Lock();
-
-  stats_.run_batch_time +=
-      (absl::Now() - run_batch_start_time) / stats_.buffer_count;
-  stats_.run_many_time += (run_many_time) / stats_.buffer_count;
-  stats_.num_inferences += num_inferences_in_batch;
+  // All the required work is done, unblock all the waiting clients.
+  for (auto& inference : batch->inferences) {
+    inference.done();
+  }
 }
 
 }  // namespace internal
@@ -190,6 +386,14 @@ void BatchingModel::RunMany(const std::vector<const ModelInput*>& inputs,
   batcher_->RunMany(other_batcher_.get(), inputs, outputs, model);
 }
 
+void BatchingModel::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                                 std::vector<ModelOutput*>* outputs,
+                                 std::string* model,
+                                 std::function<void()> done) {
+  batcher_->RunManyAsync(other_batcher_.get(), inputs, outputs, model,
+                         std::move(done));
+}
+
 void BatchingModel::StartGame() { batcher_->StartGame(); }
 
 void BatchingModel::EndGame() { batcher_->EndGame(); }
@@ -204,8 +408,11 @@ void BatchingModel::SetOther(BatchingModel* other) {
   }
 }
 
-BatchingModelFactory::BatchingModelFactory(std::string device, int buffer_count)
-    : device_(std::move(device)), buffer_count_(buffer_count) {}
+BatchingModelFactory::BatchingModelFactory(std::string device, int buffer_count,
+                                           const BatchingOptions& options)
+    : device_(std::move(device)),
+      buffer_count_(buffer_count),
+      options_(options) {}
 
 std::unique_ptr<BatchingModel> BatchingModelFactory::NewModel(
     const std::string& path) {
@@ -214,14 +421,12 @@ std::unique_ptr<BatchingModel> BatchingModelFactory::NewModel(
   // Find or create a service for the requested model.
   auto it = batchers_.find(path);
   if (it == batchers_.end()) {
-    std::vector<std::unique_ptr<Model>> models;
-    auto def = LoadModelDefinition(path);
-    auto* factory = GetModelFactory(def, device_);
-    for (int i = 0; i < buffer_count_; ++i) {
-      models.push_back(factory->NewModel(def));
-    }
+    auto models = NewModels(path, device_, buffer_count_,
+                            options_.warm_up_batch_sizes);
     auto batcher = std::make_shared<internal::ModelBatcher>(
-        absl::make_unique<BufferedModel>(std::move(models)), buffer_count_);
+        absl::make_unique<BufferedModel>(std::move(models),
+                                         options_.min_split_batch_size),
+        buffer_count_, options_);
     it = batchers_.emplace(path, std::move(batcher)).first;
   }
 
@@ -16,7 +16,9 @@
 #define CC_MODEL_BATCHING_MODEL_H_
 
 #include <atomic>
+#include <functional>
 #include <memory>
+#include <ostream>
 #include <queue>
 #include <string>
 #include <vector>
@@ -25,20 +27,83 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
+#include "cc/async/poll_thread.h"
+#include "cc/log2_histogram.h"
 #include "cc/model/factory.h"
+#include "cc/model/inference_dedup.h"
 #include "cc/model/model.h"
 
 namespace minigo {
 
+// Controls when a ModelBatcher runs a batch of inferences.
+struct BatchingOptions {
+  enum class Policy {
+    // Runs a batch once enough of the batcher's active clients (those between
+    // calls to StartGame and EndGame) have submitted inference requests.
+    kClientCount,
+
+    // Runs a batch once `max_batch_size` inferences are queued, or the oldest
+    // queued request has waited for `max_queue_delay`, or all active clients
+    // have submitted requests, whichever happens first. This is similar to
+    // TF-Serving's batch scheduler and copes better with fluctuating numbers
+    // of clients and slow clients.
+    kDeadline,
+  };
+
+  Policy policy = Policy::kClientCount;
+
+  // Only used by the kDeadline policy.
+  // Maximum number of inferences in a batch. A single request is never split,
+  // so a batch may exceed this size if one request is larger.
+  size_t max_batch_size = 256;
+
+  // Only used by the kDeadline policy.
+  // Maximum time a request waits in the queue before a batch is run.
+  absl::Duration max_queue_delay = absl::Milliseconds(2);
+
+  // Only used by the kDeadline policy.
+  // If true, the queue delay is tuned to the observed model run time: while
+  // a batch runs on one of the `buffer_count` model buffers, there's no point
+  // waiting longer than `run_many_time / buffer_count` for the next one.
+  // The delay never exceeds `max_queue_delay`.
+  bool adaptive_queue_delay = false;
+
+  // If true, identical inputs from different clients in the same batch are
+  // only evaluated once. See ModelInput::dedup_key.
+  bool deduplicate = true;
+
+  // If non-zero, batches with at least `2 * min_split_batch_size` inferences
+  // are split across the free model buffers, each buffer running at least
+  // `min_split_batch_size` inferences. See BufferedModel.
+  size_t min_split_batch_size = 0;
+
+  // Batch sizes that each model buffer is run on once when a model is loaded,
+  // before the model is used (see WarmUpModel).
+  std::vector<int> warm_up_batch_sizes;
+};
+
 struct BatchingModelStats {
   explicit BatchingModelStats(size_t buffer_count)
       : buffer_count(buffer_count) {}
   size_t num_inferences = 0;
+
+  // Number of inferences actually evaluated by the model after removing
+  // duplicates.
+  size_t num_unique_inferences = 0;
+
   size_t buffer_count = 0;
   absl::Duration run_batch_time;
   absl::Duration run_many_time;
+
+  // Number of inferences in each batch.
+  Log2Histogram batch_size_histogram;
+
+  // Time in microseconds that each request spent waiting in the queue.
+  Log2Histogram queue_wait_us_histogram;
 };
 
+std::ostream& operator<<(std::ostream& os, const BatchingModelStats& stats);
+
 namespace internal {
 
 // The ModelBatcher is responsible for batching up inference requests from
@@ -55,11 +120,34 @@ class ModelBatcher {
     const std::vector<const ModelInput*>* inputs;
     std::vector<ModelOutput*>* outputs;
     std::string* model_name;
-    absl::Notification* notification;
+    std::function<void()> done;
+    absl::Time enqueue_time;
+
+    // True if the request came from RunManyAsync.
+    bool async;
+  };
+
+  // A batch of inference requests. Owned by the batcher from the time it's
+  // taken from the queue until the model has run it.
+  struct Batch {
+    std::vector<const ModelInput*> inputs;
+    std::vector<ModelOutput*> outputs;
+    std::vector<InferenceRequest> inferences;
+    InferenceDeduplicator dedup;
+    std::string model_name;
+    absl::Time run_batch_start_time;
+    absl::Time run_many_start_time;
+
+    // True if any of the batch's requests came from RunManyAsync.
+    bool async = false;
   };
 
   // model_impl: the model that will evaluate the batched inferences.
-  ModelBatcher(std::unique_ptr<Model> model_impl, int buffer_count);
+  ModelBatcher(std::unique_ptr<Model> model_impl, int buffer_count,
+               const BatchingOptions& options);
+
+  // Runs any requests still in the queue and waits for all batches to finish,
+  // including those running asynchronously on `model_impl`.
   ~ModelBatcher();
 
   const std::string& name() const { return model_impl_->name(); }
@@ -72,19 +160,59 @@ class ModelBatcher {
   void RunMany(ModelBatcher* other_batcher,
                const std::vector<const ModelInput*>& inputs,
                std::vector<ModelOutput*>* outputs, std::string* model_name);
+  void RunManyAsync(ModelBatcher* other_batcher,
+                    const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done);
   BatchingModelStats FlushStats() LOCKS_EXCLUDED(&mutex_);
 
  private:
+  // Returns the number of requests in a batch for the kClientCount policy.
   size_t GetBatchSize() const EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
 
+  // Returns the current queue delay for the kDeadline policy.
+  absl::Duration GetQueueDelay() const EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
+
+  // Returns the time at which the oldest queued request's delay expires, or
+  // absl::InfiniteFuture() if the queue is empty.
+  absl::Time GetQueueDeadline() const EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
+
+  // Adds a request to the queue and runs any batches that are ready.
+  void Enqueue(ModelBatcher* other_batcher,
+               const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs, std::string* model_name,
+               std::function<void()> done, bool async) LOCKS_EXCLUDED(&mutex_);
+
   void MaybeRunBatchesLocked() EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
+
+  // Takes a batch from the queue and runs it on `model_impl_`.
+  // Batches that only contain synchronous requests are run on the calling
+  // thread with RunMany. Batches that contain asynchronous requests are
+  // started with RunManyAsync and may complete on another thread.
+  // Temporarily releases `mutex_`.
   void RunBatch() EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
 
+  // Called when `model_impl_` has finished running `batch`: updates the stats
+  // and invokes the requests' done callbacks.
+  void FinishBatch(std::unique_ptr<Batch> batch) LOCKS_EXCLUDED(&mutex_);
+
   absl::Mutex mutex_;
   std::unique_ptr<Model> model_impl_;
+  const BatchingOptions options_;
   std::queue<InferenceRequest> queue_ GUARDED_BY(&mutex_);
   BatchingModelStats stats_ GUARDED_BY(&mutex_);
 
+  // Total number of inferences in all requests in `queue_`.
+  size_t num_queued_inferences_ GUARDED_BY(&mutex_) = 0;
+
+  // Number of batches taken from the queue that haven't finished yet.
+  size_t num_running_batches_ GUARDED_BY(&mutex_) = 0;
+
+  // Exponential moving average of the model's RunMany time, used to tune the
+  // queue delay if `options_.adaptive_queue_delay` is true.
+  absl::Duration avg_run_many_time_ GUARDED_BY(&mutex_);
+  bool has_run_many_time_ GUARDED_BY(&mutex_) = false;
+
   // Number of clients of this batcher that are playing in a two player game
   // and are currently waiting for the other player to play a move. These
   // clients are not going to make an inference request until it's their turn
@@ -97,6 +225,12 @@ class ModelBatcher {
   // Stats that get reported when the ModelBatcher is destroyed.
   size_t num_batches_ GUARDED_BY(&mutex_) = 0;
   size_t num_inferences_ GUARDED_BY(&mutex_) = 0;
+
+  // Only used by the kDeadline policy.
+  // Synchronous RunMany callers run batches whose deadline has expired while
+  // they wait for their results. Asynchronous callers don't wait, so the
+  // first RunManyAsync call starts a thread that does this for them.
+  std::unique_ptr<PollThread> deadline_thread_ GUARDED_BY(&mutex_);
 };
 
 }  // namespace internal
@@ -113,6 +247,10 @@ class BatchingModel : public Model {
                std::vector<ModelOutput*>* outputs,
                std::string* model_name) override;
 
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override;
+
   void StartGame();
   void EndGame();
   void SetOther(BatchingModel* other);
@@ -134,7 +272,8 @@ class BatchingModel : public Model {
 // their BatchingModel clients.
 class BatchingModelFactory {
  public:
-  BatchingModelFactory(std::string device, int buffer_count);
+  BatchingModelFactory(std::string device, int buffer_count,
+                       const BatchingOptions& options = {});
 
   std::unique_ptr<BatchingModel> NewModel(const std::string& path);
 
@@ -153,6 +292,7 @@ class BatchingModelFactory {
 
   const std::string device_;
   const int buffer_count_;
+  const BatchingOptions options_;
 };
 
 }  // namespace minigo
@@ -14,270 +14,484 @@
 
 #include "cc/model/batching_model.h"
 
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <numeric>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/synchronization/mutex.h"
-#include "cc/model/buffered_model.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "cc/model/model.h"
-#include "cc/semaphore.h"
-#include "gmock/gmock.h"
+#include "cc/model/model_thread.h"
 #include "gtest/gtest.h"
 
 namespace minigo {
 namespace {
 
-class WaitingModel;
-class WaitingModelFactory;
-
-struct EvaluatedBatch {
-  EvaluatedBatch() = default;
-  EvaluatedBatch(std::string model_descriptor, size_t size)
-      : model_descriptor(std::move(model_descriptor)), size(size) {}
-  std::string model_descriptor;
-  size_t size = 0;
-};
-
-// Model implementation whose RunMany method blocks until Notify is called.
-// This is used in tests where multiple BatchingModel clients are running in
-// parallel and we want to control the evaluation order of the implementation
-// models.
-// WaitingModel also records each RunMany call with its factory.
-class WaitingModel : public Model {
+// Model that records the size of each batch it's run on.
+class RecordingModel : public Model {
  public:
-  WaitingModel(WaitingModelFactory* factory, std::string model);
+  RecordingModel()
+      : Model("recording", FeatureDescriptor::Create<AgzFeatures>(
+                               FeatureDescriptor::Layout::kNhwc)) {}
 
-  // Blocks until Notify is called.
-  // Each call pushes an EvaluatedBatch instance onto the factory's queue
-  // containing the model name and size of the batch.
   void RunMany(const std::vector<const ModelInput*>& inputs,
                std::vector<ModelOutput*>* outputs,
-               std::string* model_name) override;
+               std::string* model_name) override {
+    absl::MutexLock lock(&mutex_);
+    batch_sizes_.push_back(inputs.size());
+    if (model_name != nullptr) {
+      *model_name = name();
+    }
+  }
 
-  // Allows one call to RunMany to complete.
-  // Blocks until the executed RunMany call completes.
-  void Notify();
+  // Returns the sizes of the batches run so far, sorted.
+  std::vector<size_t> batch_sizes() {
+    absl::MutexLock lock(&mutex_);
+    auto result = batch_sizes_;
+    std::sort(result.begin(), result.end());
+    return result;
+  }
 
  private:
-  Semaphore before_;
-  Semaphore after_;
-  WaitingModelFactory* factory_;
-  std::string model_name_;
+  absl::Mutex mutex_;
+  std::vector<size_t> batch_sizes_ GUARDED_BY(&mutex_);
 };
 
-class WaitingModelFactory : public ModelFactory {
+// Model whose RunMany blocks until `gate` is notified, then sets the value of
+// each output to 1.
+class GatedModel : public Model {
  public:
-  explicit WaitingModelFactory(int buffer_count);
-
-  std::unique_ptr<Model> NewModel(const std::string& descriptor) override;
+  explicit GatedModel(absl::Notification* gate)
+      : Model("gated", FeatureDescriptor::Create<AgzFeatures>(
+                           FeatureDescriptor::Layout::kNhwc)),
+        gate_(gate) {}
 
-  // Notifies the batcher for the given model_descriptor, so that it can run a
-  // single batch of inferences.
-  // CHECK fails if batches_ is empty.
-  // CHECK fails if the front element in the batches_ queue doesn't match the
-  // given model_descriptor or expected_batch_size.
-  void FlushBatch(const std::string& model_descriptor,
-                  size_t expected_batch_size);
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    gate_->WaitForNotification();
+    for (auto* output : *outputs) {
+      output->value = 1;
+    }
+    absl::MutexLock lock(&mutex_);
+    num_inferences_ += inputs.size();
+  }
 
-  // Called by WaitingModel::RunMany.
-  void PushEvaluatedBatch(const std::string& model, size_t size);
+  size_t num_inferences() {
+    absl::MutexLock lock(&mutex_);
+    return num_inferences_;
+  }
 
  private:
-  const int buffer_count_;
-  mutable absl::Mutex mutex_;
-  absl::flat_hash_map<std::string, WaitingModel*> models_ GUARDED_BY(&mutex_);
-  std::queue<EvaluatedBatch> batches_ GUARDED_BY(&mutex_);
+  absl::Notification* gate_;
+  absl::Mutex mutex_;
+  size_t num_inferences_ GUARDED_BY(&mutex_) = 0;
 };
 
-WaitingModel::WaitingModel(WaitingModelFactory* factory, std::string model_name)
-    : Model("Waiting", FeatureDescriptor::Create<AgzFeatures>()),
-      factory_(factory),
-      model_name_(std::move(model_name)) {}
-
-void WaitingModel::RunMany(const std::vector<const ModelInput*>& inputs,
-                           std::vector<ModelOutput*>* outputs,
-                           std::string* model_name) {
-  before_.Wait();
-  factory_->PushEvaluatedBatch(model_name_, inputs.size());
-  if (model_name != nullptr) {
-    *model_name = model_name_;
-  }
-  after_.Post();
-}
-
-void WaitingModel::Notify() {
-  before_.Post();
-  after_.Wait();
-}
-
-WaitingModelFactory::WaitingModelFactory(int buffer_count)
-    : buffer_count_(buffer_count) {}
-
-std::unique_ptr<Model> WaitingModelFactory::NewModel(
-    const std::string& descriptor) {
-  absl::MutexLock lock(&mutex_);
-
-  auto model = absl::make_unique<WaitingModel>(this, descriptor);
-  MG_CHECK(models_.emplace(descriptor, model.get()).second);
-  return model;
-}
+// Runs a GatedModel asynchronously on a ModelThread that the model doesn't
+// own, like inference engines that complete requests on their own threads.
+class AsyncModel : public Model {
+ public:
+  AsyncModel(GatedModel* impl, ModelThread* thread)
+      : Model("async", FeatureDescriptor::Create<AgzFeatures>(
+                           FeatureDescriptor::Layout::kNhwc)),
+        impl_(impl),
+        thread_(thread) {}
 
-void WaitingModelFactory::FlushBatch(const std::string& model_descriptor,
-                                     size_t expected_batch_size) {
-  // Find the model for the given descriptor.
-  WaitingModel* model;
-  {
-    absl::MutexLock lock(&mutex_);
-    auto it = models_.find(model_descriptor);
-    MG_CHECK(it != models_.end());
-    model = it->second;
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    impl_->RunMany(inputs, outputs, model_name);
   }
 
-  // Notify it, letting it run a single batch.
-  model->Notify();
-
-  // The model should now have pushed a batch on to the batches_ queue: pop it
-  // off or die trying.
-  EvaluatedBatch batch;
-  {
-    absl::MutexLock lock(&mutex_);
-    MG_CHECK(!batches_.empty());
-    batch = std::move(batches_.front());
-    batches_.pop();
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override {
+    num_async_calls_ += 1;
+    thread_->RunManyAsync(inputs, outputs, model_name, std::move(done));
   }
 
-  // Check the popped batch matches the expected batch.
-  MG_CHECK(batch.model_descriptor == model_descriptor);
-  MG_CHECK(batch.size == expected_batch_size);
-}
+  int num_async_calls() const { return num_async_calls_; }
 
-void WaitingModelFactory::PushEvaluatedBatch(const std::string& model,
-                                             size_t size) {
-  absl::MutexLock lock(&mutex_);
-  batches_.emplace(model, size);
-}
+ private:
+  GatedModel* impl_;
+  ModelThread* thread_;
+  std::atomic<int> num_async_calls_{0};
+};
 
 class BatchingModelTest : public ::testing::Test {
  protected:
-  void InitFactory(int buffer_count) {
-    auto impl = absl::make_unique<WaitingModelFactory>(buffer_count);
-    model_factory_ = impl.get();
-    batcher_ =
-        absl::make_unique<BatchingModelFactory>(std::move(impl), buffer_count);
+  void Init(int buffer_count, const BatchingOptions& options = {}) {
+    buffer_count_ = buffer_count;
+    options_ = options;
+    batchers_.clear();
+    impls_.clear();
   }
 
-  std::unique_ptr<Model> NewModel(const std::string& descriptor) {
-    return batcher_->NewModel(descriptor);
+  // Returns a new client of the batcher for model `name`, creating the
+  // batcher if necessary.
+  std::unique_ptr<BatchingModel> NewModel(const std::string& name) {
+    auto& batcher = batchers_[name];
+    if (batcher == nullptr) {
+      auto impl = absl::make_unique<RecordingModel>();
+      impls_[name] = impl.get();
+      batcher = std::make_shared<internal::ModelBatcher>(
+          std::move(impl), buffer_count_, options_);
+    }
+    return absl::make_unique<BatchingModel>(batcher);
   }
 
-  void StartGame(Model* black, Model* white) {
-    batcher_->StartGame(black, white);
+  // Returns the sorted sizes of the batches run by model `name`.
+  std::vector<size_t> batch_sizes(const std::string& name) {
+    return impls_.at(name)->batch_sizes();
   }
 
-  void EndGame(Model* black, Model* white) { batcher_->EndGame(black, white); }
-
-  void FlushBatch(const std::string& model_descriptor,
-                  size_t expected_batch_size) {
-    model_factory_->FlushBatch(model_descriptor, expected_batch_size);
+  BatchingModelStats FlushStats(const std::string& name) {
+    return batchers_.at(name)->FlushStats();
   }
 
  private:
-  // Owned by batcher_.
-  WaitingModelFactory* model_factory_ = nullptr;
-  std::unique_ptr<BatchingModelFactory> batcher_;
+  int buffer_count_ = 1;
+  BatchingOptions options_;
+  absl::flat_hash_map<std::string, std::shared_ptr<internal::ModelBatcher>>
+      batchers_;
+
+  // Owned by the batchers.
+  absl::flat_hash_map<std::string, RecordingModel*> impls_;
 };
 
+// Calls RunMany on each of `models` in parallel, each with `n` inferences.
+void RunInParallel(const std::vector<Model*>& models, size_t n) {
+  std::vector<std::thread> threads;
+  for (auto* model : models) {
+    threads.emplace_back([model, n]() {
+      std::vector<ModelInput> inputs(n);
+      std::vector<ModelOutput> outputs(n);
+      std::vector<const ModelInput*> input_ptrs;
+      std::vector<ModelOutput*> output_ptrs;
+      for (size_t i = 0; i < n; ++i) {
+        input_ptrs.push_back(&inputs[i]);
+        output_ptrs.push_back(&outputs[i]);
+      }
+      std::string model_name;
+      model->RunMany(input_ptrs, &output_ptrs, &model_name);
+      EXPECT_EQ("recording", model_name);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
 TEST_F(BatchingModelTest, SelfPlay) {
   constexpr int kNumGames = 6;
 
-  struct Game {
-    ModelInput input;
-    ModelOutput output;
-    std::unique_ptr<Model> model;
-    std::thread thread;
-  };
-
   // Test single, double and triple buffering.
   for (int buffer_count = 1; buffer_count <= 3; ++buffer_count) {
-    InitFactory(buffer_count);
-    int expected_batch_size = kNumGames / buffer_count;
+    Init(buffer_count);
+    size_t expected_batch_size = kNumGames / buffer_count;
 
-    std::vector<Game> games;
+    std::vector<std::unique_ptr<BatchingModel>> models;
+    std::vector<Model*> model_ptrs;
     for (int i = 0; i < kNumGames; ++i) {
-      Game game;
-      game.model = NewModel("a");
-      StartGame(game.model.get(), game.model.get());
-      games.push_back(std::move(game));
+      models.push_back(NewModel("a"));
+      model_ptrs.push_back(models.back().get());
+      BatchingModelFactory::StartGame(models.back().get(),
+                                      models.back().get());
     }
 
-    for (auto& game : games) {
-      game.thread = std::thread([&game] {
-        std::vector<const ModelInput*> inputs = {&game.input};
-        std::vector<ModelOutput*> outputs = {&game.output};
-        game.model->RunMany(inputs, &outputs, nullptr);
-      });
-    }
-
-    for (int i = 0; i < kNumGames / expected_batch_size; ++i) {
-      FlushBatch("a", expected_batch_size);
+    RunInParallel(model_ptrs, 1);
+    for (auto& model : models) {
+      BatchingModelFactory::EndGame(model.get(), model.get());
     }
 
-    for (auto& game : games) {
-      EndGame(game.model.get(), game.model.get());
-      game.thread.join();
-    }
+    EXPECT_EQ(std::vector<size_t>(buffer_count, expected_batch_size),
+              batch_sizes("a"));
   }
 }
 
 TEST_F(BatchingModelTest, EvalDoubleBuffer) {
   constexpr int kNumGames = 6;
 
-  struct Game {
-    ModelInput input;
-    ModelOutput output;
-    std::unique_ptr<Model> black;
-    std::unique_ptr<Model> white;
-    std::thread thread;
-  };
-
   // Test single, double and triple buffering.
   for (int buffer_count = 1; buffer_count <= 3; ++buffer_count) {
-    InitFactory(buffer_count);
-    int expected_batch_size = kNumGames / buffer_count;
-
-    std::vector<Game> games;
-    for (int i = 0; i < kNumGames; ++i) {
-      Game game;
+    Init(buffer_count);
+    size_t expected_batch_size = kNumGames / buffer_count;
+
+    struct Game {
+      std::unique_ptr<BatchingModel> black;
+      std::unique_ptr<BatchingModel> white;
+    };
+    std::vector<Game> games(kNumGames);
+    for (auto& game : games) {
       game.black = NewModel("black");
       game.white = NewModel("white");
-      StartGame(game.black.get(), game.white.get());
-      games.push_back(std::move(game));
+      BatchingModelFactory::StartGame(game.black.get(), game.white.get());
     }
 
+    // Each game runs an inference with black, then with white.
+    std::vector<std::thread> threads;
     for (auto& game : games) {
-      game.thread = std::thread([&game] {
-        std::vector<const ModelInput*> inputs = {&game.input};
-        std::vector<ModelOutput*> outputs = {&game.output};
+      threads.emplace_back([&game]() {
+        ModelInput input;
+        ModelOutput output;
+        std::vector<const ModelInput*> inputs = {&input};
+        std::vector<ModelOutput*> outputs = {&output};
         game.black->RunMany(inputs, &outputs, nullptr);
         game.white->RunMany(inputs, &outputs, nullptr);
       });
     }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto& game : games) {
+      BatchingModelFactory::EndGame(game.black.get(), game.white.get());
+    }
+
+    std::vector<size_t> expected(buffer_count, expected_batch_size);
+    EXPECT_EQ(expected, batch_sizes("black"));
+    EXPECT_EQ(expected, batch_sizes("white"));
+  }
+}
+
+// A batch is run as soon as all active clients have submitted a request, even
+// if there are fewer of them than the maximum batch size.
+TEST_F(BatchingModelTest, DeadlineAllClientsQueued) {
+  constexpr int kNumClients = 3;
+
+  BatchingOptions options;
+  options.policy = BatchingOptions::Policy::kDeadline;
+  options.max_batch_size = 16;
+  options.max_queue_delay = absl::Seconds(60);
+  Init(1, options);
+
+  std::vector<std::unique_ptr<BatchingModel>> models;
+  std::vector<Model*> model_ptrs;
+  for (int i = 0; i < kNumClients; ++i) {
+    models.push_back(NewModel("a"));
+    model_ptrs.push_back(models.back().get());
+    BatchingModelFactory::StartGame(models.back().get(), models.back().get());
+  }
+
+  auto start = absl::Now();
+  RunInParallel(model_ptrs, 2);
+  EXPECT_LT(absl::Now() - start, absl::Seconds(30));
+  for (auto& model : models) {
+    BatchingModelFactory::EndGame(model.get(), model.get());
+  }
+
+  EXPECT_EQ(std::vector<size_t>({2 * kNumClients}), batch_sizes("a"));
+
+  auto stats = FlushStats("a");
+  EXPECT_EQ(2 * kNumClients, stats.num_inferences);
+  Log2Histogram expected_batch_sizes;
+  expected_batch_sizes.Add(2 * kNumClients);
+  EXPECT_EQ(expected_batch_sizes.counts, stats.batch_size_histogram.counts);
+}
+
+// Clients that never call StartGame aren't waited for: their requests are run
+// once the oldest has waited for `max_queue_delay`.
+TEST_F(BatchingModelTest, DeadlineExpires) {
+  BatchingOptions options;
+  options.policy = BatchingOptions::Policy::kDeadline;
+  options.max_batch_size = 16;
+  options.max_queue_delay = absl::Milliseconds(20);
+  Init(1, options);
+
+  auto model = NewModel("a");
+  RunInParallel({model.get()}, 3);
+  EXPECT_EQ(std::vector<size_t>({3}), batch_sizes("a"));
+
+  // The request waited in the queue for at least 20ms, which is in the
+  // [16384, 32768) microsecond bucket or later.
+  auto stats = FlushStats("a");
+  const auto& wait_counts = stats.queue_wait_us_histogram.counts;
+  EXPECT_EQ(1, std::accumulate(wait_counts.begin(), wait_counts.end(), 0));
+  EXPECT_EQ(1, std::accumulate(wait_counts.begin() + 15, wait_counts.end(), 0));
+  EXPECT_EQ(1, stats.batch_size_histogram.counts[2]);
+
+  // Flushing resets the stats.
+  stats = FlushStats("a");
+  EXPECT_EQ(0, stats.num_inferences);
+  EXPECT_EQ(Log2Histogram().counts, stats.queue_wait_us_histogram.counts);
+}
+
+// Batches are capped at `max_batch_size` inferences, without splitting
+// requests.
+TEST_F(BatchingModelTest, DeadlineMaxBatchSize) {
+  constexpr int kNumClients = 8;
+
+  BatchingOptions options;
+  options.policy = BatchingOptions::Policy::kDeadline;
+  options.max_batch_size = 4;
+  options.max_queue_delay = absl::Milliseconds(5);
+  Init(1, options);
+
+  std::vector<std::unique_ptr<BatchingModel>> models;
+  std::vector<Model*> model_ptrs;
+  for (int i = 0; i < kNumClients; ++i) {
+    models.push_back(NewModel("a"));
+    model_ptrs.push_back(models.back().get());
+  }
+
+  // Any two requests of 3 inferences exceed the maximum batch size, so each
+  // request must be run in a batch on its own, however they're timed.
+  RunInParallel(model_ptrs, 3);
+  EXPECT_EQ(std::vector<size_t>(kNumClients, 3), batch_sizes("a"));
+
+  // A single request larger than the maximum batch size isn't split.
+  RunInParallel({model_ptrs[0]}, 6);
+  auto sizes = batch_sizes("a");
+  EXPECT_EQ(6, sizes.back());
+
+  auto stats = FlushStats("a");
+  EXPECT_EQ(kNumClients * 3 + 6, stats.num_inferences);
+  EXPECT_EQ(kNumClients, stats.batch_size_histogram.counts[2]);
+  EXPECT_EQ(1, stats.batch_size_histogram.counts[3]);
+  const auto& wait_counts = stats.queue_wait_us_histogram.counts;
+  EXPECT_EQ(kNumClients + 1,
+            std::accumulate(wait_counts.begin(), wait_counts.end(), 0));
+}
+
+// Asynchronous requests are batched like synchronous ones, and complete on
+// the model's thread.
+TEST(AsyncBatchingModelTest, RunManyAsync) {
+  constexpr int kNumClients = 4;
+
+  for (auto policy : {BatchingOptions::Policy::kClientCount,
+                      BatchingOptions::Policy::kDeadline}) {
+    absl::Notification gate;
+    gate.Notify();
+    GatedModel impl(&gate);
+    ModelThread thread(&impl);
+
+    BatchingOptions options;
+    options.policy = policy;
+    options.max_queue_delay = absl::Milliseconds(5);
+    auto batcher = std::make_shared<internal::ModelBatcher>(
+        absl::make_unique<AsyncModel>(&impl, &thread), 1, options);
+
+    std::vector<std::unique_ptr<BatchingModel>> models;
+    for (int i = 0; i < kNumClients; ++i) {
+      models.push_back(absl::make_unique<BatchingModel>(batcher));
+      BatchingModelFactory::StartGame(models.back().get(),
+                                      models.back().get());
+    }
 
-    for (int i = 0; i < kNumGames / expected_batch_size; ++i) {
-      FlushBatch("black", expected_batch_size);
-      FlushBatch("white", expected_batch_size);
+    std::vector<ModelInput> inputs(kNumClients);
+    std::vector<ModelOutput> outputs(kNumClients);
+    std::vector<std::vector<const ModelInput*>> input_ptrs(kNumClients);
+    std::vector<std::vector<ModelOutput*>> output_ptrs(kNumClients);
+    absl::BlockingCounter num_pending(kNumClients);
+    for (int i = 0; i < kNumClients; ++i) {
+      outputs[i].value = 0;
+      input_ptrs[i] = {&inputs[i]};
+      output_ptrs[i] = {&outputs[i]};
+      models[i]->RunManyAsync(
+          input_ptrs[i], &output_ptrs[i], nullptr,
+          [&num_pending]() { num_pending.DecrementCount(); });
     }
+    num_pending.Wait();
 
-    for (auto& game : games) {
-      EndGame(game.black.get(), game.black.get());
-      game.thread.join();
+    EXPECT_EQ(kNumClients, impl.num_inferences());
+    for (const auto& output : outputs) {
+      EXPECT_EQ(1, output.value);
+    }
+    auto stats = batcher->FlushStats();
+    EXPECT_EQ(kNumClients, stats.num_inferences);
+
+    for (auto& model : models) {
+      BatchingModelFactory::EndGame(model.get(), model.get());
     }
   }
 }
 
+// Batches of synchronous requests run on the calling thread, without going
+// through the model's RunManyAsync.
+TEST(AsyncBatchingModelTest, SyncRequestsRunInline) {
+  absl::Notification gate;
+  gate.Notify();
+  GatedModel impl(&gate);
+  ModelThread thread(&impl);
+
+  for (auto policy : {BatchingOptions::Policy::kClientCount,
+                      BatchingOptions::Policy::kDeadline}) {
+    BatchingOptions options;
+    options.policy = policy;
+    auto* async_model = new AsyncModel(&impl, &thread);
+    auto batcher = std::make_shared<internal::ModelBatcher>(
+        std::unique_ptr<Model>(async_model), 1, options);
+    BatchingModel model(batcher);
+    BatchingModelFactory::StartGame(&model, &model);
+
+    ModelInput input;
+    ModelOutput output;
+    output.value = 0;
+    std::vector<const ModelInput*> inputs = {&input};
+    std::vector<ModelOutput*> outputs = {&output};
+    model.RunMany(inputs, &outputs, nullptr);
+    EXPECT_EQ(1, output.value);
+    EXPECT_EQ(0, async_model->num_async_calls());
+
+    absl::Notification done;
+    model.RunManyAsync(inputs, &outputs, nullptr, [&done]() { done.Notify(); });
+    EXPECT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+    EXPECT_EQ(1, async_model->num_async_calls());
+
+    BatchingModelFactory::EndGame(&model, &model);
+  }
+  EXPECT_EQ(4, impl.num_inferences());
+}
+
+// Destroying a batcher waits for the requests that are queued or running
+// asynchronously, which would otherwise complete after the batcher is gone.
+TEST(AsyncBatchingModelTest, DestructorWaitsForBatches) {
+  absl::Notification gate;
+  GatedModel impl(&gate);
+  ModelThread thread(&impl);
+
+  BatchingOptions options;
+  options.policy = BatchingOptions::Policy::kDeadline;
+  options.max_queue_delay = absl::Milliseconds(1);
+  auto model = absl::make_unique<BatchingModel>(
+      std::make_shared<internal::ModelBatcher>(
+          absl::make_unique<AsyncModel>(&impl, &thread), 1, options));
+
+  ModelInput input;
+  ModelOutput output;
+  output.value = 0;
+  std::vector<const ModelInput*> inputs = {&input};
+  std::vector<ModelOutput*> outputs = {&output};
+  absl::Notification done;
+  model->RunManyAsync(inputs, &outputs, nullptr, [&done]() { done.Notify(); });
+
+  // Destroying the only client destroys the batcher.
+  absl::Notification destroyed;
+  std::thread destroy_thread([&model, &destroyed]() {
+    model = nullptr;
+    destroyed.Notify();
+  });
+  EXPECT_FALSE(
+      destroyed.WaitForNotificationWithTimeout(absl::Milliseconds(50)));
+  EXPECT_FALSE(done.HasBeenNotified());
+
+  // The batch's done callbacks are invoked after the batcher has finished with
+  // the batch, so may still be running when the destructor returns.
+  gate.Notify();
+  destroy_thread.join();
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+  EXPECT_EQ(1, output.value);
+}
+
 }  // namespace
 }  // namespace minigo
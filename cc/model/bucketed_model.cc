@@ -0,0 +1,235 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/bucketed_model.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "cc/logging.h"
+
+namespace minigo {
+
+std::ostream& operator<<(std::ostream& os, const BucketedModelStats& stats) {
+  // Fraction of the inferences run by the wrapped model that were padding.
+  double padding_ratio = 0;
+  auto num_run = stats.num_inferences + stats.num_padding;
+  if (num_run > 0) {
+    padding_ratio = static_cast<double>(stats.num_padding) / num_run;
+  }
+  os << "num_batches:" << stats.num_batches
+     << " num_inferences:" << stats.num_inferences
+     << " num_padding:" << stats.num_padding
+     << " padding_ratio:" << padding_ratio
+     << " num_oversized:" << stats.num_oversized << "\nbucket_size:";
+  for (size_t i = 0; i < stats.bucket_sizes.size(); ++i) {
+    if (stats.bucket_counts[i] != 0) {
+      os << "\n  " << stats.bucket_sizes[i] << ": " << stats.bucket_counts[i];
+    }
+  }
+  return os;
+}
+
+std::vector<int> BucketedModel::PowerOfTwoBuckets(int max_batch_size) {
+  MG_CHECK(max_batch_size > 0);
+  std::vector<int> bucket_sizes;
+  for (int size = 1;; size *= 2) {
+    bucket_sizes.push_back(size);
+    if (size >= max_batch_size) {
+      break;
+    }
+  }
+  return bucket_sizes;
+}
+
+std::vector<int> BucketedModel::ParseBuckets(absl::string_view spec) {
+  if (absl::ConsumePrefix(&spec, "pow2:")) {
+    int max_batch_size;
+    MG_CHECK(absl::SimpleAtoi(spec, &max_batch_size))
+        << "Couldn't parse max batch size from \"" << spec << "\"";
+    return PowerOfTwoBuckets(max_batch_size);
+  }
+
+  std::vector<int> bucket_sizes;
+  for (auto str : absl::StrSplit(spec, ',')) {
+    int size;
+    MG_CHECK(absl::SimpleAtoi(str, &size))
+        << "Couldn't parse bucket size from \"" << str << "\"";
+    bucket_sizes.push_back(size);
+  }
+  return bucket_sizes;
+}
+
+BucketedModel::BucketedModel(std::unique_ptr<Model> impl,
+                             std::vector<int> bucket_sizes,
+                             bool split_oversized)
+    : Model(impl->name(), impl->feature_descriptor()),
+      impl_(std::move(impl)),
+      bucket_sizes_(std::move(bucket_sizes)),
+      split_oversized_(split_oversized) {
+  MG_CHECK(!bucket_sizes_.empty());
+  std::sort(bucket_sizes_.begin(), bucket_sizes_.end());
+  bucket_sizes_.erase(std::unique(bucket_sizes_.begin(), bucket_sizes_.end()),
+                      bucket_sizes_.end());
+  MG_CHECK(bucket_sizes_[0] > 0);
+
+  stats_.bucket_sizes = bucket_sizes_;
+  stats_.bucket_counts.resize(bucket_sizes_.size());
+}
+
+BucketedModel::~BucketedModel() {
+  auto stats = FlushStats();
+  if (stats.num_inferences > 0) {
+    MG_LOG(INFO) << "BucketedModel " << name() << " " << stats;
+  }
+}
+
+void BucketedModel::RunMany(const std::vector<const ModelInput*>& inputs,
+                            std::vector<ModelOutput*>* outputs,
+                            std::string* model_name) {
+  MG_CHECK(inputs.size() == outputs->size());
+  input_buffer_lent_ = false;
+  if (inputs.empty()) {
+    impl_->RunMany(inputs, outputs, model_name);
+    return;
+  }
+
+  for (const auto& batch : MakeBatches(inputs, *outputs)) {
+    impl_->RunMany(batch->inputs, &batch->outputs, model_name);
+  }
+}
+
+void BucketedModel::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                                 std::vector<ModelOutput*>* outputs,
+                                 std::string* model_name,
+                                 std::function<void()> done) {
+  MG_CHECK(inputs.size() == outputs->size());
+  input_buffer_lent_ = false;
+  if (inputs.empty()) {
+    impl_->RunManyAsync(inputs, outputs, model_name, std::move(done));
+    return;
+  }
+
+  // std::function requires a copyable closure, so the batches are shared
+  // between the completion callbacks.
+  auto batches = std::make_shared<std::vector<std::unique_ptr<Batch>>>(
+      MakeBatches(inputs, *outputs));
+  RunBatchesAsync(std::move(batches), 0, model_name, std::move(done));
+}
+
+ModelInputBuffer* BucketedModel::LendInputBuffer(int capacity) {
+  MG_CHECK(!input_buffer_lent_);
+  auto bucket_idx = GetBucketIndex(capacity);
+  if (bucket_idx == bucket_sizes_.size()) {
+    return nullptr;
+  }
+  auto* buffer = impl_->LendInputBuffer(bucket_sizes_[bucket_idx]);
+  input_buffer_lent_ = buffer != nullptr;
+  return buffer;
+}
+
+void BucketedModel::ReturnInputBuffer() {
+  if (input_buffer_lent_) {
+    impl_->ReturnInputBuffer();
+    input_buffer_lent_ = false;
+  }
+}
+
+BucketedModelStats BucketedModel::FlushStats() {
+  absl::MutexLock lock(&mutex_);
+  auto result = stats_;
+  stats_ = {};
+  stats_.bucket_sizes = bucket_sizes_;
+  stats_.bucket_counts.resize(bucket_sizes_.size());
+  return result;
+}
+
+size_t BucketedModel::GetBucketIndex(size_t n) const {
+  auto it = std::lower_bound(bucket_sizes_.begin(), bucket_sizes_.end(), n,
+                             [](int a, size_t b) { return size_t(a) < b; });
+  return it - bucket_sizes_.begin();
+}
+
+std::vector<std::unique_ptr<BucketedModel::Batch>> BucketedModel::MakeBatches(
+    const std::vector<const ModelInput*>& inputs,
+    const std::vector<ModelOutput*>& outputs) {
+  size_t max_bucket_size = bucket_sizes_.back();
+  bool is_oversized = inputs.size() > max_bucket_size;
+
+  // The features of a lent input buffer can't be split across batches, which
+  // is why LendInputBuffer refuses to lend for oversized capacities.
+  bool split = is_oversized && split_oversized_;
+
+  std::vector<std::unique_ptr<Batch>> batches;
+  std::vector<size_t> bucket_indices;
+  for (size_t begin = 0; begin < inputs.size();) {
+    size_t size = inputs.size() - begin;
+    if (split) {
+      size = std::min(size, max_bucket_size);
+    }
+    auto bucket_idx = GetBucketIndex(size);
+    size_t padded_size =
+        bucket_idx < bucket_sizes_.size() ? bucket_sizes_[bucket_idx] : size;
+
+    auto batch = absl::make_unique<Batch>();
+    batch->inputs.reserve(padded_size);
+    batch->outputs.reserve(padded_size);
+    batch->inputs.insert(batch->inputs.end(), inputs.begin() + begin,
+                         inputs.begin() + begin + size);
+    batch->outputs.insert(batch->outputs.end(), outputs.begin() + begin,
+                          outputs.begin() + begin + size);
+    batch->padding_outputs.resize(padded_size - size);
+    for (auto& output : batch->padding_outputs) {
+      batch->inputs.push_back(batch->inputs.back());
+      batch->outputs.push_back(&output);
+    }
+
+    batches.push_back(std::move(batch));
+    bucket_indices.push_back(bucket_idx);
+    begin += size;
+  }
+
+  absl::MutexLock lock(&mutex_);
+  stats_.num_inferences += inputs.size();
+  stats_.num_oversized += is_oversized;
+  stats_.num_batches += batches.size();
+  for (size_t i = 0; i < batches.size(); ++i) {
+    stats_.num_padding += batches[i]->padding_outputs.size();
+    if (bucket_indices[i] < bucket_sizes_.size()) {
+      stats_.bucket_counts[bucket_indices[i]] += 1;
+    }
+  }
+
+  return batches;
+}
+
+void BucketedModel::RunBatchesAsync(
+    std::shared_ptr<std::vector<std::unique_ptr<Batch>>> batches, size_t i,
+    std::string* model_name, std::function<void()> done) {
+  if (i == batches->size()) {
+    done();
+    return;
+  }
+  auto* batch = (*batches)[i].get();
+  impl_->RunManyAsync(batch->inputs, &batch->outputs, model_name,
+                      [this, batches, i, model_name, done]() {
+                        RunBatchesAsync(batches, i + 1, model_name, done);
+                      });
+}
+
+}  // namespace minigo
@@ -0,0 +1,139 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_MODEL_BUCKETED_MODEL_H_
+#define CC_MODEL_BUCKETED_MODEL_H_
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "cc/model/model.h"
+
+namespace minigo {
+
+struct BucketedModelStats {
+  // Number of batches run on the wrapped model, after splitting.
+  size_t num_batches = 0;
+
+  // Number of real inferences requested.
+  size_t num_inferences = 0;
+
+  // Number of padding inferences added to fill batches up to a bucket size.
+  size_t num_padding = 0;
+
+  // Number of requests that were larger than the largest bucket. These are
+  // either split or run unpadded, depending on `split_oversized`.
+  size_t num_oversized = 0;
+
+  // Number of batches run at each of `bucket_sizes`. Oversized requests that
+  // were run unpadded aren't counted.
+  std::vector<int> bucket_sizes;
+  std::vector<size_t> bucket_counts;
+};
+
+std::ostream& operator<<(std::ostream& os, const BucketedModelStats& stats);
+
+// Pads inference requests up to one of a fixed set of batch sizes before
+// passing them to the wrapped model. Engines like TfDualNet and LiteDualNet
+// reallocate their input tensors when the batch size changes, which is
+// expensive if batch sizes fluctuate from call to call; bucketing bounds the
+// number of distinct sizes the engine ever sees.
+// Padding inferences are copies of the last input in the request, and their
+// outputs are discarded.
+class BucketedModel : public Model {
+ public:
+  // Returns the bucket sizes 1, 2, 4, ... up to the first power of two that's
+  // >= `max_batch_size`.
+  static std::vector<int> PowerOfTwoBuckets(int max_batch_size);
+
+  // Parses a bucket specification: either "pow2:N", which is equivalent to
+  // PowerOfTwoBuckets(N), or a comma-separated list of sizes.
+  static std::vector<int> ParseBuckets(absl::string_view spec);
+
+  // bucket_sizes: the batch sizes to pad requests up to. Must be non-empty,
+  // the sizes must be positive, and they're sorted by the constructor.
+  // split_oversized: if true, requests larger than the largest bucket are
+  // split into multiple batches of at most that size. Otherwise they are run
+  // unpadded.
+  BucketedModel(std::unique_ptr<Model> impl, std::vector<int> bucket_sizes,
+                bool split_oversized);
+
+  // Logs the stats if any inferences were run.
+  ~BucketedModel() override;
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override;
+
+  // If the request is split, the batches are run on the wrapped model one
+  // after another.
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override;
+
+  // Lends the wrapped model's input buffer, sized to the bucket that
+  // `capacity` falls into. Returns null if `capacity` is larger than the
+  // largest bucket, since a lent buffer can't be split across batches.
+  // Padding slots in a lent buffer are left as they are: their outputs are
+  // discarded anyway.
+  ModelInputBuffer* LendInputBuffer(int capacity) override;
+  void ReturnInputBuffer() override;
+
+  const std::vector<int>& bucket_sizes() const { return bucket_sizes_; }
+
+  // Returns the stats accumulated since the last call to FlushStats.
+  BucketedModelStats FlushStats() LOCKS_EXCLUDED(&mutex_);
+
+ private:
+  // A single padded batch. Owns the padding outputs.
+  struct Batch {
+    std::vector<const ModelInput*> inputs;
+    std::vector<ModelOutput*> outputs;
+    std::vector<ModelOutput> padding_outputs;
+  };
+
+  // Returns the index of the smallest bucket that can hold `n` inferences, or
+  // `bucket_sizes_.size()` if there's no such bucket.
+  size_t GetBucketIndex(size_t n) const;
+
+  // Splits `inputs` into padded batches.
+  std::vector<std::unique_ptr<Batch>> MakeBatches(
+      const std::vector<const ModelInput*>& inputs,
+      const std::vector<ModelOutput*>& outputs) LOCKS_EXCLUDED(&mutex_);
+
+  // Runs `batches[i]` and the batches after it asynchronously, then calls
+  // `done`.
+  void RunBatchesAsync(
+      std::shared_ptr<std::vector<std::unique_ptr<Batch>>> batches, size_t i,
+      std::string* model_name, std::function<void()> done);
+
+  std::unique_ptr<Model> impl_;
+  std::vector<int> bucket_sizes_;
+  const bool split_oversized_;
+
+  // Set while the wrapped model's input buffer is lent out.
+  bool input_buffer_lent_ = false;
+
+  absl::Mutex mutex_;
+  BucketedModelStats stats_ GUARDED_BY(&mutex_);
+};
+
+}  // namespace minigo
+
+#endif  //  CC_MODEL_BUCKETED_MODEL_H_
@@ -0,0 +1,156 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/bucketed_model.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Model that records the size of each batch it runs and sets each output's
+// value to its input's dedup_key.
+class RecordingModel : public Model {
+ public:
+  explicit RecordingModel(std::vector<size_t>* batch_sizes)
+      : Model("recording", FeatureDescriptor::Create<AgzFeatures>(
+                               FeatureDescriptor::Layout::kNhwc)),
+        batch_sizes_(batch_sizes) {}
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    ASSERT_EQ(inputs.size(), outputs->size());
+    batch_sizes_->push_back(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      (*outputs)[i]->value = inputs[i]->dedup_key;
+    }
+    if (model_name != nullptr) {
+      *model_name = name();
+    }
+  }
+
+ private:
+  std::vector<size_t>* batch_sizes_;
+};
+
+class BucketedModelTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<BucketedModel> NewModel(std::vector<int> bucket_sizes,
+                                          bool split_oversized) {
+    batch_sizes_.clear();
+    return absl::make_unique<BucketedModel>(
+        absl::make_unique<RecordingModel>(&batch_sizes_),
+        std::move(bucket_sizes), split_oversized);
+  }
+
+  // Runs `n` inferences on `model` and checks that every output was written.
+  void Run(BucketedModel* model, size_t n, bool async) {
+    std::vector<ModelInput> inputs(n);
+    std::vector<ModelOutput> outputs(n);
+    std::vector<const ModelInput*> input_ptrs;
+    std::vector<ModelOutput*> output_ptrs;
+    for (size_t i = 0; i < n; ++i) {
+      inputs[i].dedup_key = i + 1;
+      outputs[i].value = 0;
+      input_ptrs.push_back(&inputs[i]);
+      output_ptrs.push_back(&outputs[i]);
+    }
+
+    std::string model_name;
+    if (async) {
+      bool done = false;
+      model->RunManyAsync(input_ptrs, &output_ptrs, &model_name,
+                          [&done]() { done = true; });
+      EXPECT_TRUE(done);
+    } else {
+      model->RunMany(input_ptrs, &output_ptrs, &model_name);
+    }
+
+    EXPECT_EQ("recording", model_name);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_EQ(i + 1, outputs[i].value) << i;
+    }
+  }
+
+  std::vector<size_t> batch_sizes_;
+};
+
+TEST_F(BucketedModelTest, ParseBuckets) {
+  EXPECT_EQ(std::vector<int>({1}), BucketedModel::PowerOfTwoBuckets(1));
+  EXPECT_EQ(std::vector<int>({1, 2, 4, 8}),
+            BucketedModel::PowerOfTwoBuckets(5));
+  EXPECT_EQ(std::vector<int>({1, 2, 4, 8}),
+            BucketedModel::PowerOfTwoBuckets(8));
+  EXPECT_EQ(std::vector<int>({1, 2, 4}), BucketedModel::ParseBuckets("pow2:3"));
+  EXPECT_EQ(std::vector<int>({16, 4, 8}),
+            BucketedModel::ParseBuckets("16,4,8"));
+
+  // The constructor sorts the buckets and removes duplicates.
+  auto model = NewModel({16, 4, 8, 4}, false);
+  EXPECT_EQ(std::vector<int>({4, 8, 16}), model->bucket_sizes());
+}
+
+TEST_F(BucketedModelTest, Pad) {
+  for (bool async : {false, true}) {
+    auto model = NewModel({4, 8}, false);
+    Run(model.get(), 1, async);
+    Run(model.get(), 4, async);
+    Run(model.get(), 5, async);
+    EXPECT_EQ(std::vector<size_t>({4, 4, 8}), batch_sizes_);
+
+    auto stats = model->FlushStats();
+    EXPECT_EQ(3, stats.num_batches);
+    EXPECT_EQ(10, stats.num_inferences);
+    EXPECT_EQ(6, stats.num_padding);
+    EXPECT_EQ(0, stats.num_oversized);
+    EXPECT_EQ(std::vector<size_t>({2, 1}), stats.bucket_counts);
+
+    // Flushing resets the stats.
+    stats = model->FlushStats();
+    EXPECT_EQ(0, stats.num_inferences);
+    EXPECT_EQ(std::vector<size_t>({0, 0}), stats.bucket_counts);
+  }
+}
+
+TEST_F(BucketedModelTest, Oversized) {
+  for (bool async : {false, true}) {
+    // Oversized requests are run unpadded.
+    auto model = NewModel({4}, false);
+    Run(model.get(), 10, async);
+    EXPECT_EQ(std::vector<size_t>({10}), batch_sizes_);
+    auto stats = model->FlushStats();
+    EXPECT_EQ(1, stats.num_batches);
+    EXPECT_EQ(0, stats.num_padding);
+    EXPECT_EQ(1, stats.num_oversized);
+    EXPECT_EQ(std::vector<size_t>({0}), stats.bucket_counts);
+
+    // Oversized requests are split, and the remainder padded.
+    model = NewModel({2, 4}, true);
+    Run(model.get(), 9, async);
+    EXPECT_EQ(std::vector<size_t>({4, 4, 2}), batch_sizes_);
+    stats = model->FlushStats();
+    EXPECT_EQ(3, stats.num_batches);
+    EXPECT_EQ(1, stats.num_padding);
+    EXPECT_EQ(1, stats.num_oversized);
+    EXPECT_EQ(std::vector<size_t>({1, 2}), stats.bucket_counts);
+  }
+}
+
+}  // namespace
+}  // namespace minigo
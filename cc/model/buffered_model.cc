@@ -14,10 +14,25 @@
 
 #include "cc/model/buffered_model.h"
 
+#include <atomic>
+#include <utility>
+
+#include "absl/synchronization/notification.h"
+
 namespace minigo {
 
-BufferedModel::BufferedModel(std::vector<std::unique_ptr<Model>> impls)
-    : Model(impls[0]->name(), impls[0]->feature_descriptor()) {
+struct BufferedModel::Split {
+  std::vector<std::vector<const ModelInput*>> inputs;
+  std::vector<std::vector<ModelOutput*>> outputs;
+  std::atomic<size_t> num_remaining{0};
+  std::function<void()> done;
+};
+
+BufferedModel::BufferedModel(std::vector<std::unique_ptr<Model>> impls,
+                             size_t min_split_size)
+    : Model(impls[0]->name(), impls[0]->feature_descriptor()),
+      impls_(impls.size()),
+      min_split_size_(min_split_size) {
   for (auto& x : impls) {
     // Make sure all impls use the same name & input features.
     MG_CHECK(x->name() == name());
@@ -32,9 +47,85 @@ BufferedModel::BufferedModel(std::vector<std::unique_ptr<Model>> impls)
 void BufferedModel::RunMany(const std::vector<const ModelInput*>& inputs,
                             std::vector<ModelOutput*>* outputs,
                             std::string* model_name) {
-  auto impl = impls_.Pop();
-  impl->RunMany(inputs, outputs, model_name);
-  impls_.Push(std::move(impl));
+  auto impls = AcquireImpls(inputs.size());
+  if (impls.size() == 1) {
+    impls[0]->RunMany(inputs, outputs, model_name);
+    impls_.Push(std::move(impls[0]));
+    return;
+  }
+
+  absl::Notification notification;
+  RunSplitAsync(std::move(impls), inputs, outputs, model_name,
+                [&notification]() { notification.Notify(); });
+  notification.WaitForNotification();
+}
+
+void BufferedModel::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                                 std::vector<ModelOutput*>* outputs,
+                                 std::string* model_name,
+                                 std::function<void()> done) {
+  auto impls = AcquireImpls(inputs.size());
+  if (impls.size() > 1) {
+    RunSplitAsync(std::move(impls), inputs, outputs, model_name,
+                  std::move(done));
+    return;
+  }
+
+  // std::function requires a copyable closure, so temporarily release
+  // ownership of the impl while it's running.
+  auto* impl = impls[0].release();
+  impl->RunManyAsync(inputs, outputs, model_name,
+                     [this, impl, done = std::move(done)]() {
+                       impls_.Push(std::unique_ptr<Model>(impl));
+                       done();
+                     });
+}
+
+std::vector<std::unique_ptr<Model>> BufferedModel::AcquireImpls(
+    size_t num_inferences) {
+  std::vector<std::unique_ptr<Model>> impls;
+  impls.push_back(impls_.Pop());
+  if (min_split_size_ != 0) {
+    std::unique_ptr<Model> impl;
+    while ((impls.size() + 1) * min_split_size_ <= num_inferences &&
+           impls_.TryPop(&impl)) {
+      impls.push_back(std::move(impl));
+    }
+  }
+  return impls;
+}
+
+void BufferedModel::RunSplitAsync(std::vector<std::unique_ptr<Model>> impls,
+                                  const std::vector<const ModelInput*>& inputs,
+                                  std::vector<ModelOutput*>* outputs,
+                                  std::string* model_name,
+                                  std::function<void()> done) {
+  // Partition the request as evenly as possible.
+  auto num_parts = impls.size();
+  auto split = std::make_shared<Split>();
+  split->inputs.resize(num_parts);
+  split->outputs.resize(num_parts);
+  for (size_t i = 0; i < num_parts; ++i) {
+    auto begin = inputs.size() * i / num_parts;
+    auto end = inputs.size() * (i + 1) / num_parts;
+    split->inputs[i].assign(inputs.begin() + begin, inputs.begin() + end);
+    split->outputs[i].assign(outputs->begin() + begin,
+                             outputs->begin() + end);
+  }
+  split->num_remaining = num_parts;
+  split->done = std::move(done);
+
+  // All impls have the same name, so only the first part reports it.
+  for (size_t i = 0; i < num_parts; ++i) {
+    auto* impl = impls[i].release();
+    impl->RunManyAsync(split->inputs[i], &split->outputs[i],
+                       i == 0 ? model_name : nullptr, [this, impl, split]() {
+                         impls_.Push(std::unique_ptr<Model>(impl));
+                         if (--split->num_remaining == 0) {
+                           split->done();
+                         }
+                       });
+  }
 }
 
 }  // namespace minigo
@@ -19,21 +19,51 @@
 #include <string>
 #include <vector>
 
-#include "cc/async/thread_safe_queue.h"
+#include "cc/async/bounded_queue.h"
 #include "cc/model/model.h"
 
 namespace minigo {
 
+// Runs inference on the first free model in a pool of identical models.
 class BufferedModel : public Model {
  public:
-  explicit BufferedModel(std::vector<std::unique_ptr<Model>> impls);
+  // min_split_size: if non-zero, a request with at least
+  // `2 * min_split_size` inferences is split evenly across as many free
+  // impls as possible, such that each impl gets at least `min_split_size`
+  // inferences. The parts run concurrently on impls whose RunManyAsync is
+  // asynchronous (e.g. TfDualNet & LiteDualNet) and one after another on
+  // those whose RunManyAsync isn't.
+  explicit BufferedModel(std::vector<std::unique_ptr<Model>> impls,
+                         size_t min_split_size = 0);
 
   void RunMany(const std::vector<const ModelInput*>& inputs,
                std::vector<ModelOutput*>* outputs,
                std::string* model_name) override;
 
+  // Runs the request asynchronously on the first free impl, or several if the
+  // request is split. The impls are returned to the pool just before `done`
+  // is called.
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override;
+
  private:
-  ThreadSafeQueue<std::unique_ptr<Model>> impls_;
+  // The parts of a request that has been split across multiple impls.
+  struct Split;
+
+  // Pops the first free impl from the pool, followed by as many other free
+  // impls as a request of `num_inferences` can be split across.
+  std::vector<std::unique_ptr<Model>> AcquireImpls(size_t num_inferences);
+
+  // Runs a request split across `impls` asynchronously.
+  void RunSplitAsync(std::vector<std::unique_ptr<Model>> impls,
+                     const std::vector<const ModelInput*>& inputs,
+                     std::vector<ModelOutput*>* outputs,
+                     std::string* model_name, std::function<void()> done);
+
+  // Holds the free impls, so it never has to hold more than all of them.
+  BoundedQueue<std::unique_ptr<Model>> impls_;
+  const size_t min_split_size_;
 };
 
 }  // namespace minigo
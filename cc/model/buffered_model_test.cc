@@ -0,0 +1,169 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/buffered_model.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "cc/model/model_thread.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// State shared between all the impls of a BufferedModel.
+struct SharedState {
+  absl::Mutex mutex;
+
+  // Number of RunMany calls the impls should wait for before returning.
+  int num_concurrent GUARDED_BY(&mutex) = 1;
+
+  int num_started GUARDED_BY(&mutex) = 0;
+  std::vector<size_t> batch_sizes GUARDED_BY(&mutex);
+};
+
+// Model that runs asynchronously on its own thread like TfDualNet does, and
+// sets each output's value to its input's dedup_key.
+// RunMany blocks until `num_concurrent` calls have started across all the
+// impls, which checks that they really do run in parallel.
+class ThreadedModel : public Model {
+ public:
+  explicit ThreadedModel(SharedState* state)
+      : Model("threaded", FeatureDescriptor::Create<AgzFeatures>(
+                              FeatureDescriptor::Layout::kNhwc)),
+        state_(state),
+        thread_(this) {}
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    {
+      absl::MutexLock lock(&state_->mutex);
+      state_->num_started += 1;
+      state_->batch_sizes.push_back(inputs.size());
+      auto all_started = [this]() EXCLUSIVE_LOCKS_REQUIRED(&state_->mutex) {
+        return state_->num_started >= state_->num_concurrent;
+      };
+      EXPECT_TRUE(state_->mutex.AwaitWithTimeout(absl::Condition(&all_started),
+                                                 absl::Seconds(10)));
+    }
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      (*outputs)[i]->value = inputs[i]->dedup_key;
+    }
+    if (model_name != nullptr) {
+      *model_name = name();
+    }
+  }
+
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done) override {
+    thread_.RunManyAsync(inputs, outputs, model_name, std::move(done));
+  }
+
+ private:
+  SharedState* state_;
+  ModelThread thread_;
+};
+
+class BufferedModelTest : public ::testing::Test {
+ protected:
+  std::unique_ptr<BufferedModel> NewModel(int num_impls,
+                                          size_t min_split_size) {
+    std::vector<std::unique_ptr<Model>> impls;
+    for (int i = 0; i < num_impls; ++i) {
+      impls.push_back(absl::make_unique<ThreadedModel>(&state_));
+    }
+    return absl::make_unique<BufferedModel>(std::move(impls), min_split_size);
+  }
+
+  // Runs `n` inferences on `model`, expecting them to be split into
+  // `num_parts` batches, and checks that every output was written.
+  void Run(BufferedModel* model, size_t n, int num_parts, bool async) {
+    {
+      absl::MutexLock lock(&state_.mutex);
+      state_.num_concurrent = num_parts;
+      state_.num_started = 0;
+      state_.batch_sizes.clear();
+    }
+
+    std::vector<ModelInput> inputs(n);
+    std::vector<ModelOutput> outputs(n);
+    std::vector<const ModelInput*> input_ptrs;
+    std::vector<ModelOutput*> output_ptrs;
+    for (size_t i = 0; i < n; ++i) {
+      inputs[i].dedup_key = i + 1;
+      outputs[i].value = 0;
+      input_ptrs.push_back(&inputs[i]);
+      output_ptrs.push_back(&outputs[i]);
+    }
+
+    std::string model_name;
+    if (async) {
+      absl::Notification done;
+      model->RunManyAsync(input_ptrs, &output_ptrs, &model_name,
+                          [&done]() { done.Notify(); });
+      done.WaitForNotification();
+    } else {
+      model->RunMany(input_ptrs, &output_ptrs, &model_name);
+    }
+
+    EXPECT_EQ("threaded", model_name);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_EQ(i + 1, outputs[i].value) << i;
+    }
+
+    absl::MutexLock lock(&state_.mutex);
+    EXPECT_EQ(num_parts, state_.batch_sizes.size());
+    auto minmax = std::minmax_element(state_.batch_sizes.begin(),
+                                      state_.batch_sizes.end());
+    EXPECT_LE(*minmax.second - *minmax.first, 1);
+  }
+
+  SharedState state_;
+};
+
+TEST_F(BufferedModelTest, NoSplit) {
+  for (bool async : {false, true}) {
+    auto model = NewModel(3, 0);
+    Run(model.get(), 100, 1, async);
+  }
+}
+
+TEST_F(BufferedModelTest, Split) {
+  for (bool async : {false, true}) {
+    auto model = NewModel(3, 4);
+
+    // Too small to split.
+    Run(model.get(), 7, 1, async);
+
+    // Split across two of the three impls.
+    Run(model.get(), 8, 2, async);
+    Run(model.get(), 11, 2, async);
+
+    // Split across all impls.
+    Run(model.get(), 12, 3, async);
+    Run(model.get(), 100, 3, async);
+  }
+}
+
+}  // namespace
+}  // namespace minigo
@@ -55,6 +55,12 @@ std::string ModelMetadata::DebugString() const {
   return absl::StrCat("{", absl::StrJoin(items, ", "), "}");
 }
 
+ModelBytes::ModelBytes(std::string bytes) {
+  auto owner = std::make_shared<const std::string>(std::move(bytes));
+  bytes_ = *owner;
+  owner_ = std::move(owner);
+}
+
 ModelFactory::~ModelFactory() = default;
 
 }  // namespace minigo
@@ -14,13 +14,16 @@
 #ifndef CC_MODEL_MODEL_FACTORY_H_
 #define CC_MODEL_MODEL_FACTORY_H_
 
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/variant.h"
 #include "cc/logging.h"
 #include "cc/model/model.h"
@@ -75,14 +78,99 @@ class ModelMetadata {
 
   std::string DebugString() const;
 
+  using const_iterator =
+      absl::flat_hash_map<std::string, ModelProperty>::const_iterator;
+  const_iterator begin() const { return impl_.begin(); }
+  const_iterator end() const { return impl_.end(); }
+
  private:
   absl::flat_hash_map<std::string, ModelProperty> impl_;
 };
 
+// Read-only, reference counted model data (e.g. a frozen GraphDef).
+// Copying a ModelBytes, for example by copying the ModelDefinition that holds
+// it, doesn't copy the data: all copies reference the same bytes, which are
+// freed when the last copy is destroyed. This lets every instance of a model
+// share a single copy of its data.
+class ModelBytes {
+ public:
+  ModelBytes() = default;
+
+  // Takes ownership of `bytes`.
+  explicit ModelBytes(std::string bytes);
+
+  // References `bytes`, which must remain valid for as long as `owner` (or
+  // any copy of it) is alive.
+  ModelBytes(std::shared_ptr<const void> owner, absl::string_view bytes)
+      : owner_(std::move(owner)), bytes_(bytes) {}
+
+  const char* data() const { return bytes_.data(); }
+  size_t size() const { return bytes_.size(); }
+  bool empty() const { return bytes_.empty(); }
+  absl::string_view view() const { return bytes_; }
+
+  // The object that keeps the bytes alive.
+  const std::shared_ptr<const void>& owner() const { return owner_; }
+
+ private:
+  std::shared_ptr<const void> owner_;
+  absl::string_view bytes_;
+};
+
 struct ModelDefinition {
   std::string path;
   ModelMetadata metadata;
-  std::string model_bytes;
+  ModelBytes model_bytes;
+};
+
+// A thread safe cache of objects built from a model's bytes (e.g. a compiled
+// graph), used by factories to share a single object between all instances of
+// the same model. The cache only holds weak references: each object is
+// destroyed along with the last model instance that uses it.
+template <typename T>
+class SharedModelCache {
+ public:
+  // Returns the object built from `bytes` & `key`, calling `create` to build
+  // it if there isn't one alive. `key` distinguishes between different objects
+  // built from the same bytes.
+  std::shared_ptr<T> GetOrCreate(
+      const ModelBytes& bytes, const std::string& key,
+      const std::function<std::shared_ptr<T>()>& create) {
+    absl::MutexLock lock(&mutex_);
+
+    // Entries are only valid while their bytes are alive, otherwise a new
+    // model could have been loaded at the same address.
+    std::shared_ptr<T> result;
+    auto it = entries_.begin();
+    while (it != entries_.end()) {
+      auto value = it->value.lock();
+      if (value == nullptr || it->owner.expired()) {
+        it = entries_.erase(it);
+        continue;
+      }
+      if (it->data == bytes.data() && it->key == key) {
+        result = std::move(value);
+      }
+      ++it;
+    }
+
+    if (result == nullptr) {
+      result = create();
+      entries_.push_back({bytes.owner(), bytes.data(), key, result});
+    }
+    return result;
+  }
+
+ private:
+  struct Entry {
+    std::weak_ptr<const void> owner;
+    const char* data;
+    std::string key;
+    std::weak_ptr<T> value;
+  };
+
+  absl::Mutex mutex_;
+  std::vector<Entry> entries_ GUARDED_BY(&mutex_);
 };
 
 // Factory that creates Model instances.
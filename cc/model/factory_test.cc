@@ -0,0 +1,72 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/factory.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(ModelBytesTest, CopiesShareBytes) {
+  ModelBytes a(std::string("model"));
+  ModelBytes b = a;
+  EXPECT_EQ("model", a.view());
+  EXPECT_EQ(a.data(), b.data());
+  EXPECT_EQ(a.owner(), b.owner());
+
+  // The bytes outlive the original.
+  a = ModelBytes();
+  EXPECT_TRUE(a.empty());
+  EXPECT_EQ("model", b.view());
+}
+
+TEST(SharedModelCacheTest, SharesObjects) {
+  SharedModelCache<std::string> cache;
+  ModelBytes bytes(std::string("model"));
+  ModelBytes copy = bytes;
+  ModelBytes other(std::string("model"));
+
+  int num_created = 0;
+  auto create = [&num_created]() {
+    num_created += 1;
+    return std::make_shared<std::string>(std::to_string(num_created));
+  };
+
+  // Copies of the same bytes share an object.
+  auto a = cache.GetOrCreate(bytes, "", create);
+  auto b = cache.GetOrCreate(copy, "", create);
+  EXPECT_EQ(1, num_created);
+  EXPECT_EQ(a, b);
+
+  // Different bytes or keys don't.
+  auto c = cache.GetOrCreate(other, "", create);
+  auto d = cache.GetOrCreate(bytes, "int8", create);
+  EXPECT_EQ(3, num_created);
+  EXPECT_NE(a, c);
+  EXPECT_NE(a, d);
+
+  // Objects are rebuilt once all their users have been destroyed.
+  a.reset();
+  b.reset();
+  auto e = cache.GetOrCreate(bytes, "", create);
+  EXPECT_EQ(4, num_created);
+  EXPECT_EQ("4", *e);
+}
+
+}  // namespace
+}  // namespace minigo
@@ -14,6 +14,8 @@
 
 #include "cc/model/features.h"
 
+#include <cstring>
+
 #include "cc/logging.h"
 
 namespace minigo {
@@ -40,4 +42,45 @@ FeatureDescriptor FeatureDescriptor::Create(absl::string_view input_features,
   }
 }
 
+// Both PackFeatures and UnpackFeatures process eight features at a time as a
+// little endian uint64.
+void PackFeatures(absl::Span<const uint8_t> features, uint8_t* packed) {
+  size_t n = features.size();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t x;
+    memcpy(&x, features.data() + i, sizeof(x));
+    MG_DCHECK((x & ~0x0101010101010101ull) == 0);
+    // Gathers bit 0 of byte j into bit j of the top byte.
+    *packed++ = (x * 0x0102040810204080ull) >> 56;
+  }
+  if (i < n) {
+    uint8_t bits = 0;
+    for (int j = 0; i + j < n; ++j) {
+      MG_DCHECK(features[i + j] <= 1);
+      bits |= features[i + j] << j;
+    }
+    *packed = bits;
+  }
+}
+
+void UnpackFeatures(absl::Span<const uint8_t> packed,
+                    absl::Span<uint8_t> features) {
+  size_t n = features.size();
+  MG_CHECK(packed.size() == static_cast<size_t>(GetPackedFeaturesSize(n)));
+  const auto* src = packed.data();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    // Broadcasts the packed byte, keeps bit j in byte j, then moves each
+    // remaining bit to bit 0 of its byte.
+    uint64_t x = *src++ * 0x0101010101010101ull;
+    x &= 0x8040201008040201ull;
+    x = ((x + 0x7f7f7f7f7f7f7f7full) >> 7) & 0x0101010101010101ull;
+    memcpy(features.data() + i, &x, sizeof(x));
+  }
+  for (int j = 0; i < n; ++i, ++j) {
+    features[i] = (*src >> j) & 1;
+  }
+}
+
 }  // namespace minigo
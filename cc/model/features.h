@@ -431,6 +431,23 @@ constexpr int kMaxNumFeaturePlanes =
 template <typename T>
 using BoardFeatureBuffer = std::array<T, kNumPoints * kMaxNumFeaturePlanes>;
 
+// All feature planes are binary, so features written by
+// FeatureDescriptor::set_bytes can be packed eight to a byte, least
+// significant bit first, e.g. for writing to training examples.
+// Returns the number of bytes needed to pack `num_features` features.
+constexpr int GetPackedFeaturesSize(int num_features) {
+  return (num_features + 7) / 8;
+}
+
+// Packs `features`, each of which must be 0 or 1, into
+// `GetPackedFeaturesSize(features.size())` bytes at `packed`.
+void PackFeatures(absl::Span<const uint8_t> features, uint8_t* packed);
+
+// Unpacks the features packed by PackFeatures into `features`. `packed` must
+// hold `GetPackedFeaturesSize(features.size())` bytes.
+void UnpackFeatures(absl::Span<const uint8_t> packed,
+                    absl::Span<uint8_t> features);
+
 }  // namespace minigo
 
 #endif  //  CC_MODEL_FEATURES_H_
@@ -15,6 +15,7 @@
 #include "cc/model/features.h"
 
 #include <memory>
+#include <vector>
 
 #include "cc/model/types.h"
 #include "cc/position.h"
@@ -366,5 +367,54 @@ TEST(FeaturesTest, CompareNhwcNchw) {
   }
 }
 
+TEST(FeaturesTest, PackFeatures) {
+  Random rnd(454, 43264);
+  for (int size : {0, 1, 7, 8, 9, 63, 64, kNumPoints * 17 + 3}) {
+    std::vector<uint8_t> features(size);
+    for (auto& f : features) {
+      f = rnd.UniformInt(0, 1);
+    }
+
+    std::vector<uint8_t> packed(GetPackedFeaturesSize(size), 0xff);
+    PackFeatures(features, packed.data());
+    for (int i = 0; i < size; ++i) {
+      ASSERT_EQ(features[i], (packed[i / 8] >> (i % 8)) & 1) << i;
+    }
+    if (size % 8 != 0) {
+      // Padding bits are zero.
+      EXPECT_EQ(0, packed.back() >> (size % 8));
+    }
+
+    std::vector<uint8_t> unpacked(size, 0xff);
+    UnpackFeatures(packed, absl::MakeSpan(unpacked));
+    EXPECT_EQ(features, unpacked);
+  }
+}
+
+// Verify that the features of real positions round trip through packing.
+TEST(FeaturesTest, PackPositionFeatures) {
+  Random rnd(454, 43265);
+  TestablePosition position("");
+  for (int i = 0; i < kN * kN / 2; ++i) {
+    position.PlayMove(GetRandomLegalMove(position, &rnd));
+  }
+  ModelInput input;
+  input.sym = symmetry::kIdentity;
+  input.position_history.push_back(&position);
+
+  auto desc = FeatureDescriptor::Create<Mlperf07Features>(
+      FeatureDescriptor::Layout::kNhwc);
+  BackedTensor<uint8_t> features(desc.GetInputShape(1));
+  desc.set_bytes({&input}, &features.tensor());
+
+  absl::Span<const uint8_t> expected(features.tensor().data,
+                                     features.tensor().shape.num_elements());
+  std::vector<uint8_t> packed(GetPackedFeaturesSize(expected.size()));
+  PackFeatures(expected, packed.data());
+  std::vector<uint8_t> actual(expected.size());
+  UnpackFeatures(packed, absl::MakeSpan(actual));
+  EXPECT_EQ(std::vector<uint8_t>(expected.begin(), expected.end()), actual);
+}
+
 }  // namespace
 }  // namespace minigo
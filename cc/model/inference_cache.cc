@@ -14,9 +14,15 @@
 
 #include "cc/model/inference_cache.h"
 
+#include <algorithm>
 #include <tuple>
+#include <utility>
 
+#include "absl/hash/hash.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/strip.h"
+#include "cc/platform/utils.h"
 
 namespace minigo {
 
@@ -54,8 +60,38 @@ InferenceCache::Key::Key(Coord prev_move, symmetry::Symmetry canonical_sym,
   }
 }
 
+uint64_t InferenceCache::Key::Fingerprint(
+    symmetry::Symmetry canonical_sym) const {
+  uint64_t h = absl::Hash<std::tuple<zobrist::Hash, zobrist::Hash, int>>()(
+      std::make_tuple(cache_hash_, stone_hash_,
+                      static_cast<int>(canonical_sym)));
+  return h != 0 ? h : 1;
+}
+
 InferenceCache::~InferenceCache() = default;
 
+InferenceCache::AdmissionPolicy::~AdmissionPolicy() = default;
+
+void InferenceCache::MergeMany(absl::Span<const Request> requests) {
+  for (const auto& req : requests) {
+    Merge(req.key, req.move_number, req.canonical_sym, req.inference_sym,
+          req.output);
+  }
+}
+
+int InferenceCache::TryGetMany(absl::Span<const Request> requests,
+                               absl::Span<bool> hits) {
+  MG_CHECK(hits.size() == requests.size());
+  int num_hits = 0;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const auto& req = requests[i];
+    hits[i] = TryGet(req.key, req.move_number, req.canonical_sym,
+                     req.inference_sym, req.output);
+    num_hits += hits[i];
+  }
+  return num_hits;
+}
+
 std::ostream& operator<<(std::ostream& os, const InferenceCache::Stats& stats) {
   auto num_lookups =
       stats.num_hits + stats.num_complete_misses + stats.num_symmetry_misses;
@@ -69,16 +105,108 @@ std::ostream& operator<<(std::ostream& os, const InferenceCache::Stats& stats) {
             << " hits:" << stats.num_hits
             << " complete_misses:" << stats.num_complete_misses
             << " symmetry_misses:" << stats.num_symmetry_misses
+            << " rejections:" << stats.num_rejections
             << " hit_rate:" << (100 * hit_rate) << "%";
 }
 
+TinyLfuAdmissionPolicy::TinyLfuAdmissionPolicy(size_t capacity) {
+  // Allocate roughly 16 counters per cache element, rounded up to a power of
+  // two so that hashes can be mapped to counters with a mask.
+  size_t num_counters = 64;
+  while (num_counters < 16 * capacity) {
+    num_counters *= 2;
+  }
+  counters_.resize(num_counters / 16, 0);
+  counter_mask_ = num_counters - 1;
+
+  // Halve all the counters after this many accesses.
+  sample_size_ = 10 * capacity;
+}
+
+size_t TinyLfuAdmissionPolicy::CounterIdx(int i,
+                                          InferenceCache::Key key) const {
+  static constexpr uint64_t kSeeds[kNumHashes] = {
+      0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull, 0x9ae16a3b2f90404full,
+      0xcbf29ce484222325ull};
+  // Mix the bits of the key's hash with a SplitMix64 finalizer rather than
+  // using absl::Hash: absl::Hash is seeded per process, which would make the
+  // sketch's collisions (and therefore its admission decisions)
+  // nondeterministic.
+  uint64_t h = key.cache_hash_ + kSeeds[i];
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return static_cast<size_t>(h) & counter_mask_;
+}
+
+void TinyLfuAdmissionPolicy::RecordAccess(InferenceCache::Key key,
+                                          int move_number) {
+  for (int i = 0; i < kNumHashes; ++i) {
+    auto idx = CounterIdx(i, key);
+    if (GetCounter(idx) < kMaxCount) {
+      counters_[idx / 16] += uint64_t(1) << (4 * (idx % 16));
+    }
+  }
+
+  if (++num_accesses_ == sample_size_) {
+    // Age the sketch by halving all the counters.
+    for (auto& x : counters_) {
+      x = (x >> 1) & 0x7777777777777777ull;
+    }
+    num_accesses_ /= 2;
+  }
+}
+
+int TinyLfuAdmissionPolicy::EstimateFrequency(InferenceCache::Key key) const {
+  int result = kMaxCount;
+  for (int i = 0; i < kNumHashes; ++i) {
+    result = std::min(result, GetCounter(CounterIdx(i, key)));
+  }
+  return result;
+}
+
+bool TinyLfuAdmissionPolicy::Admit(InferenceCache::Key candidate,
+                                   int candidate_move_number,
+                                   InferenceCache::Key victim) {
+  // Ties go to the candidate, so that among keys with the same frequency (e.g.
+  // keys that have only been looked up once) the cache still behaves as an LRU
+  // cache.
+  return EstimateFrequency(candidate) >= EstimateFrequency(victim);
+}
+
+bool MoveNumberAdmissionPolicy::Admit(InferenceCache::Key candidate,
+                                      int candidate_move_number,
+                                      InferenceCache::Key victim) {
+  return candidate_move_number <= max_move_number_;
+}
+
+std::unique_ptr<InferenceCache::AdmissionPolicy> NewAdmissionPolicy(
+    absl::string_view desc, size_t capacity) {
+  if (desc.empty() || desc == "all") {
+    return nullptr;
+  }
+  if (desc == "tinylfu") {
+    return absl::make_unique<TinyLfuAdmissionPolicy>(capacity);
+  }
+  if (absl::ConsumePrefix(&desc, "move_number:")) {
+    int max_move_number;
+    MG_CHECK(absl::SimpleAtoi(desc, &max_move_number))
+        << "Invalid max move number \"" << desc << "\"";
+    return absl::make_unique<MoveNumberAdmissionPolicy>(max_move_number);
+  }
+  MG_LOG(FATAL) << "Unrecognized admission policy \"" << desc << "\"";
+  return nullptr;
+}
+
 void NullInferenceCache::Clear() {}
 
-void NullInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
+void NullInferenceCache::Merge(Key key, int move_number,
+                               symmetry::Symmetry canonical_sym,
                                symmetry::Symmetry inference_sym,
                                ModelOutput* output) {}
 
-bool NullInferenceCache::TryGet(Key key, symmetry::Symmetry canonical_sym,
+bool NullInferenceCache::TryGet(Key key, int move_number,
+                                symmetry::Symmetry canonical_sym,
                                 symmetry::Symmetry inference_sym,
                                 ModelOutput* output) {
   stats_.num_complete_misses += 1;
@@ -97,14 +225,20 @@ size_t BasicInferenceCache::CalculateCapacity(size_t size_mb) {
 
   // absl::node_hash_map allocates each (key, value) pair on the heap and stores
   // pointers to those pairs in the table itself, along with one byte of hash
-  // for each element.
+  // for each element. Note that the Key is stored twice per element (once as
+  // the map key and once in the Element).
+  // The memory used by the admission policy isn't included: TinyLfu's sketch
+  // takes at most 16 bytes per element, which is noise next to the
+  // ModelOutput.
   float element_size =
       sizeof(Map::value_type) + (sizeof(Map::value_type*) + 1) / load_factor;
 
   return static_cast<size_t>(size_mb * 1024.0f * 1024.0f / element_size);
 }
 
-BasicInferenceCache::BasicInferenceCache(size_t capacity) {
+BasicInferenceCache::BasicInferenceCache(
+    size_t capacity, std::unique_ptr<AdmissionPolicy> admission_policy)
+    : admission_policy_(std::move(admission_policy)) {
   MG_CHECK(capacity > 0);
   stats_.capacity = capacity;
   Clear();
@@ -117,11 +251,24 @@ void BasicInferenceCache::Clear() {
   map_.clear();
 }
 
-void BasicInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
+void BasicInferenceCache::Merge(Key key, int move_number,
+                                symmetry::Symmetry canonical_sym,
                                 symmetry::Symmetry inference_sym,
                                 ModelOutput* output) {
+  // Merge doesn't record an access: every Merge follows a lookup of the same
+  // key that has already recorded one.
   if (map_.size() == stats_.capacity) {
-    // Cache is full, remove the last element from the LRU queue.
+    // Cache is full: if this is a new key, check that the admission policy
+    // prefers it over the element that would be evicted. Rejecting a new key
+    // leaves `output` unchanged, exactly as if it had been inserted.
+    if (admission_policy_ != nullptr && map_.find(key) == map_.end() &&
+        !admission_policy_->Admit(key, move_number,
+                                  static_cast<Element*>(list_.prev)->key)) {
+      stats_.num_rejections += 1;
+      return;
+    }
+
+    // Remove the last element from the LRU queue.
     auto it = map_.find(static_cast<Element*>(list_.prev)->key);
     MG_CHECK(it != map_.end());
     Unlink(&it->second);
@@ -174,16 +321,85 @@ void BasicInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
   PushFront(elem);
 }
 
-bool BasicInferenceCache::TryGet(Key key, symmetry::Symmetry canonical_sym,
+bool BasicInferenceCache::TryGet(Key key, int move_number,
+                                 symmetry::Symmetry canonical_sym,
                                  symmetry::Symmetry inference_sym,
                                  ModelOutput* output) {
+  if (admission_policy_ != nullptr) {
+    admission_policy_->RecordAccess(key, move_number);
+  }
+
   auto it = map_.find(key);
   if (it == map_.end()) {
     stats_.num_complete_misses += 1;
     return false;
   }
+  return TryGetImpl(&it->second, canonical_sym, inference_sym, output);
+}
+
+void BasicInferenceCache::MergeMany(absl::Span<const Request> requests) {
+  // Merging may evict elements from the cache, so we can't hold on to the
+  // results of these lookups: they're only used to warm up the cache lines
+  // that the Merge calls below will touch.
+  for (const auto& req : requests) {
+    auto it = map_.find(req.key);
+    if (it != map_.end()) {
+      Prefetch(&it->second);
+    }
+  }
+  for (const auto& req : requests) {
+    Merge(req.key, req.move_number, req.canonical_sym, req.inference_sym,
+          req.output);
+  }
+}
+
+int BasicInferenceCache::TryGetMany(absl::Span<const Request> requests,
+                                    absl::Span<bool> hits) {
+  MG_CHECK(hits.size() == requests.size());
+
+  // TryGet never removes elements from the cache, so the element pointers
+  // found in the first pass remain valid for the second.
+  elems_.clear();
+  for (const auto& req : requests) {
+    if (admission_policy_ != nullptr) {
+      admission_policy_->RecordAccess(req.key, req.move_number);
+    }
+    auto it = map_.find(req.key);
+    Element* elem = nullptr;
+    if (it != map_.end()) {
+      elem = &it->second;
+      Prefetch(elem);
+    }
+    elems_.push_back(elem);
+  }
+
+  int num_hits = 0;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const auto& req = requests[i];
+    if (elems_[i] == nullptr) {
+      stats_.num_complete_misses += 1;
+      hits[i] = false;
+    } else {
+      hits[i] = TryGetImpl(elems_[i], req.canonical_sym, req.inference_sym,
+                           req.output);
+      num_hits += hits[i];
+    }
+  }
+  return num_hits;
+}
 
-  auto* elem = &it->second;
+void BasicInferenceCache::Prefetch(const Element* elem) {
+  const auto* begin = reinterpret_cast<const char*>(elem);
+  const auto* end = begin + sizeof(Element);
+  for (const auto* ptr = begin; ptr < end; ptr += 64) {
+    MG_PREFETCH(ptr);
+  }
+}
+
+bool BasicInferenceCache::TryGetImpl(Element* elem,
+                                     symmetry::Symmetry canonical_sym,
+                                     symmetry::Symmetry inference_sym,
+                                     ModelOutput* output) {
   Unlink(elem);
   PushFront(elem);
 
@@ -209,8 +425,26 @@ BasicInferenceCache::Stats BasicInferenceCache::GetStats() const {
   return stats_;
 }
 
-ThreadSafeInferenceCache::ThreadSafeInferenceCache(size_t total_capacity,
-                                                   int num_shards) {
+struct ThreadSafeInferenceCache::Scratch {
+  std::vector<Request> sorted;
+  std::vector<int> sorted_idx;
+  std::vector<int> shard_begin;
+  std::vector<int> shard_pos;
+
+  // Hit results for the sorted requests.
+  std::unique_ptr<bool[]> hits;
+  size_t hits_capacity = 0;
+};
+
+ThreadSafeInferenceCache::Scratch* ThreadSafeInferenceCache::GetScratch() {
+  // The batched methods never call back into another ThreadSafeInferenceCache
+  // while using the scratch buffers, so one set per thread is enough.
+  static thread_local Scratch scratch;
+  return &scratch;
+}
+
+ThreadSafeInferenceCache::ThreadSafeInferenceCache(
+    size_t total_capacity, int num_shards, absl::string_view admission_policy) {
   shards_.reserve(num_shards);
   size_t shard_capacity_sum = 0;
   for (int i = 0; i < num_shards; ++i) {
@@ -218,7 +452,8 @@ ThreadSafeInferenceCache::ThreadSafeInferenceCache(size_t total_capacity,
     auto b = (i + 1) * total_capacity / num_shards;
     auto shard_capacity = b - a;
     shard_capacity_sum += shard_capacity;
-    shards_.push_back(absl::make_unique<Shard>(shard_capacity));
+    shards_.push_back(absl::make_unique<Shard>(
+        shard_capacity, NewAdmissionPolicy(admission_policy, shard_capacity)));
   }
   MG_CHECK(shard_capacity_sum == total_capacity);
 }
@@ -230,20 +465,104 @@ void ThreadSafeInferenceCache::Clear() {
   }
 }
 
-void ThreadSafeInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
+void ThreadSafeInferenceCache::Merge(Key key, int move_number,
+                                     symmetry::Symmetry canonical_sym,
                                      symmetry::Symmetry inference_sym,
                                      ModelOutput* output) {
   auto* shard = shards_[key.Shard(shards_.size())].get();
   absl::MutexLock lock(&shard->mutex);
-  shard->cache.Merge(key, canonical_sym, inference_sym, output);
+  shard->cache.Merge(key, move_number, canonical_sym, inference_sym, output);
 }
 
-bool ThreadSafeInferenceCache::TryGet(Key key, symmetry::Symmetry canonical_sym,
+bool ThreadSafeInferenceCache::TryGet(Key key, int move_number,
+                                      symmetry::Symmetry canonical_sym,
                                       symmetry::Symmetry inference_sym,
                                       ModelOutput* output) {
   auto* shard = shards_[key.Shard(shards_.size())].get();
   absl::MutexLock lock(&shard->mutex);
-  return shard->cache.TryGet(key, canonical_sym, inference_sym, output);
+  return shard->cache.TryGet(key, move_number, canonical_sym, inference_sym,
+                             output);
+}
+
+void ThreadSafeInferenceCache::MergeMany(absl::Span<const Request> requests) {
+  auto* scratch = GetScratch();
+  SortByShard(requests, scratch);
+  const auto& sorted = scratch->sorted;
+  const auto& shard_begin = scratch->shard_begin;
+
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    auto begin = shard_begin[i];
+    auto end = shard_begin[i + 1];
+    if (begin == end) {
+      continue;
+    }
+    auto* shard = shards_[i].get();
+    absl::MutexLock lock(&shard->mutex);
+    shard->cache.MergeMany(
+        absl::MakeConstSpan(sorted).subspan(begin, end - begin));
+  }
+}
+
+int ThreadSafeInferenceCache::TryGetMany(absl::Span<const Request> requests,
+                                         absl::Span<bool> hits) {
+  MG_CHECK(hits.size() == requests.size());
+
+  auto* scratch = GetScratch();
+  SortByShard(requests, scratch);
+  const auto& sorted = scratch->sorted;
+  const auto& sorted_idx = scratch->sorted_idx;
+  const auto& shard_begin = scratch->shard_begin;
+
+  // std::vector<bool> can't be converted to an absl::Span<bool>.
+  if (scratch->hits_capacity < sorted.size()) {
+    scratch->hits_capacity = sorted.size();
+    scratch->hits.reset(new bool[scratch->hits_capacity]);
+  }
+  auto* sorted_hits = scratch->hits.get();
+  int num_hits = 0;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    auto begin = shard_begin[i];
+    auto end = shard_begin[i + 1];
+    if (begin == end) {
+      continue;
+    }
+    auto* shard = shards_[i].get();
+    absl::MutexLock lock(&shard->mutex);
+    num_hits += shard->cache.TryGetMany(
+        absl::MakeConstSpan(sorted).subspan(begin, end - begin),
+        absl::MakeSpan(sorted_hits + begin, end - begin));
+  }
+
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    hits[sorted_idx[i]] = sorted_hits[i];
+  }
+  return num_hits;
+}
+
+void ThreadSafeInferenceCache::SortByShard(absl::Span<const Request> requests,
+                                           Scratch* scratch) const {
+  int num_shards = static_cast<int>(shards_.size());
+  auto& shard_begin = scratch->shard_begin;
+
+  // Counting sort: first count the number of requests for each shard...
+  shard_begin.assign(num_shards + 1, 0);
+  for (const auto& req : requests) {
+    shard_begin[req.key.Shard(num_shards) + 1] += 1;
+  }
+  for (int i = 0; i < num_shards; ++i) {
+    shard_begin[i + 1] += shard_begin[i];
+  }
+
+  // ... then scatter the requests into their shard's range.
+  auto& pos = scratch->shard_pos;
+  pos.assign(shard_begin.begin(), shard_begin.end() - 1);
+  scratch->sorted.resize(requests.size());
+  scratch->sorted_idx.resize(requests.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    auto j = pos[requests[i].key.Shard(num_shards)]++;
+    scratch->sorted[j] = requests[i];
+    scratch->sorted_idx[j] = static_cast<int>(i);
+  }
 }
 
 InferenceCache::Stats ThreadSafeInferenceCache::GetStats() const {
@@ -256,8 +575,138 @@ InferenceCache::Stats ThreadSafeInferenceCache::GetStats() const {
     result.num_hits += s.num_hits;
     result.num_complete_misses += s.num_complete_misses;
     result.num_symmetry_misses += s.num_symmetry_misses;
+    result.num_rejections += s.num_rejections;
+  }
+  return result;
+}
+
+class NumaInferenceCache::NodeView : public InferenceCache {
+ public:
+  NodeView(NumaInferenceCache* owner, int node, bool remote_lookups)
+      : owner_(owner), node_(node), remote_lookups_(remote_lookups) {}
+
+  void Clear() override { local()->Clear(); }
+
+  void Merge(Key key, int move_number, symmetry::Symmetry canonical_sym,
+             symmetry::Symmetry inference_sym, ModelOutput* output) override {
+    local()->Merge(key, move_number, canonical_sym, inference_sym, output);
+  }
+
+  bool TryGet(Key key, int move_number, symmetry::Symmetry canonical_sym,
+              symmetry::Symmetry inference_sym, ModelOutput* output) override {
+    Request req = {key, move_number, canonical_sym, inference_sym, output};
+    bool hit;
+    TryGetMany({&req, 1}, {&hit, 1});
+    return hit;
+  }
+
+  void MergeMany(absl::Span<const Request> requests) override {
+    local()->MergeMany(requests);
+  }
+
+  int TryGetMany(absl::Span<const Request> requests,
+                 absl::Span<bool> hits) override {
+    int num_hits = local()->TryGetMany(requests, hits);
+    int num_misses = static_cast<int>(requests.size()) - num_hits;
+    if (!remote_lookups_ || num_misses == 0 || owner_->num_nodes() == 1) {
+      return num_hits;
+    }
+
+    // Look the misses up in the other nodes' caches in turn, starting with
+    // the next node so that the remote lookups are spread between nodes.
+    std::vector<Request> misses;
+    std::vector<int> miss_idx;
+    for (size_t i = 0; i < requests.size(); ++i) {
+      if (!hits[i]) {
+        misses.push_back(requests[i]);
+        miss_idx.push_back(static_cast<int>(i));
+      }
+    }
+    num_remote_lookups_ += misses.size();
+
+    std::unique_ptr<bool[]> remote_hits(new bool[misses.size()]);
+    for (int i = 1; i < owner_->num_nodes() && !misses.empty(); ++i) {
+      auto* remote = owner_->caches_[(node_ + i) % owner_->num_nodes()].get();
+      int n = remote->TryGetMany(
+          misses, absl::MakeSpan(remote_hits.get(), misses.size()));
+      if (n == 0) {
+        continue;
+      }
+      num_hits += n;
+      num_remote_hits_ += n;
+
+      // Keep only the requests that are still misses.
+      size_t j = 0;
+      for (size_t k = 0; k < misses.size(); ++k) {
+        if (remote_hits[k]) {
+          hits[miss_idx[k]] = true;
+        } else {
+          misses[j] = misses[k];
+          miss_idx[j] = miss_idx[k];
+          j += 1;
+        }
+      }
+      misses.resize(j);
+      miss_idx.resize(j);
+    }
+    return num_hits;
+  }
+
+  Stats GetStats() const override { return local()->GetStats(); }
+
+  CrossNodeStats GetCrossNodeStats() const {
+    CrossNodeStats result;
+    result.num_remote_lookups = num_remote_lookups_;
+    result.num_remote_hits = num_remote_hits_;
+    return result;
+  }
+
+ private:
+  InferenceCache* local() const { return owner_->caches_[node_].get(); }
+
+  NumaInferenceCache* owner_;
+  const int node_;
+  const bool remote_lookups_;
+  std::atomic<size_t> num_remote_lookups_{0};
+  std::atomic<size_t> num_remote_hits_{0};
+};
+
+NumaInferenceCache::NumaInferenceCache(
+    std::vector<std::unique_ptr<InferenceCache>> node_caches,
+    bool remote_lookups)
+    : caches_(std::move(node_caches)) {
+  MG_CHECK(!caches_.empty());
+  for (size_t i = 0; i < caches_.size(); ++i) {
+    views_.push_back(absl::make_unique<NodeView>(this, static_cast<int>(i),
+                                                 remote_lookups));
+  }
+}
+
+NumaInferenceCache::~NumaInferenceCache() = default;
+
+InferenceCache* NumaInferenceCache::node_cache(int node) {
+  MG_CHECK(node >= 0 && node < num_nodes());
+  return views_[node].get();
+}
+
+InferenceCache::Stats NumaInferenceCache::GetStats() const {
+  InferenceCache::Stats result;
+  for (const auto& cache : caches_) {
+    auto s = cache->GetStats();
+    result.size += s.size;
+    result.capacity += s.capacity;
+    result.num_hits += s.num_hits;
+    result.num_complete_misses += s.num_complete_misses;
+    result.num_symmetry_misses += s.num_symmetry_misses;
+    result.num_rejections += s.num_rejections;
   }
   return result;
 }
 
+NumaInferenceCache::CrossNodeStats NumaInferenceCache::GetCrossNodeStats(
+    int node) const {
+  MG_CHECK(node >= 0 && node < num_nodes());
+  return views_[node]->GetCrossNodeStats();
+}
+
 }  // namespace minigo
@@ -16,13 +16,16 @@
 #define CC_MODEL_INFERENCE_CACHE_H_
 
 #include <array>
+#include <atomic>
 #include <memory>
 #include <ostream>
 #include <vector>
 
 #include "absl/container/node_hash_map.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "cc/constants.h"
 #include "cc/coord.h"
 #include "cc/model/model.h"
@@ -83,7 +86,14 @@ class InferenceCache {
 
     int Shard(int num_shards) const { return cache_hash_ % num_shards; }
 
+    // Returns a non-zero fingerprint of the key's position in the orientation
+    // given by `canonical_sym`, suitable for use as a ModelInput::dedup_key.
+    // Like the inference cache itself, the fingerprint ignores the position
+    // history.
+    uint64_t Fingerprint(symmetry::Symmetry canonical_sym) const;
+
     friend std::ostream& operator<<(std::ostream& os, Key key);
+    friend class TinyLfuAdmissionPolicy;
 
    private:
     // There is a vanishingly small chance that two Positions could have
@@ -95,12 +105,49 @@ class InferenceCache {
     zobrist::Hash stone_hash_ = 0;
   };
 
+  // Decides whether a new key should be inserted into a full cache.
+  // Each BasicInferenceCache owns its own policy, so implementations don't
+  // need to be thread safe.
+  class AdmissionPolicy {
+   public:
+    virtual ~AdmissionPolicy();
+
+    // Called once for every key looked up in the cache (by TryGet or
+    // TryGetMany), so that policies can track how frequently keys are
+    // accessed. Merging a key into the cache isn't counted as an access.
+    // `move_number` is the number of moves played to reach the key's
+    // position.
+    virtual void RecordAccess(Key key, int move_number) = 0;
+
+    // Called when the cache is full and `candidate`, whose position was
+    // reached after `candidate_move_number` moves, isn't in the cache.
+    // Returns true if `candidate` should be inserted into the cache, evicting
+    // the least-recently-used key `victim`.
+    virtual bool Admit(Key candidate, int candidate_move_number,
+                       Key victim) = 0;
+  };
+
+  // The arguments for a single element of a batched `TryGetMany` or
+  // `MergeMany` call. The fields have the same meaning as the arguments of the
+  // same name to `TryGet` and `Merge`.
+  struct Request {
+    Key key;
+    int move_number;
+    symmetry::Symmetry canonical_sym;
+    symmetry::Symmetry inference_sym;
+    ModelOutput* output;
+  };
+
   struct Stats {
     size_t size = 0;
     size_t capacity = 0;
     size_t num_hits = 0;
     size_t num_complete_misses = 0;
     size_t num_symmetry_misses = 0;
+
+    // Number of new keys that weren't inserted into a full cache because they
+    // were rejected by its admission policy.
+    size_t num_rejections = 0;
   };
 
   virtual ~InferenceCache();
@@ -110,34 +157,113 @@ class InferenceCache {
 
   // Merges the (key, inference output) pair into the cache for the given
   // inference symmetry.
+  // `move_number` is the number of moves played to reach the key's position.
+  // It isn't part of the key: it's only passed to the admission policy.
   // If the cache already contains different symmetries for the cache key,
   // the output is updated to contain their average.
   // If the cache is full, the least-recently-used pair is evicted.
-  virtual void Merge(Key key, symmetry::Symmetry canonical_sym,
+  virtual void Merge(Key key, int move_number,
+                     symmetry::Symmetry canonical_sym,
                      symmetry::Symmetry inference_sym, ModelOutput* output) = 0;
 
   // Looks up the inference output for the given features and symmetries.
+  // `move_number` has the same meaning as for `Merge`.
   // If the matching inference symmetry has already been merged into the cache,
   // the average of _all_ symmetries for the position is returned.
   // The features are marked as most-recently-used.
-  virtual bool TryGet(Key key, symmetry::Symmetry canonical_sym,
+  virtual bool TryGet(Key key, int move_number,
+                      symmetry::Symmetry canonical_sym,
                       symmetry::Symmetry inference_sym,
                       ModelOutput* output) = 0;
 
+  // Batched version of `Merge`.
+  // Has the same effect as calling `Merge` on each of the `requests` in order
+  // but gives implementations the opportunity to amortize the cost of locking
+  // & memory accesses across the whole batch.
+  virtual void MergeMany(absl::Span<const Request> requests);
+
+  // Batched version of `TryGet`.
+  // Sets `hits[i]` to the result of calling `TryGet` on `requests[i]`.
+  // `hits.size()` must equal `requests.size()`.
+  // Returns the number of hits.
+  virtual int TryGetMany(absl::Span<const Request> requests,
+                         absl::Span<bool> hits);
+
   virtual Stats GetStats() const = 0;
 };
 
 std::ostream& operator<<(std::ostream& os, const InferenceCache::Stats& stats);
 
+// Admits keys based on an estimate of how frequently they are accessed
+// compared to the key that would be evicted, as described in "TinyLFU: A
+// Highly Efficient Cache Admission Policy" (Einziger et al. 2015).
+// Access frequencies are estimated using a count-min sketch of 4-bit counters,
+// which are halved periodically so that the sketch adapts to changes in the
+// key distribution (e.g. when a game moves out of the opening).
+class TinyLfuAdmissionPolicy : public InferenceCache::AdmissionPolicy {
+ public:
+  // `capacity` is the capacity of the cache that owns the policy and is used
+  // to size the sketch.
+  explicit TinyLfuAdmissionPolicy(size_t capacity);
+
+  void RecordAccess(InferenceCache::Key key, int move_number) override;
+  bool Admit(InferenceCache::Key candidate, int candidate_move_number,
+             InferenceCache::Key victim) override;
+
+  // Returns the estimated access frequency of the given key.
+  int EstimateFrequency(InferenceCache::Key key) const;
+
+ private:
+  static constexpr int kNumHashes = 4;
+  static constexpr int kMaxCount = 15;
+
+  // Returns the index of the counter for the given hash function & key.
+  size_t CounterIdx(int i, InferenceCache::Key key) const;
+
+  int GetCounter(size_t idx) const {
+    return (counters_[idx / 16] >> (4 * (idx % 16))) & 0xf;
+  }
+
+  // Each uint64_t packs 16 4-bit counters.
+  std::vector<uint64_t> counters_;
+  size_t counter_mask_;
+  size_t num_accesses_ = 0;
+  size_t sample_size_;
+};
+
+// Rejects positions that are more than `max_move_number` moves into the game
+// once the cache is full: positions deep into a game are rarely reached by
+// more than one game, while opening positions are shared by many.
+class MoveNumberAdmissionPolicy : public InferenceCache::AdmissionPolicy {
+ public:
+  explicit MoveNumberAdmissionPolicy(int max_move_number)
+      : max_move_number_(max_move_number) {}
+
+  void RecordAccess(InferenceCache::Key key, int move_number) override {}
+  bool Admit(InferenceCache::Key candidate, int candidate_move_number,
+             InferenceCache::Key victim) override;
+
+ private:
+  const int max_move_number_;
+};
+
+// Creates a new admission policy for a cache of the given capacity from a
+// descriptor string. Supported descriptors:
+//   "" or "all" : returns null, meaning all keys are admitted.
+//   "tinylfu" : returns a TinyLfuAdmissionPolicy.
+//   "move_number:N" : returns a MoveNumberAdmissionPolicy(N).
+std::unique_ptr<InferenceCache::AdmissionPolicy> NewAdmissionPolicy(
+    absl::string_view desc, size_t capacity);
+
 // Not thread safe.
 class NullInferenceCache final : public InferenceCache {
  public:
   void Clear() override;
 
-  void Merge(Key key, symmetry::Symmetry canonical_sym,
+  void Merge(Key key, int move_number, symmetry::Symmetry canonical_sym,
              symmetry::Symmetry inference_sym, ModelOutput* output) override;
 
-  bool TryGet(Key key, symmetry::Symmetry canonical_sym,
+  bool TryGet(Key key, int move_number, symmetry::Symmetry canonical_sym,
               symmetry::Symmetry inference_sym, ModelOutput* output) override;
 
   Stats GetStats() const override;
@@ -153,13 +279,23 @@ class BasicInferenceCache : public InferenceCache {
   // an InferenceCache of size_mb MB.
   static size_t CalculateCapacity(size_t size_mb);
 
-  explicit BasicInferenceCache(size_t capacity);
+  // If `admission_policy` is null, all keys are admitted.
+  explicit BasicInferenceCache(
+      size_t capacity,
+      std::unique_ptr<AdmissionPolicy> admission_policy = nullptr);
 
   void Clear() override;
-  void Merge(Key key, symmetry::Symmetry canonical_sym,
+  void Merge(Key key, int move_number, symmetry::Symmetry canonical_sym,
              symmetry::Symmetry inference_sym, ModelOutput* output) override;
-  bool TryGet(Key key, symmetry::Symmetry canonical_sym,
+  bool TryGet(Key key, int move_number, symmetry::Symmetry canonical_sym,
               symmetry::Symmetry inference_sym, ModelOutput* output) override;
+
+  // The batched methods first look up all the requested keys, prefetching the
+  // cached elements, before performing the actual merge or lookup.
+  void MergeMany(absl::Span<const Request> requests) override;
+  int TryGetMany(absl::Span<const Request> requests,
+                 absl::Span<bool> hits) override;
+
   Stats GetStats() const override;
 
  private:
@@ -192,6 +328,14 @@ class BasicInferenceCache : public InferenceCache {
     elem->prev->next = elem->next;
   }
 
+  // Issues prefetches for the whole of the given element.
+  static void Prefetch(const Element* elem);
+
+  // Returns the output for the requested symmetry if the element contains it.
+  // Updates stats_ accordingly.
+  bool TryGetImpl(Element* elem, symmetry::Symmetry canonical_sym,
+                  symmetry::Symmetry inference_sym, ModelOutput* output);
+
   // Pushes the given element to the front of the LRU list.
   // The element must have been newly constructed, or previously unlinked from
   // the list.
@@ -214,6 +358,11 @@ class BasicInferenceCache : public InferenceCache {
   using Map = absl::node_hash_map<Key, Element>;
   Map map_;
 
+  // Scratch buffer used by TryGetMany.
+  std::vector<Element*> elems_;
+
+  std::unique_ptr<AdmissionPolicy> admission_policy_;
+
   Stats stats_;
 };
 
@@ -231,33 +380,105 @@ class ThreadSafeInferenceCache : public InferenceCache {
 
   // `total_capacity` is the total number of elements the cache can hold.
   // `num_shards` is the number BasicInferenceCaches to shard between.
-  ThreadSafeInferenceCache(size_t total_capacity, int num_shards);
+  // `admission_policy` is a descriptor passed to NewAdmissionPolicy to create
+  // each shard's admission policy.
+  ThreadSafeInferenceCache(size_t total_capacity, int num_shards,
+                           absl::string_view admission_policy = "");
 
   // Note that each shard is locked and cleared in turn: if a Clear call is
   // made concurrently with multiple Merge calls, there may never be a point in
   // time where the cache is completely empty (unless num_shards == 1).
   void Clear() override;
 
-  void Merge(Key key, symmetry::Symmetry canonical_sym,
+  void Merge(Key key, int move_number, symmetry::Symmetry canonical_sym,
              symmetry::Symmetry inference_sym, ModelOutput* output) override;
 
-  bool TryGet(Key key, symmetry::Symmetry canonical_sym,
+  bool TryGet(Key key, int move_number, symmetry::Symmetry canonical_sym,
               symmetry::Symmetry inference_sym, ModelOutput* output) override;
 
+  // The batched methods group requests by shard, locking each shard at most
+  // once per call.
+  void MergeMany(absl::Span<const Request> requests) override;
+  int TryGetMany(absl::Span<const Request> requests,
+                 absl::Span<bool> hits) override;
+
   // These stats are only approximate, since each shard is locked and queried
   // for their stats in turn. Nevertheless, the results should be close enough.
   Stats GetStats() const override;
 
  private:
   struct Shard {
-    explicit Shard(size_t capacity) : cache(capacity) {}
+    Shard(size_t capacity, std::unique_ptr<AdmissionPolicy> admission_policy)
+        : cache(capacity, std::move(admission_policy)) {}
     absl::Mutex mutex;
     BasicInferenceCache cache;
   };
 
+  // Scratch buffers used by the batched methods.
+  struct Scratch;
+
+  // Returns the calling thread's scratch buffers. The buffers are shared by
+  // all ThreadSafeInferenceCache instances, and reused between calls so that
+  // the batched methods don't allocate once the buffers have grown.
+  static Scratch* GetScratch();
+
+  // Sorts `requests` by shard into `scratch->sorted`, preserving the relative
+  // order of requests that map to the same shard. On return, the requests for
+  // shard `i` are in the range [`shard_begin[i]`, `shard_begin[i + 1]`) of
+  // `sorted` and `sorted_idx[j]` is the index in `requests` that `sorted[j]`
+  // came from.
+  void SortByShard(absl::Span<const Request> requests, Scratch* scratch) const;
+
   std::vector<std::unique_ptr<Shard>> shards_;
 };
 
+// An inference cache sharded between NUMA nodes.
+// Each node has its own cache, which threads running on that node access
+// through the node's view of the cache (see `node_cache`). Inferences are only
+// merged into the local node's cache, so if the node caches are created and
+// written by threads bound to their node, each node's cache memory stays
+// local to it.
+// If `remote_lookups` is true, requests that miss in the local node's cache
+// are looked up in the other nodes' caches before being reported as misses.
+// Remote lookups count towards the remote caches' stats and mark hits as
+// recently used in the remote cache.
+class NumaInferenceCache {
+ public:
+  // Counters of the lookups that crossed NUMA nodes.
+  struct CrossNodeStats {
+    // Number of requests that missed in the local node's cache and were looked
+    // up in the other nodes' caches.
+    size_t num_remote_lookups = 0;
+
+    // Number of those requests that hit in another node's cache.
+    size_t num_remote_hits = 0;
+  };
+
+  // `node_caches[i]` is the cache for NUMA node `i`. The caches must be thread
+  // safe if `remote_lookups` is true.
+  NumaInferenceCache(std::vector<std::unique_ptr<InferenceCache>> node_caches,
+                     bool remote_lookups);
+  ~NumaInferenceCache();
+
+  int num_nodes() const { return static_cast<int>(views_.size()); }
+
+  // Returns the view of the cache that threads on `node` should use.
+  // The view is owned by the NumaInferenceCache.
+  InferenceCache* node_cache(int node);
+
+  // Returns the combined stats of all nodes' caches.
+  InferenceCache::Stats GetStats() const;
+
+  // Returns the cross-node counters for lookups made through `node`'s view.
+  CrossNodeStats GetCrossNodeStats(int node) const;
+
+ private:
+  class NodeView;
+
+  std::vector<std::unique_ptr<InferenceCache>> caches_;
+  std::vector<std::unique_ptr<NodeView>> views_;
+};
+
 }  // namespace minigo
 
 #endif  // CC_MODEL_INFERENCE_CACHE_H_
@@ -17,9 +17,11 @@
 #include <algorithm>
 #include <sstream>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_join.h"
 #include "cc/random.h"
 #include "cc/symmetries.h"
@@ -114,24 +116,116 @@ TEST(BasicInferenceCacheTest, LruTest) {
 
   // Fill the cache.
   for (int i = 0; i < 3; ++i) {
-    cache.Merge(inferences[i].key, sym, sym, &inferences[i].output);
+    cache.Merge(inferences[i].key, 0, sym, sym, &inferences[i].output);
   }
 
   // Verify that the elements stored in the cache are as expected.
   ModelOutput output;
   for (int i = 0; i < 3; ++i) {
-    ASSERT_TRUE(cache.TryGet(inferences[i].key, sym, sym, &output));
+    ASSERT_TRUE(cache.TryGet(inferences[i].key, 0, sym, sym, &output));
     EXPECT_EQ(inferences[i].output.policy, output.policy);
     EXPECT_EQ(inferences[i].output.value, output.value);
   }
 
   // Adding a fourth element should evict the least recently used one.
-  cache.Merge(inferences[3].key, sym, sym, &inferences[3].output);
-  ASSERT_TRUE(cache.TryGet(inferences[3].key, sym, sym, &output));
+  cache.Merge(inferences[3].key, 0, sym, sym, &inferences[3].output);
+  ASSERT_TRUE(cache.TryGet(inferences[3].key, 0, sym, sym, &output));
   EXPECT_EQ(inferences[3].output.policy, output.policy);
   EXPECT_EQ(inferences[3].output.value, output.value);
 
-  EXPECT_FALSE(cache.TryGet(inferences[0].key, sym, sym, &output));
+  EXPECT_FALSE(cache.TryGet(inferences[0].key, 0, sym, sym, &output));
+}
+
+TEST(BasicInferenceCacheTest, MoveNumberAdmissionPolicy) {
+  BasicInferenceCache cache(2, absl::make_unique<MoveNumberAdmissionPolicy>(5));
+  auto sym = symmetry::kIdentity;
+  ModelOutput output;
+
+  // All keys are admitted while the cache isn't full.
+  auto a = InferenceCache::Key::CreateTestKey(1, 1);
+  auto b = InferenceCache::Key::CreateTestKey(2, 2);
+  cache.Merge(a, 10, sym, sym, &output);
+  cache.Merge(b, 3, sym, sym, &output);
+  EXPECT_TRUE(cache.TryGet(a, 10, sym, sym, &output));
+  EXPECT_TRUE(cache.TryGet(b, 3, sym, sym, &output));
+
+  // Once the cache is full, keys that are too far into the game are rejected.
+  auto c = InferenceCache::Key::CreateTestKey(3, 3);
+  cache.Merge(c, 6, sym, sym, &output);
+  EXPECT_FALSE(cache.TryGet(c, 6, sym, sym, &output));
+  EXPECT_EQ(1, cache.GetStats().num_rejections);
+
+  // Keys early in the game are still admitted, evicting the LRU element.
+  auto d = InferenceCache::Key::CreateTestKey(4, 4);
+  cache.Merge(d, 5, sym, sym, &output);
+  EXPECT_TRUE(cache.TryGet(d, 5, sym, sym, &output));
+  EXPECT_FALSE(cache.TryGet(a, 10, sym, sym, &output));
+  EXPECT_EQ(1, cache.GetStats().num_rejections);
+}
+
+TEST(BasicInferenceCacheTest, TinyLfuAdmissionPolicy) {
+  constexpr int kCapacity = 64;
+  BasicInferenceCache cache(
+      kCapacity, absl::make_unique<TinyLfuAdmissionPolicy>(kCapacity));
+  auto sym = symmetry::kIdentity;
+  ModelOutput output;
+
+  // Repeatedly access a small set of hot keys.
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < kCapacity; ++j) {
+      auto key = InferenceCache::Key::CreateTestKey(j, j);
+      if (!cache.TryGet(key, 0, sym, sym, &output)) {
+        cache.Merge(key, 0, sym, sym, &output);
+      }
+    }
+  }
+
+  // A stream of keys that are only accessed once shouldn't evict the hot keys.
+  for (int i = 100; i < 120; ++i) {
+    auto key = InferenceCache::Key::CreateTestKey(i, i);
+    EXPECT_FALSE(cache.TryGet(key, 0, sym, sym, &output));
+    cache.Merge(key, 0, sym, sym, &output);
+  }
+  EXPECT_EQ(20, cache.GetStats().num_rejections);
+  for (int j = 0; j < kCapacity; ++j) {
+    auto key = InferenceCache::Key::CreateTestKey(j, j);
+    EXPECT_TRUE(cache.TryGet(key, 0, sym, sym, &output));
+  }
+
+  // A key that becomes hot should eventually be admitted.
+  auto key = InferenceCache::Key::CreateTestKey(200, 200);
+  for (int i = 0; i < 8; ++i) {
+    if (!cache.TryGet(key, 0, sym, sym, &output)) {
+      cache.Merge(key, 0, sym, sym, &output);
+    }
+  }
+  EXPECT_TRUE(cache.TryGet(key, 0, sym, sym, &output));
+}
+
+// Each lookup counts as a single access, however many times the key is then
+// merged, and keys accessed as often as the LRU victim are admitted.
+TEST(BasicInferenceCacheTest, TinyLfuCountsLookupsOnly) {
+  constexpr int kCapacity = 2;
+  auto policy = absl::make_unique<TinyLfuAdmissionPolicy>(kCapacity);
+  auto* tiny_lfu = policy.get();
+  BasicInferenceCache cache(kCapacity, std::move(policy));
+  auto sym = symmetry::kIdentity;
+  ModelOutput output;
+
+  auto a = InferenceCache::Key::CreateTestKey(1, 1);
+  auto b = InferenceCache::Key::CreateTestKey(2, 2);
+  auto c = InferenceCache::Key::CreateTestKey(3, 3);
+  for (auto key : {a, b, c}) {
+    EXPECT_FALSE(cache.TryGet(key, 0, sym, sym, &output));
+    cache.Merge(key, 0, sym, sym, &output);
+    EXPECT_EQ(1, tiny_lfu->EstimateFrequency(key));
+  }
+
+  // `c` was accessed as often as `a`, so it replaced it.
+  EXPECT_EQ(0, cache.GetStats().num_rejections);
+  EXPECT_FALSE(cache.TryGet(a, 0, sym, sym, &output));
+  EXPECT_TRUE(cache.TryGet(b, 0, sym, sym, &output));
+  EXPECT_TRUE(cache.TryGet(c, 0, sym, sym, &output));
 }
 
 // A basic test of putting a single symmetry of a position into the cache.
@@ -170,18 +264,18 @@ TEST(InferenceCacheTest, SingleSymmetryTest) {
       // The cache should be empty.
       ModelOutput cached_output;
       EXPECT_FALSE(
-          cache.TryGet(key, canonical_sym, inference_sym, &cached_output));
+          cache.TryGet(key, 0, canonical_sym, inference_sym, &cached_output));
 
       // Merging the first symmetry for a position should not change the output.
       ModelOutput before_merge_output = real_output;
-      cache.Merge(key, canonical_sym, inference_sym, &real_output);
+      cache.Merge(key, 0, canonical_sym, inference_sym, &real_output);
 
       EXPECT_EQ(before_merge_output.policy, real_output.policy);
       EXPECT_EQ(before_merge_output.value, real_output.value);
 
       // Make sure the cached output matches what we put in.
       EXPECT_TRUE(
-          cache.TryGet(key, canonical_sym, inference_sym, &cached_output));
+          cache.TryGet(key, 0, canonical_sym, inference_sym, &cached_output));
       EXPECT_EQ(real_output.policy, cached_output.policy);
       EXPECT_EQ(real_output.value, cached_output.value);
     }
@@ -245,12 +339,12 @@ TEST(InferenceCacheTest, MergeSymmetiesTest) {
       // We haven't put this symmetry into the cache yet.
       ModelOutput cached_output;
       EXPECT_FALSE(
-          cache.TryGet(key, canonical_sym, inference_sym, &cached_output));
+          cache.TryGet(key, 0, canonical_sym, inference_sym, &cached_output));
 
       expected_non_zero_points.insert(
           symmetry::ApplySymmetry(inference_sym, real_non_zero_point));
 
-      cache.Merge(key, canonical_sym, inference_sym, &inference_output);
+      cache.Merge(key, 0, canonical_sym, inference_sym, &inference_output);
 
       for (int i = 0; i < kN * kN; ++i) {
         if (expected_non_zero_points.contains(i)) {
@@ -267,7 +361,7 @@ TEST(InferenceCacheTest, MergeSymmetiesTest) {
                   0.0001);
 
       EXPECT_TRUE(
-          cache.TryGet(key, canonical_sym, inference_sym, &cached_output));
+          cache.TryGet(key, 0, canonical_sym, inference_sym, &cached_output));
       EXPECT_EQ(inference_output.policy, cached_output.policy);
       EXPECT_EQ(inference_output.value, cached_output.value);
     }
@@ -297,18 +391,96 @@ TEST(ThreadSafeInferenceCacheTest, SimpleTest) {
 
   // Fill the cache.
   for (auto& inference : inferences) {
-    cache.Merge(inference.key, sym, sym, &inference.output);
+    cache.Merge(inference.key, 0, sym, sym, &inference.output);
   }
 
   // Verify that the elements stored in the cache are as expected.
   ModelOutput output;
   for (const auto& inference : inferences) {
-    ASSERT_TRUE(cache.TryGet(inference.key, sym, sym, &output));
+    ASSERT_TRUE(cache.TryGet(inference.key, 0, sym, sym, &output));
     EXPECT_EQ(inference.output.policy, output.policy);
     EXPECT_EQ(inference.output.value, output.value);
   }
 }
 
+// Verify that the batched MergeMany & TryGetMany methods produce the same
+// results as the equivalent sequence of Merge & TryGet calls.
+TEST(ThreadSafeInferenceCacheTest, BatchedTest) {
+  constexpr int kNumInferences = 64;
+  Random rnd(58235, 1);
+
+  ThreadSafeInferenceCache batched_cache(32, 5);
+  ThreadSafeInferenceCache single_cache(32, 5);
+
+  // Generate some inferences, some of which share keys.
+  std::vector<InferenceCache::Request> requests;
+  std::vector<ModelOutput> batched_outputs(kNumInferences);
+  std::vector<ModelOutput> single_outputs(kNumInferences);
+  for (int i = 0; i < kNumInferences; ++i) {
+    auto key = InferenceCache::Key::CreateTestKey(rnd.UniformInt(0, 47),
+                                                  rnd.UniformInt(0, 1));
+    auto canonical_sym = symmetry::kAllSymmetries[rnd.UniformInt(0, 7)];
+    auto inference_sym = symmetry::kAllSymmetries[rnd.UniformInt(0, 7)];
+    rnd.Uniform(&batched_outputs[i].policy);
+    batched_outputs[i].value = rnd();
+    single_outputs[i] = batched_outputs[i];
+    requests.push_back(
+        {key, 0, canonical_sym, inference_sym, &batched_outputs[i]});
+  }
+
+  auto check_outputs_equal = [&]() {
+    for (int i = 0; i < kNumInferences; ++i) {
+      ASSERT_EQ(single_outputs[i].policy, batched_outputs[i].policy);
+      ASSERT_EQ(single_outputs[i].value, batched_outputs[i].value);
+    }
+  };
+
+  // Merge the first half of the inferences.
+  batched_cache.MergeMany(
+      absl::MakeConstSpan(requests).subspan(0, kNumInferences / 2));
+  for (int i = 0; i < kNumInferences / 2; ++i) {
+    const auto& req = requests[i];
+    single_cache.Merge(req.key, req.move_number, req.canonical_sym,
+                       req.inference_sym, &single_outputs[i]);
+  }
+  check_outputs_equal();
+
+  // Look up all the inferences.
+  std::unique_ptr<bool[]> hits(new bool[kNumInferences]);
+  auto num_hits = batched_cache.TryGetMany(
+      requests, absl::MakeSpan(hits.get(), kNumInferences));
+  int expected_num_hits = 0;
+  for (int i = 0; i < kNumInferences; ++i) {
+    const auto& req = requests[i];
+    bool hit = single_cache.TryGet(req.key, req.move_number, req.canonical_sym,
+                                   req.inference_sym, &single_outputs[i]);
+    EXPECT_EQ(hit, hits[i]);
+    expected_num_hits += hit;
+  }
+  EXPECT_EQ(expected_num_hits, num_hits);
+  EXPECT_LT(0, num_hits);
+  EXPECT_GT(kNumInferences, num_hits);
+  check_outputs_equal();
+
+  // Merge all the inferences.
+  batched_cache.MergeMany(requests);
+  for (int i = 0; i < kNumInferences; ++i) {
+    const auto& req = requests[i];
+    single_cache.Merge(req.key, req.move_number, req.canonical_sym,
+                       req.inference_sym, &single_outputs[i]);
+  }
+  check_outputs_equal();
+
+  auto batched_stats = batched_cache.GetStats();
+  auto single_stats = single_cache.GetStats();
+  EXPECT_EQ(single_stats.size, batched_stats.size);
+  EXPECT_EQ(single_stats.num_hits, batched_stats.num_hits);
+  EXPECT_EQ(single_stats.num_complete_misses,
+            batched_stats.num_complete_misses);
+  EXPECT_EQ(single_stats.num_symmetry_misses,
+            batched_stats.num_symmetry_misses);
+}
+
 TEST(ThreadSafeInferenceCacheTest, StressTest) {
   constexpr int kCacheSize = 32;
   constexpr int kNumThreads = 10;
@@ -330,12 +502,12 @@ TEST(ThreadSafeInferenceCacheTest, StressTest) {
         // gets a roughly 50/50 split of cache hits and misses.
         auto key = InferenceCache::Key::CreateTestKey(rnd.UniformInt(0, 7),
                                                       rnd.UniformInt(0, 8));
-        if (cache.TryGet(key, sym, sym, &output)) {
+        if (cache.TryGet(key, 0, sym, sym, &output)) {
           hits += 1;
         } else {
           misses += 1;
         }
-        cache.Merge(key, sym, sym, &output);
+        cache.Merge(key, 0, sym, sym, &output);
       }
       MG_LOG(INFO) << "thread:" << i << " hits:" << hits
                    << " misses:" << misses;
@@ -346,6 +518,62 @@ TEST(ThreadSafeInferenceCacheTest, StressTest) {
   }
 }
 
+// Verify that inferences are merged into the local node's cache and that
+// remote lookups only happen if enabled.
+TEST(NumaInferenceCacheTest, RemoteLookups) {
+  for (bool remote_lookups : {false, true}) {
+    std::vector<std::unique_ptr<InferenceCache>> node_caches;
+    for (int i = 0; i < 3; ++i) {
+      node_caches.push_back(absl::make_unique<ThreadSafeInferenceCache>(4, 2));
+    }
+    NumaInferenceCache cache(std::move(node_caches), remote_lookups);
+    ASSERT_EQ(3, cache.num_nodes());
+
+    auto sym = symmetry::kIdentity;
+    auto a = InferenceCache::Key::CreateTestKey(1, 1);
+    auto b = InferenceCache::Key::CreateTestKey(2, 2);
+    ModelOutput output_a;
+    output_a.value = 0.5;
+    ModelOutput output_b;
+    output_b.value = -0.5;
+    cache.node_cache(1)->Merge(a, 0, sym, sym, &output_a);
+    cache.node_cache(2)->Merge(b, 0, sym, sym, &output_b);
+    EXPECT_EQ(1u, cache.node_cache(1)->GetStats().size);
+    EXPECT_EQ(2u, cache.GetStats().size);
+
+    // Both keys are local misses on node 0.
+    std::vector<InferenceCache::Request> requests;
+    std::vector<ModelOutput> outputs(3);
+    requests.push_back({a, 0, sym, sym, &outputs[0]});
+    requests.push_back({InferenceCache::Key::CreateTestKey(3, 3), 0, sym, sym,
+                        &outputs[1]});
+    requests.push_back({b, 0, sym, sym, &outputs[2]});
+    bool hits[3];
+    int num_hits = cache.node_cache(0)->TryGetMany(requests, hits);
+
+    auto stats = cache.GetCrossNodeStats(0);
+    if (remote_lookups) {
+      EXPECT_EQ(2, num_hits);
+      EXPECT_TRUE(hits[0]);
+      EXPECT_FALSE(hits[1]);
+      EXPECT_TRUE(hits[2]);
+      EXPECT_EQ(output_a.value, outputs[0].value);
+      EXPECT_EQ(output_b.value, outputs[2].value);
+      EXPECT_EQ(3u, stats.num_remote_lookups);
+      EXPECT_EQ(2u, stats.num_remote_hits);
+    } else {
+      EXPECT_EQ(0, num_hits);
+      EXPECT_EQ(0u, stats.num_remote_lookups);
+      EXPECT_EQ(0u, stats.num_remote_hits);
+    }
+
+    // Local hits don't count as cross-node traffic.
+    ModelOutput output;
+    EXPECT_TRUE(cache.node_cache(1)->TryGet(a, 0, sym, sym, &output));
+    EXPECT_EQ(0u, cache.GetCrossNodeStats(1).num_remote_lookups);
+  }
+}
+
 }  // namespace
 }  // namespace minigo
 
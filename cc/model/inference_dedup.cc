@@ -0,0 +1,53 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/inference_dedup.h"
+
+#include "cc/logging.h"
+
+namespace minigo {
+
+void InferenceDeduplicator::Deduplicate(
+    const std::vector<const ModelInput*>& inputs,
+    const std::vector<ModelOutput*>& outputs) {
+  MG_CHECK(inputs.size() == outputs.size());
+
+  index_.clear();
+  unique_inputs_.clear();
+  unique_outputs_.clear();
+  duplicates_.clear();
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const auto* input = inputs[i];
+    if (input->dedup_key != 0) {
+      auto result = index_.emplace(
+          std::make_pair(input->dedup_key, static_cast<int>(input->sym)),
+          unique_inputs_.size());
+      if (!result.second) {
+        duplicates_.emplace_back(outputs[i], result.first->second);
+        continue;
+      }
+    }
+    unique_inputs_.push_back(input);
+    unique_outputs_.push_back(outputs[i]);
+  }
+}
+
+void InferenceDeduplicator::CopyDuplicateOutputs() const {
+  for (const auto& duplicate : duplicates_) {
+    *duplicate.first = *unique_outputs_[duplicate.second];
+  }
+}
+
+}  // namespace minigo
@@ -0,0 +1,67 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_MODEL_INFERENCE_DEDUP_H_
+#define CC_MODEL_INFERENCE_DEDUP_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "cc/model/types.h"
+
+namespace minigo {
+
+// Removes duplicate inputs from a batch of inferences, so that the model only
+// needs to evaluate each unique input once. Inputs are duplicates if they have
+// the same non-zero `dedup_key` and the same symmetry.
+//
+// Usage:
+//   dedup.Deduplicate(inputs, outputs);
+//   model->RunMany(dedup.unique_inputs(), dedup.unique_outputs(), nullptr);
+//   dedup.CopyDuplicateOutputs();
+class InferenceDeduplicator {
+ public:
+  // Finds the unique inputs in `inputs`. The output for each unique input is
+  // written to the output of its first occurrence in `outputs`.
+  // `inputs.size()` must equal `outputs.size()`.
+  void Deduplicate(const std::vector<const ModelInput*>& inputs,
+                   const std::vector<ModelOutput*>& outputs);
+
+  // Copies the outputs of the unique inferences to their duplicates.
+  // Must be called after inference has been run on `unique_inputs()`.
+  void CopyDuplicateOutputs() const;
+
+  const std::vector<const ModelInput*>& unique_inputs() const {
+    return unique_inputs_;
+  }
+  std::vector<ModelOutput*>* unique_outputs() { return &unique_outputs_; }
+
+  size_t num_duplicates() const { return duplicates_.size(); }
+
+ private:
+  // Map from (dedup_key, symmetry) to index in `unique_inputs_`.
+  absl::flat_hash_map<std::pair<uint64_t, int>, size_t> index_;
+
+  std::vector<const ModelInput*> unique_inputs_;
+  std::vector<ModelOutput*> unique_outputs_;
+
+  // Duplicate outputs and the index in `unique_outputs_` to copy them from.
+  std::vector<std::pair<ModelOutput*, size_t>> duplicates_;
+};
+
+}  // namespace minigo
+
+#endif  //  CC_MODEL_INFERENCE_DEDUP_H_
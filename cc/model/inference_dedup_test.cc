@@ -0,0 +1,74 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/inference_dedup.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(InferenceDeduplicatorTest, Deduplicate) {
+  // Inputs 0, 2 & 5 are duplicates, as are inputs 1 & 4.
+  // Input 3 has the same key as input 0 but a different symmetry.
+  // Inputs 6 & 7 have no key and must not be deduplicated.
+  std::vector<ModelInput> inputs(8);
+  std::vector<uint64_t> keys = {1, 2, 1, 1, 2, 1, 0, 0};
+  std::vector<symmetry::Symmetry> syms = {
+      symmetry::kIdentity, symmetry::kIdentity, symmetry::kIdentity,
+      symmetry::kRot90,    symmetry::kIdentity, symmetry::kIdentity,
+      symmetry::kIdentity, symmetry::kIdentity};
+  std::vector<ModelOutput> outputs(inputs.size());
+  std::vector<const ModelInput*> input_ptrs;
+  std::vector<ModelOutput*> output_ptrs;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    inputs[i].dedup_key = keys[i];
+    inputs[i].sym = syms[i];
+    outputs[i].value = -1;
+    input_ptrs.push_back(&inputs[i]);
+    output_ptrs.push_back(&outputs[i]);
+  }
+
+  InferenceDeduplicator dedup;
+  dedup.Deduplicate(input_ptrs, output_ptrs);
+
+  std::vector<const ModelInput*> expected_inputs = {
+      &inputs[0], &inputs[1], &inputs[3], &inputs[6], &inputs[7]};
+  std::vector<ModelOutput*> expected_outputs = {
+      &outputs[0], &outputs[1], &outputs[3], &outputs[6], &outputs[7]};
+  EXPECT_EQ(expected_inputs, dedup.unique_inputs());
+  EXPECT_EQ(expected_outputs, *dedup.unique_outputs());
+  EXPECT_EQ(3, dedup.num_duplicates());
+
+  // "Run" inference on the unique inputs.
+  for (size_t i = 0; i < dedup.unique_outputs()->size(); ++i) {
+    (*dedup.unique_outputs())[i]->value = i;
+  }
+  dedup.CopyDuplicateOutputs();
+
+  std::vector<float> expected_values = {0, 1, 0, 2, 1, 0, 3, 4};
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    EXPECT_EQ(expected_values[i], outputs[i].value) << i;
+  }
+
+  // Reusing the deduplicator for a new batch must clear its state.
+  dedup.Deduplicate({input_ptrs[1]}, {output_ptrs[1]});
+  EXPECT_EQ(1, dedup.unique_inputs().size());
+  EXPECT_EQ(0, dedup.num_duplicates());
+}
+
+}  // namespace
+}  // namespace minigo
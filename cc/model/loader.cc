@@ -15,11 +15,20 @@
 #include "cc/model/loader.h"
 
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_split.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cc/async/thread_budget.h"
+#include "cc/dual_net/native_dual_net.h"
 #include "cc/dual_net/random_dual_net.h"
 #include "cc/file/utils.h"
 #include "cc/json.h"
@@ -102,6 +111,10 @@ class FactoryRegistry {
       return absl::make_unique<RandomDualNetFactory>();
     }
 
+    if (engine == "native") {
+      return absl::make_unique<NativeDualNetFactory>();
+    }
+
 #ifdef MG_ENABLE_TF_DUAL_NET
     if (engine == "tf") {
       return absl::make_unique<TfDualNetFactory>(device);
@@ -152,8 +165,11 @@ ModelDefinition ReadModelDefinition(const std::string& path) {
 
   def.path = path;
 
-  std::string contents;
-  MG_CHECK(file::ReadFile(path, &contents));
+  // Map the file rather than reading it: only the header & metadata are read
+  // here, the model bytes are left for the inference engine to read.
+  std::unique_ptr<file::MappedFile> file;
+  MG_CHECK(file::MapFile(path, &file));
+  auto contents = file->contents();
 
   ModelHeader header;
   MG_CHECK(contents.size() >= sizeof(header));
@@ -195,11 +211,14 @@ ModelDefinition ReadModelDefinition(const std::string& path) {
     }
   }
 
-  // TODO(tommadams): this copies almost the entire file. Add a proper file
-  // abstraction that can load partial files to avoid this (currently the only
-  // abstraction we have is file::ReadFile, which can only read an entire file's
-  // contents in one shot).
-  def.model_bytes = contents.substr(sizeof(header) + header.metadata_size);
+  // The model bytes reference the mapped file, which stays mapped until the
+  // last copy of them is destroyed. All the engines read the whole model
+  // while creating the first instance, so start reading it ahead now.
+  size_t offset = sizeof(header) + header.metadata_size;
+  file->Advise(offset, contents.size() - offset,
+               file::MappedFile::Advice::kWillNeed);
+  std::shared_ptr<const file::MappedFile> owner = std::move(file);
+  def.model_bytes = ModelBytes(std::move(owner), contents.substr(offset));
 
   MG_CHECK(def.metadata.Has("engine"));
   MG_CHECK(def.metadata.Has("input_features"));
@@ -216,11 +235,39 @@ ModelDefinition LoadModelDefinition(const std::string& path) {
   absl::string_view path_view(path);
   if (absl::ConsumePrefix(&path_view, "random:")) {
     return CreateRandomModelDefinition(path_view);
+  } else if (absl::ConsumePrefix(&path_view, "native:")) {
+    // Run a frozen TensorFlow graph using the native engine.
+    auto def = ReadModelDefinition(std::string(path_view));
+    MG_CHECK(def.metadata.Get<std::string>("engine") == "tf")
+        << "The native engine can only run \"tf\" models, got \""
+        << def.metadata.Get<std::string>("engine") << "\"";
+    def.metadata.Set("engine", "native");
+    return def;
   } else {
     return ReadModelDefinition(path);
   }
 }
 
+void WriteModelDefinition(const std::string& path, const ModelDefinition& def) {
+  nlohmann::json j;
+  for (const auto& kv : def.metadata) {
+    absl::visit([&](const auto& value) { j[kv.first] = value; }, kv.second);
+  }
+  auto metadata = j.dump();
+
+  ModelHeader header;
+  memcpy(header.magic, "<minigo>", sizeof(header.magic));
+  header.version = 1;
+  header.metadata_size = metadata.size();
+  header.file_size =
+      sizeof(header) + header.metadata_size + def.model_bytes.size();
+
+  std::string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+  contents.append(metadata);
+  contents.append(def.model_bytes.data(), def.model_bytes.size());
+  MG_CHECK(file::WriteFile(path, contents)) << "Couldn't write " << path;
+}
+
 ModelFactory* GetModelFactory(const std::string& engine,
                               const std::string& device) {
   return FactoryRegistry::Get()->GetFactory(engine, device);
@@ -241,4 +288,41 @@ std::unique_ptr<Model> NewModel(const std::string& path,
   return factory->NewModel(def);
 }
 
+std::vector<std::unique_ptr<Model>> NewModels(
+    const std::string& path, const std::string& device, int num_instances,
+    absl::Span<const int> warm_up_batch_sizes) {
+  MG_CHECK(num_instances > 0);
+  auto start_time = absl::Now();
+  auto def = LoadModelDefinition(path);
+  auto* factory = GetModelFactory(def, device);
+  auto load_time = absl::Now();
+
+  // Some engines compile the model for the first instance and share it with
+  // the rest, so the instances may not be created fully in parallel. They are
+  // warmed up in parallel though.
+  std::vector<std::unique_ptr<Model>> models(num_instances);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_instances; ++i) {
+    threads.emplace_back([&, i]() {
+      // Engines that create their own thread pools typically do so from the
+      // thread that creates the model, so pin the thread first to have the
+      // pools inherit its affinity.
+      PinThreadToBudget(ThreadRole::kInference);
+      models[i] = factory->NewModel(def);
+      WarmUpModel(models[i].get(), warm_up_batch_sizes);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto ready_time = absl::Now();
+  MG_LOG(INFO) << "Model " << path << " ready in "
+               << absl::FormatDuration(ready_time - start_time) << " (load "
+               << absl::FormatDuration(load_time - start_time) << ", create & "
+               << "warm up " << num_instances << " instances "
+               << absl::FormatDuration(ready_time - load_time) << ")";
+  return models;
+}
+
 }  // namespace minigo
@@ -16,16 +16,27 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "cc/model/factory.h"
 #include "cc/model/model.h"
 
 namespace minigo {
 
 // Load a ModelDefinition from the given path.
+// Paths of the form "random:<features>:<layout>:<seed>" create a definition
+// for a RandomDualNet. Prefixing the path of a "tf" model with "native:" loads
+// the model to be run by the NativeDualNet engine.
+// Model files are memory mapped where possible, so they must not be modified
+// in place while any copy of the definition's model bytes is alive: write new
+// models to a new file (or replace the file by renaming a new one over it).
 ModelDefinition LoadModelDefinition(const std::string& path);
 
+// Writes a ModelDefinition to `path` in the Minigo file format.
+void WriteModelDefinition(const std::string& path, const ModelDefinition& def);
+
 // Look or create up the factory instance for given engine and device.
 ModelFactory* GetModelFactory(const std::string& engine,
                               const std::string& device);
@@ -42,6 +53,15 @@ ModelFactory* GetModelFactory(const ModelDefinition& def,
 std::unique_ptr<Model> NewModel(const std::string& path,
                                 const std::string& device);
 
+// Helper to load a model and create `num_instances` instances of it in
+// parallel. Each instance is warmed up by running it once for each of
+// `warm_up_batch_sizes` (see WarmUpModel) on the thread that created it, so
+// that the returned instances are ready to run at full speed. Logs the time
+// taken for the instances to become ready.
+std::vector<std::unique_ptr<Model>> NewModels(
+    const std::string& path, const std::string& device, int num_instances,
+    absl::Span<const int> warm_up_batch_sizes = {});
+
 }  // namespace minigo
 
 #endif  //  CC_MODEL_MODEL_LOADER_H_
@@ -14,15 +14,77 @@
 
 #include "cc/model/model.h"
 
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 namespace minigo {
 
+ModelInputBuffer::ModelInputBuffer(const FeatureDescriptor& feature_desc,
+                                   const Tensor<float>& features)
+    : feature_desc_(feature_desc), floats_(features) {}
+
+ModelInputBuffer::ModelInputBuffer(const FeatureDescriptor& feature_desc,
+                                   const Tensor<uint8_t>& features)
+    : feature_desc_(feature_desc), bytes_(features) {}
+
+int ModelInputBuffer::capacity() const {
+  return floats_.data != nullptr ? floats_.shape[0] : bytes_.shape[0];
+}
+
+void ModelInputBuffer::SetFeatures(
+    int pos, absl::Span<const ModelInput* const> inputs) const {
+  MG_CHECK(pos >= 0 && pos + static_cast<int>(inputs.size()) <= capacity());
+  if (inputs.empty()) {
+    return;
+  }
+
+  // Create a tensor that views just the requested slots.
+  auto shape = feature_desc_.GetInputShape(inputs.size());
+  int stride = shape[1] * shape[2] * shape[3];
+  if (floats_.data != nullptr) {
+    Tensor<float> features(shape, floats_.data + pos * stride);
+    feature_desc_.set_floats(inputs, &features);
+  } else {
+    Tensor<uint8_t> features(shape, bytes_.data + pos * stride);
+    feature_desc_.set_bytes(inputs, &features);
+  }
+}
+
+void ModelInputBuffer::CopyFeatures(int pos,
+                                    const Tensor<uint8_t>& features) const {
+  int n = features.shape[0];
+  MG_CHECK(pos >= 0 && pos + n <= capacity());
+  auto shape = feature_desc_.GetInputShape(n);
+  MG_CHECK(features.shape.num_elements() == shape.num_elements())
+      << features.shape << " vs " << shape;
+
+  int stride = shape[1] * shape[2] * shape[3];
+  const auto* src = features.data;
+  const auto* end = src + n * stride;
+  if (floats_.data != nullptr) {
+    std::copy(src, end, floats_.data + pos * stride);
+  } else {
+    std::copy(src, end, bytes_.data + pos * stride);
+  }
+}
+
 Model::Model(std::string name, const FeatureDescriptor& feature_desc)
     : name_(std::move(name)), feature_desc_(feature_desc) {}
 
 Model::~Model() = default;
 
+void Model::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                         std::vector<ModelOutput*>* outputs,
+                         std::string* model_name, std::function<void()> done) {
+  RunMany(inputs, outputs, model_name);
+  done();
+}
+
+ModelInputBuffer* Model::LendInputBuffer(int capacity) { return nullptr; }
+
+void Model::ReturnInputBuffer() {}
+
 void Model::GetOutputs(absl::Span<const ModelInput* const> inputs,
                        const Tensor<float>& policy, const Tensor<float>& value,
                        absl::Span<ModelOutput*> outputs) {
@@ -52,4 +114,22 @@ void Model::ApplySymmetry(symmetry::Symmetry sym, const ModelOutput& src,
   dst->value = src.value;
 }
 
+void WarmUpModel(Model* model, absl::Span<const int> batch_sizes) {
+  Position position(Color::kBlack);
+  ModelInput input;
+  input.sym = symmetry::kIdentity;
+  input.position_history.push_back(&position);
+
+  for (int batch_size : batch_sizes) {
+    MG_CHECK(batch_size > 0);
+    std::vector<const ModelInput*> inputs(batch_size, &input);
+    std::vector<ModelOutput> outputs(batch_size);
+    std::vector<ModelOutput*> output_ptrs;
+    for (auto& output : outputs) {
+      output_ptrs.push_back(&output);
+    }
+    model->RunMany(inputs, &output_ptrs, nullptr);
+  }
+}
+
 }  // namespace minigo
@@ -15,6 +15,7 @@
 #ifndef CC_MODEL_MODEL_H_
 #define CC_MODEL_MODEL_H_
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -29,6 +30,39 @@
 
 namespace minigo {
 
+// A model's input feature tensor, lent out by `Model::LendInputBuffer` so that
+// callers can encode the features for a batch directly into it. This takes
+// feature encoding off the inference thread and lets several threads encode
+// different ranges of the same batch in parallel.
+class ModelInputBuffer {
+ public:
+  ModelInputBuffer() = default;
+  ModelInputBuffer(const FeatureDescriptor& feature_desc,
+                   const Tensor<float>& features);
+  ModelInputBuffer(const FeatureDescriptor& feature_desc,
+                   const Tensor<uint8_t>& features);
+
+  // Maximum number of inferences the buffer can hold features for.
+  int capacity() const;
+
+  // Encodes the features for `inputs` into the buffer's slots
+  // [pos, pos + inputs.size()).
+  // It's safe to call SetFeatures concurrently for non-overlapping ranges.
+  void SetFeatures(int pos, absl::Span<const ModelInput* const> inputs) const;
+
+  // Copies features that were already encoded using the buffer's
+  // FeatureDescriptor (e.g. read from training examples) into slots
+  // [pos, pos + features.shape[0]).
+  void CopyFeatures(int pos, const Tensor<uint8_t>& features) const;
+
+ private:
+  FeatureDescriptor feature_desc_ = {};
+
+  // Exactly one of these has non-null data.
+  Tensor<float> floats_;
+  Tensor<uint8_t> bytes_;
+};
+
 // TODO(tommadams): replace all std::vector parameters with absl::Span.
 class Model {
  public:
@@ -61,11 +95,46 @@ class Model {
                        std::vector<ModelOutput*>* outputs,
                        std::string* model_name) = 0;
 
+  // Asynchronous version of RunMany: starts running inference and returns
+  // without waiting for it to complete. `done` is called once all `outputs`
+  // (and `model_name` if it's non-null) have been written, possibly on a
+  // different thread, possibly before RunManyAsync returns.
+  // `inputs`, `outputs` and `model_name` must remain valid until `done` is
+  // called. Callers must not call RunMany on a model while a RunManyAsync call
+  // is in flight on it.
+  // The default implementation calls RunMany on the calling thread.
+  virtual void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                            std::vector<ModelOutput*>* outputs,
+                            std::string* model_name,
+                            std::function<void()> done);
+
+  // Lends out the model's input tensor, sized to hold the features for at
+  // least `capacity` inferences. Returns null if the model doesn't support
+  // this, in which case RunMany encodes the features as usual.
+  // If a buffer is returned, the caller must write the features for its next
+  // batch to slots [0, inputs.size()) of the buffer, then either pass that
+  // batch to RunMany or RunManyAsync, which run the model without encoding the
+  // features again, or call ReturnInputBuffer. Either way, the buffer must
+  // not be used afterwards.
+  // Must not be called while a RunManyAsync call is in flight.
+  virtual ModelInputBuffer* LendInputBuffer(int capacity);
+
+  // Returns a buffer lent by LendInputBuffer without running inference, for
+  // example because the batch turned out to be empty.
+  virtual void ReturnInputBuffer();
+
  private:
   const std::string name_;
   const FeatureDescriptor feature_desc_;
 };
 
+// Runs `model` once for each of `batch_sizes` on empty boards.
+// Inference engines do a lot of one-off work during their first inferences,
+// for example optimizing the graph and allocating tensors for each batch
+// size. Warming a model up before publishing it keeps that work out of the
+// first batches of real games.
+void WarmUpModel(Model* model, absl::Span<const int> batch_sizes);
+
 }  // namespace minigo
 
 #endif  //  CC_MODEL_MODEL_H_
@@ -0,0 +1,55 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/model_thread.h"
+
+#include <utility>
+
+#include "cc/async/thread_budget.h"
+#include "wtf/macros.h"
+
+namespace minigo {
+
+ModelThread::ModelThread(Model* model) : Thread("model"), model_(model) {
+  Start();
+}
+
+ModelThread::~ModelThread() {
+  queue_.Push({nullptr, nullptr, nullptr, nullptr});
+  Join();
+}
+
+void ModelThread::RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                               std::vector<ModelOutput*>* outputs,
+                               std::string* model_name,
+                               std::function<void()> done) {
+  queue_.Push({&inputs, outputs, model_name, std::move(done)});
+}
+
+void ModelThread::Run() {
+  PinThreadToBudget(ThreadRole::kInference);
+  for (;;) {
+    auto request = queue_.Pop();
+    if (request.done == nullptr) {
+      break;
+    }
+    {
+      WTF_SCOPE("ModelThread::RunMany", size_t)(request.inputs->size());
+      model_->RunMany(*request.inputs, request.outputs, request.model_name);
+    }
+    request.done();
+  }
+}
+
+}  // namespace minigo
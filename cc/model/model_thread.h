@@ -0,0 +1,63 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_MODEL_MODEL_THREAD_H_
+#define CC_MODEL_MODEL_THREAD_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cc/async/thread.h"
+#include "cc/async/thread_safe_queue.h"
+#include "cc/model/model.h"
+
+namespace minigo {
+
+// Runs a model's synchronous RunMany on a dedicated thread.
+// Used by the inference engines that only expose a blocking API (TensorFlow,
+// TFLite) to implement RunManyAsync: requests are run in the order that they
+// were submitted, one at a time.
+class ModelThread : public Thread {
+ public:
+  // The thread is started in the constructor. `model` must outlive the
+  // ModelThread.
+  explicit ModelThread(Model* model);
+
+  // Runs all pending requests and joins the thread.
+  ~ModelThread() override;
+
+  void RunManyAsync(const std::vector<const ModelInput*>& inputs,
+                    std::vector<ModelOutput*>* outputs, std::string* model_name,
+                    std::function<void()> done);
+
+ private:
+  struct Request {
+    const std::vector<const ModelInput*>* inputs;
+    std::vector<ModelOutput*>* outputs;
+    std::string* model_name;
+    std::function<void()> done;
+  };
+
+  void Run() override;
+
+  Model* model_;
+
+  // A request with a null `done` callback signals the thread to exit.
+  ThreadSafeQueue<Request> queue_;
+};
+
+}  // namespace minigo
+
+#endif  //  CC_MODEL_MODEL_THREAD_H_
@@ -0,0 +1,149 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/model/model_thread.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Model that records the order of its RunMany calls and the threads they ran
+// on. RunMany blocks until `gate` is notified.
+class RecordingModel : public Model {
+ public:
+  explicit RecordingModel(absl::Notification* gate)
+      : Model("recording", FeatureDescriptor::Create<AgzFeatures>(
+                               FeatureDescriptor::Layout::kNhwc)),
+        gate_(gate) {}
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    gate_->WaitForNotification();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      (*outputs)[i]->value = inputs[i]->dedup_key;
+    }
+    if (model_name != nullptr) {
+      *model_name = name();
+    }
+    absl::MutexLock lock(&mutex_);
+    batch_sizes_.push_back(inputs.size());
+    thread_ids_.push_back(std::this_thread::get_id());
+  }
+
+  std::vector<size_t> batch_sizes() {
+    absl::MutexLock lock(&mutex_);
+    return batch_sizes_;
+  }
+
+  std::vector<std::thread::id> thread_ids() {
+    absl::MutexLock lock(&mutex_);
+    return thread_ids_;
+  }
+
+ private:
+  absl::Notification* gate_;
+  absl::Mutex mutex_;
+  std::vector<size_t> batch_sizes_ GUARDED_BY(&mutex_);
+  std::vector<std::thread::id> thread_ids_ GUARDED_BY(&mutex_);
+};
+
+// A single request to run on a ModelThread.
+struct Request {
+  explicit Request(size_t n) : inputs(n), outputs(n) {
+    for (size_t i = 0; i < n; ++i) {
+      inputs[i].dedup_key = i + 1;
+      outputs[i].value = 0;
+      input_ptrs.push_back(&inputs[i]);
+      output_ptrs.push_back(&outputs[i]);
+    }
+  }
+
+  std::vector<ModelInput> inputs;
+  std::vector<ModelOutput> outputs;
+  std::vector<const ModelInput*> input_ptrs;
+  std::vector<ModelOutput*> output_ptrs;
+  std::string model_name;
+  absl::Notification done;
+};
+
+TEST(ModelThreadTest, RunsRequestsInOrder) {
+  absl::Notification gate;
+  RecordingModel model(&gate);
+  ModelThread thread(&model);
+
+  // Requests don't block the caller, even while the model is busy.
+  std::vector<std::unique_ptr<Request>> requests;
+  for (size_t n : {3, 1, 2}) {
+    requests.push_back(absl::make_unique<Request>(n));
+    auto* req = requests.back().get();
+    thread.RunManyAsync(req->input_ptrs, &req->output_ptrs, &req->model_name,
+                        [req]() { req->done.Notify(); });
+  }
+  EXPECT_FALSE(requests[0]->done.HasBeenNotified());
+
+  gate.Notify();
+  for (auto& req : requests) {
+    ASSERT_TRUE(req->done.WaitForNotificationWithTimeout(absl::Seconds(10)));
+    EXPECT_EQ("recording", req->model_name);
+    for (size_t i = 0; i < req->outputs.size(); ++i) {
+      EXPECT_EQ(i + 1, req->outputs[i].value);
+    }
+  }
+
+  EXPECT_EQ(std::vector<size_t>({3, 1, 2}), model.batch_sizes());
+
+  // All requests run on the model thread.
+  auto thread_ids = model.thread_ids();
+  ASSERT_EQ(3, thread_ids.size());
+  for (const auto& id : thread_ids) {
+    EXPECT_NE(std::this_thread::get_id(), id);
+    EXPECT_EQ(thread_ids[0], id);
+  }
+}
+
+TEST(ModelThreadTest, DestructorRunsPendingRequests) {
+  absl::Notification gate;
+  gate.Notify();
+  RecordingModel model(&gate);
+
+  std::vector<std::unique_ptr<Request>> requests;
+  {
+    ModelThread thread(&model);
+    for (int i = 0; i < 4; ++i) {
+      requests.push_back(absl::make_unique<Request>(1));
+      auto* req = requests.back().get();
+      thread.RunManyAsync(req->input_ptrs, &req->output_ptrs, nullptr,
+                          [req]() { req->done.Notify(); });
+    }
+  }
+
+  for (auto& req : requests) {
+    EXPECT_TRUE(req->done.HasBeenNotified());
+    EXPECT_EQ(1, req->outputs[0].value);
+  }
+  EXPECT_EQ(4, model.batch_sizes().size());
+}
+
+}  // namespace
+}  // namespace minigo
@@ -147,6 +147,13 @@ struct ModelInput {
   // position_history[0] holds the current position and position_history[i]
   // holds the position from i moves ago.
   inline_vector<const Position*, kMaxPositionHistory> position_history;
+
+  // Optional fingerprint of the input position, used by ModelBatcher to run
+  // inference only once on identical inputs in the same batch: inputs with
+  // equal non-zero `dedup_key` and `sym` are assumed to produce the same
+  // output. Zero disables deduplication for this input.
+  // See InferenceCache::Key::Fingerprint.
+  uint64_t dedup_key = 0;
 };
 
 struct ModelOutput {
@@ -16,14 +16,18 @@
 #define CC_PLATFORM_UTILS_H_
 
 #include <string>
+#include <vector>
 
 #if defined(_MSC_VER)
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <xmmintrin.h>
 
 #define MG_ALIGN(x) __declspec(align(x))
 #define MG_WARN_UNUSED_RESULT _Check_return_
+#define MG_PREFETCH(x) \
+  _mm_prefetch(reinterpret_cast<const char*>(x), _MM_HINT_T0)
 
 #elif defined(__GNUC__)
 
@@ -32,6 +36,7 @@
 #define MG_ALIGN(x) __attribute__((aligned(x)))
 #define MG_WARN_UNUSED_RESULT __attribute__((warn_unused_result))
 #define MG_ALWAYS_INLINE __attribute__((always_inline))
+#define MG_PREFETCH(x) __builtin_prefetch(x)
 
 #endif
 
@@ -47,6 +52,27 @@ using ProcessId = pid_t;
 // Returns the number of logical CPUs.
 int GetNumLogicalCpus();
 
+// Restricts the calling thread to run on the given logical CPUs. Returns false
+// if the platform doesn't support setting thread affinity.
+bool SetThreadAffinity(const std::vector<int>& cpus);
+
+// Gets the logical CPUs that the calling thread may run on. Returns false if
+// the platform doesn't support querying thread affinity.
+bool GetThreadAffinity(std::vector<int>* cpus);
+
+// Returns the number of NUMA nodes. Returns 1 if the platform doesn't expose
+// its NUMA topology.
+int GetNumNumaNodes();
+
+// Returns the logical CPUs on the given NUMA node. If the platform doesn't
+// expose its NUMA topology, node 0 has all the logical CPUs.
+std::vector<int> GetNumaNodeCpus(int node);
+
+// Makes the calling thread prefer to allocate new memory from the given NUMA
+// node. Returns false if the platform doesn't support setting the memory
+// policy.
+bool SetThreadMemoryNode(int node);
+
 // Returns true if the given file descriptor supports ANSI color codes.
 bool FdSupportsAnsiColors(int fd);
 
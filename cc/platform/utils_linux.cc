@@ -12,18 +12,101 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 
 #include <cstring>
+#include <fstream>
+#include <sstream>
 
 #include "cc/platform/utils.h"
 
 namespace minigo {
 
+namespace {
+
+// Parses a sysfs list such as "0-11,24-35". Returns an empty list if the file
+// can't be read.
+std::vector<int> ReadSysfsList(const std::string& path) {
+  std::vector<int> result;
+  std::ifstream f(path);
+  std::string range;
+  while (std::getline(f, range, ',')) {
+    int begin, end;
+    char dash;
+    std::istringstream ss(range);
+    if (!(ss >> begin)) {
+      break;
+    }
+    end = begin;
+    if (ss >> dash >> end && dash != '-') {
+      break;
+    }
+    for (int i = begin; i <= end; ++i) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
 bool FdSupportsAnsiColors(int fd) { return isatty(fd); }
 
 int GetNumLogicalCpus() { return get_nprocs(); }
 
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) ==
+         0;
+}
+
+bool GetThreadAffinity(std::vector<int>* cpus) {
+  cpu_set_t cpu_set;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+    return false;
+  }
+  cpus->clear();
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpu_set)) {
+      cpus->push_back(cpu);
+    }
+  }
+  return true;
+}
+
+int GetNumNumaNodes() {
+  auto nodes = ReadSysfsList("/sys/devices/system/node/online");
+  return nodes.empty() ? 1 : nodes.back() + 1;
+}
+
+std::vector<int> GetNumaNodeCpus(int node) {
+  auto cpus = ReadSysfsList("/sys/devices/system/node/node" +
+                            std::to_string(node) + "/cpulist");
+  if (cpus.empty() && node == 0) {
+    for (int i = 0; i < GetNumLogicalCpus(); ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+bool SetThreadMemoryNode(int node) {
+  // Call set_mempolicy directly rather than depending on libnuma.
+  constexpr int kBitsPerWord = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> node_mask(node / kBitsPerWord + 1, 0);
+  node_mask[node / kBitsPerWord] = 1ul << (node % kBitsPerWord);
+  return syscall(SYS_set_mempolicy, MPOL_PREFERRED, node_mask.data(),
+                 node_mask.size() * kBitsPerWord) == 0;
+}
+
 ProcessId GetProcessId() { return getpid(); }
 
 std::string GetHostname() {
@@ -29,6 +29,26 @@ int GetNumLogicalCpus() {
   return nproc;
 }
 
+// macOS only supports affinity hints between threads, not binding threads to
+// specific CPUs.
+bool SetThreadAffinity(const std::vector<int>& cpus) { return false; }
+
+bool GetThreadAffinity(std::vector<int>* cpus) { return false; }
+
+int GetNumNumaNodes() { return 1; }
+
+std::vector<int> GetNumaNodeCpus(int node) {
+  std::vector<int> cpus;
+  if (node == 0) {
+    for (int i = 0; i < GetNumLogicalCpus(); ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+bool SetThreadMemoryNode(int node) { return false; }
+
 bool FdSupportsAnsiColors(int fd) { return isatty(fd); }
 
 ProcessId GetProcessId() { return getpid(); }
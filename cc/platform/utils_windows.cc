@@ -26,6 +26,54 @@ int GetNumLogicalCpus() {
   return sysinfo.dwNumberOfProcessors;
 }
 
+// Only CPUs in the thread's current processor group (at most 64) are
+// supported.
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+  DWORD_PTR mask = 0;
+  for (int cpu : cpus) {
+    if (cpu < static_cast<int>(8 * sizeof(mask))) {
+      mask |= static_cast<DWORD_PTR>(1) << cpu;
+    }
+  }
+  return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+bool GetThreadAffinity(std::vector<int>* cpus) {
+  // Windows can only query a thread's affinity by setting it.
+  return false;
+}
+
+int GetNumNumaNodes() {
+  ULONG highest_node = 0;
+  if (!GetNumaHighestNodeNumber(&highest_node)) {
+    return 1;
+  }
+  return static_cast<int>(highest_node) + 1;
+}
+
+// Like SetThreadAffinity, only CPUs in the first processor group are
+// supported.
+std::vector<int> GetNumaNodeCpus(int node) {
+  std::vector<int> cpus;
+  ULONGLONG mask = 0;
+  if (GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask)) {
+    for (int cpu = 0; cpu < static_cast<int>(8 * sizeof(mask)); ++cpu) {
+      if (mask & (static_cast<ULONGLONG>(1) << cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+  } else if (node == 0) {
+    for (int i = 0; i < GetNumLogicalCpus(); ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+// Windows only supports choosing a NUMA node per allocation
+// (VirtualAllocExNuma), not per thread.
+bool SetThreadMemoryNode(int node) { return false; }
+
 ProcessId GetProcessId() { return ::GetCurrentProcessId(); }
 
 std::string GetHostname() {
@@ -0,0 +1,346 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/record_codec.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "cc/logging.h"
+#include "zlib.h"
+
+#ifdef MG_ENABLE_ZSTD
+#include "zstd.h"
+#endif  // MG_ENABLE_ZSTD
+
+namespace minigo {
+
+namespace {
+
+constexpr char kZstdDisabledError[] =
+    "zstd support isn't enabled. Please recompile, passing --define=zstd=1 "
+    "to bazel build.";
+
+// Size of the output that deflate may write when flushing, beyond the
+// deflateBound of the input: an empty stored block & the bits before it.
+constexpr size_t kDeflateFlushSize = 16;
+
+// Compresses `src` as a raw deflate stream to `dst`. If `last` is true, the
+// stream is finished, otherwise it's flushed to a byte boundary so that
+// further streams can be appended to it.
+void DeflateBlock(int level, absl::string_view src, bool last,
+                  std::string* dst) {
+  z_stream strm = {};
+  MG_CHECK(deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                        Z_DEFAULT_STRATEGY) == Z_OK);
+  strm.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+  strm.avail_in = src.size();
+
+  dst->resize(deflateBound(&strm, src.size()) + kDeflateFlushSize);
+  size_t size = 0;
+  for (;;) {
+    strm.next_out = reinterpret_cast<Bytef*>(&(*dst)[size]);
+    strm.avail_out = dst->size() - size;
+    int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    MG_CHECK(ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR)
+        << "deflate failed: " << ret;
+    size = dst->size() - strm.avail_out;
+    if (last ? ret == Z_STREAM_END : strm.avail_out != 0) {
+      break;
+    }
+    dst->resize(2 * dst->size());
+  }
+  MG_CHECK(strm.avail_in == 0);
+  dst->resize(size);
+  deflateEnd(&strm);
+}
+
+// Returns the two byte zlib header for a deflate stream with a 32KB window,
+// compressed at `level`.
+std::string GetZlibHeader(int level) {
+  int cmf = 0x78;
+  int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+  int flg = flevel << 6;
+  flg += 31 - (cmf * 256 + flg) % 31;
+  return {static_cast<char>(cmf), static_cast<char>(flg)};
+}
+
+bool Inflate(absl::string_view src, std::string* dst) {
+  z_stream strm = {};
+  if (inflateInit(&strm) != Z_OK) {
+    return false;
+  }
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+  strm.avail_in = src.size();
+
+  dst->resize(std::max<size_t>(4 * src.size(), 1024));
+  size_t size = 0;
+  int ret;
+  do {
+    if (size == dst->size()) {
+      dst->resize(2 * dst->size());
+    }
+    strm.next_out = reinterpret_cast<Bytef*>(&(*dst)[size]);
+    strm.avail_out = dst->size() - size;
+    ret = inflate(&strm, Z_NO_FLUSH);
+    size = dst->size() - strm.avail_out;
+  } while (ret == Z_OK);
+  inflateEnd(&strm);
+  dst->resize(size);
+  return ret == Z_STREAM_END && strm.avail_in == 0;
+}
+
+#ifdef MG_ENABLE_ZSTD
+
+void ZstdCompressBlock(int level, absl::string_view src, std::string* dst) {
+  dst->resize(ZSTD_compressBound(src.size()));
+  size_t size =
+      ZSTD_compress(&(*dst)[0], dst->size(), src.data(), src.size(), level);
+  MG_CHECK(!ZSTD_isError(size))
+      << "ZSTD_compress failed: " << ZSTD_getErrorName(size);
+  dst->resize(size);
+}
+
+bool ZstdDecompress(absl::string_view src, std::string* dst) {
+  auto* dctx = ZSTD_createDCtx();
+  MG_CHECK(dctx != nullptr);
+  ZSTD_inBuffer input = {src.data(), src.size(), 0};
+
+  dst->resize(std::max<size_t>(4 * src.size(), ZSTD_DStreamOutSize()));
+  size_t size = 0;
+  size_t ret;
+  for (;;) {
+    if (size == dst->size()) {
+      dst->resize(2 * dst->size());
+    }
+    ZSTD_outBuffer output = {&(*dst)[0], dst->size(), size};
+    ret = ZSTD_decompressStream(dctx, &output, &input);
+    size = output.pos;
+    // The decoder has flushed everything it can once it stops filling the
+    // output buffer.
+    if (ZSTD_isError(ret) ||
+        (input.pos == input.size && size < dst->size())) {
+      break;
+    }
+  }
+  ZSTD_freeDCtx(dctx);
+  dst->resize(size);
+
+  // ZSTD_decompressStream returns 0 once it has finished a frame.
+  return ret == 0;
+}
+
+#endif  // MG_ENABLE_ZSTD
+
+}  // namespace
+
+RecordCompression ParseRecordCompression(absl::string_view spec) {
+  RecordCompression compression;
+  if (spec == "none") {
+    compression.codec = RecordCompression::Codec::kNone;
+    compression.level = 0;
+    return compression;
+  }
+
+  std::pair<absl::string_view, absl::string_view> kv =
+      absl::StrSplit(spec, ':');
+  int max_level = 0;
+  if (kv.first == "zlib") {
+    compression.codec = RecordCompression::Codec::kZlib;
+    max_level = 9;
+  } else if (kv.first == "zstd") {
+    MG_CHECK(IsZstdEnabled()) << kZstdDisabledError;
+    compression.codec = RecordCompression::Codec::kZstd;
+    max_level = 19;
+  } else {
+    MG_LOG(FATAL) << "Unrecognized compression \"" << spec << "\"";
+  }
+  MG_CHECK(absl::SimpleAtoi(kv.second, &compression.level) &&
+           compression.level >= 1 && compression.level <= max_level)
+      << "Couldn't parse compression \"" << spec
+      << "\": expected a level between 1 and " << max_level;
+  return compression;
+}
+
+std::ostream& operator<<(std::ostream& os,
+                         const RecordCompression& compression) {
+  switch (compression.codec) {
+    case RecordCompression::Codec::kNone:
+      return os << "none";
+    case RecordCompression::Codec::kZlib:
+      return os << "zlib:" << compression.level;
+    case RecordCompression::Codec::kZstd:
+      return os << "zstd:" << compression.level;
+  }
+  return os << "<unknown codec>";
+}
+
+bool IsZstdEnabled() {
+#ifdef MG_ENABLE_ZSTD
+  return true;
+#else
+  return false;
+#endif  // MG_ENABLE_ZSTD
+}
+
+const char* GetTfRecordExtension(RecordCompression::Codec codec) {
+  switch (codec) {
+    case RecordCompression::Codec::kNone:
+      return ".tfrecord";
+    case RecordCompression::Codec::kZlib:
+      return ".tfrecord.zz";
+    case RecordCompression::Codec::kZstd:
+      return ".tfrecord.zst";
+  }
+  return "";
+}
+
+RecordCompression::Codec GetRecordCodecForPath(absl::string_view path) {
+  if (absl::EndsWith(path, ".zz")) {
+    return RecordCompression::Codec::kZlib;
+  } else if (absl::EndsWith(path, ".zst")) {
+    return RecordCompression::Codec::kZstd;
+  }
+  return RecordCompression::Codec::kNone;
+}
+
+BlockCompressor::BlockCompressor(const RecordCompression& compression,
+                                 size_t block_size, WorkStealingPool* pool,
+                                 Sink sink)
+    : compression_(compression),
+      block_size_(block_size),
+      pool_(pool),
+      sink_(std::move(sink)),
+      adler32_(::adler32(0, Z_NULL, 0)) {
+  MG_CHECK(block_size_ > 0);
+  if (compression_.codec == RecordCompression::Codec::kZstd) {
+    MG_CHECK(IsZstdEnabled()) << kZstdDisabledError;
+  }
+  int num_blocks = pool_ != nullptr ? pool_->num_workers() : 1;
+  blocks_.resize(num_blocks);
+  compressed_.resize(num_blocks);
+  checksums_.resize(num_blocks);
+  for (auto& block : blocks_) {
+    block.reserve(block_size_);
+  }
+}
+
+BlockCompressor::~BlockCompressor() {
+  MG_CHECK(closed_) << "BlockCompressor destroyed without calling Close";
+}
+
+void BlockCompressor::Write(absl::string_view data) {
+  MG_CHECK(!closed_);
+  if (compression_.codec == RecordCompression::Codec::kNone) {
+    if (!data.empty()) {
+      sink_(data);
+    }
+    return;
+  }
+
+  while (!data.empty()) {
+    auto& block = blocks_[num_blocks_ - 1];
+    size_t n = std::min(data.size(), block_size_ - block.size());
+    block.append(data.data(), n);
+    data.remove_prefix(n);
+    if (block.size() == block_size_) {
+      if (num_blocks_ == static_cast<int>(blocks_.size())) {
+        CompressBlocks(false);
+      } else {
+        num_blocks_ += 1;
+      }
+    }
+  }
+}
+
+void BlockCompressor::Close() {
+  MG_CHECK(!closed_);
+  if (compression_.codec != RecordCompression::Codec::kNone) {
+    CompressBlocks(true);
+  }
+  closed_ = true;
+}
+
+void BlockCompressor::CompressBlocks(bool last) {
+  auto compress_block = [this, last](int worker, int i) {
+    const auto& block = blocks_[i];
+    bool last_block = last && i == num_blocks_ - 1;
+    if (compression_.codec == RecordCompression::Codec::kZlib) {
+      DeflateBlock(compression_.level, block, last_block, &compressed_[i]);
+      checksums_[i] = ::adler32(
+          ::adler32(0, Z_NULL, 0),
+          reinterpret_cast<const Bytef*>(block.data()), block.size());
+    } else {
+#ifdef MG_ENABLE_ZSTD
+      ZstdCompressBlock(compression_.level, block, &compressed_[i]);
+#endif  // MG_ENABLE_ZSTD
+    }
+  };
+  if (pool_ != nullptr && num_blocks_ > 1) {
+    pool_->Run(num_blocks_, compress_block);
+  } else {
+    for (int i = 0; i < num_blocks_; ++i) {
+      compress_block(0, i);
+    }
+  }
+
+  bool zlib = compression_.codec == RecordCompression::Codec::kZlib;
+  if (zlib && !wrote_header_) {
+    sink_(GetZlibHeader(compression_.level));
+    wrote_header_ = true;
+  }
+  for (int i = 0; i < num_blocks_; ++i) {
+    sink_(compressed_[i]);
+    if (zlib) {
+      adler32_ =
+          ::adler32_combine(adler32_, checksums_[i], blocks_[i].size());
+    }
+    blocks_[i].clear();
+  }
+  num_blocks_ = 1;
+
+  if (zlib && last) {
+    // The zlib trailer is the big-endian adler32 of the uncompressed data.
+    char trailer[4] = {static_cast<char>(adler32_ >> 24),
+                       static_cast<char>(adler32_ >> 16),
+                       static_cast<char>(adler32_ >> 8),
+                       static_cast<char>(adler32_)};
+    sink_({trailer, sizeof(trailer)});
+  }
+}
+
+bool Decompress(RecordCompression::Codec codec, absl::string_view src,
+                std::string* dst) {
+  switch (codec) {
+    case RecordCompression::Codec::kNone:
+      dst->assign(src.data(), src.size());
+      return true;
+    case RecordCompression::Codec::kZlib:
+      return Inflate(src, dst);
+    case RecordCompression::Codec::kZstd:
+#ifdef MG_ENABLE_ZSTD
+      return ZstdDecompress(src, dst);
+#else
+      MG_LOG(FATAL) << kZstdDisabledError;
+      return false;
+#endif  // MG_ENABLE_ZSTD
+  }
+  return false;
+}
+
+}  // namespace minigo
@@ -0,0 +1,127 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_RECORD_CODEC_H_
+#define CC_RECORD_CODEC_H_
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "cc/async/work_stealing_pool.h"
+
+namespace minigo {
+
+// How record files (e.g. TFRecords of training examples) are compressed.
+struct RecordCompression {
+  enum class Codec {
+    kNone,
+    kZlib,
+    kZstd,
+  };
+
+  Codec codec = Codec::kZlib;
+
+  // Compression level: [1, 9] for zlib and [1, 19] for zstd.
+  int level = 2;
+};
+
+// Parses a compression spec of the form "none", "zlib:<level>" or
+// "zstd:<level>", e.g. "zlib:2".
+// CHECK fails if the spec is invalid, or if it's a zstd spec and the binary
+// was not compiled with --define=zstd=1.
+RecordCompression ParseRecordCompression(absl::string_view spec);
+
+std::ostream& operator<<(std::ostream& os,
+                         const RecordCompression& compression);
+
+// Returns true if the binary was compiled with --define=zstd=1.
+bool IsZstdEnabled();
+
+// Returns the extension of TFRecord files compressed with `codec`:
+// ".tfrecord", ".tfrecord.zz" or ".tfrecord.zst".
+const char* GetTfRecordExtension(RecordCompression::Codec codec);
+
+// Returns the codec that a file was compressed with, from the extension of
+// its `path`: ".zz" for zlib, ".zst" for zstd and anything else for none.
+RecordCompression::Codec GetRecordCodecForPath(absl::string_view path);
+
+// Compresses a stream of data in blocks of `block_size` bytes, passing the
+// compressed stream to `sink` in order.
+//
+// Blocks are compressed independently, so if `pool` isn't null, up to
+// `pool->num_workers()` blocks are compressed in parallel. The output is
+// still a single stream that any decoder for the codec can read:
+//  - zlib: each block is a raw deflate stream that is flushed to a byte
+//    boundary, so that the blocks concatenate into one deflate stream. The
+//    stream is framed by a single zlib header and the combined adler32 of the
+//    blocks. This is the scheme that pigz uses.
+//  - zstd: each block is a separate zstd frame. zstd decoders read
+//    concatenated frames as a single stream.
+// Splitting the data into blocks loses the matches that would have crossed
+// block boundaries, which is negligible for blocks of a MB or so.
+//
+// BlockCompressor isn't thread-safe.
+class BlockCompressor {
+ public:
+  using Sink = std::function<void(absl::string_view)>;
+
+  static constexpr size_t kDefaultBlockSize = 1 << 20;
+
+  BlockCompressor(const RecordCompression& compression, size_t block_size,
+                  WorkStealingPool* pool, Sink sink);
+
+  // CHECK fails if Close wasn't called.
+  ~BlockCompressor();
+
+  void Write(absl::string_view data);
+
+  // Compresses any remaining data & writes the end of the stream.
+  void Close();
+
+ private:
+  // Compresses `blocks_[0, num_blocks_)` and passes them to the sink.
+  // If `last` is true, the last block ends the stream.
+  void CompressBlocks(bool last);
+
+  const RecordCompression compression_;
+  const size_t block_size_;
+  WorkStealingPool* const pool_;
+  const Sink sink_;
+
+  // Uncompressed blocks: all but the last of the first `num_blocks_` blocks
+  // are full.
+  std::vector<std::string> blocks_;
+  int num_blocks_ = 1;
+
+  // Compressed blocks & the adler32 checksums of their uncompressed data.
+  std::vector<std::string> compressed_;
+  std::vector<uint32_t> checksums_;
+
+  bool wrote_header_ = false;
+  bool closed_ = false;
+  uint32_t adler32_;
+};
+
+// Decompresses `src`, a complete stream compressed with `codec` (e.g. by
+// BlockCompressor), to `dst`. Returns false if `src` is corrupt or truncated.
+bool Decompress(RecordCompression::Codec codec, absl::string_view src,
+                std::string* dst);
+
+}  // namespace minigo
+
+#endif  // CC_RECORD_CODEC_H_
@@ -0,0 +1,153 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/record_codec.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "zlib.h"
+
+namespace minigo {
+namespace {
+
+// Returns `size` bytes of data that compresses moderately well.
+std::string MakeData(size_t size) {
+  std::string data;
+  uint32_t x = 1;
+  while (data.size() < size) {
+    x = x * 1664525 + 1013904223;
+    data.append(std::to_string(x >> 24));
+    data.push_back(' ');
+  }
+  data.resize(size);
+  return data;
+}
+
+// Compresses `data` with `compression`, writing it in pieces of
+// `write_size` bytes.
+std::string Compress(const RecordCompression& compression, size_t block_size,
+                     WorkStealingPool* pool, const std::string& data,
+                     size_t write_size) {
+  std::string compressed;
+  BlockCompressor compressor(compression, block_size, pool,
+                             [&compressed](absl::string_view s) {
+                               compressed.append(s.data(), s.size());
+                             });
+  for (size_t i = 0; i < data.size(); i += write_size) {
+    compressor.Write(absl::string_view(data).substr(i, write_size));
+  }
+  compressor.Close();
+  return compressed;
+}
+
+TEST(RecordCodecTest, ParseRecordCompression) {
+  auto none = ParseRecordCompression("none");
+  EXPECT_EQ(RecordCompression::Codec::kNone, none.codec);
+
+  auto zlib = ParseRecordCompression("zlib:7");
+  EXPECT_EQ(RecordCompression::Codec::kZlib, zlib.codec);
+  EXPECT_EQ(7, zlib.level);
+
+  std::ostringstream oss;
+  oss << zlib;
+  EXPECT_EQ("zlib:7", oss.str());
+
+  if (IsZstdEnabled()) {
+    auto zstd = ParseRecordCompression("zstd:3");
+    EXPECT_EQ(RecordCompression::Codec::kZstd, zstd.codec);
+    EXPECT_EQ(3, zstd.level);
+  }
+}
+
+TEST(RecordCodecTest, Extensions) {
+  for (auto codec : {RecordCompression::Codec::kNone,
+                     RecordCompression::Codec::kZlib,
+                     RecordCompression::Codec::kZstd}) {
+    EXPECT_EQ(codec, GetRecordCodecForPath(
+                         std::string("a/b/c") + GetTfRecordExtension(codec)));
+  }
+}
+
+// Blocks compressed in parallel must form a single zlib stream that zlib's
+// own uncompress can read, since that's all that TensorFlow's record reader
+// understands.
+TEST(RecordCodecTest, ParallelZlibIsOneStream) {
+  WorkStealingPool pool(3);
+  RecordCompression compression;
+  compression.codec = RecordCompression::Codec::kZlib;
+  compression.level = 2;
+
+  for (size_t size : {0, 1, 1000, 4096, 4097, 12288, 100000}) {
+    auto data = MakeData(size);
+    for (auto* p : {static_cast<WorkStealingPool*>(nullptr), &pool}) {
+      auto compressed = Compress(compression, 4096, p, data, 1000);
+
+      std::vector<Bytef> uncompressed(data.size() + 1);
+      uLongf uncompressed_size = uncompressed.size();
+      ASSERT_EQ(Z_OK,
+                uncompress(uncompressed.data(), &uncompressed_size,
+                           reinterpret_cast<const Bytef*>(compressed.data()),
+                           compressed.size()))
+          << "size " << size;
+      EXPECT_EQ(data, std::string(uncompressed.begin(),
+                                  uncompressed.begin() + uncompressed_size));
+
+      std::string decompressed;
+      ASSERT_TRUE(Decompress(compression.codec, compressed, &decompressed));
+      EXPECT_EQ(data, decompressed);
+    }
+  }
+}
+
+TEST(RecordCodecTest, RoundTrip) {
+  WorkStealingPool pool(4);
+  std::vector<std::string> specs = {"none", "zlib:1", "zlib:9"};
+  if (IsZstdEnabled()) {
+    specs.push_back("zstd:1");
+    specs.push_back("zstd:19");
+  }
+
+  auto data = MakeData(50000);
+  for (const auto& spec : specs) {
+    auto compression = ParseRecordCompression(spec);
+    auto serial = Compress(compression, 4096, nullptr, data, 777);
+    auto parallel = Compress(compression, 4096, &pool, data, 777);
+
+    // Compressing blocks in parallel doesn't change the output.
+    EXPECT_EQ(serial, parallel) << spec;
+    if (compression.codec != RecordCompression::Codec::kNone) {
+      EXPECT_LT(parallel.size(), data.size()) << spec;
+    }
+
+    std::string decompressed;
+    ASSERT_TRUE(Decompress(compression.codec, parallel, &decompressed))
+        << spec;
+    EXPECT_EQ(data, decompressed) << spec;
+
+    // Truncated streams are detected.
+    if (compression.codec != RecordCompression::Codec::kNone) {
+      EXPECT_FALSE(Decompress(compression.codec,
+                              absl::string_view(parallel).substr(
+                                  0, parallel.size() - 1),
+                              &decompressed))
+          << spec;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace minigo
@@ -19,8 +19,7 @@
 #include <vector>
 
 #include "absl/memory/memory.h"
-#include "cc/async/thread.h"
-#include "cc/async/thread_safe_queue.h"
+#include "cc/async/work_stealing_pool.h"
 #include "cc/color.h"
 #include "cc/file/path.h"
 #include "cc/file/utils.h"
@@ -88,24 +87,14 @@ void Run() {
   std::vector<std::string> basenames;
   MG_CHECK(file::ListDir(FLAGS_sgf_dir, &basenames));
 
-  ThreadSafeQueue<std::string> work_queue;
-  for (const auto& basename : basenames) {
-    work_queue.Push(basename);
-  }
-
-  ThreadSafeQueue<GameInfo> game_info_queue;
-
-  std::vector<std::unique_ptr<LambdaThread>> threads;
-  for (int i = 0; i < FLAGS_num_threads; ++i) {
-    threads.push_back(absl::make_unique<LambdaThread>([&]() {
-      std::string basename;
-      while (work_queue.TryPop(&basename)) {
-        auto path = file::JoinPath(FLAGS_sgf_dir, basename);
-        game_info_queue.Push(ProcessSgf(path));
-      }
-    }));
-    threads.back()->Start();
-  }
+  // Games vary in length, so let the worker threads steal games from each
+  // other.
+  std::vector<std::unique_ptr<GameInfo>> game_infos(basenames.size());
+  WorkStealingPool pool(FLAGS_num_threads);
+  pool.Run(basenames.size(), [&](int worker, int i) {
+    auto path = file::JoinPath(FLAGS_sgf_dir, basenames[i]);
+    game_infos[i] = absl::make_unique<GameInfo>(ProcessSgf(path));
+  });
 
   int num_pass_pass_games = 0;
   int num_move_limit_games = 0;
@@ -113,8 +102,8 @@ void Run() {
   int game_length_sum = 0;
   int whole_board_pass_alive_sum = 0;
   int min_whole_board_pass_alive = kN * kN * 2;
-  for (size_t i = 0; i < basenames.size(); ++i) {
-    auto info = game_info_queue.Pop();
+  for (const auto& game_info : game_infos) {
+    const auto& info = *game_info;
     switch (info.game_over_reason) {
       case GameOverReason::kMoveLimit:
         num_move_limit_games += 1;
@@ -135,10 +124,6 @@ void Run() {
     }
   }
 
-  for (auto& t : threads) {
-    t->Join();
-  }
-
   MG_LOG(INFO) << "total games: " << basenames.size();
   MG_LOG(INFO) << "num move limit games: " << num_move_limit_games;
   MG_LOG(INFO) << "num whole-board pass-alive games: "
@@ -18,20 +18,21 @@
 #include <vector>
 
 #include "absl/memory/memory.h"
-#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
 #include "cc/async/thread.h"
+#include "cc/async/work_stealing_pool.h"
 #include "cc/init.h"
 #include "cc/logging.h"
 #include "cc/random.h"
+#include "cc/record_codec.h"
+#include "cc/tf_records.h"
 #include "gflags/gflags.h"
 #include "tensorflow/core/lib/core/status.h"
-#include "tensorflow/core/lib/io/record_reader.h"
-#include "tensorflow/core/lib/io/record_writer.h"
 #include "tensorflow/core/platform/env.h"
-#include "tensorflow/core/platform/file_system.h"
 
 DEFINE_double(sample_frac, 0,
               "Fraction of records to read. Exactly one of sample_frac or "
@@ -45,17 +46,26 @@ DEFINE_int32(num_write_threads, 1,
              "Number of threads to use when writing destination files. If "
              "num_write threads is > 1, the destination file will be sharded "
              "with one shard per write thread. Shards will be named "
-             "<basename>-NNNNN-of-NNNNN.tfrecord.zz");
-DEFINE_int32(compression, 1,
-             "Compression level between 0 (disabled) and 9. Default is 1.");
+             "<basename>-NNNNN-of-NNNNN<ext>, where <ext> is the extension "
+             "for --compression, e.g. .tfrecord.zz for zlib.");
+DEFINE_string(compression, "zlib:1",
+              "How the destination files are compressed: \"none\", "
+              "\"zlib:<level>\" or \"zstd:<level>\" (see "
+              "cc/record_codec.h). For compatibility, a plain number is "
+              "a zlib compression level, with 0 disabling compression. "
+              "Source files are decompressed according to their extension: "
+              ".zz for zlib and .zst for zstd.");
+DEFINE_int32(compression_threads, 1,
+             "Number of threads that each write thread compresses blocks of "
+             "its destination file on in parallel.");
 DEFINE_int32(files_per_pattern, 0,
              "If > 0, randomly select exactly files_per_pattern input files "
              "to sample records from, failing if fewer are found.");
 DEFINE_uint64(seed, 0, "Random seed.");
 DEFINE_bool(shuffle, false, "Whether to shuffle the sampled records.");
 DEFINE_string(dst, "",
-              "Destination path. If path has a .zz suffix, the file will be "
-              "automatically compressed.");
+              "Destination path. The file is compressed according to "
+              "--compression, whatever its extension.");
 
 namespace minigo {
 
@@ -75,36 +85,22 @@ class ReadThread : public Thread {
     return sampled_records_;
   }
 
+  // Number of files that couldn't be read in full. ReadTfRecords stops
+  // reading a file at its first corrupt record, so records after that are
+  // skipped.
+  int num_failed_files() const { return num_failed_files_; }
+
  private:
   void Run() override {
-    tensorflow::io::RecordReaderOptions options;
     for (const auto& path : paths_) {
-      std::unique_ptr<tensorflow::RandomAccessFile> file;
-      TF_CHECK_OK(tensorflow::Env::Default()->NewRandomAccessFile(path, &file));
-      if (absl::EndsWith(path, ".zz")) {
-        options.compression_type =
-            tensorflow::io::RecordReaderOptions::ZLIB_COMPRESSION;
-      } else {
-        options.compression_type = tensorflow::io::RecordReaderOptions::NONE;
-      }
-
-      tensorflow::io::SequentialRecordReader reader(file.get(), options);
-      std::string record;
-      for (;;) {
-        auto status = reader.ReadRecord(&record);
-        if (status.code() == tensorflow::error::OUT_OF_RANGE) {
-          // Reached the end of the file.
-          break;
-        } else if (!status.ok()) {
-          // Some other error.
-          MG_LOG(WARNING) << "Error reading record from \"" << path
-                          << "\": " << status;
-          continue;
-        }
-
+      bool ok = ReadTfRecords(path, [this](std::string* record) {
         if (options_.sample_frac == 1 || rnd_() < options_.sample_frac) {
-          sampled_records_.push_back(std::move(record));
+          sampled_records_.push_back(std::move(*record));
         }
+        return true;
+      });
+      if (!ok) {
+        ++num_failed_files_;
       }
     }
   }
@@ -112,6 +108,7 @@ class ReadThread : public Thread {
   Random rnd_;
   const std::vector<std::string> paths_;
   std::vector<std::string> sampled_records_;
+  int num_failed_files_ = 0;
   const Options options_;
 };
 
@@ -120,7 +117,8 @@ class WriteThread : public Thread {
   struct Options {
     int shard = 0;
     int num_shards = 1;
-    int compression = 1;
+    RecordCompression compression;
+    int compression_threads = 1;
   };
 
   WriteThread(std::vector<std::string> records, std::string path,
@@ -130,38 +128,29 @@ class WriteThread : public Thread {
       path_ = path;
     } else {
       absl::string_view expected_ext =
-          options_.compression == 0 ? ".tfrecord" : ".tfrecord.zz";
+          GetTfRecordExtension(options_.compression.codec);
       absl::string_view stem = path;
       MG_CHECK(absl::ConsumeSuffix(&stem, expected_ext))
           << "expected path to have extension '" << expected_ext
           << "', got '" << stem << "'";
-      path_ = absl::StrFormat("%s-%05d-of-%05d.tfrecord.zz", stem,
-                              options_.shard, options_.num_shards);
+      path_ = absl::StrFormat("%s-%05d-of-%05d%s", stem, options_.shard,
+                              options_.num_shards, expected_ext);
     }
   }
 
  private:
   void Run() override {
-    std::unique_ptr<tensorflow::WritableFile> file;
-    TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(path_, &file));
-
-    tensorflow::io::RecordWriterOptions options;
-    if (options_.compression > 0) {
-      MG_CHECK(options_.compression <= 9);
-      options.compression_type =
-          tensorflow::io::RecordWriterOptions::ZLIB_COMPRESSION;
-      options.zlib_options.compression_level = options_.compression;
-    } else {
-      options.compression_type = tensorflow::io::RecordWriterOptions::NONE;
+    std::unique_ptr<WorkStealingPool> pool;
+    if (options_.compression_threads > 1) {
+      pool = absl::make_unique<WorkStealingPool>(options_.compression_threads,
+                                                 ThreadRole::kOutput);
     }
 
-    tensorflow::io::RecordWriter writer(file.get(), options);
+    TfRecordWriter writer(path_, options_.compression, pool.get());
     for (const auto& record : records_) {
-      TF_CHECK_OK(writer.WriteRecord(record));
+      writer.WriteRecord(record);
     }
-
-    TF_CHECK_OK(writer.Close());
-    TF_CHECK_OK(file->Close());
+    writer.Close();
   }
 
   std::string path_;
@@ -213,8 +202,15 @@ std::vector<std::string> Read(std::vector<std::string> paths) {
 
   // Concatenate sampled records.
   size_t n = 0;
+  int num_failed_files = 0;
   for (const auto& t : threads) {
     n += t->sampled_records().size();
+    num_failed_files += t->num_failed_files();
+  }
+  if (num_failed_files != 0) {
+    MG_LOG(WARNING) << "failed to read " << num_failed_files << " of "
+                    << num_paths << " files in full: records after the first "
+                    << "error in each file were skipped";
   }
   MG_LOG(INFO) << "sampled " << n << " records";
   MG_LOG(INFO) << "concatenating";
@@ -233,10 +229,21 @@ void Shuffle(std::vector<std::string>* records) {
   rnd.Shuffle(records);
 }
 
+RecordCompression GetCompression() {
+  // --compression used to be a zlib compression level.
+  int level;
+  if (absl::SimpleAtoi(FLAGS_compression, &level)) {
+    return ParseRecordCompression(level == 0 ? "none"
+                                             : absl::StrCat("zlib:", level));
+  }
+  return ParseRecordCompression(FLAGS_compression);
+}
+
 void Write(std::vector<std::string> records, const std::string& path) {
   WriteThread::Options write_options;
   write_options.num_shards = FLAGS_num_write_threads;
-  write_options.compression = FLAGS_compression;
+  write_options.compression = GetCompression();
+  write_options.compression_threads = FLAGS_compression_threads;
 
   size_t num_records;
   if (FLAGS_num_records != 0) {
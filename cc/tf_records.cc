@@ -0,0 +1,150 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/tf_records.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "cc/logging.h"
+#include "tensorflow/core/lib/core/coding.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/hash/crc32c.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace minigo {
+
+namespace {
+
+// Returns the masked CRC32C of `data`, as stored in TFRecord files.
+uint32_t MaskedCrc(const char* data, size_t n) {
+  return tensorflow::crc32c::Mask(tensorflow::crc32c::Value(data, n));
+}
+
+// A file whose contents have already been read into memory.
+class StringRandomAccessFile : public tensorflow::RandomAccessFile {
+ public:
+  explicit StringRandomAccessFile(std::string contents)
+      : contents_(std::move(contents)) {}
+
+  tensorflow::Status Read(tensorflow::uint64 offset, size_t n,
+                          tensorflow::StringPiece* result,
+                          char* scratch) const override {
+    offset = std::min<tensorflow::uint64>(offset, contents_.size());
+    size_t size = std::min<size_t>(n, contents_.size() - offset);
+    *result = tensorflow::StringPiece(contents_.data() + offset, size);
+    if (size < n) {
+      return tensorflow::errors::OutOfRange("Read past end of file");
+    }
+    return tensorflow::Status::OK();
+  }
+
+ private:
+  const std::string contents_;
+};
+
+}  // namespace
+
+TfRecordWriter::TfRecordWriter(const std::string& path,
+                               const RecordCompression& compression,
+                               WorkStealingPool* pool)
+    : compressor_(compression, BlockCompressor::kDefaultBlockSize, pool,
+                  [this](absl::string_view data) {
+                    TF_CHECK_OK(file_->Append({data.data(), data.size()}));
+                  }) {
+  TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(path, &file_));
+}
+
+TfRecordWriter::~TfRecordWriter() = default;
+
+void TfRecordWriter::WriteRecord(absl::string_view record) {
+  // Each record is framed by its length & the masked CRCs of the length and
+  // the record.
+  char header[sizeof(uint64_t) + sizeof(uint32_t)];
+  tensorflow::core::EncodeFixed64(header, record.size());
+  tensorflow::core::EncodeFixed32(header + sizeof(uint64_t),
+                                  MaskedCrc(header, sizeof(uint64_t)));
+  char footer[sizeof(uint32_t)];
+  tensorflow::core::EncodeFixed32(footer,
+                                  MaskedCrc(record.data(), record.size()));
+
+  compressor_.Write({header, sizeof(header)});
+  compressor_.Write(record);
+  compressor_.Write({footer, sizeof(footer)});
+}
+
+void TfRecordWriter::Close() {
+  compressor_.Close();
+  TF_CHECK_OK(file_->Close());
+}
+
+bool ReadTfRecords(const std::string& path,
+                   const std::function<bool(std::string* record)>& fn) {
+  auto* env = tensorflow::Env::Default();
+  tensorflow::io::RecordReaderOptions options;
+  std::unique_ptr<tensorflow::RandomAccessFile> file;
+  tensorflow::Status status;
+  switch (GetRecordCodecForPath(path)) {
+    case RecordCompression::Codec::kNone:
+      status = env->NewRandomAccessFile(path, &file);
+      break;
+
+    case RecordCompression::Codec::kZlib:
+      options.compression_type =
+          tensorflow::io::RecordReaderOptions::ZLIB_COMPRESSION;
+      status = env->NewRandomAccessFile(path, &file);
+      break;
+
+    case RecordCompression::Codec::kZstd: {
+      // TensorFlow's record reader doesn't support zstd, so decompress the
+      // whole file and read the records from memory.
+      std::string compressed;
+      std::string contents;
+      status = tensorflow::ReadFileToString(env, path, &compressed);
+      if (status.ok() && !Decompress(RecordCompression::Codec::kZstd,
+                                     compressed, &contents)) {
+        status = tensorflow::errors::DataLoss("Corrupt zstd stream");
+      }
+      file = absl::make_unique<StringRandomAccessFile>(std::move(contents));
+      break;
+    }
+  }
+  if (!status.ok()) {
+    MG_LOG(ERROR) << "Error reading \"" << path << "\": " << status;
+    return false;
+  }
+
+  tensorflow::io::SequentialRecordReader reader(file.get(), options);
+  std::string record;
+  for (;;) {
+    status = reader.ReadRecord(&record);
+    if (status.code() == tensorflow::error::OUT_OF_RANGE) {
+      // Reached the end of the file.
+      return true;
+    } else if (!status.ok()) {
+      MG_LOG(ERROR) << "Error reading record from \"" << path
+                    << "\": " << status;
+      return false;
+    }
+    if (!fn(&record)) {
+      return true;
+    }
+  }
+}
+
+}  // namespace minigo
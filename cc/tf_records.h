@@ -0,0 +1,66 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_TF_RECORDS_H_
+#define CC_TF_RECORDS_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "cc/async/work_stealing_pool.h"
+#include "cc/record_codec.h"
+
+namespace tensorflow {
+class WritableFile;
+}  // namespace tensorflow
+
+namespace minigo {
+
+// Writes a TFRecord file, compressed with any RecordCompression codec.
+// Unlike tensorflow::io::RecordWriter, blocks of the file are compressed in
+// parallel on `pool` if it isn't null (see BlockCompressor). zlib compressed
+// files are still a single zlib stream, so TensorFlow's record readers (and
+// tf.data.TFRecordDataset) read them as usual. TensorFlow can't read zstd
+// compressed files, but ReadTfRecords can.
+class TfRecordWriter {
+ public:
+  TfRecordWriter(const std::string& path,
+                 const RecordCompression& compression,
+                 WorkStealingPool* pool = nullptr);
+  ~TfRecordWriter();
+
+  void WriteRecord(absl::string_view record);
+
+  // Must be called before the writer is destroyed.
+  void Close();
+
+ private:
+  std::unique_ptr<tensorflow::WritableFile> file_;
+  BlockCompressor compressor_;
+};
+
+// Calls `fn` on each record of the TFRecord file at `path` until `fn` returns
+// false. The file is decompressed according to its extension (see
+// GetRecordCodecForPath); zstd compressed files are read into memory in full.
+// Returns false, after logging the error, if the file couldn't be read or
+// contains a corrupt record. Reading stops at the first corrupt record, so
+// `fn` will already have been called on the records before it.
+bool ReadTfRecords(const std::string& path,
+                   const std::function<bool(std::string* record)>& fn);
+
+}  // namespace minigo
+
+#endif  // CC_TF_RECORDS_H_
@@ -17,103 +17,134 @@
 #include <algorithm>
 #include <array>
 #include <memory>
+#include <string>
+#include <utility>
 
+#include "absl/memory/memory.h"
 #include "cc/constants.h"
+#include "cc/example_serializer.h"
 #include "cc/file/path.h"
 #include "cc/file/utils.h"
 #include "cc/model/model.h"
-#include "tensorflow/core/example/example.pb.h"
-#include "tensorflow/core/lib/core/status.h"
-#include "tensorflow/core/lib/io/record_writer.h"
-#include "tensorflow/core/platform/env.h"
-#include "tensorflow/core/platform/file_system.h"
-
-using tensorflow::io::RecordWriter;
-using tensorflow::io::RecordWriterOptions;
+#include "cc/tf_records.h"
 
 namespace minigo {
 namespace tf_utils {
 
 namespace {
 
-tensorflow::Feature MakeBytesFeature(const Tensor<uint8_t>& src) {
-  int size = src.shape.num_elements();
-  tensorflow::Feature feature;
-  feature.mutable_bytes_list()->add_value(
-      reinterpret_cast<const void*>(src.data), size);
-  return feature;
-}
-
-template <size_t N>
-tensorflow::Feature MakeBytesFeature(const std::array<float, N>& data) {
-  tensorflow::Feature feature;
-  feature.mutable_bytes_list()->add_value(
-      reinterpret_cast<const void*>(data.data()), sizeof(float) * data.size());
-  return feature;
-}
-
-// Converts board features, and the pi & value outputs of MTCS to a tensorflow
-// example proto.
-tensorflow::Example MakeTfExample(const Tensor<uint8_t>& features,
-                                  const std::array<float, kNumMoves>& pi,
-                                  float Q, int N, Coord c, float outcome) {
-  tensorflow::Example example;
-  auto& dst_features = *example.mutable_features()->mutable_feature();
-
-  // The input features are expected to be uint8 bytes.
-  dst_features["x"] = MakeBytesFeature(features);
+// Serializes the board features, and the pi & value outputs of MCTS to a
+// tensorflow example proto.
+// Features are added in key order, as ExampleSerializer requires.
+void SerializeTfExample(const Tensor<uint8_t>& features,
+                        const Game::Move& move, float outcome,
+                        const ExampleOptions& options,
+                        ExampleSerializer* serializer, std::string* record) {
+  // The move played is a single int.
+  serializer->AddInt64s("c", {static_cast<int64_t>(move.c)});
 
-  // pi is expected to be a float array serialized as bytes.
-  dst_features["pi"] = MakeBytesFeature(pi);
+  // Number of reads is a single int.
+  serializer->AddInt64s("n", {static_cast<int64_t>(move.N)});
 
   // outcome is a single float.
-  dst_features["outcome"].mutable_float_list()->add_value(outcome);
+  serializer->AddFloats("outcome", {outcome});
+
+  if (options.sparse_pi) {
+    // The nonzero elements of pi, as a list of indices & a list of values.
+    std::vector<int64_t> pi_idx;
+    std::vector<float> pi_val;
+    pi_idx.reserve(move.search_pi.size());
+    pi_val.reserve(move.search_pi.size());
+    for (const auto& p : move.search_pi) {
+      pi_idx.push_back(p.first);
+      pi_val.push_back(p.second);
+    }
+    serializer->AddInt64s("pi_idx", pi_idx);
+    serializer->AddFloats("pi_val", pi_val);
+  } else {
+    // pi is expected to be a float array serialized as bytes.
+    auto pi = move.GetSearchPi();
+    serializer->AddBytes("pi", {reinterpret_cast<const char*>(pi.data()),
+                                sizeof(float) * pi.size()});
+  }
 
   // Q is a single float.
-  dst_features["q"].mutable_float_list()->add_value(Q);
-
-  // Number of reads is a single int.
-  dst_features["n"].mutable_int64_list()->add_value(N);
-
-  // The move played is a single int.
-  dst_features["c"].mutable_int64_list()->add_value(c);
+  serializer->AddFloats("q", {move.Q});
+
+  int size = features.shape.num_elements();
+  if (options.pack_features) {
+    // The input features packed eight to a byte.
+    std::array<uint8_t, GetPackedFeaturesSize(kNumPoints *
+                                              kMaxNumFeaturePlanes)>
+        packed;
+    int packed_size = GetPackedFeaturesSize(size);
+    MG_CHECK(packed_size <= static_cast<int>(packed.size()));
+    PackFeatures({features.data, static_cast<size_t>(size)}, packed.data());
+    serializer->AddBytes(
+        "x_bits", {reinterpret_cast<const char*>(packed.data()),
+                   static_cast<size_t>(packed_size)});
+  } else {
+    // The input features are expected to be uint8 bytes.
+    serializer->AddBytes("x", {reinterpret_cast<const char*>(features.data),
+                               static_cast<size_t>(size)});
+  }
 
-  return example;
+  serializer->Finish(record);
 }
 
-// Writes a list of tensorflow Example protos to a zlib compressed TFRecord
-// file.
+// Writes a list of serialized tensorflow Example protos to a TFRecord file.
 void WriteTfExamples(const std::string& path,
-                     const std::vector<tensorflow::Example>& examples) {
-  std::unique_ptr<tensorflow::WritableFile> file;
-  TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(path, &file));
-
-  RecordWriterOptions options;
-  options.compression_type = RecordWriterOptions::ZLIB_COMPRESSION;
-  options.zlib_options.compression_level = 2;
-  RecordWriter writer(file.get(), options);
-
-  std::string data;
-  for (const auto& example : examples) {
-    example.SerializeToString(&data);
-    TF_CHECK_OK(writer.WriteRecord(data));
+                     const RecordCompression& compression,
+                     const std::vector<std::string>& records) {
+  TfRecordWriter writer(path, compression);
+  for (const auto& record : records) {
+    writer.WriteRecord(record);
   }
-
-  TF_CHECK_OK(writer.Close());
-  TF_CHECK_OK(file->Close());
+  writer.Close();
 }
 
+class TfRecordChunkFile : public ChunkWriter::File {
+ public:
+  TfRecordChunkFile(const std::string& path,
+                    const RecordCompression& compression,
+                    WorkStealingPool* pool)
+      : writer_(path, compression, pool) {}
+
+  void Append(absl::string_view record) override {
+    writer_.WriteRecord(record);
+  }
+
+  void Close() override { writer_.Close(); }
+
+ private:
+  TfRecordWriter writer_;
+};
+
 }  // namespace
 
-std::vector<tensorflow::Example> MakeExamples(
-    const FeatureDescriptor& feature_desc, const Game& game) {
-  // Write the TensorFlow examples.
-  std::vector<tensorflow::Example> examples;
-  examples.reserve(game.num_moves());
+void WriteGameExamples(const std::string& output_dir,
+                       const std::string& output_name,
+                       const FeatureDescriptor& feature_desc,
+                       const ExampleOptions& options, const Game& game) {
+  MG_CHECK(file::RecursivelyCreateDir(output_dir));
+  auto output_path = file::JoinPath(
+      output_dir,
+      output_name + GetTfRecordExtension(options.compression.codec));
+
+  auto records = SerializeGameExamples(feature_desc, options, game);
+  WriteTfExamples(output_path, options.compression, records);
+}
+
+std::vector<std::string> SerializeGameExamples(
+    const FeatureDescriptor& feature_desc, const ExampleOptions& options,
+    const Game& game) {
+  std::vector<std::string> records;
+  records.reserve(game.num_moves());
 
   auto shape = feature_desc.GetInputShape(1);
   BoardFeatureBuffer<uint8_t> features_buffer;
   Tensor<uint8_t> features(shape, features_buffer.data());
+  ExampleSerializer serializer;
 
   for (size_t i = 0; i < game.moves().size(); ++i) {
     const auto* move = game.moves()[i].get();
@@ -126,21 +157,17 @@ std::vector<tensorflow::Example> MakeExamples(
     game.GetPositionHistory(i, kMaxPositionHistory, &input.position_history);
 
     feature_desc.set_bytes({&input}, &features);
-    examples.push_back(MakeTfExample(features, move->search_pi.value(), move->Q,
-                                     move->N, move->c, game.result()));
+    records.emplace_back();
+    SerializeTfExample(features, *move, game.result(), options, &serializer,
+                       &records.back());
   }
-  return examples;
+  return records;
 }
 
-void WriteGameExamples(const std::string& output_dir,
-                       const std::string& output_name,
-                       const FeatureDescriptor& feature_desc,
-                       const Game& game) {
-  MG_CHECK(file::RecursivelyCreateDir(output_dir));
-  auto output_path = file::JoinPath(output_dir, output_name + ".tfrecord.zz");
-
-  auto examples = MakeExamples(feature_desc, game);
-  WriteTfExamples(output_path, examples);
+std::unique_ptr<ChunkWriter::File> NewTfRecordChunkFile(
+    const std::string& path, const RecordCompression& compression,
+    WorkStealingPool* pool) {
+  return absl::make_unique<TfRecordChunkFile>(path, compression, pool);
 }
 
 }  // namespace tf_utils
@@ -15,25 +15,68 @@
 #ifndef CC_TF_UTILS_H_
 #define CC_TF_UTILS_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "cc/async/work_stealing_pool.h"
+#include "cc/chunk_writer.h"
 #include "cc/game.h"
 #include "cc/model/features.h"
+#include "cc/record_codec.h"
 
 namespace minigo {
 namespace tf_utils {
 
-// Writes a list of tensorflow Example protos to a zlib compressed TFRecord
-// file, one for each position in the player's move history.
+// Controls how training examples are encoded.
+struct ExampleOptions {
+  // If true, the search pi is written as the indices and values of its
+  // nonzero elements instead of as a dense array. The Python input pipeline
+  // reads both encodings.
+  bool sparse_pi = false;
+
+  // If true, the input features are packed eight to a byte (see PackFeatures
+  // in cc/model/features.h) and written as "x_bits" instead of "x".
+  bool pack_features = false;
+
+  // How the TFRecord files that the examples are written to are compressed.
+  // Note that TensorFlow can't read zstd compressed files.
+  RecordCompression compression;
+};
+
+// Writes a list of tensorflow Example protos to a TFRecord file compressed
+// according to options.compression, one for each position in the player's
+// move history. The file is named `output_name` plus the compression's
+// extension (see GetTfRecordExtension).
 // Each example contains:
 //   x: the input BoardFeatures as bytes.
+//      If options.pack_features is set, x is instead written as:
+//      x_bits: the input BoardFeatures packed eight to a byte.
 //   pi: the search pi as a float array, serialized as bytes.
+//       If options.sparse_pi is set, pi is instead written as:
+//       pi_idx: the int64 indices of the nonzero elements of the search pi.
+//       pi_val: the float values of those elements.
 //   outcome: a single float containing the game result +/-1.
 // CHECK fails if the binary was not compiled with --define=tf=1.
 void WriteGameExamples(const std::string& output_dir,
                        const std::string& output_name,
-                       const FeatureDescriptor& feature_desc, const Game& game);
+                       const FeatureDescriptor& feature_desc,
+                       const ExampleOptions& options, const Game& game);
+
+// Returns the serialized tensorflow Example protos that WriteGameExamples
+// writes for `game`, for appending to a TFRecord chunk.
+// CHECK fails if the binary was not compiled with --define=tf=1.
+std::vector<std::string> SerializeGameExamples(
+    const FeatureDescriptor& feature_desc, const ExampleOptions& options,
+    const Game& game);
+
+// Returns a ChunkWriter file that writes each record to a TFRecord file
+// compressed with `compression`. If `pool` isn't null, blocks of the file are
+// compressed on it in parallel (see TfRecordWriter in cc/tf_records.h).
+// CHECK fails if the binary was not compiled with --define=tf=1.
+std::unique_ptr<ChunkWriter::File> NewTfRecordChunkFile(
+    const std::string& path, const RecordCompression& compression,
+    WorkStealingPool* pool);
 
 // Writes a list of tensorflow Example protos to the specified
 // Bigtable, one example per row, starting at the given row cursor.
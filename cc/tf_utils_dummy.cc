@@ -21,11 +21,29 @@ namespace tf_utils {
 void WriteGameExamples(const std::string& output_dir,
                        const std::string& output_name,
                        const FeatureDescriptor& feature_desc,
-                       const Game& game) {
+                       const ExampleOptions& options, const Game& game) {
   MG_LOG(FATAL)
       << "Can't write TensorFlow examples without TensorFlow support enabled. "
          "Please recompile, passing --define=tf=1 to bazel build.";
 }
 
+std::vector<std::string> SerializeGameExamples(
+    const FeatureDescriptor& feature_desc, const ExampleOptions& options,
+    const Game& game) {
+  MG_LOG(FATAL)
+      << "Can't write TensorFlow examples without TensorFlow support enabled. "
+         "Please recompile, passing --define=tf=1 to bazel build.";
+  return {};
+}
+
+std::unique_ptr<ChunkWriter::File> NewTfRecordChunkFile(
+    const std::string& path, const RecordCompression& compression,
+    WorkStealingPool* pool) {
+  MG_LOG(FATAL)
+      << "Can't write TensorFlow examples without TensorFlow support enabled. "
+         "Please recompile, passing --define=tf=1 to bazel build.";
+  return nullptr;
+}
+
 }  // namespace tf_utils
 }  // namespace minigo
@@ -24,9 +24,22 @@ import go
 import sgf_wrapper
 import symmetries
 
+from absl import flags
 import numpy as np
 import tensorflow as tf
 
+flags.DEFINE_bool('pack_features', False,
+                  'Whether training examples may store their features packed '
+                  'eight to a byte in "x_bits", as written by '
+                  'concurrent_selfplay --pack_features.')
+
+flags.DEFINE_bool('sparse_pi', False,
+                  'Whether training examples may store only the nonzero '
+                  'elements of pi in "pi_idx" and "pi_val", as written by '
+                  'concurrent_selfplay --sparse_pi.')
+
+FLAGS = flags.FLAGS
+
 TF_RECORD_CONFIG = tf.python_io.TFRecordOptions(
     tf.python_io.TFRecordCompressionType.ZLIB)
 
@@ -37,23 +50,49 @@ def _one_hot(index):
     return onehot
 
 
-def make_tf_example(features, pi, value):
+def _pack_features(features):
+    """Packs binary features eight to a byte, least significant bit first."""
+    flat = features.ravel()
+    flat = np.pad(flat, (0, -len(flat) % 8), 'constant')
+    bits = flat.reshape(-1, 8) << np.arange(8, dtype=np.uint8)
+    return bits.sum(axis=1, dtype=np.uint8)
+
+
+def make_tf_example(features, pi, value, sparse_pi=False,
+                    pack_features=False):
     """
     Args:
         features: [N, N, FEATURE_DIM] nparray of uint8
         pi: [N * N + 1] nparray of float32
         value: float
+        sparse_pi: whether to store only the nonzero elements of pi, as
+            'pi_idx' and 'pi_val' lists instead of a dense 'pi' array.
+        pack_features: whether to store the features, which must all be 0 or
+            1, packed eight to a byte in 'x_bits' instead of in 'x'.
     """
-    return tf.train.Example(features=tf.train.Features(feature={
-        'x': tf.train.Feature(
-            bytes_list=tf.train.BytesList(
-                value=[features.tostring()])),
-        'pi': tf.train.Feature(
-            bytes_list=tf.train.BytesList(
-                value=[pi.tostring()])),
+    feature = {
         'outcome': tf.train.Feature(
             float_list=tf.train.FloatList(
-                value=[value]))}))
+                value=[value]))}
+    if pack_features:
+        feature['x_bits'] = tf.train.Feature(
+            bytes_list=tf.train.BytesList(
+                value=[_pack_features(features).tostring()]))
+    else:
+        feature['x'] = tf.train.Feature(
+            bytes_list=tf.train.BytesList(
+                value=[features.tostring()]))
+    if sparse_pi:
+        idx = np.flatnonzero(pi)
+        feature['pi_idx'] = tf.train.Feature(
+            int64_list=tf.train.Int64List(value=idx))
+        feature['pi_val'] = tf.train.Feature(
+            float_list=tf.train.FloatList(value=pi[idx]))
+    else:
+        feature['pi'] = tf.train.Feature(
+            bytes_list=tf.train.BytesList(
+                value=[pi.tostring()]))
+    return tf.train.Example(features=tf.train.Features(feature=feature))
 
 
 def write_tf_examples(filename, tf_examples, serialize=True):
@@ -82,14 +121,42 @@ def batch_parse_tf_example(batch_size, layout, example_batch):
         A tuple (feature_tensor, dict of output tensors)
     """
     planes = dual_net.get_features_planes()
-
+    num_moves = go.N * go.N + 1
+    x_size = go.N * go.N * planes
+    x_bits_size = (x_size + 7) // 8
+
+    # With --pack_features, the features are stored either one per byte in
+    # 'x', or packed eight to a byte in 'x_bits'.
+    # With --sparse_pi, pi is stored either as a dense float array in 'pi', or
+    # as the indices and values of its nonzero elements in 'pi_idx' and
+    # 'pi_val'.
+    # In both cases a batch may contain both kinds of example, so the missing
+    # dense field defaults to zeros and the two forms are summed.
     features = {
         'x': tf.FixedLenFeature([], tf.string),
         'pi': tf.FixedLenFeature([], tf.string),
         'outcome': tf.FixedLenFeature([], tf.float32),
     }
+    if FLAGS.pack_features:
+        features['x'] = tf.FixedLenFeature([], tf.string,
+                                           default_value=b'\0' * x_size)
+        features['x_bits'] = tf.FixedLenFeature(
+            [], tf.string, default_value=b'\0' * x_bits_size)
+    if FLAGS.sparse_pi:
+        features['pi'] = tf.FixedLenFeature(
+            [], tf.string, default_value=b'\0' * (4 * num_moves))
+        features['pi_idx'] = tf.VarLenFeature(tf.int64)
+        features['pi_val'] = tf.VarLenFeature(tf.float32)
     parsed = tf.parse_example(example_batch, features)
     x = tf.decode_raw(parsed['x'], tf.uint8)
+    if FLAGS.pack_features:
+        x_bits = tf.decode_raw(parsed['x_bits'], tf.uint8)
+        x_bits = tf.bitwise.bitwise_and(
+            tf.bitwise.right_shift(tf.expand_dims(x_bits, -1),
+                                   tf.range(8, dtype=tf.uint8)),
+            1)
+        x_bits = tf.reshape(x_bits, [batch_size, 8 * x_bits_size])[:, :x_size]
+        x += x_bits
     x = tf.cast(x, tf.float32)
 
     if layout == 'nhwc':
@@ -99,7 +166,12 @@ def batch_parse_tf_example(batch_size, layout, example_batch):
     x = tf.reshape(x, shape)
 
     pi = tf.decode_raw(parsed['pi'], tf.float32)
-    pi = tf.reshape(pi, [batch_size, go.N * go.N + 1])
+    pi = tf.reshape(pi, [batch_size, num_moves])
+    if FLAGS.sparse_pi:
+        pi_idx = parsed['pi_idx']
+        indices = tf.stack([pi_idx.indices[:, 0], pi_idx.values], axis=1)
+        pi += tf.scatter_nd(tf.cast(indices, tf.int32),
+                            parsed['pi_val'].values, tf.shape(pi))
     outcome = parsed['outcome']
     outcome.set_shape([batch_size])
     return x, {'pi_tensor': pi, 'value_tensor': outcome}
@@ -15,6 +15,8 @@
 import random
 import tempfile
 
+from absl.testing import flagsaver
+
 import coords
 import dual_net
 import preprocessing
@@ -138,6 +140,45 @@ class TestPreprocessing(test_utils.MinigoUnitTest):
 
         self.assertEqualData(raw_data, recovered_data)
 
+    @flagsaver.flagsaver(sparse_pi=True)
+    def test_sparse_pi_round_trip(self):
+        np.random.seed(1)
+        raw_data = self.create_random_data(10)
+        for i, (_, pi, _) in enumerate(raw_data):
+            pi[np.random.random(pi.shape) < 0.9] = 0
+            if i == 3:
+                pi[:] = 0
+        # Write a mix of dense & sparse examples.
+        tfexamples = [
+            preprocessing.make_tf_example(*datum, sparse_pi=(i % 2 == 0))
+            for i, datum in enumerate(raw_data)]
+        self.assertNotIn('pi', tfexamples[0].features.feature)
+        self.assertIn('pi', tfexamples[1].features.feature)
+
+        with tempfile.NamedTemporaryFile() as f:
+            preprocessing.write_tf_examples(f.name, tfexamples)
+            recovered_data = self.extract_data(f.name)
+
+        self.assertEqualData(raw_data, recovered_data)
+
+    @flagsaver.flagsaver(pack_features=True)
+    def test_packed_features_round_trip(self):
+        np.random.seed(1)
+        raw_data = self.create_random_data(10)
+        raw_data = [(x % 2, pi, v) for x, pi, v in raw_data]
+        # Write a mix of packed & unpacked examples.
+        tfexamples = [
+            preprocessing.make_tf_example(*datum, pack_features=(i % 2 == 0))
+            for i, datum in enumerate(raw_data)]
+        self.assertNotIn('x', tfexamples[0].features.feature)
+        self.assertIn('x', tfexamples[1].features.feature)
+
+        with tempfile.NamedTemporaryFile() as f:
+            preprocessing.write_tf_examples(f.name, tfexamples)
+            recovered_data = self.extract_data(f.name)
+
+        self.assertEqualData(raw_data, recovered_data)
+
     def test_filter(self):
         raw_data = self.create_random_data(100)
         tfexamples = list(map(preprocessing.make_tf_example, *zip(*raw_data)))